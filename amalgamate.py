@@ -150,12 +150,13 @@ def merge_sources(*, source_dir: Path, covered_headers: Set[Path]):
                 )
 
             print(f'Processing internal header "{path}"')
-            output += merge_headers(
+            # The headers end up in the source file, where #pragma once is meaningless (and warned about).
+            output += [x for x in merge_headers(
                 header=path,
                 search_paths=PUBLIC_INCLUDE_PATHS + INTERNAL_INCLUDE_PATHS,
                 covered_headers=covered_headers,
                 stack=[],
-            )
+            ) if x.strip() != '#pragma once']
 
     return output
 
@@ -0,0 +1,41 @@
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <safetyhook.hpp>
+
+SAFETYHOOK_NOINLINE static int near_target() {
+    return 42;
+}
+
+// Allocations near a function, as made for trampolines, from a fresh allocator. Allocations are freed in batches
+// outside of the timed region so the allocator keeps having to find new memory.
+static void BM_AllocateNear(benchmark::State& state) {
+    constexpr size_t max_live_allocations = 1024;
+    const auto size = static_cast<size_t>(state.range(0));
+    const auto allocator = safetyhook::Allocator::create();
+    auto* target = reinterpret_cast<uint8_t*>(&near_target);
+    std::vector<safetyhook::Allocation> allocations{};
+
+    allocations.reserve(max_live_allocations);
+
+    for (auto _ : state) {
+        auto allocation = allocator->allocate_near({target}, size);
+
+        if (!allocation) {
+            state.SkipWithError("failed to allocate");
+            break;
+        }
+
+        allocations.emplace_back(std::move(*allocation));
+
+        if (allocations.size() == max_live_allocations) {
+            state.PauseTiming();
+            allocations.clear();
+            state.ResumeTiming();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_AllocateNear)->RangeMultiplier(4)->Range(16, 1024)->ArgName("size");
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <safetyhook.hpp>
+
+// Replays a mix of allocate_near and free calls like the ones made while installing and removing many hooks. Sizes
+// are those of trampolines, relays and mid hook stubs, desired addresses are spread over the code of a few modules and
+// every allocation lives for a random number of events.
+
+struct ModuleShape {
+    size_t size;
+    double weight;
+};
+
+struct Workload {
+    std::string_view name;
+    std::vector<ModuleShape> modules;
+    size_t allocations;
+    double mean_lifetime; ///< In allocations.
+};
+
+#if SAFETYHOOK_ARCH_X86_64
+constexpr size_t LARGE_MODULE_SIZE = 512 * 1024 * 1024;
+#else
+constexpr size_t LARGE_MODULE_SIZE = 128 * 1024 * 1024;
+#endif
+
+static const std::array g_workloads{
+    Workload{"SmallModules", {{4 << 20, 1.0}, {4 << 20, 1.0}, {2 << 20, 1.0}, {1 << 20, 1.0}, {1 << 20, 1.0}}, 2048,
+        256.0},
+    Workload{"LargeBinary", {{LARGE_MODULE_SIZE, 1.0}}, 4096, 2048.0},
+    Workload{"Mixed", {{LARGE_MODULE_SIZE, 4.0}, {8 << 20, 1.0}, {4 << 20, 1.0}, {1 << 20, 0.5}}, 4096, 512.0},
+};
+
+struct SizeWeight {
+    size_t size;
+    double weight;
+};
+
+// Relays, inline hook trampolines, mid hook stubs and the occasional large trampoline.
+static constexpr std::array g_sizes{
+    SizeWeight{14, 15.0},
+    SizeWeight{32, 35.0},
+    SizeWeight{64, 25.0},
+    SizeWeight{192, 15.0},
+    SizeWeight{512, 7.0},
+    SizeWeight{1024, 3.0},
+};
+
+struct Event {
+    bool is_free;
+    size_t slot;
+    uint8_t* desired_address;
+    size_t size;
+};
+
+// Address space standing in for the code of the modules. It's only reserved, so nothing else is mapped over it and
+// the allocator has to place memory around it, the same as around a loaded module.
+class FakeModules {
+public:
+    explicit FakeModules(const std::vector<ModuleShape>& shapes) {
+        for (const auto& shape : shapes) {
+            const auto address = safetyhook::vm_allocate(nullptr, shape.size, safetyhook::VM_ACCESS_R);
+
+            if (!address) {
+                return;
+            }
+
+            m_modules.push_back({*address, shape.size});
+        }
+
+        m_ok = true;
+    }
+
+    FakeModules(const FakeModules&) = delete;
+    FakeModules& operator=(const FakeModules&) = delete;
+
+    ~FakeModules() {
+        for (const auto& [address, size] : m_modules) {
+            safetyhook::vm_free(address);
+        }
+    }
+
+    [[nodiscard]] bool ok() const { return m_ok; }
+    [[nodiscard]] uint8_t* address(size_t i) const { return m_modules[i].first; }
+    [[nodiscard]] size_t size(size_t i) const { return m_modules[i].second; }
+
+private:
+    std::vector<std::pair<uint8_t*, size_t>> m_modules{};
+    bool m_ok{};
+};
+
+static std::vector<Event> generate_events(const Workload& workload, const FakeModules& modules) {
+    std::mt19937_64 rng{0x5AFE'700C};
+    std::vector<double> module_weights{};
+    std::vector<double> size_weights{};
+
+    for (const auto& module : workload.modules) {
+        module_weights.push_back(module.weight);
+    }
+
+    for (const auto& [size, weight] : g_sizes) {
+        size_weights.push_back(weight);
+    }
+
+    std::discrete_distribution<size_t> pick_module{module_weights.begin(), module_weights.end()};
+    std::discrete_distribution<size_t> pick_size{size_weights.begin(), size_weights.end()};
+    std::exponential_distribution<double> lifetime{1.0 / workload.mean_lifetime};
+
+    // Frees are ordered by the allocation they come after.
+    using PendingFree = std::pair<double, size_t>;
+    std::priority_queue<PendingFree, std::vector<PendingFree>, std::greater<>> frees{};
+    std::vector<Event> events{};
+
+    for (size_t i = 0; i < workload.allocations; ++i) {
+        while (!frees.empty() && frees.top().first <= static_cast<double>(i)) {
+            events.push_back({true, frees.top().second, nullptr, 0});
+            frees.pop();
+        }
+
+        const auto module = pick_module(rng);
+        const auto offset = std::uniform_int_distribution<size_t>{0, modules.size(module) - 1}(rng);
+
+        events.push_back({false, i, modules.address(module) + offset, g_sizes[pick_size(rng)].size});
+        frees.emplace(static_cast<double>(i) + lifetime(rng), i);
+    }
+
+    // Whatever is still pending stays live until the end of the replay, which is when the fragmentation is measured.
+    return events;
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+
+    const auto i = static_cast<size_t>(p * static_cast<double>(sorted.size()));
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// Replays the events of a workload against a fresh allocator. Reports the allocate_near latency percentiles, how many
+// blocks the allocator mapped and how many memory regions (VMAs) they ended up as, how much of the mapped memory was
+// unused at the end of the replay and how often no memory could be found in range.
+static void BM_AllocatorReplay(benchmark::State& state) {
+    const auto& workload = g_workloads[static_cast<size_t>(state.range(0))];
+    const FakeModules modules{workload.modules};
+
+    state.SetLabel(std::string{workload.name});
+
+    if (!modules.ok()) {
+        state.SkipWithError("failed to reserve the modules");
+        return;
+    }
+
+    const auto events = generate_events(workload, modules);
+    const auto granularity = safetyhook::system_info().allocation_granularity;
+    std::vector<double> latencies{};
+    double mappings{};
+    double regions{};
+    double fragmentation{};
+    double failures{};
+
+    for (auto _ : state) {
+        const auto allocator = safetyhook::Allocator::create();
+        std::vector<std::optional<safetyhook::Allocation>> live(workload.allocations);
+        std::unordered_set<uintptr_t> blocks{};
+        size_t live_bytes{};
+
+        for (const auto& event : events) {
+            auto& slot = live[event.slot];
+
+            if (event.is_free) {
+                live_bytes -= slot.has_value() ? slot->size() : 0;
+                slot.reset();
+                continue;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            auto allocation = allocator->allocate_near({event.desired_address}, event.size);
+            latencies.push_back(
+                std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+
+            if (!allocation) {
+                ++failures;
+                continue;
+            }
+
+            // The allocations are smaller than the allocation granularity, so the allocator maps memory one granule at
+            // a time and never unmaps it before it's destroyed. Each granule that was ever used is one mapping.
+            blocks.insert(allocation->address() / granularity * granularity);
+            live_bytes += allocation->size();
+            slot = std::move(*allocation);
+        }
+
+        state.PauseTiming();
+
+        // Adjacent mappings with the same access are merged into one region by the OS.
+        std::unordered_set<uintptr_t> region_starts{};
+
+        for (const auto block : blocks) {
+            if (const auto mbi = safetyhook::vm_query(reinterpret_cast<uint8_t*>(block))) {
+                region_starts.insert(reinterpret_cast<uintptr_t>(mbi->address));
+            }
+        }
+
+        const auto mapped_bytes = static_cast<double>(blocks.size() * granularity);
+
+        mappings += static_cast<double>(blocks.size());
+        regions += static_cast<double>(region_starts.size());
+        fragmentation += mapped_bytes != 0.0 ? 1.0 - static_cast<double>(live_bytes) / mapped_bytes : 0.0;
+        live.clear();
+
+        state.ResumeTiming();
+    }
+
+    std::ranges::sort(latencies);
+
+    const auto iterations = static_cast<double>(state.iterations());
+
+    state.counters["p50_ns"] = percentile(latencies, 0.5);
+    state.counters["p99_ns"] = percentile(latencies, 0.99);
+    state.counters["p999_ns"] = percentile(latencies, 0.999);
+    state.counters["max_ns"] = latencies.empty() ? 0.0 : latencies.back();
+    state.counters["mmaps"] = mappings / iterations;
+    state.counters["vmas"] = regions / iterations;
+    state.counters["fragmentation"] = fragmentation / iterations;
+    state.counters["near_failure_rate"] = failures / static_cast<double>(latencies.size());
+    state.SetItemsProcessed(static_cast<int64_t>(latencies.size()));
+}
+BENCHMARK(BM_AllocatorReplay)
+    ->DenseRange(0, g_workloads.size() - 1)
+    ->ArgName("workload")
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
@@ -0,0 +1,212 @@
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string_view>
+
+#include <benchmark/benchmark.h>
+#include <safetyhook.hpp>
+#include <xbyak/xbyak.h>
+
+#include "perf_counters.hpp"
+
+using namespace Xbyak::util;
+
+#if SAFETYHOOK_ARCH_X86_64
+static const auto& frame_reg = rbp;
+static const auto& stack_reg = rsp;
+#else
+static const auto& frame_reg = ebp;
+static const auto& stack_reg = esp;
+#endif
+
+struct Prologue {
+    std::string_view name;
+    void (*emit)(Xbyak::CodeGenerator& cg);
+};
+
+// Prologues that exercise the different paths of building a trampoline. None of them are called.
+static constexpr std::array g_prologues{
+    Prologue{"StackFrame",
+        [](Xbyak::CodeGenerator& cg) {
+            cg.push(frame_reg);
+            cg.mov(frame_reg, stack_reg);
+            cg.sub(stack_reg, 0x40);
+            cg.xor_(eax, eax);
+            cg.leave();
+            cg.ret();
+        }},
+    Prologue{"HotPatch",
+        [](Xbyak::CodeGenerator& cg) {
+            cg.mov(edi, edi);
+            cg.push(frame_reg);
+            cg.mov(frame_reg, stack_reg);
+            cg.pop(frame_reg);
+            cg.ret();
+        }},
+    Prologue{"ShortBranch",
+        [](Xbyak::CodeGenerator& cg) {
+            Xbyak::Label zero{};
+            cg.test(ecx, ecx);
+            cg.jz(zero, Xbyak::CodeGenerator::T_SHORT);
+            cg.mov(eax, 1);
+            cg.ret();
+            cg.L(zero);
+            cg.xor_(eax, eax);
+            cg.ret();
+        }},
+    Prologue{"CallInPrologue",
+        [](Xbyak::CodeGenerator& cg) {
+            Xbyak::Label callee{};
+            cg.call(callee);
+            cg.ret();
+            cg.L(callee);
+            cg.mov(eax, 1);
+            cg.ret();
+        }},
+#if SAFETYHOOK_ARCH_X86_64
+    Prologue{"RipRelative",
+        [](Xbyak::CodeGenerator& cg) {
+            Xbyak::Label data{};
+            cg.lea(rax, ptr[rip + data]);
+            cg.mov(eax, dword[rax]);
+            cg.ret();
+            cg.L(data);
+            cg.dd(42);
+        }},
+#endif
+};
+
+static int hooked_prologue() {
+    return 0;
+}
+
+static std::unique_ptr<Xbyak::CodeGenerator> generate(const Prologue& prologue) {
+    auto cg = std::make_unique<Xbyak::CodeGenerator>();
+    prologue.emit(*cg);
+    return cg;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void BM_InlineHookCreate(benchmark::State& state) {
+    const auto& prologue = g_prologues[static_cast<size_t>(state.range(0))];
+    const auto cg = generate(prologue);
+    auto* target = cg->getCode<void*>();
+
+    state.SetLabel(std::string{prologue.name});
+
+    for (auto _ : state) {
+        const auto start = std::chrono::steady_clock::now();
+        auto hook = SafetyHookInline::create(target, hooked_prologue);
+        state.SetIterationTime(seconds_since(start));
+
+        if (!hook) {
+            state.SkipWithError("failed to create the hook");
+            break;
+        }
+
+        benchmark::DoNotOptimize(hook);
+    }
+}
+BENCHMARK(BM_InlineHookCreate)->DenseRange(0, g_prologues.size() - 1)->ArgName("prologue")->UseManualTime();
+
+static void BM_InlineHookEnable(benchmark::State& state) {
+    const auto cg = generate(g_prologues[0]);
+    auto hook = SafetyHookInline::create(cg->getCode<void*>(), hooked_prologue, SafetyHookInline::StartDisabled);
+
+    if (!hook) {
+        state.SkipWithError("failed to create the hook");
+        return;
+    }
+
+    for (auto _ : state) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto enabled = hook->enable();
+        state.SetIterationTime(seconds_since(start));
+
+        benchmark::DoNotOptimize(enabled);
+        (void)hook->disable();
+    }
+}
+BENCHMARK(BM_InlineHookEnable)->UseManualTime();
+
+static void BM_InlineHookDisable(benchmark::State& state) {
+    const auto cg = generate(g_prologues[0]);
+    auto hook = SafetyHookInline::create(cg->getCode<void*>(), hooked_prologue, SafetyHookInline::StartDisabled);
+
+    if (!hook) {
+        state.SkipWithError("failed to create the hook");
+        return;
+    }
+
+    for (auto _ : state) {
+        (void)hook->enable();
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto disabled = hook->disable();
+        state.SetIterationTime(seconds_since(start));
+
+        benchmark::DoNotOptimize(disabled);
+    }
+}
+BENCHMARK(BM_InlineHookDisable)->UseManualTime();
+
+static SafetyHookInline g_call_hook{};
+static SafetyHookInline g_unsafe_call_hook{};
+
+// The bodies differ so identical code folding can't merge them.
+SAFETYHOOK_NOINLINE static int add_unhooked(int a, int b) {
+    return a + b + 1;
+}
+
+SAFETYHOOK_NOINLINE static int add_call(int a, int b) {
+    return a + b + 2;
+}
+
+SAFETYHOOK_NOINLINE static int add_unsafe_call(int a, int b) {
+    return a + b + 3;
+}
+
+static int hooked_add_call(int a, int b) {
+    return g_call_hook.call<int>(a, b);
+}
+
+static int hooked_add_unsafe_call(int a, int b) {
+    return g_unsafe_call_hook.unsafe_call<int>(a, b);
+}
+
+// Calls through a hook's destination into the original with call() or unsafe_call(), against an unhooked call and a
+// call straight to the trampoline.
+static void BM_InlineHookCall(benchmark::State& state) {
+    static constexpr std::array<std::string_view, 4> labels{"unhooked", "call", "unsafe_call", "trampoline"};
+    int (*volatile fn)(int, int) = add_unhooked;
+
+    if (state.range(0) == 1) {
+        g_call_hook = safetyhook::create_inline(add_call, hooked_add_call);
+        fn = add_call;
+    } else if (state.range(0) == 2) {
+        g_unsafe_call_hook = safetyhook::create_inline(add_unsafe_call, hooked_add_unsafe_call);
+        fn = add_unsafe_call;
+    } else if (state.range(0) == 3) {
+        g_call_hook = safetyhook::create_inline(add_call, hooked_add_call);
+        fn = g_call_hook.original<int (*)(int, int)>();
+    }
+
+    state.SetLabel(std::string{labels[static_cast<size_t>(state.range(0))]});
+
+    PerfCounters counters{};
+    counters.start();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fn(1, 2));
+    }
+
+    counters.stop();
+    counters.report(state);
+
+    g_call_hook = {};
+    g_unsafe_call_hook = {};
+}
+BENCHMARK(BM_InlineHookCall)->DenseRange(0, 3)->ArgName("mode");
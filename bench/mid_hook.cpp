@@ -0,0 +1,46 @@
+#include <array>
+#include <string_view>
+
+#include <benchmark/benchmark.h>
+#include <safetyhook.hpp>
+
+#include "perf_counters.hpp"
+
+SAFETYHOOK_NOINLINE static int mul_add(int a, int b) {
+    return a * b + 7;
+}
+
+static void mid_destination(SafetyHookContext&) {
+}
+
+// Cost of a call to a function with a mid hook that does nothing, with and without saving the extended state, against
+// an unhooked call.
+static void BM_MidHookHit(benchmark::State& state) {
+    static constexpr std::array<std::string_view, 3> labels{"unhooked", "default", "extended_state"};
+    int (*volatile fn)(int, int) = mul_add;
+    SafetyHookMid hook{};
+
+    if (state.range(0) == 1) {
+        hook = safetyhook::create_mid(mul_add, mid_destination);
+    } else if (state.range(0) == 2) {
+        hook = safetyhook::create_mid(mul_add, mid_destination, SafetyHookMid::SaveExtendedState);
+    }
+
+    if (state.range(0) != 0 && !hook) {
+        state.SkipWithError("failed to create the hook");
+        return;
+    }
+
+    state.SetLabel(std::string{labels[static_cast<size_t>(state.range(0))]});
+
+    PerfCounters counters{};
+    counters.start();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fn(3, 4));
+    }
+
+    counters.stop();
+    counters.report(state);
+}
+BENCHMARK(BM_MidHookHit)->DenseRange(0, 2)->ArgName("mode");
@@ -0,0 +1,153 @@
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <safetyhook/common.hpp>
+
+#include "perf_counters.hpp"
+
+#if SAFETYHOOK_OS_LINUX
+#include <cpuid.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// The names are in the same order as the counters.
+static constexpr std::array<std::string_view, 6> COUNTER_NAMES{
+    "cycles", "instructions", "branch_misses", "itlb_misses", "icache_misses", "ret_mispredicts"};
+
+#if SAFETYHOOK_OS_LINUX
+struct EventConfig {
+    uint32_t type;
+    uint64_t config;
+};
+
+static constexpr uint64_t cache_miss_config(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+static std::optional<EventConfig> ret_mispredict_event() {
+    if (const auto* raw = std::getenv("SAFETYHOOK_BENCH_RET_MISPREDICT_EVENT")) {
+        return EventConfig{PERF_TYPE_RAW, std::strtoull(raw, nullptr, 16)};
+    }
+
+    unsigned int eax{};
+    unsigned int ebx{};
+    unsigned int ecx{};
+    unsigned int edx{};
+
+    if (__get_cpuid(0, &eax, &ebx, &ecx, &edx) == 0) {
+        return std::nullopt;
+    }
+
+    // The vendor string is in ebx, edx, ecx. Its first four characters tell the vendors apart.
+    if (ebx == 0x756E6547) { // "Genu"ineIntel
+        return EventConfig{PERF_TYPE_RAW, 0x08C5};
+    }
+
+    if (ebx == 0x68747541) { // "Auth"enticAMD
+        return EventConfig{PERF_TYPE_RAW, 0xC9};
+    }
+
+    return std::nullopt;
+}
+
+static int open_event(const EventConfig& event) {
+    perf_event_attr attr{};
+
+    attr.size = sizeof(attr);
+    attr.type = event.type;
+    attr.config = event.config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+PerfCounters::PerfCounters() {
+    const std::array<std::optional<EventConfig>, NUM_COUNTERS> events{
+        EventConfig{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        EventConfig{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        EventConfig{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        EventConfig{PERF_TYPE_HW_CACHE, cache_miss_config(PERF_COUNT_HW_CACHE_ITLB)},
+        EventConfig{PERF_TYPE_HW_CACHE, cache_miss_config(PERF_COUNT_HW_CACHE_L1I)},
+        ret_mispredict_event(),
+    };
+
+    for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+        if (events[i]) {
+            m_counters[i].fd = open_event(*events[i]);
+        }
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (const auto& counter : m_counters) {
+        if (counter.fd != -1) {
+            close(counter.fd);
+        }
+    }
+}
+
+void PerfCounters::start() {
+    for (auto& counter : m_counters) {
+        if (counter.fd != -1) {
+            ioctl(counter.fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop() {
+    for (auto& counter : m_counters) {
+        if (counter.fd == -1) {
+            continue;
+        }
+
+        ioctl(counter.fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        // The value, the time the counter was enabled and the time it was running.
+        uint64_t values[3]{};
+
+        if (read(counter.fd, values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)) || values[2] == 0) {
+            counter.value = 0;
+            continue;
+        }
+
+        // When there are more counters than the PMU has, the kernel multiplexes them. Scale the value up to the whole
+        // time the counter was enabled.
+        counter.value = static_cast<uint64_t>(
+            static_cast<double>(values[0]) * static_cast<double>(values[1]) / static_cast<double>(values[2]));
+    }
+}
+#else
+PerfCounters::PerfCounters() = default;
+PerfCounters::~PerfCounters() = default;
+
+void PerfCounters::start() {
+}
+
+void PerfCounters::stop() {
+}
+#endif
+
+void PerfCounters::report(benchmark::State& state) const {
+    for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+        if (m_counters[i].fd != -1) {
+            state.counters[std::string{COUNTER_NAMES[i]}] = benchmark::Counter(
+                static_cast<double>(m_counters[i].value), benchmark::Counter::kAvgIterations);
+        }
+    }
+
+    const auto& cycles = m_counters[0];
+    const auto& instructions = m_counters[1];
+
+    if (cycles.fd != -1 && instructions.fd != -1 && cycles.value != 0) {
+        state.counters["ipc"] = static_cast<double>(instructions.value) / static_cast<double>(cycles.value);
+    }
+}
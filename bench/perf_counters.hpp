@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <benchmark/benchmark.h>
+
+// Hardware performance counters for a benchmark's loop, read with perf_event_open on Linux. Each counter is opened on
+// its own, so counters the CPU, the kernel or perf_event_paranoid don't allow are left out and the benchmark reports
+// only the time when none are available.
+//
+// The return mispredict counter has no generic perf event. It uses BR_MISP_RETIRED.RET on Intel (Ice Lake and later)
+// and "Retired Near Returns Mispredicted" on AMD, or the raw event in SAFETYHOOK_BENCH_RET_MISPREDICT_EVENT (hex).
+class PerfCounters {
+public:
+    PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters();
+
+    void start();
+    void stop();
+
+    /// @brief Adds the counts per iteration, and the instructions per cycle, to the benchmark's counters.
+    void report(benchmark::State& state) const;
+
+private:
+    static constexpr size_t NUM_COUNTERS = 6;
+
+    struct Counter {
+        int fd{-1};
+        uint64_t value{};
+    };
+
+    std::array<Counter, NUM_COUNTERS> m_counters{};
+};
@@ -0,0 +1,335 @@
+// Stress harness for hooks under concurrent execution.
+//
+// Caller threads call the targets in tight loops while mutator threads repeatedly create, enable, disable, retarget
+// and destroy inline hooks on the same targets. Every result a caller sees has to be one the original function or one
+// of the destinations could return, anything else (or a crash) means a caller ran a torn instruction. The exit code is
+// non-zero if a caller saw a bad result or a mutator's operation failed.
+//
+// Usage: safetyhook-stress [--callers=64] [--mutators=4] [--seconds=5]
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <safetyhook.hpp>
+
+#if SAFETYHOOK_OS_LINUX
+#include <ucontext.h>
+#endif
+
+using namespace std::literals;
+
+// Offsets the destinations add to the original result, so each possible result identifies who produced it.
+constexpr int DESTINATION_OFFSETS[] = {1'000'000, 2'000'000};
+
+template <int N> SAFETYHOOK_NOINLINE int target(int x) {
+    volatile int v = x;
+    return v * 3 + N;
+}
+
+template <int N, int D> int destination(int x) {
+    return x * 3 + N + DESTINATION_OFFSETS[D];
+}
+
+struct Target {
+    int (*fn)(int);
+    std::array<int (*)(int), 2> destinations;
+    int n;
+
+    std::mutex mutex{};
+    SafetyHookInline hook{};
+};
+
+template <size_t... Ns> std::array<Target, sizeof...(Ns)> make_targets(std::index_sequence<Ns...>) {
+    return {Target{&target<Ns>, {&destination<Ns, 0>, &destination<Ns, 1>}, static_cast<int>(Ns)}...};
+}
+
+static auto g_targets = make_targets(std::make_index_sequence<8>{});
+static std::atomic_bool g_stop{};
+
+static bool is_valid_result(const Target& target, int x, int result) {
+    const auto original = x * 3 + target.n;
+
+    return result == original ||
+           std::ranges::any_of(DESTINATION_OFFSETS, [&](int offset) { return result == original + offset; });
+}
+
+struct CallerStats {
+    uint64_t calls{};
+    uint64_t bad_results{};
+    int first_bad_target{-1};
+    int first_bad_input{};
+    int first_bad_result{};
+};
+
+static void run_caller(size_t index, CallerStats& stats) {
+    auto x = static_cast<int>(index);
+
+    while (!g_stop.load(std::memory_order_relaxed)) {
+        for (auto& target : g_targets) {
+            int (*volatile fn)(int) = target.fn;
+            const auto result = fn(x);
+
+            if (!is_valid_result(target, x, result)) {
+                if (stats.bad_results++ == 0) {
+                    stats.first_bad_target = target.n;
+                    stats.first_bad_input = x;
+                    stats.first_bad_result = result;
+                }
+            }
+
+            x = (x + 1) & 0xFFFF;
+            ++stats.calls;
+        }
+    }
+}
+
+struct MutatorStats {
+    uint64_t creates{};
+    uint64_t enables{};
+    uint64_t disables{};
+    uint64_t retargets{};
+    uint64_t destroys{};
+    uint64_t failures{};
+    std::vector<double> enable_latencies{};
+    std::vector<double> disable_latencies{};
+};
+
+static double microseconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void run_mutator(size_t index, MutatorStats& stats) {
+    std::mt19937 rng{static_cast<uint32_t>(index)};
+
+    while (!g_stop.load(std::memory_order_relaxed)) {
+        auto& target = g_targets[rng() % g_targets.size()];
+        const auto destination = target.destinations[rng() % target.destinations.size()];
+        std::scoped_lock lock{target.mutex};
+        auto& hook = target.hook;
+
+        switch (rng() % 5) {
+        case 0:
+            if (!hook) {
+                hook = safetyhook::create_inline(target.fn, destination, SafetyHookInline::StartDisabled);
+                ++(hook ? stats.creates : stats.failures);
+            }
+            break;
+        case 1:
+            if (hook && !hook.enabled()) {
+                const auto start = std::chrono::steady_clock::now();
+                const auto result = hook.enable();
+                stats.enable_latencies.push_back(microseconds_since(start));
+                ++(result ? stats.enables : stats.failures);
+            }
+            break;
+        case 2:
+            if (hook && hook.enabled()) {
+                const auto start = std::chrono::steady_clock::now();
+                const auto result = hook.disable();
+                stats.disable_latencies.push_back(microseconds_since(start));
+                ++(result ? stats.disables : stats.failures);
+            }
+            break;
+        case 3:
+            // Inline hooks can't change their destination, so the hook is replaced by one to the other destination.
+            hook = {};
+            hook = safetyhook::create_inline(target.fn, destination);
+            ++(hook ? stats.retargets : stats.failures);
+            break;
+        default:
+            if (hook) {
+                hook = {};
+                ++stats.destroys;
+            }
+            break;
+        }
+    }
+}
+
+static void print_latencies(std::string_view name, std::vector<double>& latencies) {
+    if (latencies.empty()) {
+        std::printf("%-18.*s none\n", static_cast<int>(name.size()), name.data());
+        return;
+    }
+
+    std::ranges::sort(latencies);
+
+    const auto percentile = [&](double p) {
+        const auto i = static_cast<size_t>(p * static_cast<double>(latencies.size()));
+        return latencies[std::min(i, latencies.size() - 1)];
+    };
+
+    std::printf("%-18.*s p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us (%zu samples)\n",
+        static_cast<int>(name.size()), name.data(), percentile(0.5), percentile(0.99), percentile(0.999),
+        latencies.back(), latencies.size());
+}
+
+// A crash while hooks are being changed is most likely a caller running a torn instruction, or running code that was
+// freed under it. Where the crash happened tells the two apart.
+static void report_crash(int signal, uintptr_t ip) {
+    for (const auto& target : g_targets) {
+        const auto offset = ip - reinterpret_cast<uintptr_t>(target.fn);
+
+        if (offset < 16) {
+            std::fprintf(stderr, "CRASH: signal %d at %#zx, target %d + %zu\n", signal, static_cast<size_t>(ip),
+                target.n, static_cast<size_t>(offset));
+            std::_Exit(2);
+        }
+    }
+
+    std::fprintf(stderr, "CRASH: signal %d at %#zx, outside of the targets\n", signal, static_cast<size_t>(ip));
+    std::_Exit(2);
+}
+
+#if SAFETYHOOK_OS_LINUX
+static void crash_handler(int signal, siginfo_t*, void* context) {
+    const auto& mcontext = static_cast<ucontext_t*>(context)->uc_mcontext;
+#if SAFETYHOOK_ARCH_X86_64
+    report_crash(signal, static_cast<uintptr_t>(mcontext.gregs[REG_RIP]));
+#else
+    report_crash(signal, static_cast<uintptr_t>(mcontext.gregs[REG_EIP]));
+#endif
+}
+
+static void install_crash_handler() {
+    struct sigaction action {};
+    action.sa_sigaction = crash_handler;
+    action.sa_flags = SA_SIGINFO;
+
+    for (const auto signal : {SIGSEGV, SIGILL, SIGBUS, SIGFPE}) {
+        sigaction(signal, &action, nullptr);
+    }
+}
+#else
+static void install_crash_handler() {
+    for (const auto signal : {SIGSEGV, SIGILL, SIGFPE}) {
+        std::signal(signal, [](int signal) { report_crash(signal, 0); });
+    }
+}
+#endif
+
+static size_t parse_option(std::string_view arg, std::string_view name, size_t value) {
+    if (!arg.starts_with(name)) {
+        return value;
+    }
+
+    arg.remove_prefix(name.size());
+
+    if (std::from_chars(arg.data(), arg.data() + arg.size(), value).ec != std::errc{}) {
+        std::fprintf(stderr, "invalid value for %.*s\n", static_cast<int>(name.size()), name.data());
+        std::exit(1);
+    }
+
+    return value;
+}
+
+int main(int argc, char* argv[]) {
+    size_t num_callers = 64;
+    size_t num_mutators = 4;
+    size_t seconds = 5;
+
+    for (auto i = 1; i < argc; ++i) {
+        num_callers = parse_option(argv[i], "--callers="sv, num_callers);
+        num_mutators = parse_option(argv[i], "--mutators="sv, num_mutators);
+        seconds = parse_option(argv[i], "--seconds="sv, seconds);
+    }
+
+    install_crash_handler();
+
+    std::vector<CallerStats> caller_stats(num_callers);
+    std::vector<MutatorStats> mutator_stats(num_mutators);
+    std::vector<std::thread> threads{};
+
+    for (size_t i = 0; i < num_callers; ++i) {
+        threads.emplace_back(run_caller, i, std::ref(caller_stats[i]));
+    }
+
+    for (size_t i = 0; i < num_mutators; ++i) {
+        threads.emplace_back(run_mutator, i, std::ref(mutator_stats[i]));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds{seconds});
+    g_stop = true;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto& target : g_targets) {
+        target.hook = {};
+    }
+
+    CallerStats calls{};
+
+    for (const auto& stats : caller_stats) {
+        calls.calls += stats.calls;
+
+        if (stats.bad_results != 0 && calls.bad_results == 0) {
+            calls.first_bad_target = stats.first_bad_target;
+            calls.first_bad_input = stats.first_bad_input;
+            calls.first_bad_result = stats.first_bad_result;
+        }
+
+        calls.bad_results += stats.bad_results;
+    }
+
+    MutatorStats operations{};
+
+    for (auto& stats : mutator_stats) {
+        operations.creates += stats.creates;
+        operations.enables += stats.enables;
+        operations.disables += stats.disables;
+        operations.retargets += stats.retargets;
+        operations.destroys += stats.destroys;
+        operations.failures += stats.failures;
+        operations.enable_latencies.insert(
+            operations.enable_latencies.end(), stats.enable_latencies.begin(), stats.enable_latencies.end());
+        operations.disable_latencies.insert(
+            operations.disable_latencies.end(), stats.disable_latencies.begin(), stats.disable_latencies.end());
+    }
+
+    std::printf("callers %zu, mutators %zu, targets %zu, %.2f s\n", num_callers, num_mutators, g_targets.size(),
+        elapsed);
+    std::printf("calls              %llu (%.2f M/s)\n", static_cast<unsigned long long>(calls.calls),
+        static_cast<double>(calls.calls) / elapsed / 1e6);
+    std::printf("operations         create %llu, enable %llu, disable %llu, retarget %llu, destroy %llu, failed %llu\n",
+        static_cast<unsigned long long>(operations.creates), static_cast<unsigned long long>(operations.enables),
+        static_cast<unsigned long long>(operations.disables), static_cast<unsigned long long>(operations.retargets),
+        static_cast<unsigned long long>(operations.destroys), static_cast<unsigned long long>(operations.failures));
+    print_latencies("enable latency", operations.enable_latencies);
+    print_latencies("disable latency", operations.disable_latencies);
+
+    auto passed = true;
+
+    if (calls.bad_results != 0) {
+        std::printf("BAD RESULTS: %llu (first: target %d, input %d, result %d)\n",
+            static_cast<unsigned long long>(calls.bad_results), calls.first_bad_target, calls.first_bad_input,
+            calls.first_bad_result);
+        passed = false;
+    } else {
+        std::printf("bad results        0\n");
+    }
+
+    // Every operation is on a hook in the right state, so none of them should fail.
+    if (operations.failures != 0) {
+        std::printf("FAILED OPERATIONS: %llu\n", static_cast<unsigned long long>(operations.failures));
+        passed = false;
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <safetyhook.hpp>
+
+#include "perf_counters.hpp"
+
+SAFETYHOOK_NOINLINE static int traced_mul_add(int a, int b) {
+    return a * b + 9;
+}
+
+static std::filesystem::path bench_trace_file_path() {
+    return std::filesystem::temp_directory_path() / "safetyhook-bench.shtrace";
+}
+
+// Cost of a traced call, which writes an enter and an exit event, against an unhooked call. A flush thread drains the
+// buffer as the benchmark runs so the events aren't dropped. In the file mode the events go to a trace file instead.
+static void BM_TracerCall(benchmark::State& state) {
+    static constexpr std::array<std::string_view, 3> labels{"unhooked", "traced", "traced to file"};
+    int (*volatile fn)(int, int) = traced_mul_add;
+    std::shared_ptr<SafetyHookTracer> tracer{};
+    std::shared_ptr<safetyhook::TraceFile> file{};
+    std::error_code ec{};
+
+    if (state.range(0) == 2) {
+        auto file_result = safetyhook::TraceFile::create(bench_trace_file_path());
+
+        if (!file_result) {
+            state.SkipWithError("failed to create the trace file");
+            return;
+        }
+
+        file = std::move(*file_result);
+
+        auto result = SafetyHookTracer::create(file, {{reinterpret_cast<void*>(traced_mul_add), "traced_mul_add"}});
+
+        if (!result) {
+            state.SkipWithError("failed to create the tracer");
+            return;
+        }
+
+        tracer = std::move(*result);
+    } else if (state.range(0) == 1) {
+        auto result = SafetyHookTracer::create({{reinterpret_cast<void*>(traced_mul_add), "traced_mul_add"}}, 1 << 20);
+
+        if (!result) {
+            state.SkipWithError("failed to create the tracer");
+            return;
+        }
+
+        tracer = std::move(*result);
+        tracer->start_flushing([](const SafetyHookTracer::Event&) {}, std::chrono::milliseconds{1});
+    }
+
+    state.SetLabel(std::string{labels[static_cast<size_t>(state.range(0))]});
+
+    PerfCounters counters{};
+    counters.start();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fn(1, 2));
+    }
+
+    counters.stop();
+    counters.report(state);
+
+    if (file) {
+        state.counters["dropped"] = static_cast<double>(file->dropped());
+        std::filesystem::remove(bench_trace_file_path(), ec);
+    } else if (tracer) {
+        tracer->stop_flushing();
+        state.counters["dropped"] = static_cast<double>(tracer->dropped());
+    }
+}
+BENCHMARK(BM_TracerCall)->DenseRange(0, 2)->ArgName("mode");
+
+// Throughput of TraceFile::Writer::write with a payload of a given number of words, rotating through the segments of
+// a 64 MiB file.
+static void BM_TraceFileWrite(benchmark::State& state) {
+    auto file = safetyhook::TraceFile::create(bench_trace_file_path());
+
+    if (!file) {
+        state.SkipWithError("failed to create the trace file");
+        return;
+    }
+
+    safetyhook::TraceFile::Writer writer{*file};
+    const std::vector<uint64_t> payload(static_cast<size_t>(state.range(0)), 0x1234);
+    uint32_t hook_id = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(writer.write(hook_id++, 0, payload));
+    }
+
+    const auto record_size = sizeof(safetyhook::TraceFile::Record) + payload.size() * sizeof(uint64_t);
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(record_size));
+    state.counters["dropped"] = static_cast<double>((*file)->dropped());
+
+    std::error_code ec{};
+    std::filesystem::remove(bench_trace_file_path(), ec);
+}
+BENCHMARK(BM_TraceFileWrite)->Arg(0)->Arg(4)->Arg(16)->ArgName("payload");
@@ -0,0 +1,36 @@
+#include <chrono>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <safetyhook.hpp>
+
+SAFETYHOOK_NOINLINE static void virtual_method() {
+    benchmark::ClobberMemory();
+}
+
+// Creates a VmtHook for an object whose VMT has the given number of methods, which is how many entries are cloned.
+static void BM_VmtHookCreate(benchmark::State& state) {
+    const auto num_methods = static_cast<size_t>(state.range(0));
+
+    // The header entries, the methods and a null entry ending the VMT.
+    std::vector<void*> vmt(safetyhook::VMT_HEADER + num_methods + 1);
+    std::fill_n(vmt.begin() + safetyhook::VMT_HEADER, num_methods, reinterpret_cast<void*>(&virtual_method));
+
+    struct Object {
+        void** vptr;
+    } object{vmt.data() + safetyhook::VMT_HEADER};
+
+    for (auto _ : state) {
+        const auto start = std::chrono::steady_clock::now();
+        auto hook = SafetyHookVmt::create(&object);
+        state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        if (!hook) {
+            state.SkipWithError("failed to create the hook");
+            break;
+        }
+
+        benchmark::DoNotOptimize(hook);
+    }
+}
+BENCHMARK(BM_VmtHookCreate)->RangeMultiplier(4)->Range(8, 2048)->ArgName("methods")->UseManualTime();
@@ -1,14 +1,28 @@
 #pragma once
 
+#include "safetyhook/call_site_hook.hpp"
+#include "safetyhook/call_site_scanner.hpp"
 #include "safetyhook/easy.hpp"
+#include "safetyhook/import_hook.hpp"
 #include "safetyhook/inline_hook.hpp"
+#include "safetyhook/latency.hpp"
+#include "safetyhook/metrics.hpp"
 #include "safetyhook/mid_hook.hpp"
 #include "safetyhook/os.hpp"
+#include "safetyhook/pointer_hook.hpp"
+#include "safetyhook/recorder.hpp"
+#include "safetyhook/trace_file.hpp"
+#include "safetyhook/tracer.hpp"
 #include "safetyhook/vmt_hook.hpp"
 
+using SafetyHookCallSite = safetyhook::CallSiteHook;
 using SafetyHookContext = safetyhook::Context;
+using SafetyHookImport = safetyhook::ImportHook;
 using SafetyHookInline = safetyhook::InlineHook;
 using SafetyHookMid = safetyhook::MidHook;
+using SafetyHookPointer = safetyhook::PointerHook;
+using SafetyHookRecorder = safetyhook::Recorder;
+using SafetyHookTracer = safetyhook::Tracer;
 using SafetyInlineHook [[deprecated("Use SafetyHookInline instead.")]] = safetyhook::InlineHook;
 using SafetyMidHook [[deprecated("Use SafetyHookMid instead.")]] = safetyhook::MidHook;
 using SafetyHookVmt = safetyhook::VmtHook;
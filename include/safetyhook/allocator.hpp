@@ -95,6 +95,13 @@ public:
     [[nodiscard]] std::expected<Allocation, Error> allocate_near(
         const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance = 0x7FFF'FFFF);
 
+    /// @brief Allocates non-executable memory for data.
+    /// @param size The size of the allocation.
+    /// @return The Allocation or an Allocator::Error if the allocation failed.
+    /// @note Data allocations are read/write and come from separate memory than code allocations, keeping the code
+    /// dense and data out of executable memory. They are aligned for any fundamental type.
+    [[nodiscard]] std::expected<Allocation, Error> allocate_data(size_t size);
+
 protected:
     friend Allocation;
 
@@ -111,6 +118,7 @@ private:
         uint8_t* address{};
         size_t size{};
         std::unique_ptr<FreeNode> freelist{};
+        bool is_executable{};
 
         ~Memory();
     };
@@ -121,12 +129,14 @@ private:
     Allocator() = default;
 
     [[nodiscard]] std::expected<Allocation, Error> internal_allocate_near(
-        const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance = 0x7FFF'FFFF);
+        const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance = 0x7FFF'FFFF,
+        bool is_executable = true);
     void internal_free(uint8_t* address, size_t size);
 
     static void combine_adjacent_freenodes(Memory& memory);
+    [[nodiscard]] static size_t aligned_size(size_t size, bool is_executable);
     [[nodiscard]] static std::expected<uint8_t*, Error> allocate_nearby_memory(
-        const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance);
+        const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance, bool is_executable);
     [[nodiscard]] static bool in_range(
         uint8_t* address, const std::vector<uint8_t*>& desired_addresses, size_t max_distance);
 };
@@ -0,0 +1,265 @@
+/// @file safetyhook/call_site_hook.hpp
+/// @brief Call site hooking class.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <vector>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/allocator.hpp"
+#include "safetyhook/common.hpp"
+
+namespace safetyhook {
+/// @brief A hook on call sites.
+/// @details A CallSiteHook retargets `call rel32` (E8) or `jmp rel32` (E9) instructions to the destination by
+/// rewriting their displacements, leaving the callee and every other caller alone. When the destination is out of range
+/// of a call site the instruction is pointed at a relay thunk allocated near it instead.
+/// @note Other threads keep running while the call sites are patched on Linux, so each displacement is rewritten with
+/// a single store, which x86 only performs atomically when it doesn't cross a cache line. Call sites whose
+/// displacement does (those starting at the last 4 bytes of a 64 byte line) fail with CROSSES_CACHE_LINE there.
+class SAFETYHOOK_API CallSiteHook final {
+public:
+    /// @brief Error type for CallSiteHook.
+    struct Error {
+        /// @brief The type of error.
+        enum : uint8_t {
+            BAD_ALLOCATION,               ///< An error occurred when allocating the relay thunk.
+            FAILED_TO_DECODE_INSTRUCTION, ///< Failed to decode the instruction at the call site.
+            NOT_A_CALL_SITE,              ///< The instruction isn't a call rel32 or jmp rel32.
+            DIFFERENT_CALLEES,            ///< The call sites don't all call the same function.
+            FAILED_TO_UNPROTECT,          ///< Failed to unprotect the pages of a call site.
+            CROSSES_CACHE_LINE,           ///< The call site's displacement can't be rewritten atomically.
+        } type;
+
+        /// @brief Extra information about the error.
+        union {
+            Allocator::Error allocator_error; ///< Allocator error information.
+            uint8_t* ip;                      ///< IP of the problematic instruction.
+        };
+
+        /// @brief Create a BAD_ALLOCATION error.
+        /// @param err The Allocator::Error that failed.
+        /// @return The new BAD_ALLOCATION error.
+        [[nodiscard]] static Error bad_allocation(Allocator::Error err) {
+            Error error{};
+            error.type = BAD_ALLOCATION;
+            error.allocator_error = err;
+            return error;
+        }
+
+        /// @brief Create a FAILED_TO_DECODE_INSTRUCTION error.
+        /// @param ip The IP of the problematic instruction.
+        /// @return The new FAILED_TO_DECODE_INSTRUCTION error.
+        [[nodiscard]] static Error failed_to_decode_instruction(uint8_t* ip) {
+            Error error{};
+            error.type = FAILED_TO_DECODE_INSTRUCTION;
+            error.ip = ip;
+            return error;
+        }
+
+        /// @brief Create a NOT_A_CALL_SITE error.
+        /// @param ip The IP of the problematic instruction.
+        /// @return The new NOT_A_CALL_SITE error.
+        [[nodiscard]] static Error not_a_call_site(uint8_t* ip) {
+            Error error{};
+            error.type = NOT_A_CALL_SITE;
+            error.ip = ip;
+            return error;
+        }
+
+        /// @brief Create a DIFFERENT_CALLEES error.
+        /// @param ip The IP of the call site with a different callee.
+        /// @return The new DIFFERENT_CALLEES error.
+        [[nodiscard]] static Error different_callees(uint8_t* ip) {
+            Error error{};
+            error.type = DIFFERENT_CALLEES;
+            error.ip = ip;
+            return error;
+        }
+
+        /// @brief Create a FAILED_TO_UNPROTECT error.
+        /// @param ip The IP of the call site that couldn't be unprotected.
+        /// @return The new FAILED_TO_UNPROTECT error.
+        [[nodiscard]] static Error failed_to_unprotect(uint8_t* ip) {
+            Error error{};
+            error.type = FAILED_TO_UNPROTECT;
+            error.ip = ip;
+            return error;
+        }
+
+        /// @brief Create a CROSSES_CACHE_LINE error.
+        /// @param ip The IP of the call site whose displacement crosses a cache line.
+        /// @return The new CROSSES_CACHE_LINE error.
+        [[nodiscard]] static Error crosses_cache_line(uint8_t* ip) {
+            Error error{};
+            error.type = CROSSES_CACHE_LINE;
+            error.ip = ip;
+            return error;
+        }
+    };
+
+    /// @brief Create a call site hook.
+    /// @param site The address of the call rel32 or jmp rel32 instruction.
+    /// @param destination The destination address.
+    /// @return The CallSiteHook or a CallSiteHook::Error if an error occurred.
+    /// @note This will use the default global Allocator for the relay thunk.
+    [[nodiscard]] static std::expected<CallSiteHook, Error> create(void* site, void* destination);
+
+    /// @brief Create a call site hook.
+    /// @param site The address of the call rel32 or jmp rel32 instruction.
+    /// @param destination The destination address.
+    /// @return The CallSiteHook or a CallSiteHook::Error if an error occurred.
+    /// @note This will use the default global Allocator for the relay thunk.
+    template <typename T, typename U>
+    [[nodiscard]] static std::expected<CallSiteHook, Error> create(T site, U destination) {
+        return create(reinterpret_cast<void*>(site), reinterpret_cast<void*>(destination));
+    }
+
+    /// @brief Create a call site hook with a given Allocator.
+    /// @param allocator The allocator to use for the relay thunk.
+    /// @param site The address of the call rel32 or jmp rel32 instruction.
+    /// @param destination The destination address.
+    /// @return The CallSiteHook or a CallSiteHook::Error if an error occurred.
+    [[nodiscard]] static std::expected<CallSiteHook, Error> create(
+        const std::shared_ptr<Allocator>& allocator, void* site, void* destination);
+
+    /// @brief Create a hook on many call sites of the same function.
+    /// @param sites The addresses of the call rel32 or jmp rel32 instructions, e.g. from find_call_sites.
+    /// @param destination The destination address.
+    /// @return The CallSiteHook or a CallSiteHook::Error if an error occurred.
+    /// @note This will use the default global Allocator for the relay thunks.
+    /// @details Every site is validated before any is patched, and the sites are then patched in one batch that
+    /// unprotects each page of code once. If a page can't be unprotected, the sites already patched are restored.
+    [[nodiscard]] static std::expected<CallSiteHook, Error> create(
+        const std::vector<uint8_t*>& sites, void* destination);
+
+    /// @brief Create a hook on many call sites of the same function.
+    /// @param sites The addresses of the call rel32 or jmp rel32 instructions, e.g. from find_call_sites.
+    /// @param destination The destination address.
+    /// @return The CallSiteHook or a CallSiteHook::Error if an error occurred.
+    /// @note This will use the default global Allocator for the relay thunks.
+    template <typename T>
+    [[nodiscard]] static std::expected<CallSiteHook, Error> create(const std::vector<uint8_t*>& sites, T destination) {
+        return create(sites, reinterpret_cast<void*>(destination));
+    }
+
+    /// @brief Create a hook on many call sites of the same function with a given Allocator.
+    /// @param allocator The allocator to use for the relay thunks.
+    /// @param sites The addresses of the call rel32 or jmp rel32 instructions, e.g. from find_call_sites.
+    /// @param destination The destination address.
+    /// @return The CallSiteHook or a CallSiteHook::Error if an error occurred.
+    [[nodiscard]] static std::expected<CallSiteHook, Error> create(
+        const std::shared_ptr<Allocator>& allocator, const std::vector<uint8_t*>& sites, void* destination);
+
+    CallSiteHook() = default;
+    CallSiteHook(const CallSiteHook&) = delete;
+    CallSiteHook(CallSiteHook&& other) noexcept;
+    CallSiteHook& operator=(const CallSiteHook&) = delete;
+    CallSiteHook& operator=(CallSiteHook&& other) noexcept;
+    ~CallSiteHook();
+
+    /// @brief Reset the hook.
+    /// @details This will point the call sites back at the original callee.
+    /// @return Nothing or a FAILED_TO_UNPROTECT error, in which case every call site is still hooked.
+    /// @note This is called automatically in the destructor. If it fails there, the call sites stay hooked and the
+    /// relay thunks are leaked.
+    std::expected<void, Error> reset();
+
+    /// @brief Get a pointer to the (first) call site.
+    /// @return A pointer to the call site.
+    [[nodiscard]] uint8_t* site() const { return m_sites.empty() ? nullptr : m_sites.front(); }
+
+    /// @brief Get the hooked call sites.
+    /// @return The hooked call sites.
+    [[nodiscard]] const std::vector<uint8_t*>& sites() const { return m_sites; }
+
+    /// @brief Get a pointer to the destination.
+    /// @return A pointer to the destination.
+    [[nodiscard]] uint8_t* destination() const { return m_destination; }
+
+    /// @brief Get the relay thunk Allocations.
+    /// @return The relay thunk Allocations, none when the destination is in range of every call site.
+    [[nodiscard]] const std::vector<Allocation>& relays() const { return m_relays; }
+
+    /// @brief Tests if the hook is valid.
+    /// @return True if the hook is valid, false otherwise.
+    explicit operator bool() const { return !m_sites.empty(); }
+
+    /// @brief Returns the address of the callee the call sites had before they were hooked.
+    /// @tparam T The type of the function pointer.
+    /// @return The address of the original callee.
+    template <typename T> [[nodiscard]] T original() const { return reinterpret_cast<T>(m_original); }
+
+    /// @brief Calls the original callee.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original callee.
+    /// @note This function will use the default calling convention set by your compiler.
+    template <typename RetT = void, typename... Args> RetT call(Args... args) {
+        return m_original != nullptr ? original<RetT (*)(Args...)>()(args...) : RetT();
+    }
+
+    /// @brief Calls the original callee.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original callee.
+    /// @note This function will use the __cdecl calling convention.
+    template <typename RetT = void, typename... Args> RetT ccall(Args... args) {
+        return m_original != nullptr ? original<RetT(SAFETYHOOK_CCALL*)(Args...)>()(args...) : RetT();
+    }
+
+    /// @brief Calls the original callee.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original callee.
+    /// @note This function will use the __thiscall calling convention.
+#if SAFETYHOOK_COMPILER_GCC
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#endif
+    template <typename RetT = void, typename... Args> RetT thiscall(Args... args) {
+        return m_original != nullptr ? original<RetT(SAFETYHOOK_THISCALL*)(Args...)>()(args...) : RetT();
+    }
+#if SAFETYHOOK_COMPILER_GCC
+#pragma GCC diagnostic pop
+#endif
+
+    /// @brief Calls the original callee.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original callee.
+    /// @note This function will use the __stdcall calling convention.
+    template <typename RetT = void, typename... Args> RetT stdcall(Args... args) {
+        return m_original != nullptr ? original<RetT(SAFETYHOOK_STDCALL*)(Args...)>()(args...) : RetT();
+    }
+
+    /// @brief Calls the original callee.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original callee.
+    /// @note This function will use the __fastcall calling convention.
+    template <typename RetT = void, typename... Args> RetT fastcall(Args... args) {
+        return m_original != nullptr ? original<RetT(SAFETYHOOK_FASTCALL*)(Args...)>()(args...) : RetT();
+    }
+
+private:
+    std::vector<uint8_t*> m_sites{};
+    uint8_t* m_original{};
+    uint8_t* m_destination{};
+    std::vector<Allocation> m_relays{};
+
+    std::expected<void, Error> destroy();
+    void release();
+};
+} // namespace safetyhook
@@ -0,0 +1,36 @@
+/// @file safetyhook/call_site_scanner.hpp
+/// @brief Finding the call sites of a function.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <cstdint>
+#include <vector>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/common.hpp"
+
+namespace safetyhook {
+/// @brief Finds the direct calls and jumps to a function in a module.
+/// @param function The function to find the call sites of.
+/// @param module An address inside the module to search, or nullptr to search the module containing the function.
+/// @return The sorted addresses of the `call rel32` (E8) and `jmp rel32` (E9) instructions targeting the function.
+/// @details The executable segments of the module are scanned for E8 and E9 bytes whose displacement points at the
+/// function, 32 bytes at a time with AVX2 or 16 with SSE2 depending on the CPU. Such a byte can just as well be part of
+/// another instruction, so each candidate is decoded from the start of the function containing it (from the unwind
+/// information of the module, .eh_frame_hdr on ELF and .pdata on x64 PE) and kept only if decoding lands on it.
+/// Candidates outside of any known function, e.g. in x86 PE modules which have no unwind table, are decoded from a
+/// short distance before them instead, which is much less reliable.
+/// @note Pass the result to CallSiteHook::create to hook every call site at once.
+[[nodiscard]] std::vector<uint8_t*> SAFETYHOOK_API find_call_sites(void* function, void* module = nullptr);
+
+/// @brief Finds the direct calls and jumps to a function in a module.
+/// @param function The function to find the call sites of.
+/// @param module An address inside the module to search, or nullptr to search the module containing the function.
+/// @return The sorted addresses of the `call rel32` (E8) and `jmp rel32` (E9) instructions targeting the function.
+template <typename T> [[nodiscard]] std::vector<uint8_t*> find_call_sites(T function, void* module = nullptr) {
+    return find_call_sites(reinterpret_cast<void*>(function), module);
+}
+} // namespace safetyhook
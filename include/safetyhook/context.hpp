@@ -4,6 +4,7 @@
 #pragma once
 
 #ifndef SAFETYHOOK_USE_CXXMODULES
+#include <cstddef>
 #include <cstdint>
 #else
 import std.compat;
@@ -21,15 +22,60 @@ union Xmm {
     double f64[2];
 };
 
+union Ymm {
+    uint8_t u8[32];
+    uint16_t u16[16];
+    uint32_t u32[8];
+    uint64_t u64[4];
+    float f32[8];
+    double f64[4];
+    Xmm xmm[2];
+};
+
+union Zmm {
+    uint8_t u8[64];
+    uint16_t u16[32];
+    uint32_t u32[16];
+    uint64_t u64[8];
+    float f32[16];
+    double f64[8];
+    Xmm xmm[4];
+    Ymm ymm[2];
+};
+
 /// @brief Context structure for 64-bit MidHook.
 /// @details This structure is used to pass the context of the hooked function to the destination allowing full access
 /// to the 64-bit registers at the moment the hook is called.
 /// @note rip will point to a trampoline containing the replaced instruction(s).
 /// @note rsp is read-only. Modifying it will have no effect. Use trampoline_rsp to modify rsp if needed but make sure
 /// the top of the stack is the rip you want to resume at.
+/// @note The hook returns to the trampoline with a jmp, which keeps return prediction intact, unless rip or
+/// trampoline_rsp were changed.
 struct Context64 {
     Xmm xmm0, xmm1, xmm2, xmm3, xmm4, xmm5, xmm6, xmm7, xmm8, xmm9, xmm10, xmm11, xmm12, xmm13, xmm14, xmm15;
     uintptr_t rflags, r15, r14, r13, r12, r11, r10, r9, r8, rdi, rsi, rdx, rcx, rbx, rax, rbp, rsp, trampoline_rsp, rip;
+
+    /// @brief Reads ymm0 to ymm15.
+    /// @param index The register number.
+    /// @return The register value.
+    /// @note The upper halves are only available in MidHooks created with MidHook::SaveExtendedState and read as zero
+    /// otherwise. The lower halves are the xmm members.
+    [[nodiscard]] Ymm SAFETYHOOK_API ymm(size_t index) const;
+
+    /// @brief Writes ymm0 to ymm15. See ymm() for when the upper halves are available.
+    /// @param index The register number.
+    /// @param value The new register value.
+    void SAFETYHOOK_API set_ymm(size_t index, const Ymm& value);
+
+    /// @brief Reads zmm0 to zmm31. See ymm() for when the upper bits are available.
+    /// @param index The register number.
+    /// @return The register value.
+    [[nodiscard]] Zmm SAFETYHOOK_API zmm(size_t index) const;
+
+    /// @brief Writes zmm0 to zmm31. See ymm() for when the upper bits are available.
+    /// @param index The register number.
+    /// @param value The new register value.
+    void SAFETYHOOK_API set_zmm(size_t index, const Zmm& value);
 };
 
 /// @brief Context structure for 32-bit MidHook.
@@ -38,9 +84,33 @@ struct Context64 {
 /// @note eip will point to a trampoline containing the replaced instruction(s).
 /// @note esp is read-only. Modifying it will have no effect. Use trampoline_esp to modify esp if needed but make sure
 /// the top of the stack is the eip you want to resume at.
+/// @note The hook returns to the trampoline with a jmp, which keeps return prediction intact, unless eip or
+/// trampoline_esp were changed.
 struct Context32 {
     Xmm xmm0, xmm1, xmm2, xmm3, xmm4, xmm5, xmm6, xmm7;
     uintptr_t eflags, edi, esi, edx, ecx, ebx, eax, ebp, esp, trampoline_esp, eip;
+
+    /// @brief Reads ymm0 to ymm7.
+    /// @param index The register number.
+    /// @return The register value.
+    /// @note The upper halves are only available in MidHooks created with MidHook::SaveExtendedState and read as zero
+    /// otherwise. The lower halves are the xmm members.
+    [[nodiscard]] Ymm SAFETYHOOK_API ymm(size_t index) const;
+
+    /// @brief Writes ymm0 to ymm7. See ymm() for when the upper halves are available.
+    /// @param index The register number.
+    /// @param value The new register value.
+    void SAFETYHOOK_API set_ymm(size_t index, const Ymm& value);
+
+    /// @brief Reads zmm0 to zmm7. See ymm() for when the upper bits are available.
+    /// @param index The register number.
+    /// @return The register value.
+    [[nodiscard]] Zmm SAFETYHOOK_API zmm(size_t index) const;
+
+    /// @brief Writes zmm0 to zmm7. See ymm() for when the upper bits are available.
+    /// @param index The register number.
+    /// @param value The new register value.
+    void SAFETYHOOK_API set_zmm(size_t index, const Zmm& value);
 };
 
 /// @brief Context structure for MidHook.
@@ -54,4 +124,25 @@ using Context = Context64;
 using Context = Context32;
 #endif
 
+/// @brief How MidHooks created with MidHook::SaveExtendedState save the AVX and AVX-512 state.
+struct ExtendedStateLayout {
+    uint64_t features;   ///< The XSAVE state components that are saved. Zero if there is nothing to save.
+    uint32_t size;       ///< The size of the save area in bytes.
+    bool compacted;      ///< Whether the save area uses the compacted format of XSAVEC.
+    uint32_t offsets[8]; ///< The offsets of the saved state components in the save area.
+    int32_t thread_slot; ///< The thread slot holding the save area of the innermost hook (see thread_slot_allocate).
+};
+
+/// @brief Detects the extended state supported by the CPU and enabled by the OS.
+/// @return The layout used by MidHooks created with MidHook::SaveExtendedState.
+[[nodiscard]] const ExtendedStateLayout& SAFETYHOOK_API extended_state_layout();
+
+/// @brief General purpose registers that can be referenced before the context is saved (see MidHook::Filter).
+/// @note The values match the register numbers used by the x86 instruction encoding.
+#if SAFETYHOOK_ARCH_X86_64
+enum class Register : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+#elif SAFETYHOOK_ARCH_X86_32
+enum class Register : uint8_t { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+#endif
+
 } // namespace safetyhook
\ No newline at end of file
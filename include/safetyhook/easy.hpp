@@ -3,9 +3,12 @@
 
 #pragma once
 
+#include "safetyhook/call_site_hook.hpp"
 #include "safetyhook/common.hpp"
+#include "safetyhook/import_hook.hpp"
 #include "safetyhook/inline_hook.hpp"
 #include "safetyhook/mid_hook.hpp"
+#include "safetyhook/pointer_hook.hpp"
 #include "safetyhook/utility.hpp"
 #include "safetyhook/vmt_hook.hpp"
 
@@ -28,6 +31,53 @@ template <typename T, typename U>
     return create_inline(reinterpret_cast<void*>(target), reinterpret_cast<void*>(destination), flags);
 }
 
+/// @brief Easy to use API for creating a CallSiteHook.
+/// @param site The address of the call rel32 or jmp rel32 instruction.
+/// @param destination The address of the destination function.
+/// @return The CallSiteHook object.
+[[nodiscard]] CallSiteHook SAFETYHOOK_API create_call_site(void* site, void* destination);
+
+/// @brief Easy to use API for creating a CallSiteHook.
+/// @param site The address of the call rel32 or jmp rel32 instruction.
+/// @param destination The address of the destination function.
+/// @return The CallSiteHook object.
+template <typename T, typename U> [[nodiscard]] CallSiteHook create_call_site(T site, U destination) {
+    return create_call_site(reinterpret_cast<void*>(site), reinterpret_cast<void*>(destination));
+}
+
+/// @brief Easy to use API for creating a CallSiteHook on many call sites of the same function.
+/// @param sites The addresses of the call rel32 or jmp rel32 instructions, e.g. from find_call_sites.
+/// @param destination The address of the destination function.
+/// @return The CallSiteHook object.
+[[nodiscard]] CallSiteHook SAFETYHOOK_API create_call_site(const std::vector<uint8_t*>& sites, void* destination);
+
+/// @brief Easy to use API for creating a CallSiteHook on many call sites of the same function.
+/// @param sites The addresses of the call rel32 or jmp rel32 instructions, e.g. from find_call_sites.
+/// @param destination The address of the destination function.
+/// @return The CallSiteHook object.
+template <typename T>
+[[nodiscard]] CallSiteHook create_call_site(const std::vector<uint8_t*>& sites, T destination) {
+    return create_call_site(sites, reinterpret_cast<void*>(destination));
+}
+
+/// @brief Easy to use API for creating an ImportHook.
+/// @param symbol The name of the imported function.
+/// @param destination The address of the destination function.
+/// @param module An address inside the module whose imports to hook, or nullptr to hook every loaded module.
+/// @return The ImportHook object.
+[[nodiscard]] ImportHook SAFETYHOOK_API create_import(
+    std::string_view symbol, void* destination, void* module = nullptr);
+
+/// @brief Easy to use API for creating an ImportHook.
+/// @param symbol The name of the imported function.
+/// @param destination The address of the destination function.
+/// @param module An address inside the module whose imports to hook, or nullptr to hook every loaded module.
+/// @return The ImportHook object.
+template <typename T>
+[[nodiscard]] ImportHook create_import(std::string_view symbol, T destination, void* module = nullptr) {
+    return create_import(symbol, reinterpret_cast<void*>(destination), module);
+}
+
 /// @brief Easy to use API for creating a MidHook.
 /// @param target the address of the function to hook.
 /// @param destination The destination function.
@@ -46,10 +96,46 @@ template <typename T>
     return create_mid(reinterpret_cast<void*>(target), destination, flags);
 }
 
+/// @brief Easy to use API for creating a MidHook that only calls the destination for hits that pass the given filters.
+/// @param target the address of the function to hook.
+/// @param destination The destination function.
+/// @param filters The filters to check before the context is saved.
+/// @param flags The flags to use.
+/// @return The MidHook object.
+[[nodiscard]] MidHook SAFETYHOOK_API create_mid(void* target, MidHookFn destination,
+    const std::vector<MidHook::Filter>& filters, MidHook::Flags flags = MidHook::Default);
+
+/// @brief Easy to use API for creating a MidHook that only calls the destination for hits that pass the given filters.
+/// @param target the address of the function to hook.
+/// @param destination The destination function.
+/// @param filters The filters to check before the context is saved.
+/// @param flags The flags to use.
+/// @return The MidHook object.
+template <typename T>
+[[nodiscard]] MidHook create_mid(T target, MidHookFn destination, const std::vector<MidHook::Filter>& filters,
+    MidHook::Flags flags = MidHook::Default) {
+    return create_mid(reinterpret_cast<void*>(target), destination, filters, flags);
+}
+
+/// @brief Easy to use API for creating a PointerHook.
+/// @param slot The address of the function pointer to swap.
+/// @param destination The address of the destination function.
+/// @return The PointerHook object.
+[[nodiscard]] PointerHook SAFETYHOOK_API create_pointer(void* slot, void* destination);
+
+/// @brief Easy to use API for creating a PointerHook.
+/// @param slot The address of the function pointer to swap.
+/// @param destination The address of the destination function.
+/// @return The PointerHook object.
+template <typename T, typename U> [[nodiscard]] PointerHook create_pointer(T slot, U destination) {
+    return create_pointer(reinterpret_cast<void*>(slot), reinterpret_cast<void*>(destination));
+}
+
 /// @brief Easy to use API for creating a VmtHook.
 /// @param object The object to hook.
+/// @param flags The flags to use.
 /// @return The VmtHook object.
-[[nodiscard]] VmtHook SAFETYHOOK_API create_vmt(void* object);
+[[nodiscard]] VmtHook SAFETYHOOK_API create_vmt(void* object, VmtHook::Flags flags = VmtHook::Default);
 
 /// @brief Easy to use API for creating a VmHook.
 /// @param vmt The VmtHook to use to create the VmHook.
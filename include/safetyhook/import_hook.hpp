@@ -0,0 +1,142 @@
+/// @file safetyhook/import_hook.hpp
+/// @brief Import hooking class.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <cstdint>
+#include <expected>
+#include <string_view>
+#include <vector>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/common.hpp"
+
+namespace safetyhook {
+/// @brief A hook that replaces the GOT entries modules import a function through.
+/// @details Calls to a shared library function from another module go through an entry of the calling module's global
+/// offset table (.got.plt for PLT calls, .got otherwise). An ImportHook swaps those entries for the destination, so
+/// there is no code to patch and no trampoline, and calls through the hook cost the same as calls to the original.
+/// Calls the library makes to itself don't go through the GOT and aren't hooked.
+/// @note Import hooks are only supported for ELF modules.
+class SAFETYHOOK_API ImportHook final {
+public:
+    /// @brief Error type for ImportHook.
+    struct Error {
+        /// @brief The type of error.
+        enum : uint8_t {
+            IMPORT_NOT_FOUND,    ///< No module imports the symbol.
+            FAILED_TO_UNPROTECT, ///< Failed to unprotect a GOT entry.
+            UNSUPPORTED,         ///< Import hooks aren't supported on this platform.
+        } type;
+
+        /// @brief Extra information about the error.
+        union {
+            uint8_t* entry; ///< The GOT entry that failed to unprotect.
+        };
+
+        /// @brief Create a IMPORT_NOT_FOUND error.
+        /// @return The new IMPORT_NOT_FOUND error.
+        [[nodiscard]] static Error import_not_found() {
+            Error error{};
+            error.type = IMPORT_NOT_FOUND;
+            return error;
+        }
+
+        /// @brief Create a FAILED_TO_UNPROTECT error.
+        /// @param entry The GOT entry that failed to unprotect.
+        /// @return The new FAILED_TO_UNPROTECT error.
+        [[nodiscard]] static Error failed_to_unprotect(uint8_t* entry) {
+            Error error{};
+            error.type = FAILED_TO_UNPROTECT;
+            error.entry = entry;
+            return error;
+        }
+
+        /// @brief Create a UNSUPPORTED error.
+        /// @return The new UNSUPPORTED error.
+        [[nodiscard]] static Error unsupported() {
+            Error error{};
+            error.type = UNSUPPORTED;
+            return error;
+        }
+    };
+
+    /// @brief Create an import hook.
+    /// @param symbol The name of the imported function.
+    /// @param destination The destination address.
+    /// @param module An address inside the module whose imports to hook, or nullptr to hook every loaded module.
+    /// @return The ImportHook or an ImportHook::Error if an error occurred.
+    /// @note Modules loaded after the hook is created aren't hooked.
+    [[nodiscard]] static std::expected<ImportHook, Error> create(
+        std::string_view symbol, void* destination, void* module = nullptr);
+
+    /// @brief Create an import hook.
+    /// @param symbol The name of the imported function.
+    /// @param destination The destination address.
+    /// @param module An address inside the module whose imports to hook, or nullptr to hook every loaded module.
+    /// @return The ImportHook or an ImportHook::Error if an error occurred.
+    /// @note Modules loaded after the hook is created aren't hooked.
+    template <typename T>
+    [[nodiscard]] static std::expected<ImportHook, Error> create(
+        std::string_view symbol, T destination, void* module = nullptr) {
+        return create(symbol, reinterpret_cast<void*>(destination), module);
+    }
+
+    ImportHook() = default;
+    ImportHook(const ImportHook&) = delete;
+    ImportHook(ImportHook&& other) noexcept;
+    ImportHook& operator=(const ImportHook&) = delete;
+    ImportHook& operator=(ImportHook&& other) noexcept;
+    ~ImportHook();
+
+    /// @brief Reset the hook.
+    /// @details This will put the original GOT entries back.
+    /// @note This is called automatically in the destructor.
+    void reset();
+
+    /// @brief Get a pointer to the destination.
+    /// @return A pointer to the destination.
+    [[nodiscard]] uint8_t* destination() const { return m_destination; }
+
+    /// @brief Get the number of GOT entries that were hooked.
+    /// @return The number of GOT entries that were hooked.
+    [[nodiscard]] size_t entry_count() const { return m_entries.size(); }
+
+    /// @brief Tests if the hook is valid.
+    /// @return True if the hook is valid, false otherwise.
+    explicit operator bool() const { return !m_entries.empty(); }
+
+    /// @brief Returns the address of the original function.
+    /// @tparam T The type of the function pointer.
+    /// @return The address of the original function.
+    /// @details This is the function the first hooked GOT entry was bound to, so it's the version of the symbol that
+    /// entry's module needs. If the entry was still lazily bound, it's looked up with that module's symbol version.
+    template <typename T> [[nodiscard]] T original() const { return reinterpret_cast<T>(m_original); }
+
+    /// @brief Calls the original function.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original function.
+    /// @note This function will use the default calling convention set by your compiler.
+    template <typename RetT = void, typename... Args> RetT call(Args... args) {
+        return m_original != nullptr ? original<RetT (*)(Args...)>()(args...) : RetT();
+    }
+
+private:
+    struct Entry {
+        uint8_t** address{};
+        uint8_t* original{};
+        bool is_relro{};
+    };
+
+    std::vector<Entry> m_entries{};
+    uint8_t* m_original{};
+    uint8_t* m_destination{};
+
+    void destroy();
+};
+} // namespace safetyhook
@@ -16,6 +16,7 @@ import std.compat;
 
 #include "safetyhook/allocator.hpp"
 #include "safetyhook/common.hpp"
+#include "safetyhook/latency.hpp"
 #include "safetyhook/utility.hpp"
 
 namespace safetyhook {
@@ -33,12 +34,14 @@ public:
             UNSUPPORTED_INSTRUCTION_IN_TRAMPOLINE, ///< An unsupported instruction was found in the trampoline.
             FAILED_TO_UNPROTECT,                   ///< Failed to unprotect memory.
             NOT_ENOUGH_SPACE,                      ///< Not enough space to create the hook.
+            BAD_LATENCY_PROBE,                     ///< An error occurred when creating the LatencyProbe.
         } type;
 
         /// @brief Extra information about the error.
         union {
-            Allocator::Error allocator_error; ///< Allocator error information.
-            uint8_t* ip;                      ///< IP of the problematic instruction.
+            Allocator::Error allocator_error;  ///< Allocator error information.
+            uint8_t* ip;                       ///< IP of the problematic instruction.
+            LatencyProbe::Error latency_error; ///< LatencyProbe error information.
         };
 
         /// @brief Create a BAD_ALLOCATION error.
@@ -110,12 +113,30 @@ public:
             error.ip = ip;
             return error;
         }
+
+        /// @brief Create a BAD_LATENCY_PROBE error.
+        /// @param err The LatencyProbe::Error that failed.
+        /// @return The new BAD_LATENCY_PROBE error.
+        [[nodiscard]] static Error bad_latency_probe(LatencyProbe::Error err) {
+            Error error{};
+            error.type = BAD_LATENCY_PROBE;
+            error.latency_error = err;
+            return error;
+        }
     };
 
     /// @brief Flags for InlineHook.
     enum Flags : int {
-        Default = 0,            ///< Default flags.
-        StartDisabled = 1 << 0, ///< Start the hook disabled.
+        Default = 0,             ///< Default flags.
+        StartDisabled = 1 << 0,  ///< Start the hook disabled.
+        CountHits = 1 << 1,      ///< Count the calls to the target that go to the destination (see hits).
+        MeasureLatency = 1 << 2, ///< Time the calls to the destination (see latencies).
+    };
+
+    /// @brief The number of hits of a hook created with CountHits.
+    struct HitCount {
+        uint8_t* target; ///< The target of the hook.
+        uint64_t hits;   ///< The number of hits.
     };
 
     /// @brief Create an inline hook.
@@ -346,6 +367,33 @@ public:
     /// @brief Check if the hook is enabled.
     [[nodiscard]] bool enabled() const { return m_enabled; }
 
+    /// @brief Returns the number of times the hook was entered, if it was created with CountHits.
+    /// @return The number of hits, or 0 if the hook doesn't count them.
+    /// @note Entering the hook runs a stub between the target and the destination that increments one of several
+    /// counters, picked by the thread, so threads mostly don't share a cache line. The stub changes the arithmetic
+    /// flags, which is fine at the start of a function but not in the middle of one.
+    [[nodiscard]] uint64_t hits() const;
+
+    /// @brief Sets the number of hits of the hook to 0.
+    void reset_hits();
+
+    /// @brief Returns the number of hits of every hook created with CountHits that still exists.
+    /// @return The targets and their number of hits.
+    [[nodiscard]] static std::vector<HitCount> hit_counts();
+
+    /// @brief Sets the number of hits of every hook created with CountHits to 0.
+    static void reset_hit_counts();
+
+    /// @brief Returns how long the calls to the destination took, if the hook was created with MeasureLatency.
+    /// @return The durations in time stamp counter ticks, or an empty histogram if the hook doesn't time calls.
+    /// @note A call is timed from the hook's entry to the destination's return, so it includes the original function
+    /// when the destination calls it. See LatencyProbe for the calls that aren't timed and what the destination must
+    /// not do.
+    [[nodiscard]] LatencyHistogram latencies() const;
+
+    /// @brief Removes the durations recorded so far.
+    void reset_latencies();
+
 private:
     friend class MidHook;
 
@@ -358,20 +406,34 @@ private:
     uint8_t* m_target{};
     uint8_t* m_destination{};
     Allocation m_trampoline{};
+    Allocation m_hit_counters{};
+    LatencyProbe m_latency_probe{};
     std::vector<uint8_t> m_original_bytes{};
     uintptr_t m_trampoline_size{};
     std::recursive_mutex m_mutex{};
     bool m_enabled{};
     Type m_type{Type::Unset};
 
-    std::expected<void, Error> setup(
-        const std::shared_ptr<Allocator>& allocator, uint8_t* target, uint8_t* destination);
-    std::expected<void, Error> e9_hook(const std::shared_ptr<Allocator>& allocator);
+    // A non-zero stub_size reserves that many bytes after the trampoline, in the same allocation, for a MidHook's
+    // stub (see InlineHook::stub). The destination is then the stub's entry point, stub_entry bytes into it.
+    std::expected<void, Error> setup(const std::shared_ptr<Allocator>& allocator, uint8_t* target,
+        uint8_t* destination, size_t stub_size = 0, size_t stub_entry = 0);
+    std::expected<void, Error> e9_hook(
+        const std::shared_ptr<Allocator>& allocator, size_t stub_size, size_t stub_entry);
 
 #if SAFETYHOOK_ARCH_X86_64
-    std::expected<void, Error> ff_hook(const std::shared_ptr<Allocator>& allocator);
+    std::expected<void, Error> ff_hook(
+        const std::shared_ptr<Allocator>& allocator, size_t stub_size, size_t stub_entry);
 #endif
 
+    [[nodiscard]] size_t stub_offset() const;
+    [[nodiscard]] uint8_t* stub() const { return m_trampoline.data() + stub_offset(); }
+
+    // Fill the stub reserved by setup with code that counts a hit, or times the call, and jumps to the destination.
+    std::expected<void, Error> setup_hit_counters(const std::shared_ptr<Allocator>& allocator, uint8_t* destination);
+    std::expected<void, Error> setup_latency_probe(uint8_t* stub, uint8_t* destination);
+    [[nodiscard]] uint8_t* hit_counter_shards() const;
+
     void destroy();
 };
 } // namespace safetyhook
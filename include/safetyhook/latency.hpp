@@ -0,0 +1,130 @@
+/// @file safetyhook/latency.hpp
+/// @brief Latency histograms of the calls to timed inline hooks.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/common.hpp"
+
+namespace safetyhook {
+/// @brief A log-linear histogram of durations in time stamp counter ticks.
+/// @details Durations below SUB_BUCKETS * 2 ticks have a bucket each. Above that, every power of two is split into
+/// SUB_BUCKETS buckets of equal width, so a bucket is at most 1 / SUB_BUCKETS of the durations it holds wide.
+class SAFETYHOOK_API LatencyHistogram final {
+public:
+    /// @brief The number of buckets each power of two is split into, as a power of two.
+    static constexpr size_t SUB_BUCKET_BITS = 3;
+
+    /// @brief The number of buckets each power of two is split into.
+    static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+
+    /// @brief The number of buckets, enough for any 64-bit duration.
+    static constexpr size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    /// @brief Returns the index of the bucket that holds a duration.
+    /// @param ticks The duration.
+    /// @return The index of the bucket.
+    [[nodiscard]] static size_t bucket_index(uint64_t ticks);
+
+    /// @brief Returns the shortest duration a bucket holds.
+    /// @param index The index of the bucket.
+    /// @return The shortest duration.
+    [[nodiscard]] static uint64_t bucket_lower_bound(size_t index);
+
+    /// @brief Returns the longest duration a bucket holds.
+    /// @param index The index of the bucket.
+    /// @return The longest duration.
+    [[nodiscard]] static uint64_t bucket_upper_bound(size_t index);
+
+    /// @brief Adds a duration.
+    /// @param ticks The duration.
+    /// @param count The number of times to add it.
+    void record(uint64_t ticks, uint64_t count = 1);
+
+    /// @brief Adds all the durations of another histogram.
+    /// @param other The other histogram.
+    void merge(const LatencyHistogram& other);
+
+    /// @brief Removes all the durations.
+    void clear() { m_buckets = {}; }
+
+    /// @brief Returns the number of durations.
+    [[nodiscard]] uint64_t count() const;
+
+    /// @brief Returns a percentile of the durations.
+    /// @param percentile The percentile, from 0 to 100.
+    /// @return The upper bound of the bucket holding the percentile, or 0 if the histogram is empty.
+    [[nodiscard]] uint64_t percentile(double percentile) const;
+
+    /// @brief Returns the number of durations in each bucket.
+    [[nodiscard]] const std::array<uint64_t, NUM_BUCKETS>& buckets() const { return m_buckets; }
+
+private:
+    std::array<uint64_t, NUM_BUCKETS> m_buckets{};
+};
+
+/// @brief Times the calls that enter a destination through its stub. Used by InlineHook for MeasureLatency.
+/// @details The stub saves the registers that can hold arguments, records the time stamp counter on a per-thread
+/// shadow stack and swaps the return address for a shared exit stub. When the destination returns, the exit stub pops
+/// the shadow stack, adds the duration to the calling thread's histogram for the probe and returns to the original
+/// return address. The histograms of all the threads are merged when they're read.
+/// @note A call isn't timed when the shadow stack of the thread is full or the call happens while safetyhook is
+/// recording another duration on the same thread. The destination must return normally: throwing an exception or
+/// calling longjmp through it, or switching to another stack inside it, loses the shadow stack entry and the stack
+/// can't be unwound through the swapped return address.
+class SAFETYHOOK_API LatencyProbe final {
+public:
+    /// @brief The error type returned by LatencyProbe::create.
+    enum class Error : uint8_t {
+        BAD_ALLOCATION,  ///< Allocating the exit stub failed.
+        TOO_MANY_PROBES, ///< All the probes are in use.
+    };
+
+    /// @brief The size of the stub written by emit_stub.
+    static constexpr size_t STUB_SIZE = sizeof(uintptr_t) == 8 ? 224 : 176;
+
+    /// @brief The maximum number of probes that can exist at the same time.
+    static constexpr size_t MAX_PROBES = 0x1000;
+
+    /// @brief The maximum number of nested timed calls per thread.
+    static constexpr size_t MAX_DEPTH = 64;
+
+    /// @brief Creates a new LatencyProbe.
+    /// @return The LatencyProbe or a LatencyProbe::Error if an error occurred.
+    [[nodiscard]] static std::expected<LatencyProbe, Error> create();
+
+    LatencyProbe() = default;
+    LatencyProbe(const LatencyProbe&) = delete;
+    LatencyProbe(LatencyProbe&& other) noexcept;
+    LatencyProbe& operator=(const LatencyProbe&) = delete;
+    LatencyProbe& operator=(LatencyProbe&& other) noexcept;
+    ~LatencyProbe();
+
+    /// @brief Writes the stub that times the calls to a destination.
+    /// @param stub Where to write the stub, STUB_SIZE bytes of executable memory.
+    /// @param destination The destination the stub jumps to.
+    void emit_stub(uint8_t* stub, uint8_t* destination) const;
+
+    /// @brief Returns the durations of the calls made through the probe's stubs, merged across threads.
+    [[nodiscard]] LatencyHistogram histogram() const;
+
+    /// @brief Removes the durations recorded so far.
+    void reset();
+
+    /// @brief Tests if the probe is valid.
+    explicit operator bool() const { return m_key != 0; }
+
+private:
+    uint32_t m_key{};
+
+    void destroy();
+};
+} // namespace safetyhook
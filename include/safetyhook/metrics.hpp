@@ -0,0 +1,47 @@
+/// @file safetyhook/metrics.hpp
+/// @brief Counters and timings of the work safetyhook does to create and change hooks.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <cstdint>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/common.hpp"
+
+#if defined(SAFETYHOOK_ENABLE_METRICS)
+#define SAFETYHOOK_METRICS 1
+#else
+#define SAFETYHOOK_METRICS 0
+#endif
+
+namespace safetyhook {
+/// @brief A snapshot of the metrics. Times are in nanoseconds.
+/// @note The metrics are only collected when safetyhook is built with SAFETYHOOK_ENABLE_METRICS defined (the CMake
+/// option of the same name), otherwise they are always 0.
+struct Metrics {
+    uint64_t vm_query_calls;         ///< Calls to vm_query.
+    uint64_t vm_query_time;          ///< Time spent in vm_query.
+    uint64_t maps_parses;            ///< Reads of /proc/self/maps. Always 0 on Windows.
+    uint64_t vm_protect_calls;       ///< Calls to vm_protect.
+    uint64_t vm_protect_time;        ///< Time spent in vm_protect.
+    uint64_t protect_syscalls;       ///< Calls to mprotect or VirtualProtect.
+    uint64_t trap_threads_calls;     ///< Calls to trap_threads.
+    uint64_t trap_threads_time;      ///< Time spent in trap_threads, including the function it runs.
+    uint64_t instructions_decoded;   ///< Instructions decoded by Zydis.
+    uint64_t near_allocation_probes; ///< Addresses tried when mapping memory near the desired addresses.
+    uint64_t near_allocation_time;   ///< Time spent looking for and mapping memory near the desired addresses.
+    uint64_t e9_to_ff_fallbacks;     ///< Inline hooks that used an FF jmp because an E9 jmp couldn't be used.
+};
+
+/// @brief Returns a snapshot of the metrics.
+/// @return The metrics collected since the start of the process or the last reset_metrics.
+/// @note The metrics are updated independently, so a snapshot taken while hooks are being changed on other threads
+/// can be slightly inconsistent.
+[[nodiscard]] Metrics SAFETYHOOK_API metrics();
+
+/// @brief Sets all the metrics to 0.
+void SAFETYHOOK_API reset_metrics();
+} // namespace safetyhook
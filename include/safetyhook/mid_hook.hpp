@@ -6,6 +6,7 @@
 #ifndef SAFETYHOOK_USE_CXXMODULES
 #include <cstdint>
 #include <memory>
+#include <vector>
 #else
 import std.compat;
 #endif
@@ -14,6 +15,8 @@ import std.compat;
 #include "safetyhook/common.hpp"
 #include "safetyhook/context.hpp"
 #include "safetyhook/inline_hook.hpp"
+#include "safetyhook/os.hpp"
+#include "safetyhook/recorder.hpp"
 #include "safetyhook/utility.hpp"
 
 namespace safetyhook {
@@ -30,12 +33,16 @@ public:
         enum : uint8_t {
             BAD_ALLOCATION,
             BAD_INLINE_HOOK,
+            BAD_FILTER,
+            BAD_RECORDER,
+            BAD_THREAD_SLOT,
         } type;
 
         /// @brief Extra error information.
         union {
             Allocator::Error allocator_error;    ///< Allocator error information.
             InlineHook::Error inline_hook_error; ///< InlineHook error information.
+            OsError os_error;                    ///< OsError information.
         };
 
         /// @brief Create a BAD_ALLOCATION error.
@@ -57,12 +64,131 @@ public:
             error.inline_hook_error = err;
             return error;
         }
+
+        /// @brief Create a BAD_FILTER error.
+        /// @return The new BAD_FILTER error.
+        [[nodiscard]] static Error bad_filter() {
+            Error error{};
+            error.type = BAD_FILTER;
+            return error;
+        }
+
+        /// @brief Create a BAD_RECORDER error.
+        /// @return The new BAD_RECORDER error.
+        [[nodiscard]] static Error bad_recorder() {
+            Error error{};
+            error.type = BAD_RECORDER;
+            return error;
+        }
+
+        /// @brief Create a BAD_THREAD_SLOT error.
+        /// @param err The OsError of thread_slot_allocate.
+        /// @return The new BAD_THREAD_SLOT error.
+        [[nodiscard]] static Error bad_thread_slot(OsError err) {
+            Error error{};
+            error.type = BAD_THREAD_SLOT;
+            error.os_error = err;
+            return error;
+        }
+    };
+
+    /// @brief A condition checked by the stub before the context is saved.
+    /// @details A hit that fails any of a hook's filters resumes at the trampoline straight away without saving the
+    /// context or calling the destination. Filters are checked in order and all of them have to pass.
+    /// @note REGISTER and MEMORY filters pass when (value & mask) == Filter::value, or when it doesn't if negate is
+    /// set. SAMPLE filters pass once every Filter::value hits on average.
+    struct Filter {
+        /// @brief The type of filter.
+        enum : uint8_t {
+            REGISTER, ///< Test the value of a register.
+            MEMORY,   ///< Test the value in memory at a register plus an offset.
+            SAMPLE,   ///< Pass for one in every N hits.
+        } type;
+
+        Register reg;    ///< The register to test, or the base register for MEMORY filters.
+        uint8_t size;    ///< The size in bytes of the value read by MEMORY filters (1, 2, 4 or 8 on x86_64).
+        bool negate;     ///< Pass when the comparison fails instead of when it succeeds.
+        bool random;     ///< Use a pseudo-random interval averaging Filter::value hits for SAMPLE filters.
+        bool per_thread; ///< Count hits separately for each thread for SAMPLE filters. Uses a thread slot.
+        int32_t offset;  ///< The offset from reg for MEMORY filters.
+        uintptr_t mask;  ///< The mask applied to the value before it is compared.
+        uintptr_t value; ///< The value to compare against, or the sampling interval for SAMPLE filters.
+
+        /// @brief Create a filter that passes when a register equals a value.
+        /// @param reg The register to test.
+        /// @param value The value to compare against.
+        /// @param mask The mask applied to the register before it is compared.
+        /// @return The new REGISTER filter.
+        [[nodiscard]] static Filter register_equals(Register reg, uintptr_t value, uintptr_t mask = ~uintptr_t{}) {
+            return {REGISTER, reg, sizeof(uintptr_t), false, false, false, 0, mask, value};
+        }
+
+        /// @brief Create a filter that passes when a bit of a register is set.
+        /// @param reg The register to test.
+        /// @param bit The index of the bit to test.
+        /// @return The new REGISTER filter.
+        [[nodiscard]] static Filter register_bit_set(Register reg, uint8_t bit) {
+            const auto mask = bit < sizeof(uintptr_t) * 8 ? uintptr_t{1} << bit : 0;
+            return {REGISTER, reg, sizeof(uintptr_t), false, false, false, 0, mask, mask};
+        }
+
+        /// @brief Create a filter that passes when the value at [base + offset] equals a value.
+        /// @param base The base register of the address.
+        /// @param offset The offset from the base register.
+        /// @param value The value to compare against.
+        /// @param size The size in bytes of the value to read.
+        /// @param mask The mask applied to the value read before it is compared.
+        /// @return The new MEMORY filter.
+        [[nodiscard]] static Filter memory_equals(Register base, int32_t offset, uintptr_t value,
+            uint8_t size = sizeof(uintptr_t), uintptr_t mask = ~uintptr_t{}) {
+            return {MEMORY, base, size, false, false, false, offset, mask, value};
+        }
+
+        /// @brief Create a filter that passes when a bit of the value at [base + offset] is set.
+        /// @param base The base register of the address.
+        /// @param offset The offset from the base register.
+        /// @param bit The index of the bit to test. Only the byte containing the bit is read.
+        /// @return The new MEMORY filter.
+        [[nodiscard]] static Filter memory_bit_set(Register base, int32_t offset, uint32_t bit) {
+            const auto mask = static_cast<uintptr_t>(1u << (bit % 8));
+            return {MEMORY, base, 1, false, false, false, offset + static_cast<int32_t>(bit / 8), mask, mask};
+        }
+
+        /// @brief Create a filter that passes for every Nth hit.
+        /// @param interval The number of hits between each hit that passes.
+        /// @param per_thread Count hits separately for each thread instead of for the whole hook.
+        /// @return The new SAMPLE filter.
+        /// @note A per hook counter is shared between threads without synchronization, so concurrent hits may be
+        /// counted once. Per thread counters start at zero, so the first hit on each thread passes.
+        [[nodiscard]] static Filter sample(uint32_t interval, bool per_thread = false) {
+            return {SAMPLE, {}, sizeof(uint32_t), false, false, per_thread, 0, ~uintptr_t{}, interval};
+        }
+
+        /// @brief Create a filter that passes for one hit after a pseudo-random number of hits.
+        /// @details The number of hits between hits that pass is uniformly distributed between 1 and
+        /// 2 * mean_interval - 1 which avoids aliasing with periodic behavior of the hooked code.
+        /// @param mean_interval The average number of hits between each hit that passes.
+        /// @param per_thread Count hits separately for each thread instead of for the whole hook.
+        /// @return The new SAMPLE filter.
+        /// @note See sample() for notes about the counters.
+        [[nodiscard]] static Filter sample_random(uint32_t mean_interval, bool per_thread = false) {
+            return {SAMPLE, {}, sizeof(uint32_t), false, true, per_thread, 0, ~uintptr_t{}, mean_interval};
+        }
+
+        /// @brief Get a copy of this filter that passes when this one fails.
+        /// @return The negated filter.
+        [[nodiscard]] Filter negated() const {
+            auto filter = *this;
+            filter.negate = !filter.negate;
+            return filter;
+        }
     };
 
     /// @brief Flags for MidHook.
     enum Flags : int {
-        Default = 0,       ///< Default flags.
-        StartDisabled = 1, ///< Start the hook disabled.
+        Default = 0,           ///< Default flags.
+        StartDisabled = 1,     ///< Start the hook disabled.
+        SaveExtendedState = 2, ///< Save the AVX and AVX-512 registers around the destination (see Context::ymm).
     };
 
     /// @brief Creates a new MidHook object.
@@ -88,6 +214,32 @@ public:
         return create(reinterpret_cast<void*>(target), destination_fn, flags);
     }
 
+    /// @brief Creates a new MidHook object that only calls the destination for hits that pass the given filters.
+    /// @param target The address of the function to hook.
+    /// @param destination_fn The destination function.
+    /// @param filters The filters to check before the context is saved.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    /// @note This will use the default global Allocator.
+    /// @note If you don't care about error handling, use the easy API (safetyhook::create_mid).
+    [[nodiscard]] static std::expected<MidHook, Error> create(
+        void* target, MidHookFn destination_fn, const std::vector<Filter>& filters, Flags flags = Default);
+
+    /// @brief Creates a new MidHook object that only calls the destination for hits that pass the given filters.
+    /// @tparam T The type of the function to hook.
+    /// @param target The address of the function to hook.
+    /// @param destination_fn The destination function.
+    /// @param filters The filters to check before the context is saved.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    /// @note This will use the default global Allocator.
+    /// @note If you don't care about error handling, use the easy API (safetyhook::create_mid).
+    template <typename T>
+    [[nodiscard]] static std::expected<MidHook, Error> create(
+        T target, MidHookFn destination_fn, const std::vector<Filter>& filters, Flags flags = Default) {
+        return create(reinterpret_cast<void*>(target), destination_fn, filters, flags);
+    }
+
     /// @brief Creates a new MidHook object with a given Allocator.
     /// @param allocator The Allocator to use.
     /// @param target The address of the function to hook.
@@ -112,12 +264,103 @@ public:
         return create(allocator, reinterpret_cast<void*>(target), destination_fn, flags);
     }
 
+    /// @brief Creates a new MidHook object with a given Allocator that only calls the destination for hits that pass
+    /// the given filters.
+    /// @param allocator The Allocator to use.
+    /// @param target The address of the function to hook.
+    /// @param destination_fn The destination function.
+    /// @param filters The filters to check before the context is saved.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    /// @note If you don't care about error handling, use the easy API (safetyhook::create_mid).
+    [[nodiscard]] static std::expected<MidHook, Error> create(const std::shared_ptr<Allocator>& allocator, void* target,
+        MidHookFn destination_fn, const std::vector<Filter>& filters, Flags flags = Default);
+
+    /// @brief Creates a new MidHook object with a given Allocator that only calls the destination for hits that pass
+    /// the given filters.
+    /// @tparam T The type of the function to hook.
+    /// @param allocator The Allocator to use.
+    /// @param target The address of the function to hook.
+    /// @param destination_fn The destination function.
+    /// @param filters The filters to check before the context is saved.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    /// @note If you don't care about error handling, use the easy API (safetyhook::create_mid).
+    template <typename T>
+    [[nodiscard]] static std::expected<MidHook, Error> create(const std::shared_ptr<Allocator>& allocator, T target,
+        MidHookFn destination_fn, const std::vector<Filter>& filters, Flags flags = Default) {
+        return create(allocator, reinterpret_cast<void*>(target), destination_fn, filters, flags);
+    }
+
+    /// @brief Creates a new record-only MidHook object.
+    /// @details Instead of saving the context and calling a destination, the stub writes a Recorder::Record holding
+    /// the time stamp counter, hook_id and the chosen registers to the Recorder and resumes straight away.
+    /// @param target The address of the function to hook.
+    /// @param recorder The Recorder to write to. The hook keeps it alive.
+    /// @param hook_id The id stored in each record.
+    /// @param registers The registers to record (see Recorder::register_mask).
+    /// @param filters The filters to check before a record is written.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    /// @note This will use the default global Allocator.
+    [[nodiscard]] static std::expected<MidHook, Error> create_record_only(void* target,
+        const std::shared_ptr<Recorder>& recorder, uint32_t hook_id, uint16_t registers = Recorder::ALL_REGISTERS,
+        const std::vector<Filter>& filters = {}, Flags flags = Default);
+
+    /// @brief Creates a new record-only MidHook object.
+    /// @tparam T The type of the function to hook.
+    /// @param target The address of the function to hook.
+    /// @param recorder The Recorder to write to. The hook keeps it alive.
+    /// @param hook_id The id stored in each record.
+    /// @param registers The registers to record (see Recorder::register_mask).
+    /// @param filters The filters to check before a record is written.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    /// @note This will use the default global Allocator.
+    template <typename T>
+    [[nodiscard]] static std::expected<MidHook, Error> create_record_only(T target,
+        const std::shared_ptr<Recorder>& recorder, uint32_t hook_id, uint16_t registers = Recorder::ALL_REGISTERS,
+        const std::vector<Filter>& filters = {}, Flags flags = Default) {
+        return create_record_only(reinterpret_cast<void*>(target), recorder, hook_id, registers, filters, flags);
+    }
+
+    /// @brief Creates a new record-only MidHook object with a given Allocator.
+    /// @param allocator The Allocator to use.
+    /// @param target The address of the function to hook.
+    /// @param recorder The Recorder to write to. The hook keeps it alive.
+    /// @param hook_id The id stored in each record.
+    /// @param registers The registers to record (see Recorder::register_mask).
+    /// @param filters The filters to check before a record is written.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    [[nodiscard]] static std::expected<MidHook, Error> create_record_only(const std::shared_ptr<Allocator>& allocator,
+        void* target, const std::shared_ptr<Recorder>& recorder, uint32_t hook_id,
+        uint16_t registers = Recorder::ALL_REGISTERS, const std::vector<Filter>& filters = {}, Flags flags = Default);
+
+    /// @brief Creates a new record-only MidHook object with a given Allocator.
+    /// @tparam T The type of the function to hook.
+    /// @param allocator The Allocator to use.
+    /// @param target The address of the function to hook.
+    /// @param recorder The Recorder to write to. The hook keeps it alive.
+    /// @param hook_id The id stored in each record.
+    /// @param registers The registers to record (see Recorder::register_mask).
+    /// @param filters The filters to check before a record is written.
+    /// @param flags The flags to use.
+    /// @return The MidHook object or a MidHook::Error if an error occurred.
+    template <typename T>
+    [[nodiscard]] static std::expected<MidHook, Error> create_record_only(const std::shared_ptr<Allocator>& allocator,
+        T target, const std::shared_ptr<Recorder>& recorder, uint32_t hook_id,
+        uint16_t registers = Recorder::ALL_REGISTERS, const std::vector<Filter>& filters = {}, Flags flags = Default) {
+        return create_record_only(
+            allocator, reinterpret_cast<void*>(target), recorder, hook_id, registers, filters, flags);
+    }
+
     MidHook() = default;
     MidHook(const MidHook&) = delete;
     MidHook(MidHook&& other) noexcept;
     MidHook& operator=(const MidHook&) = delete;
     MidHook& operator=(MidHook&& other) noexcept;
-    ~MidHook() = default;
+    ~MidHook();
 
     /// @brief Reset the hook.
     /// @details This will remove the hook and free the stub.
@@ -133,16 +376,20 @@ public:
     [[nodiscard]] uintptr_t target_address() const { return reinterpret_cast<uintptr_t>(m_target); }
 
     /// @brief Get the destination function.
-    /// @return The destination function.
+    /// @return The destination function, or nullptr for record-only hooks.
     [[nodiscard]] MidHookFn destination() const { return m_destination; }
 
+    /// @brief Get the Recorder of a record-only hook.
+    /// @return The Recorder, or nullptr if this isn't a record-only hook.
+    [[nodiscard]] const std::shared_ptr<Recorder>& recorder() const { return m_recorder; }
+
     /// @brief Returns a vector containing the original bytes of the target function.
     /// @return A vector of the original bytes of the target function.
     [[nodiscard]] const auto& original_bytes() const { return m_hook.m_original_bytes; }
 
     /// @brief Tests if the hook is valid.
     /// @return true if the hook is valid, false otherwise.
-    explicit operator bool() const { return static_cast<bool>(m_stub); }
+    explicit operator bool() const { return static_cast<bool>(m_hook); }
 
     /// @brief Enable the hook.
     [[nodiscard]] std::expected<void, Error> enable();
@@ -156,10 +403,13 @@ public:
 private:
     InlineHook m_hook{};
     uint8_t* m_target{};
-    Allocation m_stub{};
     MidHookFn m_destination{};
+    std::vector<int32_t> m_thread_slots{};
+    std::shared_ptr<Recorder> m_recorder{};
 
-    std::expected<void, Error> setup(
-        const std::shared_ptr<Allocator>& allocator, uint8_t* target, MidHookFn destination);
+    std::expected<void, Error> setup(const std::shared_ptr<Allocator>& allocator, uint8_t* target,
+        MidHookFn destination, const std::vector<Filter>& filters, Flags flags, uint32_t record_id = 0,
+        uint16_t record_registers = 0);
+    void free_thread_slots();
 };
 } // namespace safetyhook
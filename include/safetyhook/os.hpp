@@ -4,6 +4,7 @@
 #ifndef SAFETYHOOK_USE_CXXMODULES
 #include <cstdint>
 #include <expected>
+#include <filesystem>
 #include <functional>
 #else
 import std.compat;
@@ -23,6 +24,8 @@ enum class OsError {
     FAILED_TO_FREEZE_THREAD,
     FAILED_TO_UNFREEZE_THREAD,
     FAILED_TO_GET_THREAD_ID,
+    FAILED_TO_ALLOCATE_THREAD_SLOT,
+    FAILED_TO_MAP_FILE,
 };
 
 struct VmAccess {
@@ -47,6 +50,12 @@ struct VmBasicInfo {
     bool is_free;
 };
 
+struct SymbolInfo {
+    uint8_t* address;
+    size_t size;
+    const char* name;
+};
+
 std::expected<uint8_t*, OsError> SAFETYHOOK_API vm_allocate(uint8_t* address, size_t size, VmAccess access);
 void SAFETYHOOK_API vm_free(uint8_t* address);
 std::expected<uint32_t, OsError> SAFETYHOOK_API vm_protect(uint8_t* address, size_t size, VmAccess access);
@@ -56,6 +65,11 @@ bool SAFETYHOOK_API vm_is_readable(uint8_t* address, size_t size);
 bool SAFETYHOOK_API vm_is_writable(uint8_t* address, size_t size);
 bool SAFETYHOOK_API vm_is_executable(uint8_t* address);
 
+/// @brief Finds the symbol containing an address in the loaded modules' dynamic symbol tables.
+/// @param address The address to look up.
+/// @return The symbol or FAILED_TO_QUERY if no sized symbol contains the address (always on Windows).
+std::expected<SymbolInfo, OsError> SAFETYHOOK_API symbol_query(uint8_t* address);
+
 struct SystemInfo {
     uint32_t page_size;
     uint32_t allocation_granularity;
@@ -65,6 +79,63 @@ struct SystemInfo {
 
 SystemInfo SAFETYHOOK_API system_info();
 
+struct FileMapping {
+    uint8_t* address;
+    size_t size;
+};
+
+/// @brief Maps a file into memory. The mapping is shared with the file, so what's written to it reaches the file even
+/// if the process crashes, and other processes mapping the file see it as it's written.
+/// @param path The file.
+/// @param size The size to create the file with, or 0 to open an existing file and map all of it.
+/// @param access VM_ACCESS_RW to create (or replace) the file with its blocks allocated up front, VM_ACCESS_R to open
+/// an existing one.
+/// @return The mapping or FAILED_TO_MAP_FILE.
+std::expected<FileMapping, OsError> SAFETYHOOK_API file_map(
+    const std::filesystem::path& path, size_t size, VmAccess access);
+
+/// @brief Unmaps a mapping created by file_map.
+/// @param mapping The mapping.
+void SAFETYHOOK_API file_unmap(const FileMapping& mapping);
+
+/// @brief Starts writing the modified pages of a mapping back to its file without waiting for it to finish.
+/// @param mapping The mapping.
+void SAFETYHOOK_API file_flush(const FileMapping& mapping);
+
+/// @brief Returns the operating system's id of the calling thread (the TID on Linux, the thread ID on Windows).
+uint32_t SAFETYHOOK_API current_thread_id();
+
+/// @brief The segment override prefix that addresses the current thread's block (fs or gs).
+#if (SAFETYHOOK_OS_WINDOWS && SAFETYHOOK_ARCH_X86_64) || (SAFETYHOOK_OS_LINUX && SAFETYHOOK_ARCH_X86_32)
+inline constexpr uint8_t THREAD_SEGMENT_PREFIX = 0x65;
+#else
+inline constexpr uint8_t THREAD_SEGMENT_PREFIX = 0x64;
+#endif
+
+/// @brief The offset of the thread block's pointer to itself from the base of the thread segment. The pointer is
+/// unique to each thread (the TEB on Windows, the TCB on Linux).
+#if SAFETYHOOK_OS_WINDOWS && SAFETYHOOK_ARCH_X86_64
+inline constexpr int32_t THREAD_SELF_OFFSET = 0x30;
+#elif SAFETYHOOK_OS_WINDOWS && SAFETYHOOK_ARCH_X86_32
+inline constexpr int32_t THREAD_SELF_OFFSET = 0x18;
+#else
+inline constexpr int32_t THREAD_SELF_OFFSET = 0;
+#endif
+
+/// @brief Allocates a zero initialized, pointer sized slot that exists once per thread.
+/// @return The offset of the slot from the base of the thread segment (see THREAD_SEGMENT_PREFIX). The offset is the
+/// same for every thread so generated code can access the slot with a single segment prefixed instruction.
+std::expected<int32_t, OsError> SAFETYHOOK_API thread_slot_allocate();
+
+/// @brief Frees a slot allocated by thread_slot_allocate.
+/// @param offset The offset returned by thread_slot_allocate.
+void SAFETYHOOK_API thread_slot_free(int32_t offset);
+
+/// @brief Reads the calling thread's value of a slot allocated by thread_slot_allocate.
+/// @param offset The offset returned by thread_slot_allocate.
+/// @return The value of the slot.
+uintptr_t SAFETYHOOK_API thread_slot_get(int32_t offset);
+
 using ThreadContext = void*;
 
 void SAFETYHOOK_API trap_threads(uint8_t* from, uint8_t* to, size_t len, const std::function<void()>& run_fn);
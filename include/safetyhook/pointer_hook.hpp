@@ -0,0 +1,204 @@
+/// @file safetyhook/pointer_hook.hpp
+/// @brief Pointer hooking class.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <cstdint>
+#include <expected>
+#include <vector>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/common.hpp"
+
+namespace safetyhook {
+/// @brief A hook that swaps the function pointers stored in slots of memory.
+/// @details Function pointers kept in dispatch arrays, callback structs or jump tables can be hooked by swapping them
+/// for the destination, with no code patching and no trampoline. Each slot is swapped with an atomic exchange, so
+/// threads reading it concurrently see either the original or the destination. Slots in read-only memory are
+/// unprotected for the swap.
+class SAFETYHOOK_API PointerHook final {
+public:
+    /// @brief Error type for PointerHook.
+    struct Error {
+        /// @brief The type of error.
+        enum : uint8_t {
+            NO_SLOTS,            ///< No slots were given.
+            FAILED_TO_UNPROTECT, ///< Failed to unprotect a slot.
+        } type;
+
+        /// @brief Extra information about the error.
+        union {
+            uint8_t* slot; ///< The slot that failed to unprotect.
+        };
+
+        /// @brief Create a NO_SLOTS error.
+        /// @return The new NO_SLOTS error.
+        [[nodiscard]] static Error no_slots() {
+            Error error{};
+            error.type = NO_SLOTS;
+            return error;
+        }
+
+        /// @brief Create a FAILED_TO_UNPROTECT error.
+        /// @param slot The slot that failed to unprotect.
+        /// @return The new FAILED_TO_UNPROTECT error.
+        [[nodiscard]] static Error failed_to_unprotect(uint8_t* slot) {
+            Error error{};
+            error.type = FAILED_TO_UNPROTECT;
+            error.slot = slot;
+            return error;
+        }
+    };
+
+    /// @brief Create a pointer hook.
+    /// @param slot The address of the function pointer to swap.
+    /// @param destination The destination address.
+    /// @return The PointerHook or a PointerHook::Error if an error occurred.
+    [[nodiscard]] static std::expected<PointerHook, Error> create(void* slot, void* destination);
+
+    /// @brief Create a pointer hook.
+    /// @param slot The address of the function pointer to swap.
+    /// @param destination The destination address.
+    /// @return The PointerHook or a PointerHook::Error if an error occurred.
+    template <typename T, typename U>
+    [[nodiscard]] static std::expected<PointerHook, Error> create(T slot, U destination) {
+        return create(reinterpret_cast<void*>(slot), reinterpret_cast<void*>(destination));
+    }
+
+    /// @brief Create a pointer hook on many slots.
+    /// @param slots The addresses of the function pointers to swap.
+    /// @param destination The destination address.
+    /// @return The PointerHook or a PointerHook::Error if an error occurred.
+    /// @details The slots are swapped in one batch: slots sharing a memory region are unprotected once for all of
+    /// them, and regions that are already writable aren't unprotected at all. If a slot fails to unprotect the slots
+    /// swapped so far are restored.
+    [[nodiscard]] static std::expected<PointerHook, Error> create(const std::vector<void*>& slots, void* destination);
+
+    /// @brief Create a pointer hook on many slots.
+    /// @param slots The addresses of the function pointers to swap.
+    /// @param destination The destination address.
+    /// @return The PointerHook or a PointerHook::Error if an error occurred.
+    template <typename T>
+    [[nodiscard]] static std::expected<PointerHook, Error> create(const std::vector<void*>& slots, T destination) {
+        return create(slots, reinterpret_cast<void*>(destination));
+    }
+
+    PointerHook() = default;
+    PointerHook(const PointerHook&) = delete;
+    PointerHook(PointerHook&& other) noexcept;
+    PointerHook& operator=(const PointerHook&) = delete;
+    PointerHook& operator=(PointerHook&& other) noexcept;
+    ~PointerHook();
+
+    /// @brief Reset the hook.
+    /// @details This will put the original pointers back into the slots that still hold the destination. Slots that
+    /// were changed again after the hook are left alone.
+    /// @note This is called automatically in the destructor.
+    void reset();
+
+    /// @brief Get a pointer to the destination.
+    /// @return A pointer to the destination.
+    [[nodiscard]] uint8_t* destination() const { return m_destination; }
+
+    /// @brief Get the number of slots that were hooked.
+    /// @return The number of slots that were hooked.
+    [[nodiscard]] size_t slot_count() const { return m_slots.size(); }
+
+    /// @brief Get the address of a hooked slot.
+    /// @param index The index of the slot, in the order the slots were given.
+    /// @return The address of the slot.
+    [[nodiscard]] uint8_t** slot(size_t index = 0) const { return m_slots[index].address; }
+
+    /// @brief Tests if the hook is valid.
+    /// @return True if the hook is valid, false otherwise.
+    explicit operator bool() const { return !m_slots.empty(); }
+
+    /// @brief Returns the pointer a slot held before it was hooked.
+    /// @tparam T The type of the function pointer.
+    /// @param index The index of the slot, in the order the slots were given.
+    /// @return The original pointer.
+    template <typename T> [[nodiscard]] T original(size_t index = 0) const {
+        return reinterpret_cast<T>(m_slots[index].original);
+    }
+
+    /// @brief Calls the original function of the first slot.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original function.
+    /// @note This function will use the default calling convention set by your compiler.
+    template <typename RetT = void, typename... Args> RetT call(Args... args) {
+        return !m_slots.empty() && m_slots.front().original != nullptr ? original<RetT (*)(Args...)>()(args...)
+                                                                       : RetT();
+    }
+
+    /// @brief Calls the original function of the first slot.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original function.
+    /// @note This function will use the __cdecl calling convention.
+    template <typename RetT = void, typename... Args> RetT ccall(Args... args) {
+        return !m_slots.empty() && m_slots.front().original != nullptr
+                   ? original<RetT(SAFETYHOOK_CCALL*)(Args...)>()(args...)
+                   : RetT();
+    }
+
+    /// @brief Calls the original function of the first slot.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original function.
+    /// @note This function will use the __thiscall calling convention.
+#if SAFETYHOOK_COMPILER_GCC
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#endif
+    template <typename RetT = void, typename... Args> RetT thiscall(Args... args) {
+        return !m_slots.empty() && m_slots.front().original != nullptr
+                   ? original<RetT(SAFETYHOOK_THISCALL*)(Args...)>()(args...)
+                   : RetT();
+    }
+#if SAFETYHOOK_COMPILER_GCC
+#pragma GCC diagnostic pop
+#endif
+
+    /// @brief Calls the original function of the first slot.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original function.
+    /// @note This function will use the __stdcall calling convention.
+    template <typename RetT = void, typename... Args> RetT stdcall(Args... args) {
+        return !m_slots.empty() && m_slots.front().original != nullptr
+                   ? original<RetT(SAFETYHOOK_STDCALL*)(Args...)>()(args...)
+                   : RetT();
+    }
+
+    /// @brief Calls the original function of the first slot.
+    /// @tparam RetT The return type of the function.
+    /// @tparam ...Args The argument types of the function.
+    /// @param ...args The arguments to pass to the function.
+    /// @return The result of calling the original function.
+    /// @note This function will use the __fastcall calling convention.
+    template <typename RetT = void, typename... Args> RetT fastcall(Args... args) {
+        return !m_slots.empty() && m_slots.front().original != nullptr
+                   ? original<RetT(SAFETYHOOK_FASTCALL*)(Args...)>()(args...)
+                   : RetT();
+    }
+
+private:
+    struct Slot {
+        uint8_t** address{};
+        uint8_t* original{};
+    };
+
+    std::vector<Slot> m_slots{};
+    uint8_t* m_destination{};
+
+    void destroy();
+};
+} // namespace safetyhook
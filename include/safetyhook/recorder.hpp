@@ -0,0 +1,123 @@
+/// @file safetyhook/recorder.hpp
+/// @brief Lock-free buffer of register snapshots written by record-only MidHooks.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/context.hpp"
+
+namespace safetyhook {
+class MidHook;
+
+/// @brief Collects the records written by record-only MidHooks (see MidHook::create_record_only).
+/// @details Records are written by the hooked threads into one ring buffer per CPU, selected with rdtscp. Writers
+/// reserve a slot with a single atomic add and never wait, so a full ring overwrites its oldest records. A single
+/// consumer at a time drains the rings with Recorder::drain, typically on a background thread.
+/// @note Requires a CPU with rdtscp. The CPU number is taken from the low 12 bits of IA32_TSC_AUX, which both
+/// Windows and Linux set to the current processor.
+class SAFETYHOOK_API Recorder final {
+public:
+    /// @brief The error type returned by Recorder::create.
+    enum class Error : uint8_t {
+        BAD_CAPACITY,   ///< The capacity or the number of lanes is invalid.
+        BAD_ALLOCATION, ///< Allocating the ring buffers failed.
+    };
+
+    /// @brief A snapshot written by a record-only MidHook.
+    struct Record {
+        uint64_t timestamp; ///< The time stamp counter when the hook was hit.
+        uint32_t hook_id;   ///< The id the hook was created with.
+        uint16_t cpu;       ///< The CPU the hook was hit on.
+        uint16_t registers; ///< Bit mask of the registers that were recorded (see Recorder::register_mask).
+
+        /// @brief The recorded register values indexed by Register. Registers that weren't recorded are zero.
+        /// @note The stack pointer is the value at the hooked instruction.
+        uintptr_t values[sizeof(uintptr_t) * 2];
+    };
+
+    /// @brief Creates a new Recorder.
+    /// @param capacity The number of records each lane can hold. Rounded up to a power of two.
+    /// @param lanes The number of ring buffers. CPUs share lanes when there are fewer lanes than CPUs. Rounded up to
+    /// a power of two. Defaults to one per hardware thread.
+    /// @return The new Recorder or a Recorder::Error if an error occurred.
+    [[nodiscard]] static std::expected<std::shared_ptr<Recorder>, Error> create(size_t capacity, size_t lanes = 0);
+
+    /// @brief Builds a mask of registers to record.
+    /// @param registers The registers to record.
+    /// @return The mask to pass to MidHook::create_record_only.
+    [[nodiscard]] static constexpr uint16_t register_mask(std::initializer_list<Register> registers) {
+        uint16_t mask{};
+
+        for (auto reg : registers) {
+            mask |= static_cast<uint16_t>(1u << static_cast<uint8_t>(reg));
+        }
+
+        return mask;
+    }
+
+    /// @brief A mask that records every general purpose register.
+    static constexpr uint16_t ALL_REGISTERS = static_cast<uint16_t>((1u << (sizeof(uintptr_t) * 2)) - 1);
+
+    Recorder(const Recorder&) = delete;
+    Recorder(Recorder&&) noexcept = delete;
+    Recorder& operator=(const Recorder&) = delete;
+    Recorder& operator=(Recorder&&) noexcept = delete;
+    ~Recorder();
+
+    /// @brief Hands every record written since the last drain to a function, one lane at a time.
+    /// @param fn The function to call for each record.
+    /// @return The number of records passed to fn.
+    /// @note Records are in order within a lane. Sort by Record::timestamp to merge lanes.
+    /// @note A record that is still being written stops the drain of its lane until the next call.
+    size_t drain(const std::function<void(const Record&)>& fn);
+
+    /// @brief Returns the number of records that were overwritten before they could be drained.
+    /// @return The number of records lost so far.
+    [[nodiscard]] uint64_t dropped() const;
+
+    /// @brief Returns the number of records each lane can hold.
+    /// @return The capacity of a lane.
+    [[nodiscard]] size_t capacity() const { return m_capacity; }
+
+    /// @brief Returns the number of lanes.
+    /// @return The number of lanes.
+    [[nodiscard]] size_t lanes() const { return m_lane_count; }
+
+private:
+    friend MidHook;
+
+    // A lane is a LANE_HEADER_SIZE byte header holding the next write position followed by capacity cells. A cell's
+    // sequence is zero while it's being written and the write position plus one once its record is complete.
+    struct Cell {
+        uintptr_t sequence;
+        Record record;
+    };
+
+    static constexpr size_t LANE_HEADER_SIZE = 64;
+
+    uint8_t* m_memory{};
+    size_t m_capacity{};
+    size_t m_lane_count{};
+    size_t m_lane_size{};
+    std::vector<uintptr_t> m_read_positions{};
+    uint64_t m_dropped{};
+    mutable std::mutex m_mutex{};
+
+    Recorder() = default;
+
+    [[nodiscard]] uint8_t* lane(size_t index) const { return m_memory + index * m_lane_size; }
+};
+} // namespace safetyhook
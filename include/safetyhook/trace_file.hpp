@@ -0,0 +1,253 @@
+/// @file safetyhook/trace_file.hpp
+/// @brief A binary trace format written to memory mapped files, and its reader.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/os.hpp"
+
+namespace safetyhook {
+/// @brief A file of hook events, written through a shared memory mapping.
+/// @details The file starts with a Header and a table of hook names, followed by segment_count segments of
+/// segment_size bytes. A Writer claims a free segment, takes the next sequence number for it and appends Records to
+/// it, publishing each one by advancing the segment's used count. When the segment is full it releases it and claims
+/// the segment the next sequence number maps to, so the file is a ring of segments that always holds the most recent
+/// events. Writing never blocks, allocates or makes a system call: a writer that finds no free segment drops the event.
+///
+/// Since the mapping is shared with the file, the events written before a crash are in the file once the process is
+/// gone, and a TraceFileReader can read them while they're written, from this process or another one.
+///
+/// All the integers are in the byte order of the machine that wrote the file (little endian on x86).
+class SAFETYHOOK_API TraceFile final {
+public:
+    /// @brief The error type returned by TraceFile::create.
+    enum class Error : uint8_t {
+        BAD_SIZE,      ///< The segment size or count is invalid.
+        FAILED_TO_MAP, ///< The file couldn't be created or mapped.
+    };
+
+    /// @brief The first bytes of the file.
+    static constexpr char MAGIC[8] = {'S', 'H', 'T', 'R', 'A', 'C', 'E', '\0'};
+
+    /// @brief The version of the format, changed whenever the layout changes.
+    static constexpr uint32_t VERSION = 1;
+
+    /// @brief The size of the header and the table of names, before the first segment.
+    static constexpr uint32_t HEADER_SIZE = 0x10000;
+
+    /// @brief The maximum number of payload words in a record.
+    static constexpr size_t MAX_PAYLOAD = 32;
+
+    /// @brief The header at the start of the file.
+    struct Header {
+        char magic[8];                ///< MAGIC.
+        uint32_t version;             ///< VERSION.
+        uint32_t header_size;         ///< The offset of the first segment.
+        uint32_t segment_size;        ///< The size of a segment, including its SegmentHeader.
+        uint32_t segment_count;       ///< The number of segments.
+        uint32_t names_offset;        ///< The offset of the table of names.
+        uint32_t names_size;          ///< The size of the table of names.
+        uint64_t start_timestamp;     ///< The time stamp counter when the file was created.
+        double ticks_per_microsecond; ///< The number of time stamp counter ticks per microsecond.
+        uint64_t next_sequence;       ///< The last sequence number given to a segment.
+        uint64_t dropped;             ///< The number of records dropped because no segment was free.
+        uint32_t names_used;          ///< The number of bytes of the table of names in use.
+        uint32_t reserved;
+    };
+
+    /// @brief A name in the table of names: its hook id and length, followed by the name padded to 4 bytes.
+    struct NameEntry {
+        uint32_t hook_id; ///< The hook id.
+        uint32_t length;  ///< The length of the name.
+    };
+
+    /// @brief The header at the start of each segment.
+    struct SegmentHeader {
+        uint64_t sequence;  ///< The sequence number of the segment, or 0 while it's unused or being claimed.
+        uint32_t thread_id; ///< The thread that writes the segment (see current_thread_id).
+        uint32_t used;      ///< The number of bytes of records after the header.
+        uint32_t writing;   ///< 1 while a writer owns the segment.
+        uint8_t reserved[44];
+    };
+
+    /// @brief An event, followed by payload_count 64-bit payload words.
+    struct Record {
+        uint64_t timestamp;    ///< The time stamp counter when the event happened.
+        uint32_t hook_id;      ///< The hook that wrote the event. The table of names can name it.
+        uint8_t type;          ///< The kind of event. Tracers write Tracer::Event::Type values.
+        uint8_t payload_count; ///< The number of payload words that follow.
+        uint16_t reserved;
+    };
+
+    /// @brief Appends records to the file. Each thread writing to the file needs its own Writer.
+    class SAFETYHOOK_API Writer final {
+    public:
+        Writer() = default;
+
+        /// @brief Creates a writer for the calling thread.
+        /// @param file The file to write to. The writer keeps it open.
+        explicit Writer(std::shared_ptr<TraceFile> file);
+
+        Writer(const Writer&) = delete;
+        Writer(Writer&& other) noexcept;
+        Writer& operator=(const Writer&) = delete;
+        Writer& operator=(Writer&& other) noexcept;
+
+        /// @brief Releases the segment being written.
+        ~Writer();
+
+        /// @brief Appends a record, timestamped with the time stamp counter.
+        /// @param hook_id The hook id.
+        /// @param type The kind of event.
+        /// @param payload Up to MAX_PAYLOAD words, such as registers or arguments.
+        /// @return false if the record was dropped.
+        bool write(uint32_t hook_id, uint8_t type, std::span<const uint64_t> payload = {});
+
+        /// @brief Appends a record with a given timestamp.
+        /// @param timestamp The time stamp counter when the event happened.
+        /// @param hook_id The hook id.
+        /// @param type The kind of event.
+        /// @param payload Up to MAX_PAYLOAD words, such as registers or arguments.
+        /// @return false if the record was dropped.
+        bool write_at(uint64_t timestamp, uint32_t hook_id, uint8_t type, std::span<const uint64_t> payload = {});
+
+        /// @brief Tests if the writer has a file.
+        explicit operator bool() const { return m_file != nullptr; }
+
+    private:
+        std::shared_ptr<TraceFile> m_file{};
+        SegmentHeader* m_segment{};
+        uint32_t m_used{};
+        uint32_t m_thread_id{};
+
+        bool rotate();
+        void release();
+    };
+
+    /// @brief Creates (or replaces) a trace file and maps it.
+    /// @param path The file.
+    /// @param segment_size The size of a segment, a multiple of 4 KiB up to 1 GiB.
+    /// @param segment_count The number of segments, at least 2. More segments let more threads write at the same time.
+    /// @return The TraceFile or a TraceFile::Error if an error occurred.
+    /// @note This waits 10 ms to measure the time stamp counter frequency.
+    [[nodiscard]] static std::expected<std::shared_ptr<TraceFile>, Error> create(
+        const std::filesystem::path& path, size_t segment_size = 0x100000, size_t segment_count = 64);
+
+    TraceFile(const TraceFile&) = delete;
+    TraceFile(TraceFile&&) noexcept = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+    TraceFile& operator=(TraceFile&&) noexcept = delete;
+
+    /// @brief Measures the time stamp counter frequency again, flushes and unmaps the file.
+    ~TraceFile();
+
+    /// @brief Adds a name for a hook id to the table of names.
+    /// @param hook_id The hook id.
+    /// @param name The name.
+    /// @return false if the table is full.
+    bool set_name(uint32_t hook_id, std::string_view name);
+
+    /// @brief Starts writing the records to the disk without waiting for it. The operating system does it anyway,
+    /// this only makes it happen sooner.
+    void flush();
+
+    /// @brief Returns the number of records dropped because no segment was free.
+    [[nodiscard]] uint64_t dropped() const;
+
+    /// @brief Returns the size of a segment.
+    [[nodiscard]] size_t segment_size() const { return header().segment_size; }
+
+    /// @brief Returns the number of segments.
+    [[nodiscard]] size_t segment_count() const { return header().segment_count; }
+
+private:
+    FileMapping m_mapping{};
+    std::chrono::steady_clock::time_point m_start_time{};
+    std::mutex m_names_mutex{};
+
+    TraceFile() = default;
+
+    [[nodiscard]] Header& header() const { return *reinterpret_cast<Header*>(m_mapping.address); }
+    [[nodiscard]] SegmentHeader& segment(size_t index) const;
+    void measure_ticks_per_microsecond();
+};
+
+/// @brief Reads the records of a trace file, whether it's complete, left behind by a crash or still being written.
+/// @details Each call to read hands over the records written since the previous one, segment by segment in sequence
+/// order. A segment that was reused after it was read starts over, and the records that were overwritten before they
+/// could be read are lost.
+class SAFETYHOOK_API TraceFileReader final {
+public:
+    /// @brief The error type returned by TraceFileReader::open.
+    enum class Error : uint8_t {
+        FAILED_TO_MAP,       ///< The file couldn't be opened or mapped.
+        BAD_FORMAT,          ///< The file isn't a trace file or is truncated.
+        UNSUPPORTED_VERSION, ///< The file was written with another version of the format.
+    };
+
+    /// @brief A record.
+    struct Event {
+        uint64_t sequence;                 ///< The sequence number of the segment the record is in.
+        uint64_t timestamp;                ///< The time stamp counter when the event happened.
+        uint32_t thread_id;                ///< The thread that wrote the record.
+        uint32_t hook_id;                  ///< The hook that wrote the record.
+        uint8_t type;                      ///< The kind of event.
+        std::span<const uint64_t> payload; ///< The payload words. Only valid while the event is handled.
+    };
+
+    /// @brief Opens and maps a trace file.
+    /// @param path The file.
+    /// @return The TraceFileReader or a TraceFileReader::Error if an error occurred.
+    [[nodiscard]] static std::expected<TraceFileReader, Error> open(const std::filesystem::path& path);
+
+    TraceFileReader(const TraceFileReader&) = delete;
+    TraceFileReader(TraceFileReader&& other) noexcept;
+    TraceFileReader& operator=(const TraceFileReader&) = delete;
+    TraceFileReader& operator=(TraceFileReader&& other) noexcept;
+    ~TraceFileReader();
+
+    /// @brief Hands the records written since the last read to a function.
+    /// @param fn The function to call for each record.
+    /// @return The number of records passed to fn.
+    /// @note Records are in order within a thread. Sort by Event::timestamp to merge threads.
+    size_t read(const std::function<void(const Event&)>& fn);
+
+    /// @brief Returns the file's header.
+    [[nodiscard]] const TraceFile::Header& header() const {
+        return *reinterpret_cast<const TraceFile::Header*>(m_mapping.address);
+    }
+
+    /// @brief Returns the names in the table of names, by hook id.
+    [[nodiscard]] std::map<uint32_t, std::string> names() const;
+
+private:
+    struct Cursor {
+        uint64_t sequence;
+        uint32_t offset;
+    };
+
+    FileMapping m_mapping{};
+    std::vector<Cursor> m_cursors{};
+    std::vector<uint8_t> m_records{};
+
+    explicit TraceFileReader(FileMapping mapping);
+};
+} // namespace safetyhook
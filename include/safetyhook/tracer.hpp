@@ -0,0 +1,261 @@
+/// @file safetyhook/tracer.hpp
+/// @brief Function entry and exit tracing built on inline hooks.
+
+#pragma once
+
+#ifndef SAFETYHOOK_USE_CXXMODULES
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#else
+import std.compat;
+#endif
+
+#include "safetyhook/allocator.hpp"
+#include "safetyhook/common.hpp"
+#include "safetyhook/inline_hook.hpp"
+#include "safetyhook/trace_file.hpp"
+
+namespace safetyhook {
+struct TraceBuffer;
+
+/// @brief Traces the entries to and exits from a set of functions.
+/// @details Every target gets an InlineHook whose destination is a generated thunk. The thunk records an enter event
+/// with the time stamp counter, swaps the return address for a shared exit stub and continues to the original
+/// function. The exit stub records the exit event and returns to the caller. Events go to a ring buffer per thread,
+/// which the thread allocates the first time it enters a target and then writes without locking or allocating. They
+/// are read with Tracer::drain, or by a flush thread started with Tracer::start_flushing. A full buffer drops events.
+/// A tracer created with a TraceFile writes the events to the file instead, through a TraceFile::Writer per thread.
+/// @note Calls aren't traced past MAX_DEPTH nested calls on a thread, nor while the thread allocates its buffer. The
+/// targets must return normally: throwing an exception or calling longjmp through a traced call loses its exit event
+/// and the stack can't be unwound through the swapped return address.
+class SAFETYHOOK_API Tracer final {
+public:
+    /// @brief Error type for Tracer.
+    struct Error {
+        /// @brief The type of error.
+        enum : uint8_t {
+            BAD_CAPACITY,     ///< The capacity is invalid.
+            BAD_ALLOCATION,   ///< An error occurred when allocating the thunks or the exit stub.
+            TOO_MANY_TRACERS, ///< MAX_TRACERS tracers already exist.
+            BAD_INLINE_HOOK,  ///< An error occurred when hooking a target.
+        } type;
+
+        /// @brief Extra information about the error.
+        union {
+            Allocator::Error allocator_error;    ///< Allocator error information.
+            InlineHook::Error inline_hook_error; ///< InlineHook error information.
+        };
+
+        /// @brief The target that couldn't be hooked, for BAD_INLINE_HOOK.
+        uint8_t* target;
+
+        /// @brief Create a BAD_CAPACITY error.
+        /// @return The new BAD_CAPACITY error.
+        [[nodiscard]] static Error bad_capacity() {
+            Error error{};
+            error.type = BAD_CAPACITY;
+            return error;
+        }
+
+        /// @brief Create a BAD_ALLOCATION error.
+        /// @param err The Allocator::Error that failed.
+        /// @return The new BAD_ALLOCATION error.
+        [[nodiscard]] static Error bad_allocation(Allocator::Error err) {
+            Error error{};
+            error.type = BAD_ALLOCATION;
+            error.allocator_error = err;
+            return error;
+        }
+
+        /// @brief Create a TOO_MANY_TRACERS error.
+        /// @return The new TOO_MANY_TRACERS error.
+        [[nodiscard]] static Error too_many_tracers() {
+            Error error{};
+            error.type = TOO_MANY_TRACERS;
+            return error;
+        }
+
+        /// @brief Create a BAD_INLINE_HOOK error.
+        /// @param err The InlineHook::Error that failed.
+        /// @param target The target that couldn't be hooked.
+        /// @return The new BAD_INLINE_HOOK error.
+        [[nodiscard]] static Error bad_inline_hook(InlineHook::Error err, uint8_t* target) {
+            Error error{};
+            error.type = BAD_INLINE_HOOK;
+            error.inline_hook_error = err;
+            error.target = target;
+            return error;
+        }
+    };
+
+    /// @brief A function to trace.
+    struct Target {
+        void* address;    ///< The address of the function.
+        std::string name; ///< The name of the function. Looked up with symbol_query when empty.
+    };
+
+    /// @brief An enter or exit event.
+    struct Event {
+        /// @brief The kind of event.
+        enum Type : uint8_t {
+            ENTER, ///< The thread entered the target.
+            EXIT,  ///< The target returned.
+        };
+
+        uint64_t timestamp; ///< The time stamp counter when the event happened.
+        uint32_t thread_id; ///< The id of the thread (see current_thread_id).
+        uint32_t target;    ///< The index of the target in the vector passed to Tracer::create.
+        Type type;          ///< The kind of event.
+    };
+
+    /// @brief The maximum number of tracers that can exist at the same time.
+    static constexpr size_t MAX_TRACERS = 16;
+
+    /// @brief The maximum number of nested traced calls per thread.
+    static constexpr size_t MAX_DEPTH = 64;
+
+    /// @brief Creates a new Tracer and hooks its targets.
+    /// @param targets The functions to trace.
+    /// @param capacity The number of events each thread's buffer can hold. Rounded up to a power of two.
+    /// @return The Tracer or a Tracer::Error if an error occurred.
+    /// @note This will use the default global Allocator.
+    [[nodiscard]] static std::expected<std::shared_ptr<Tracer>, Error> create(
+        const std::vector<Target>& targets, size_t capacity = 0x10000);
+
+    /// @brief Creates a new Tracer with a given Allocator and hooks its targets.
+    /// @param allocator The allocator to use.
+    /// @param targets The functions to trace.
+    /// @param capacity The number of events each thread's buffer can hold. Rounded up to a power of two.
+    /// @return The Tracer or a Tracer::Error if an error occurred.
+    [[nodiscard]] static std::expected<std::shared_ptr<Tracer>, Error> create(
+        const std::shared_ptr<Allocator>& allocator, const std::vector<Target>& targets, size_t capacity = 0x10000);
+
+    /// @brief Creates a new Tracer that writes its events to a trace file and hooks its targets.
+    /// @param file The file. The hook id of an event is the index of its target, and the names of the targets are
+    /// added to the file's table of names, so a file should only be written by one tracer.
+    /// @param targets The functions to trace.
+    /// @return The Tracer or a Tracer::Error if an error occurred.
+    /// @note This will use the default global Allocator. The events aren't drained, and the ones dropped are counted
+    /// by TraceFile::dropped.
+    [[nodiscard]] static std::expected<std::shared_ptr<Tracer>, Error> create(
+        const std::shared_ptr<TraceFile>& file, const std::vector<Target>& targets);
+
+    Tracer(const Tracer&) = delete;
+    Tracer(Tracer&&) noexcept = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    Tracer& operator=(Tracer&&) noexcept = delete;
+
+    /// @brief Unhooks the targets and stops the flush thread, which drains the remaining events first.
+    /// @details The calling thread's buffer is freed, releasing its TraceFile::Writer. Other threads free theirs the
+    /// next time they enter a traced function or when they exit, until then they keep the trace file open.
+    ~Tracer();
+
+    /// @brief Hands every event written since the last drain to a function, one thread at a time.
+    /// @param fn The function to call for each event.
+    /// @return The number of events passed to fn.
+    /// @note Events are in order within a thread. Sort by Event::timestamp to merge threads.
+    size_t drain(const std::function<void(const Event&)>& fn);
+
+    /// @brief Starts a thread that drains the events to a function periodically.
+    /// @param fn The function to call for each event, on the flush thread.
+    /// @param interval The time between drains.
+    /// @note Does nothing if the flush thread is already running.
+    void start_flushing(std::function<void(const Event&)> fn,
+        std::chrono::milliseconds interval = std::chrono::milliseconds{10});
+
+    /// @brief Stops the flush thread after a last drain.
+    void stop_flushing();
+
+    /// @brief Returns the number of events that were dropped because a buffer was full.
+    [[nodiscard]] uint64_t dropped() const;
+
+    /// @brief Returns the number of events each thread's buffer can hold, or 0 for a tracer that writes to a file.
+    [[nodiscard]] size_t capacity() const { return m_capacity; }
+
+    /// @brief Returns the names of the targets, in the order they were passed to Tracer::create.
+    [[nodiscard]] const std::vector<std::string>& names() const { return m_names; }
+
+    /// @brief Returns the number of time stamp counter ticks per microsecond.
+    /// @details Measured against the steady clock since the tracer was created, waiting for at least 10 ms to pass.
+    [[nodiscard]] double ticks_per_microsecond() const;
+
+    /// @brief Returns the time stamp counter when the tracer was created.
+    [[nodiscard]] uint64_t start_timestamp() const { return m_start_timestamp; }
+
+private:
+    friend struct TraceThread;
+
+    uint32_t m_key{};
+    Allocation m_thunks{};
+    std::vector<InlineHook> m_hooks{};
+    std::vector<std::string> m_names{};
+    size_t m_capacity{};
+    uint64_t m_start_timestamp{};
+    std::chrono::steady_clock::time_point m_start_time{};
+
+    // Buffers of the threads that exited, guarded by the tracer registry's mutex.
+    std::vector<std::unique_ptr<TraceBuffer>> m_exited_buffers{};
+    uint64_t m_exited_dropped{};
+
+    std::mutex m_drain_mutex{};
+    std::thread m_flush_thread{};
+    std::mutex m_flush_mutex{};
+    std::condition_variable m_flush_cv{};
+    bool m_flushing{};
+
+    Tracer() = default;
+
+    [[nodiscard]] static std::expected<std::shared_ptr<Tracer>, Error> create(
+        const std::shared_ptr<Allocator>& allocator, const std::vector<Target>& targets, size_t capacity,
+        const std::shared_ptr<TraceFile>& file);
+};
+
+/// @brief Writes events as a Chrome trace (the JSON array format of the Trace Event Format).
+/// @details The output opens in chrome://tracing and Perfetto. Enter and exit events become duration begin and end
+/// events, with timestamps in microseconds since the tracer was created.
+class SAFETYHOOK_API ChromeTraceWriter final {
+public:
+    /// @brief Starts a trace.
+    /// @param out The stream to write to.
+    /// @param tracer The tracer the events come from.
+    ChromeTraceWriter(std::ostream& out, const Tracer& tracer);
+
+    /// @brief Starts a trace of events that come from elsewhere, such as a TraceFileReader.
+    /// @param out The stream to write to.
+    /// @param names The names of the targets, by index.
+    /// @param start_timestamp The time stamp counter timestamps are relative to.
+    /// @param ticks_per_microsecond The number of time stamp counter ticks per microsecond.
+    ChromeTraceWriter(std::ostream& out, const std::vector<std::string>& names, uint64_t start_timestamp,
+        double ticks_per_microsecond);
+    ChromeTraceWriter(const ChromeTraceWriter&) = delete;
+    ChromeTraceWriter& operator=(const ChromeTraceWriter&) = delete;
+
+    /// @brief Calls finish.
+    ~ChromeTraceWriter();
+
+    /// @brief Writes an event.
+    /// @param event The event.
+    void write(const Tracer::Event& event);
+
+    /// @brief Ends the trace. Writing after this does nothing.
+    void finish();
+
+private:
+    std::ostream* m_out;
+    std::vector<std::string> m_names{};
+    uint64_t m_start_timestamp{};
+    double m_ticks_per_microsecond{};
+    bool m_first{true};
+    bool m_finished{};
+};
+} // namespace safetyhook
@@ -4,9 +4,12 @@
 #pragma once
 
 #ifndef SAFETYHOOK_USE_CXXMODULES
+#include <algorithm>
 #include <cstdint>
 #include <expected>
-#include <unordered_map>
+#include <memory>
+#include <span>
+#include <vector>
 #else
 import std.compat;
 #endif
@@ -26,6 +29,9 @@ constexpr size_t VMT_HEADER = 2; // offset-to-top + RTTI ptr
 constexpr size_t VMT_HEADER = 0;
 #endif
 
+struct VmtClone;
+class VmtObjectTable;
+
 /// @brief A hook class that allows for hooking a single method in a VMT.
 class SAFETYHOOK_API VmHook final {
 public:
@@ -102,8 +108,8 @@ private:
     uint8_t* m_new_vm{};
     uint8_t** m_vmt_entry{};
 
-    // This keeps the allocation alive until the hook is destroyed.
-    std::shared_ptr<Allocation> m_new_vmt_allocation{};
+    // This keeps the cloned VMT alive until the hook is destroyed.
+    std::shared_ptr<VmtClone> m_vmt{};
 
     void destroy();
 };
@@ -115,7 +121,10 @@ public:
     struct Error {
         /// @brief The type of error.
         enum : uint8_t {
-            BAD_ALLOCATION, ///< An error occurred while allocating memory.
+            BAD_ALLOCATION,            ///< An error occurred while allocating memory.
+            METHOD_ALREADY_HOOKED,     ///< The method is hooked with a different function in a shared VMT.
+            FAILED_TO_UNPROTECT,       ///< Failed to unprotect the original VMT.
+            DESTRUCTOR_INDEX_MISMATCH, ///< untrack_on_destroy was given another destructor for a shared VMT.
         } type;
 
         /// @brief Extra error information.
@@ -132,12 +141,52 @@ public:
             error.allocator_error = err;
             return error;
         }
+
+        /// @brief Create a METHOD_ALREADY_HOOKED error.
+        /// @return The new METHOD_ALREADY_HOOKED error.
+        [[nodiscard]] static Error method_already_hooked() {
+            Error error{};
+            error.type = METHOD_ALREADY_HOOKED;
+            return error;
+        }
+
+        /// @brief Create a FAILED_TO_UNPROTECT error.
+        /// @return The new FAILED_TO_UNPROTECT error.
+        [[nodiscard]] static Error failed_to_unprotect() {
+            Error error{};
+            error.type = FAILED_TO_UNPROTECT;
+            return error;
+        }
+
+        /// @brief Create a DESTRUCTOR_INDEX_MISMATCH error.
+        /// @return The new DESTRUCTOR_INDEX_MISMATCH error.
+        [[nodiscard]] static Error destructor_index_mismatch() {
+            Error error{};
+            error.type = DESTRUCTOR_INDEX_MISMATCH;
+            return error;
+        }
+    };
+
+    /// @brief Flags for VmtHook.
+    enum Flags : int {
+        Default = 0,         ///< Default flags.
+        ShareClone = 1 << 0, ///< Share the cloned VMT with the other VmtHooks created with ShareClone for the VMT.
+        InPlace = 1 << 1,    ///< Hook methods in the original VMT, for every object of the class, instead of a clone.
     };
 
     /// @brief Creates a new VmtHook object. Will clone the VMT of the given object and replace it.
     /// @param object The object to hook.
+    /// @param flags The flags to use.
     /// @return The VmtHook object or a VmtHook::Error if an error occurred.
-    [[nodiscard]] static std::expected<VmtHook, Error> create(void* object);
+    /// @details With ShareClone, hooks for objects of the same class reuse one cloned VMT so hooking another object
+    /// only costs a vptr store. Methods of a shared VMT are hooked for all of its objects: hooking a method again with
+    /// the same function shares the hook, which stays in place until the last VmHook for it is destroyed, while a
+    /// different function fails with METHOD_ALREADY_HOOKED.
+    /// @details With InPlace, nothing is cloned and the object's VMT is left alone. Hooking a method patches the entry
+    /// in the original VMT (which usually lives in read-only memory) with an atomic store, hooking every object of the
+    /// class at once, and destroying the VmHook puts the original entry back. Objects aren't tracked so apply and
+    /// remove do nothing. InPlace VmtHooks for the same VMT share their hooks like ShareClone.
+    [[nodiscard]] static std::expected<VmtHook, Error> create(void* object, Flags flags = Default);
 
     VmtHook() = default;
     VmtHook(const VmtHook&) = delete;
@@ -149,39 +198,60 @@ public:
     /// @brief Applies the hook.
     /// @param object The object to apply the hook to.
     /// @note This will replace the VMT of the object with the new VMT. You can apply the hook to multiple objects.
+    /// @note Applying and removing the hook is thread safe. The vptr is replaced with an atomic compare-and-swap.
     void apply(void* object);
 
+    /// @brief Applies the hook to many objects at once.
+    /// @param objects The objects to apply the hook to.
+    /// @note This takes each lock of the object tracking once rather than once per object.
+    void apply(std::span<void* const> objects);
+
     /// @brief Removes the hook.
     /// @param object The object to remove the hook from.
     void remove(void* object);
 
+    /// @brief Removes the hook from many objects at once.
+    /// @param objects The objects to remove the hook from.
+    void remove(std::span<void* const> objects);
+
     /// @brief Removes the hook from all objects.
     void reset();
 
+    /// @brief Stops tracking objects when they are destroyed.
+    /// @param destructor_index The index of the virtual destructor.
+    /// @return Nothing or a VmtHook::Error if an error occurred. DESTRUCTOR_INDEX_MISMATCH if another VmtHook sharing
+    /// the cloned VMT untracks objects with a different destructor_index.
+    /// @details This wraps the destructor entries of the cloned VMT (the complete and deleting destructors on Itanium,
+    /// the deleting destructor on MSVC) so an object is removed from the hook and gets its original VMT back as it is
+    /// destroyed. Only the first VMT of an object is cloned, deleting it through a secondary base class isn't seen.
+    [[nodiscard]] std::expected<void, Error> untrack_on_destroy(size_t destructor_index = 0);
+
     /// @brief Hooks a method in the VMT.
     /// @param index The index of the method to hook.
     /// @param new_function The new function to use.
     template <typename T> [[nodiscard]] std::expected<VmHook, Error> hook_method(size_t index, T new_function) {
-        VmHook hook{};
+        // Member function pointers can be larger than a pointer, the address comes first.
+        uint8_t* new_vm{};
+        std::copy_n(reinterpret_cast<const uint8_t*>(&new_function), sizeof(new_vm),
+            reinterpret_cast<uint8_t*>(&new_vm));
 
-        index += VMT_HEADER; // Skip RTTI header.
-        hook.m_original_vm = m_new_vmt[index];
-        store(reinterpret_cast<uint8_t*>(&hook.m_new_vm), new_function);
-        hook.m_vmt_entry = &m_new_vmt[index];
-        hook.m_new_vmt_allocation = m_new_vmt_allocation;
-        m_new_vmt[index] = hook.m_new_vm;
-
-        return hook;
+        return hook_vm(index, new_vm);
     }
 
 private:
-    // Map of object instance to their original VMT.
-    std::unordered_map<void*, uint8_t**> m_objects{};
+    // Object instances and their original VMTs.
+    std::shared_ptr<VmtObjectTable> m_objects{};
 
-    // The allocation is a shared_ptr, so it can be shared with VmHooks to ensure the memory is kept alive.
-    std::shared_ptr<Allocation> m_new_vmt_allocation{};
+    // The clone is a shared_ptr, so it can be shared with VmHooks (and other VmtHooks when it is shared) to ensure
+    // the memory is kept alive.
+    std::shared_ptr<VmtClone> m_vmt{};
     uint8_t** m_new_vmt{};
 
+    // Hooks on the destructor entries when untracking objects on destruction.
+    std::vector<VmHook> m_destructor_hooks{};
+
+    [[nodiscard]] std::expected<VmHook, Error> hook_vm(size_t index, uint8_t* new_vm);
+    void stop_untracking();
     void destroy();
 };
 } // namespace safetyhook
@@ -11,30 +11,68 @@ export {
     using safetyhook::Allocation;
     using safetyhook::Allocator;
 
+    // call_site_hook.hpp
+    using safetyhook::CallSiteHook;
+
+    // call_site_scanner.hpp
+    using safetyhook::find_call_sites;
+
     // context.hpp
     using safetyhook::Context;
     using safetyhook::Context32;
     using safetyhook::Context64;
+    using safetyhook::extended_state_layout;
+    using safetyhook::ExtendedStateLayout;
+    using safetyhook::Register;
     using safetyhook::Xmm;
+    using safetyhook::Ymm;
+    using safetyhook::Zmm;
 
     // easy.hpp
+    using safetyhook::create_call_site;
+    using safetyhook::create_import;
     using safetyhook::create_inline;
     using safetyhook::create_mid;
+    using safetyhook::create_pointer;
     using safetyhook::create_vm;
     using safetyhook::create_vmt;
 
+    // import_hook.hpp
+    using safetyhook::ImportHook;
+
     // inline_hook.hpp
     using safetyhook::InlineHook;
 
+    // latency.hpp
+    using safetyhook::LatencyHistogram;
+    using safetyhook::LatencyProbe;
+
+    // metrics.hpp
+    using safetyhook::Metrics;
+    using safetyhook::metrics;
+    using safetyhook::reset_metrics;
+
     // mid_hook.hpp
     using safetyhook::MidHook;
     using safetyhook::MidHookFn;
 
     // os.hpp
+    using safetyhook::current_thread_id;
+    using safetyhook::file_flush;
+    using safetyhook::file_map;
+    using safetyhook::file_unmap;
+    using safetyhook::FileMapping;
     using safetyhook::fix_ip;
     using safetyhook::OsError;
+    using safetyhook::symbol_query;
+    using safetyhook::SymbolInfo;
     using safetyhook::system_info;
     using safetyhook::SystemInfo;
+    using safetyhook::THREAD_SEGMENT_PREFIX;
+    using safetyhook::THREAD_SELF_OFFSET;
+    using safetyhook::thread_slot_allocate;
+    using safetyhook::thread_slot_free;
+    using safetyhook::thread_slot_get;
     using safetyhook::ThreadContext;
     using safetyhook::trap_threads;
     using safetyhook::VM_ACCESS_R;
@@ -51,6 +89,20 @@ export {
     using safetyhook::VmAccess;
     using safetyhook::VmBasicInfo;
 
+    // pointer_hook.hpp
+    using safetyhook::PointerHook;
+
+    // recorder.hpp
+    using safetyhook::Recorder;
+
+    // trace_file.hpp
+    using safetyhook::TraceFile;
+    using safetyhook::TraceFileReader;
+
+    // tracer.hpp
+    using safetyhook::ChromeTraceWriter;
+    using safetyhook::Tracer;
+
     // utility.hpp
     using safetyhook::address_cast;
     using safetyhook::align_down;
@@ -67,9 +119,14 @@ export {
     } // namespace safetyhook
 
     // safetyhook.hpp
+    using ::SafetyHookCallSite;
     using ::SafetyHookContext;
+    using ::SafetyHookImport;
     using ::SafetyHookInline;
     using ::SafetyHookMid;
+    using ::SafetyHookPointer;
+    using ::SafetyHookRecorder;
+    using ::SafetyHookTracer;
     using ::SafetyHookVm;
     using ::SafetyHookVmt;
 }
@@ -1,7 +1,9 @@
 #include <algorithm>
+#include <cstddef>
 #include <functional>
 #include <limits>
 
+#include "safetyhook/internal/metrics.hpp"
 #include "safetyhook/os.hpp"
 #include "safetyhook/utility.hpp"
 
@@ -77,21 +79,24 @@ std::expected<Allocation, Allocator::Error> Allocator::allocate_near(
     return internal_allocate_near(desired_addresses, size, max_distance);
 }
 
+std::expected<Allocation, Allocator::Error> Allocator::allocate_data(size_t size) {
+    std::scoped_lock lock{m_mutex};
+    return internal_allocate_near({}, size, std::numeric_limits<size_t>::max(), false);
+}
+
 void Allocator::free(uint8_t* address, size_t size) {
     std::scoped_lock lock{m_mutex};
     return internal_free(address, size);
 }
 
 std::expected<Allocation, Allocator::Error> Allocator::internal_allocate_near(
-    const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance) {
-    // Align to 2 bytes to pass MFP virtual method check
-    // See https://itanium-cxx-abi.github.io/cxx-abi/abi.html#member-function-pointers
-    size_t aligned_size = align_up(size, 2);
+    const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance, bool is_executable) {
+    size_t aligned_size = Allocator::aligned_size(size, is_executable);
 
     // First search through our list of allocations for a free block that is large
     // enough.
     for (const auto& allocation : m_memory) {
-        if (allocation->size < aligned_size) {
+        if (allocation->is_executable != is_executable || allocation->size < aligned_size) {
             continue;
         }
 
@@ -116,7 +121,7 @@ std::expected<Allocation, Allocator::Error> Allocator::internal_allocate_near(
 
     // If we didn't find a free block, we need to allocate a new one.
     auto allocation_size = align_up(aligned_size, system_info().allocation_granularity);
-    auto allocation_address = allocate_nearby_memory(desired_addresses, allocation_size, max_distance);
+    auto allocation_address = allocate_nearby_memory(desired_addresses, allocation_size, max_distance, is_executable);
 
     if (!allocation_address) {
         return std::unexpected{allocation_address.error()};
@@ -126,6 +131,7 @@ std::expected<Allocation, Allocator::Error> Allocator::internal_allocate_near(
 
     allocation->address = *allocation_address;
     allocation->size = allocation_size;
+    allocation->is_executable = is_executable;
     allocation->freelist = std::make_unique<FreeNode>();
     allocation->freelist->start = *allocation_address + aligned_size;
     allocation->freelist->end = *allocation_address + allocation_size;
@@ -134,14 +140,13 @@ std::expected<Allocation, Allocator::Error> Allocator::internal_allocate_near(
 }
 
 void Allocator::internal_free(uint8_t* address, size_t size) {
-    // See internal_allocate_near
-    size = align_up(size, 2);
-
     for (const auto& allocation : m_memory) {
         if (allocation->address > address || allocation->address + allocation->size < address) {
             continue;
         }
 
+        size = aligned_size(size, allocation->is_executable);
+
         // Find the right place for our new freenode.
         FreeNode* prev{};
 
@@ -183,22 +188,36 @@ void Allocator::combine_adjacent_freenodes(Memory& memory) {
     }
 }
 
+size_t Allocator::aligned_size(size_t size, bool is_executable) {
+    if (!is_executable) {
+        return align_up(size, alignof(std::max_align_t));
+    }
+
+    // Align to 2 bytes to pass MFP virtual method check
+    // See https://itanium-cxx-abi.github.io/cxx-abi/abi.html#member-function-pointers
+    return align_up(size, 2);
+}
+
 std::expected<uint8_t*, Allocator::Error> Allocator::allocate_nearby_memory(
-    const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance) {
+    const std::vector<uint8_t*>& desired_addresses, size_t size, size_t max_distance, bool is_executable) {
+    const auto access = is_executable ? VM_ACCESS_RWX : VM_ACCESS_RW;
+
     if (desired_addresses.empty()) {
-        if (auto result = vm_allocate(nullptr, size, VM_ACCESS_RWX)) {
+        if (auto result = vm_allocate(nullptr, size, access)) {
             return result.value();
         }
 
         return std::unexpected{Error::BAD_VIRTUAL_ALLOC};
     }
 
+    MetricTimer timer{Metric::NEAR_ALLOCATION_TIME};
+
     auto attempt_allocation = [&](uint8_t* p) -> uint8_t* {
         if (!in_range(p, desired_addresses, max_distance)) {
             return nullptr;
         }
 
-        if (auto result = vm_allocate(p, size, VM_ACCESS_RWX)) {
+        if (auto result = vm_allocate(p, size, access)) {
             return result.value();
         }
 
@@ -226,6 +245,8 @@ std::expected<uint8_t*, Allocator::Error> Allocator::allocate_nearby_memory(
     // Search backwards from the desired_address.
     for (auto p = desired_address; p > search_start && in_range(p, desired_addresses, max_distance);
         p = align_down(mbi.address - 1, si.allocation_granularity)) {
+        add_metric(Metric::NEAR_ALLOCATION_PROBES);
+
         auto result = vm_query(p);
 
         if (!result) {
@@ -245,6 +266,8 @@ std::expected<uint8_t*, Allocator::Error> Allocator::allocate_nearby_memory(
 
     // Search forwards from the desired_address.
     for (auto p = desired_address; p < search_end && in_range(p, desired_addresses, max_distance); p += mbi.size) {
+        add_metric(Metric::NEAR_ALLOCATION_PROBES);
+
         auto result = vm_query(p);
 
         if (!result) {
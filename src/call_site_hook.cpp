@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <optional>
+
+#if __has_include("Zydis/Zydis.h")
+#include "Zydis/Zydis.h"
+#elif __has_include("Zydis.h")
+#include "Zydis.h"
+#else
+#error "Zydis not found"
+#endif
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/internal/metrics.hpp"
+#include "safetyhook/os.hpp"
+#include "safetyhook/utility.hpp"
+
+#include "safetyhook/call_site_hook.hpp"
+
+namespace safetyhook {
+// Size of a call rel32 or jmp rel32.
+constexpr size_t CALL_SITE_SIZE = 5;
+
+#if SAFETYHOOK_ARCH_X86_64
+#pragma pack(push, 1)
+struct CallSiteRelay {
+    uint8_t opcode0{0xFF};
+    uint8_t opcode1{0x25};
+    uint32_t offset{0};
+    uint64_t destination_address{};
+};
+#pragma pack(pop)
+#endif
+
+static bool decode_call_site(uint8_t* site, ZydisDecodedInstruction& ix) {
+    ZydisDecoder decoder{};
+
+#if SAFETYHOOK_ARCH_X86_64
+    if (!ZYAN_SUCCESS(ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64))) {
+        return false;
+    }
+#elif SAFETYHOOK_ARCH_X86_32
+    if (!ZYAN_SUCCESS(ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LEGACY_32, ZYDIS_STACK_WIDTH_32))) {
+        return false;
+    }
+#endif
+
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(&decoder, nullptr, site, 15, &ix))) {
+        return false;
+    }
+
+    add_metric(Metric::INSTRUCTIONS_DECODED);
+
+    return true;
+}
+
+static uint8_t* call_site_target(uint8_t* site) {
+    int32_t displacement{};
+    std::copy_n(site + 1, sizeof(displacement), reinterpret_cast<uint8_t*>(&displacement));
+    return site + CALL_SITE_SIZE + displacement;
+}
+
+#if SAFETYHOOK_OS_LINUX
+// Tests if a call site's displacement crosses a cache line, in which case a store to it isn't atomic.
+static bool crosses_cache_line(uint8_t* site) {
+    constexpr uintptr_t CACHE_LINE_SIZE = 64;
+    return reinterpret_cast<uintptr_t>(site + 1) % CACHE_LINE_SIZE > CACHE_LINE_SIZE - sizeof(int32_t);
+}
+#endif
+
+// Points a call site at a new target. Threads may be executing the instruction, so the displacement is written with a
+// single 4 byte store. It's atomic when naturally aligned, and x86 also performs an unaligned store atomically as long
+// as it doesn't cross a cache line. Where other threads aren't stopped while patching, create rejects the call sites
+// that would cross one.
+static void store_call_site(uint8_t* site, uint8_t* target) {
+    const auto displacement = static_cast<int32_t>(target - (site + CALL_SITE_SIZE));
+
+    if (reinterpret_cast<uintptr_t>(site + 1) % sizeof(displacement) == 0) {
+        std::atomic_ref{*reinterpret_cast<int32_t*>(site + 1)}.store(displacement);
+    } else {
+        store(site + 1, displacement);
+    }
+}
+
+// Points sorted call sites at new targets in one batch: threads are trapped once, and each run of consecutive pages
+// holding call sites is unprotected once rather than once per call site. If a run can't be unprotected, the runs
+// already patched are pointed back at their previous targets and the first call site of that run is returned.
+template <typename TargetFn>
+static std::expected<void, uint8_t*> retarget_call_sites(const std::vector<uint8_t*>& sites, TargetFn target_for) {
+    if (sites.empty()) {
+        return {};
+    }
+
+    const auto page_size = system_info().page_size;
+    std::expected<void, uint8_t*> result{};
+
+    trap_threads(sites.front(), sites.front(), CALL_SITE_SIZE, [&] {
+        // The patched runs stay unprotected until the end so they can be rolled back.
+        std::vector<UnprotectMemory> unprotected_runs{};
+        std::vector<uint8_t*> previous_targets{};
+        previous_targets.reserve(sites.size());
+
+        for (auto first = sites.begin(); first != sites.end();) {
+            auto* start = align_down(*first, page_size);
+            auto* end = align_up(*first + CALL_SITE_SIZE, page_size);
+            auto last = first + 1;
+
+            for (; last != sites.end() && align_down(*last, page_size) <= end; ++last) {
+                end = align_up(*last + CALL_SITE_SIZE, page_size);
+            }
+
+            auto unprotected = unprotect(start, static_cast<size_t>(end - start));
+
+            if (!unprotected) {
+                for (size_t i = 0; i < previous_targets.size(); ++i) {
+                    store_call_site(sites[i], previous_targets[i]);
+                }
+
+                result = std::unexpected{*first};
+                return;
+            }
+
+            for (auto it = first; it != last; ++it) {
+                previous_targets.push_back(call_site_target(*it));
+                store_call_site(*it, target_for(*it));
+            }
+
+            unprotected_runs.push_back(std::move(*unprotected));
+            first = last;
+        }
+    });
+
+    return result;
+}
+
+std::expected<CallSiteHook, CallSiteHook::Error> CallSiteHook::create(void* site, void* destination) {
+    return create(Allocator::global(), site, destination);
+}
+
+std::expected<CallSiteHook, CallSiteHook::Error> CallSiteHook::create(
+    const std::shared_ptr<Allocator>& allocator, void* site, void* destination) {
+    return create(allocator, std::vector{reinterpret_cast<uint8_t*>(site)}, destination);
+}
+
+std::expected<CallSiteHook, CallSiteHook::Error> CallSiteHook::create(
+    const std::vector<uint8_t*>& sites, void* destination) {
+    return create(Allocator::global(), sites, destination);
+}
+
+std::expected<CallSiteHook, CallSiteHook::Error> CallSiteHook::create(
+    const std::shared_ptr<Allocator>& allocator, const std::vector<uint8_t*>& sites, void* destination) {
+    if (sites.empty()) {
+        return std::unexpected{Error::not_a_call_site(nullptr)};
+    }
+
+    CallSiteHook hook{};
+    hook.m_destination = reinterpret_cast<uint8_t*>(destination);
+    hook.m_sites = sites;
+    std::sort(hook.m_sites.begin(), hook.m_sites.end());
+    hook.m_sites.erase(std::unique(hook.m_sites.begin(), hook.m_sites.end()), hook.m_sites.end());
+
+    for (auto* ip : hook.m_sites) {
+        ZydisDecodedInstruction ix{};
+
+        if (!decode_call_site(ip, ix)) {
+            return std::unexpected{Error::failed_to_decode_instruction(ip)};
+        }
+
+        if ((ix.mnemonic != ZYDIS_MNEMONIC_CALL && ix.mnemonic != ZYDIS_MNEMONIC_JMP) ||
+            ix.length != CALL_SITE_SIZE || (ip[0] != 0xE8 && ip[0] != 0xE9)) {
+            return std::unexpected{Error::not_a_call_site(ip)};
+        }
+
+#if SAFETYHOOK_OS_LINUX
+        // trap_threads doesn't stop the other threads here, one could run a half written displacement.
+        if (crosses_cache_line(ip)) {
+            return std::unexpected{Error::crosses_cache_line(ip)};
+        }
+#endif
+
+        if (hook.m_original == nullptr) {
+            hook.m_original = call_site_target(ip);
+        } else if (call_site_target(ip) != hook.m_original) {
+            return std::unexpected{Error::different_callees(ip)};
+        }
+    }
+
+    // The target of each call site, either the destination or a relay in range of it.
+    std::vector<uint8_t*> targets(hook.m_sites.size(), hook.m_destination);
+
+#if SAFETYHOOK_ARCH_X86_64
+    const auto in_range = [](uint8_t* ip, uint8_t* target) {
+        const auto distance = target - (ip + CALL_SITE_SIZE);
+        return distance >= std::numeric_limits<int32_t>::min() && distance <= std::numeric_limits<int32_t>::max();
+    };
+
+    for (size_t i = 0; i < hook.m_sites.size(); ++i) {
+        auto* ip = hook.m_sites[i];
+
+        if (in_range(ip, hook.m_destination)) {
+            continue;
+        }
+
+        // Call sites of a module usually share one relay.
+        auto relay_it = std::find_if(hook.m_relays.begin(), hook.m_relays.end(),
+            [&](const Allocation& relay) { return in_range(ip, relay.data()); });
+
+        if (relay_it == hook.m_relays.end()) {
+            // Leave some room so the displacement to the relay is in range wherever it lands.
+            auto relay_allocation = allocator->allocate_near({ip}, sizeof(CallSiteRelay), 0x7FFF'0000);
+
+            if (!relay_allocation) {
+                return std::unexpected{Error::bad_allocation(relay_allocation.error())};
+            }
+
+            CallSiteRelay relay{};
+            relay.destination_address = reinterpret_cast<uintptr_t>(hook.m_destination);
+            store(relay_allocation->data(), relay);
+            relay_it = hook.m_relays.insert(hook.m_relays.end(), std::move(*relay_allocation));
+        }
+
+        targets[i] = relay_it->data();
+    }
+#else
+    (void)allocator;
+#endif
+
+    auto retargeted = retarget_call_sites(hook.m_sites, [&](uint8_t* ip) {
+        const auto it = std::lower_bound(hook.m_sites.begin(), hook.m_sites.end(), ip);
+        return targets[static_cast<size_t>(it - hook.m_sites.begin())];
+    });
+
+    if (!retargeted) {
+        // Nothing is left pointing at the relays, the hook can be destroyed without restoring anything.
+        hook.m_sites.clear();
+        return std::unexpected{Error::failed_to_unprotect(retargeted.error())};
+    }
+
+    return hook;
+}
+
+CallSiteHook::CallSiteHook(CallSiteHook&& other) noexcept {
+    *this = std::move(other);
+}
+
+CallSiteHook& CallSiteHook::operator=(CallSiteHook&& other) noexcept {
+    if (this != &other) {
+        release();
+
+        m_sites = std::move(other.m_sites);
+        m_original = other.m_original;
+        m_destination = other.m_destination;
+        m_relays = std::move(other.m_relays);
+
+        other.m_sites.clear();
+        other.m_relays.clear();
+        other.m_original = nullptr;
+        other.m_destination = nullptr;
+    }
+
+    return *this;
+}
+
+CallSiteHook::~CallSiteHook() {
+    release();
+}
+
+std::expected<void, CallSiteHook::Error> CallSiteHook::reset() {
+    if (auto restored = destroy(); !restored) {
+        return restored;
+    }
+
+    *this = {};
+
+    return {};
+}
+
+std::expected<void, CallSiteHook::Error> CallSiteHook::destroy() {
+    if (m_sites.empty()) {
+        return {};
+    }
+
+    // Leave call sites alone if they were retargeted again after us.
+    std::vector<uint8_t*> hooked_sites{};
+
+    for (auto* site : m_sites) {
+        auto* target = call_site_target(site);
+
+        if (target == m_destination || std::any_of(m_relays.begin(), m_relays.end(),
+                                           [target](const Allocation& relay) { return relay.data() == target; })) {
+            hooked_sites.push_back(site);
+        }
+    }
+
+    if (auto restored = retarget_call_sites(hooked_sites, [this](uint8_t*) { return m_original; }); !restored) {
+        return std::unexpected{Error::failed_to_unprotect(restored.error())};
+    }
+
+    m_sites.clear();
+    m_original = nullptr;
+    m_destination = nullptr;
+    m_relays.clear();
+
+    return {};
+}
+
+void CallSiteHook::release() {
+    if (destroy()) {
+        return;
+    }
+
+    // Every call site is still hooked, and some may go through the relays. Leak them rather than leave the call sites
+    // jumping to freed memory.
+    static_cast<void>(new std::vector<Allocation>{std::move(m_relays)});
+
+    m_sites.clear();
+    m_original = nullptr;
+    m_destination = nullptr;
+    m_relays.clear();
+}
+} // namespace safetyhook
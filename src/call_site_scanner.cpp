@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+
+#if __has_include("Zydis/Zydis.h")
+#include "Zydis/Zydis.h"
+#elif __has_include("Zydis.h")
+#include "Zydis.h"
+#else
+#error "Zydis not found"
+#endif
+
+#include <immintrin.h>
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/internal/metrics.hpp"
+
+#if SAFETYHOOK_OS_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#if __has_include(<Windows.h>)
+#include <Windows.h>
+#elif __has_include(<windows.h>)
+#include <windows.h>
+#else
+#error "Windows.h not found"
+#endif
+#elif SAFETYHOOK_OS_LINUX
+#include <link.h>
+#endif
+
+#include "safetyhook/call_site_scanner.hpp"
+
+#if SAFETYHOOK_COMPILER_MSVC
+#define SAFETYHOOK_TARGET_SSE2
+#define SAFETYHOOK_TARGET_AVX2
+#else
+#define SAFETYHOOK_TARGET_SSE2 __attribute__((target("sse2")))
+#define SAFETYHOOK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace safetyhook {
+namespace {
+// Size of a call rel32 or jmp rel32.
+constexpr size_t CALL_REL32_SIZE = 5;
+
+// How far before a candidate to start decoding when it isn't inside a known function.
+constexpr size_t RESYNC_DISTANCE = 64;
+
+struct CodeModule {
+    uint8_t* address{};
+    std::vector<std::span<uint8_t>> code{};
+
+    // The start of every function with unwind information, which are known instruction boundaries.
+    std::vector<uint8_t*> functions{};
+};
+
+bool calls_function(const uint8_t* ip, const uint8_t* function) {
+    int32_t displacement{};
+    std::memcpy(&displacement, ip + 1, sizeof(displacement));
+    return ip + CALL_REL32_SIZE + displacement == function;
+}
+
+void scan_scalar(uint8_t* begin, uint8_t* end, uint8_t* function, std::vector<uint8_t*>& candidates) {
+    for (auto* ip = begin; ip + CALL_REL32_SIZE <= end; ++ip) {
+        if ((*ip == 0xE8 || *ip == 0xE9) && calls_function(ip, function)) {
+            candidates.push_back(ip);
+        }
+    }
+}
+
+// Checks the opcodes in a block of bytes found by one of the vectorized scans.
+void check_block(uint8_t* block, uint32_t opcode_mask, uint8_t* function, std::vector<uint8_t*>& candidates) {
+    for (; opcode_mask != 0; opcode_mask &= opcode_mask - 1) {
+        auto* ip = block + std::countr_zero(opcode_mask);
+
+        if (calls_function(ip, function)) {
+            candidates.push_back(ip);
+        }
+    }
+}
+
+SAFETYHOOK_TARGET_SSE2 void scan_sse2(
+    uint8_t* begin, uint8_t* end, uint8_t* function, std::vector<uint8_t*>& candidates) {
+    const auto call = _mm_set1_epi8(static_cast<char>(0xE8));
+    const auto jmp = _mm_set1_epi8(static_cast<char>(0xE9));
+    auto* ip = begin;
+
+    // The displacement of an opcode at the end of a block is read past it.
+    for (; ip + 16 + CALL_REL32_SIZE - 1 <= end; ip += 16) {
+        const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ip));
+        const auto opcodes = _mm_or_si128(_mm_cmpeq_epi8(bytes, call), _mm_cmpeq_epi8(bytes, jmp));
+        check_block(ip, static_cast<uint32_t>(_mm_movemask_epi8(opcodes)), function, candidates);
+    }
+
+    scan_scalar(ip, end, function, candidates);
+}
+
+SAFETYHOOK_TARGET_AVX2 void scan_avx2(
+    uint8_t* begin, uint8_t* end, uint8_t* function, std::vector<uint8_t*>& candidates) {
+    const auto call = _mm256_set1_epi8(static_cast<char>(0xE8));
+    const auto jmp = _mm256_set1_epi8(static_cast<char>(0xE9));
+    auto* ip = begin;
+
+    // The displacement of an opcode at the end of a block is read past it.
+    for (; ip + 32 + CALL_REL32_SIZE - 1 <= end; ip += 32) {
+        const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ip));
+        const auto opcodes = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, call), _mm256_cmpeq_epi8(bytes, jmp));
+        check_block(ip, static_cast<uint32_t>(_mm256_movemask_epi8(opcodes)), function, candidates);
+    }
+
+    scan_scalar(ip, end, function, candidates);
+}
+
+bool cpu_has_sse2() {
+#if SAFETYHOOK_ARCH_X86_64 || SAFETYHOOK_COMPILER_MSVC
+    return true;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool cpu_has_avx2() {
+#if SAFETYHOOK_COMPILER_MSVC
+    int info[4]{};
+    __cpuid(info, 0);
+
+    if (info[0] < 7) {
+        return false;
+    }
+
+    // The OS has to save the ymm registers (OSXSAVE and XCR0) for AVX to be usable.
+    __cpuid(info, 1);
+
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+void scan_code(std::span<uint8_t> code, uint8_t* function, std::vector<uint8_t*>& candidates) {
+    static const auto has_avx2 = cpu_has_avx2();
+    static const auto has_sse2 = cpu_has_sse2();
+    auto* begin = code.data();
+    auto* end = code.data() + code.size();
+
+    if (has_avx2) {
+        scan_avx2(begin, end, function, candidates);
+    } else if (has_sse2) {
+        scan_sse2(begin, end, function, candidates);
+    } else {
+        scan_scalar(begin, end, function, candidates);
+    }
+}
+
+#if SAFETYHOOK_OS_LINUX
+constexpr uint8_t DW_EH_PE_UDATA4 = 0x03;
+constexpr uint8_t DW_EH_PE_SDATA4 = 0x0B;
+constexpr uint8_t DW_EH_PE_DATAREL = 0x30;
+
+// Reads the function starts out of the binary search table of .eh_frame_hdr. Every linker emits the table with
+// sdata4 entries relative to the start of .eh_frame_hdr, other encodings are ignored.
+void read_eh_frame_hdr(const uint8_t* hdr, std::vector<uint8_t*>& functions) {
+    const auto version = hdr[0];
+    const auto eh_frame_ptr_enc = hdr[1];
+    const auto fde_count_enc = hdr[2];
+    const auto table_enc = hdr[3];
+
+    // The eh_frame_ptr and fde_count fields are 4 bytes in the supported encodings.
+    if (version != 1 || (eh_frame_ptr_enc & 0x0F) != DW_EH_PE_SDATA4 ||
+        (fde_count_enc != DW_EH_PE_UDATA4 && fde_count_enc != DW_EH_PE_SDATA4) ||
+        table_enc != (DW_EH_PE_DATAREL | DW_EH_PE_SDATA4)) {
+        return;
+    }
+
+    uint32_t fde_count{};
+    std::memcpy(&fde_count, hdr + 8, sizeof(fde_count));
+
+    for (auto* entry = hdr + 12; entry < hdr + 12 + static_cast<size_t>(fde_count) * 8; entry += 8) {
+        int32_t initial_location{};
+        std::memcpy(&initial_location, entry, sizeof(initial_location));
+        functions.push_back(const_cast<uint8_t*>(hdr) + initial_location);
+    }
+}
+
+int find_code_module(dl_phdr_info* info, size_t, void* data) {
+    auto& module = *static_cast<CodeModule*>(data);
+    const auto base = info->dlpi_addr;
+    auto contains_module = false;
+
+    for (auto phdr = info->dlpi_phdr; phdr < info->dlpi_phdr + info->dlpi_phnum; ++phdr) {
+        auto* start = reinterpret_cast<uint8_t*>(base + phdr->p_vaddr);
+
+        if (phdr->p_type == PT_LOAD) {
+            contains_module = contains_module || (module.address >= start && module.address < start + phdr->p_memsz);
+        }
+    }
+
+    if (!contains_module) {
+        return 0;
+    }
+
+    for (auto phdr = info->dlpi_phdr; phdr < info->dlpi_phdr + info->dlpi_phnum; ++phdr) {
+        auto* start = reinterpret_cast<uint8_t*>(base + phdr->p_vaddr);
+
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X) != 0) {
+            module.code.emplace_back(start, phdr->p_memsz);
+        } else if (phdr->p_type == PT_GNU_EH_FRAME) {
+            read_eh_frame_hdr(start, module.functions);
+        }
+    }
+
+    return 1;
+}
+#endif
+
+CodeModule code_module(uint8_t* address) {
+    CodeModule module{address};
+
+#if SAFETYHOOK_OS_WINDOWS
+    HMODULE handle{};
+
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+            reinterpret_cast<LPCWSTR>(address), &handle)) {
+        return module;
+    }
+
+    auto* base = reinterpret_cast<uint8_t*>(handle);
+    const auto* dos = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+    const auto* nt = reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dos->e_lfanew);
+    const auto* sections = IMAGE_FIRST_SECTION(nt);
+
+    for (WORD i = 0; i < nt->FileHeader.NumberOfSections; ++i) {
+        if ((sections[i].Characteristics & IMAGE_SCN_MEM_EXECUTE) != 0) {
+            module.code.emplace_back(base + sections[i].VirtualAddress, sections[i].Misc.VirtualSize);
+        }
+    }
+
+#if SAFETYHOOK_ARCH_X86_64
+    const auto& exceptions = nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+    const auto* functions = reinterpret_cast<const RUNTIME_FUNCTION*>(base + exceptions.VirtualAddress);
+
+    for (size_t i = 0; i < exceptions.Size / sizeof(RUNTIME_FUNCTION); ++i) {
+        module.functions.push_back(base + functions[i].BeginAddress);
+    }
+#endif
+#elif SAFETYHOOK_OS_LINUX
+    dl_iterate_phdr(find_code_module, &module);
+#endif
+
+    std::sort(module.functions.begin(), module.functions.end());
+
+    return module;
+}
+
+// Decodes instructions from start until reaching target, returning where decoding stopped: target when it is an
+// instruction boundary, past it when it isn't, or nullptr if an instruction failed to decode.
+uint8_t* decode_until(const ZydisDecoder& decoder, uint8_t* ip, uint8_t* target, uint8_t* end) {
+    uint64_t decoded{};
+
+    while (ip < target) {
+        ZydisDecodedInstruction ix{};
+
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(
+                &decoder, nullptr, ip, std::min<size_t>(15, end - ip), &ix))) {
+            add_metric(Metric::INSTRUCTIONS_DECODED, decoded);
+            return nullptr;
+        }
+
+        ++decoded;
+        ip += ix.length;
+    }
+
+    add_metric(Metric::INSTRUCTIONS_DECODED, decoded);
+
+    return ip;
+}
+} // namespace
+
+std::vector<uint8_t*> find_call_sites(void* function, void* module) {
+    auto* target = static_cast<uint8_t*>(function);
+    const auto code = code_module(module != nullptr ? static_cast<uint8_t*>(module) : target);
+    ZydisDecoder decoder{};
+    std::vector<uint8_t*> sites{};
+
+#if SAFETYHOOK_ARCH_X86_64
+    if (!ZYAN_SUCCESS(ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64))) {
+        return sites;
+    }
+#elif SAFETYHOOK_ARCH_X86_32
+    if (!ZYAN_SUCCESS(ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LEGACY_32, ZYDIS_STACK_WIDTH_32))) {
+        return sites;
+    }
+#endif
+
+    for (const auto region : code.code) {
+        std::vector<uint8_t*> candidates{};
+        scan_code(region, target, candidates);
+
+        // Candidates are in order, so decoding carries on from the previous candidate of the same function.
+        uint8_t* function_start{};
+        uint8_t* ip{};
+        auto* region_end = region.data() + region.size();
+
+        for (auto* candidate : candidates) {
+            auto it = std::upper_bound(code.functions.begin(), code.functions.end(), candidate);
+
+            if (it != code.functions.begin() && *(it - 1) >= region.data()) {
+                if (*(it - 1) != function_start) {
+                    function_start = *(it - 1);
+                    ip = function_start;
+                }
+
+                if (ip != nullptr && ip <= candidate) {
+                    ip = decode_until(decoder, ip, candidate, region_end);
+                }
+            } else {
+                auto* start = candidate - std::min<size_t>(RESYNC_DISTANCE, candidate - region.data());
+                function_start = nullptr;
+                ip = decode_until(decoder, start, candidate, region_end);
+            }
+
+            if (ip == candidate) {
+                sites.push_back(candidate);
+            }
+        }
+    }
+
+    return sites;
+}
+} // namespace safetyhook
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cstring>
+
+#include "safetyhook/common.hpp"
+
+#if SAFETYHOOK_COMPILER_MSVC
+#include <immintrin.h>
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "safetyhook/os.hpp"
+#include "safetyhook/utility.hpp"
+
+#include "safetyhook/context.hpp"
+
+namespace safetyhook {
+// The XSAVE state components holding the AVX and AVX-512 registers.
+constexpr uint32_t XSTATE_AVX = 2;       // Upper halves of ymm0 to ymm15.
+constexpr uint32_t XSTATE_OPMASK = 5;    // k0 to k7.
+constexpr uint32_t XSTATE_ZMM_HI256 = 6; // Upper halves of zmm0 to zmm15.
+constexpr uint32_t XSTATE_HI16_ZMM = 7;  // zmm16 to zmm31.
+constexpr uint64_t XSTATE_SAVED =
+    (1u << XSTATE_AVX) | (1u << XSTATE_OPMASK) | (1u << XSTATE_ZMM_HI256) | (1u << XSTATE_HI16_ZMM);
+
+// The legacy region and the header come first in both formats, the header starting with XSTATE_BV. The MidHook thunk
+// stores the address of the Context the area belongs to in the bytes of the legacy region left to software.
+constexpr uint32_t XSAVE_CONTEXT_OFFSET = 464;
+constexpr uint32_t XSAVE_HEADER_OFFSET = 512;
+constexpr uint32_t XSAVE_EXTENDED_OFFSET = 576;
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t (&regs)[4]) {
+#if SAFETYHOOK_COMPILER_MSVC
+    int info[4]{};
+    __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+    std::memcpy(regs, info, sizeof(regs));
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv(uint32_t index) {
+#if SAFETYHOOK_COMPILER_MSVC
+    return _xgetbv(index);
+#else
+    uint32_t eax{};
+    uint32_t edx{};
+    asm volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return static_cast<uint64_t>(edx) << 32 | eax;
+#endif
+}
+
+static ExtendedStateLayout detect_extended_state_layout() {
+    ExtendedStateLayout layout{};
+    uint32_t regs[4]{};
+
+    cpuid(0, 0, regs);
+
+    if (regs[0] < 0xD) {
+        return layout;
+    }
+
+    // XSAVE has to be supported and enabled by the OS (OSXSAVE) before XCR0 can be read.
+    cpuid(1, 0, regs);
+
+    if ((regs[2] & (1u << 26)) == 0 || (regs[2] & (1u << 27)) == 0) {
+        return layout;
+    }
+
+    const auto features = xgetbv(0) & XSTATE_SAVED;
+
+    if ((features & (1u << XSTATE_AVX)) == 0) {
+        return layout;
+    }
+
+    cpuid(0xD, 1, regs);
+    layout.compacted = (regs[0] & (1u << 1)) != 0;
+
+    // The compacted format packs the saved components in order, some of them aligned to 64 bytes.
+    uint32_t size = XSAVE_EXTENDED_OFFSET;
+
+    for (uint32_t component = 2; component < 8; ++component) {
+        if ((features & (1ull << component)) == 0) {
+            continue;
+        }
+
+        cpuid(0xD, component, regs);
+
+        if (layout.compacted) {
+            if ((regs[2] & (1u << 1)) != 0) {
+                size = align_up(size, 64);
+            }
+
+            layout.offsets[component] = size;
+            size += regs[0];
+        } else {
+            layout.offsets[component] = regs[1];
+            size = std::max(size, regs[1] + regs[0]);
+        }
+    }
+
+    const auto thread_slot = thread_slot_allocate();
+
+    if (!thread_slot) {
+        return layout;
+    }
+
+    layout.features = features;
+    layout.size = size;
+    layout.thread_slot = *thread_slot;
+
+    return layout;
+}
+
+const ExtendedStateLayout& extended_state_layout() {
+    static const auto layout = detect_extended_state_layout();
+    return layout;
+}
+
+// Returns a component of a Context's save area, or nullptr if it isn't available. Only the innermost area of the
+// calling thread is published, and it belongs to another Context when a hook without one is nested in the destination
+// of a hook with one. XSAVE(C) skips components that are in their initial (zero) state, so they are zeroed and marked
+// as saved before being written to make XRSTOR pick up the new value.
+static uint8_t* extended_state_component(const void* context, uint32_t component, size_t size, bool write) {
+    const auto& layout = extended_state_layout();
+
+    if ((layout.features & (1ull << component)) == 0) {
+        return nullptr;
+    }
+
+    auto* area = reinterpret_cast<uint8_t*>(thread_slot_get(layout.thread_slot));
+
+    if (area == nullptr) {
+        return nullptr;
+    }
+
+    const void* owner{};
+    std::memcpy(&owner, area + XSAVE_CONTEXT_OFFSET, sizeof(owner));
+
+    if (owner != context) {
+        return nullptr;
+    }
+
+    auto* data = area + layout.offsets[component];
+    uint64_t xstate_bv{};
+    std::memcpy(&xstate_bv, area + XSAVE_HEADER_OFFSET, sizeof(xstate_bv));
+
+    if ((xstate_bv & (1ull << component)) == 0) {
+        if (!write) {
+            return nullptr;
+        }
+
+        std::memset(data, 0, size);
+        xstate_bv |= 1ull << component;
+        std::memcpy(area + XSAVE_HEADER_OFFSET, &xstate_bv, sizeof(xstate_bv));
+    }
+
+    return data;
+}
+
+// zmm16 to zmm31 only exist in 64-bit mode, which is also the only mode with 16 xmm registers.
+static Zmm read_zmm(const void* context, const Xmm* xmm, size_t count, size_t index) {
+    Zmm value{};
+
+    if (index < count) {
+        value.xmm[0] = xmm[index];
+
+        if (const auto* hi128 = extended_state_component(context, XSTATE_AVX, 16 * 16, false)) {
+            std::memcpy(&value.xmm[1], hi128 + index * 16, 16);
+        }
+
+        if (const auto* hi256 = extended_state_component(context, XSTATE_ZMM_HI256, 16 * 32, false)) {
+            std::memcpy(&value.ymm[1], hi256 + index * 32, 32);
+        }
+    } else if (count == 16 && index < 32) {
+        if (const auto* hi16 = extended_state_component(context, XSTATE_HI16_ZMM, 16 * 64, false)) {
+            std::memcpy(&value, hi16 + (index - 16) * 64, 64);
+        }
+    }
+
+    return value;
+}
+
+static void write_zmm(const void* context, Xmm* xmm, size_t count, size_t index, const Zmm& value, size_t size) {
+    if (index < count) {
+        xmm[index] = value.xmm[0];
+
+        if (auto* hi128 = extended_state_component(context, XSTATE_AVX, 16 * 16, true)) {
+            std::memcpy(hi128 + index * 16, &value.xmm[1], 16);
+        }
+
+        if (size < sizeof(Zmm)) {
+            return;
+        }
+
+        if (auto* hi256 = extended_state_component(context, XSTATE_ZMM_HI256, 16 * 32, true)) {
+            std::memcpy(hi256 + index * 32, &value.ymm[1], 32);
+        }
+    } else if (count == 16 && index < 32) {
+        if (auto* hi16 = extended_state_component(context, XSTATE_HI16_ZMM, 16 * 64, true)) {
+            std::memcpy(hi16 + (index - 16) * 64, &value, 64);
+        }
+    }
+}
+
+Ymm Context64::ymm(size_t index) const {
+    return read_zmm(this, &xmm0, 16, index).ymm[0];
+}
+
+void Context64::set_ymm(size_t index, const Ymm& value) {
+    Zmm zmm{};
+    zmm.ymm[0] = value;
+    write_zmm(this, &xmm0, 16, index, zmm, sizeof(Ymm));
+}
+
+Zmm Context64::zmm(size_t index) const {
+    return read_zmm(this, &xmm0, 16, index);
+}
+
+void Context64::set_zmm(size_t index, const Zmm& value) {
+    write_zmm(this, &xmm0, 16, index, value, sizeof(Zmm));
+}
+
+Ymm Context32::ymm(size_t index) const {
+    return read_zmm(this, &xmm0, 8, index).ymm[0];
+}
+
+void Context32::set_ymm(size_t index, const Ymm& value) {
+    Zmm zmm{};
+    zmm.ymm[0] = value;
+    write_zmm(this, &xmm0, 8, index, zmm, sizeof(Ymm));
+}
+
+Zmm Context32::zmm(size_t index) const {
+    return read_zmm(this, &xmm0, 8, index);
+}
+
+void Context32::set_zmm(size_t index, const Zmm& value) {
+    write_zmm(this, &xmm0, 8, index, value, sizeof(Zmm));
+}
+} // namespace safetyhook
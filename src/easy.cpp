@@ -9,6 +9,30 @@ InlineHook create_inline(void* target, void* destination, InlineHook::Flags flag
     }
 }
 
+CallSiteHook create_call_site(void* site, void* destination) {
+    if (auto hook = CallSiteHook::create(site, destination)) {
+        return std::move(*hook);
+    } else {
+        return {};
+    }
+}
+
+CallSiteHook create_call_site(const std::vector<uint8_t*>& sites, void* destination) {
+    if (auto hook = CallSiteHook::create(sites, destination)) {
+        return std::move(*hook);
+    } else {
+        return {};
+    }
+}
+
+ImportHook create_import(std::string_view symbol, void* destination, void* module) {
+    if (auto hook = ImportHook::create(symbol, destination, module)) {
+        return std::move(*hook);
+    } else {
+        return {};
+    }
+}
+
 MidHook create_mid(void* target, MidHookFn destination, MidHook::Flags flags) {
     if (auto hook = MidHook::create(target, destination, flags)) {
         return std::move(*hook);
@@ -17,8 +41,25 @@ MidHook create_mid(void* target, MidHookFn destination, MidHook::Flags flags) {
     }
 }
 
-VmtHook create_vmt(void* object) {
-    if (auto hook = VmtHook::create(object)) {
+MidHook create_mid(void* target, MidHookFn destination, const std::vector<MidHook::Filter>& filters,
+    MidHook::Flags flags) {
+    if (auto hook = MidHook::create(target, destination, filters, flags)) {
+        return std::move(*hook);
+    } else {
+        return {};
+    }
+}
+
+PointerHook create_pointer(void* slot, void* destination) {
+    if (auto hook = PointerHook::create(slot, destination)) {
+        return std::move(*hook);
+    } else {
+        return {};
+    }
+}
+
+VmtHook create_vmt(void* object, VmtHook::Flags flags) {
+    if (auto hook = VmtHook::create(object, flags)) {
         return std::move(*hook);
     } else {
         return {};
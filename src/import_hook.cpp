@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/os.hpp"
+#include "safetyhook/utility.hpp"
+
+#if SAFETYHOOK_OS_LINUX
+#include <dlfcn.h>
+#include <link.h>
+#endif
+
+#include "safetyhook/import_hook.hpp"
+
+namespace safetyhook {
+#if SAFETYHOOK_OS_LINUX
+namespace {
+#if SAFETYHOOK_ARCH_X86_64
+constexpr auto RELOC_JUMP_SLOT = R_X86_64_JUMP_SLOT;
+constexpr auto RELOC_GLOB_DAT = R_X86_64_GLOB_DAT;
+
+constexpr size_t reloc_type(ElfW(Xword) info) {
+    return ELF64_R_TYPE(info);
+}
+
+constexpr size_t reloc_symbol(ElfW(Xword) info) {
+    return ELF64_R_SYM(info);
+}
+#elif SAFETYHOOK_ARCH_X86_32
+constexpr auto RELOC_JUMP_SLOT = R_386_JMP_SLOT;
+constexpr auto RELOC_GLOB_DAT = R_386_GLOB_DAT;
+
+constexpr size_t reloc_type(ElfW(Word) info) {
+    return ELF32_R_TYPE(info);
+}
+
+constexpr size_t reloc_symbol(ElfW(Word) info) {
+    return ELF32_R_SYM(info);
+}
+#endif
+
+struct ImportEntry {
+    uint8_t** address{};
+    bool is_relro{};
+    bool is_jump_slot{};
+    uint8_t* module_start{}; ///< The lowest address the module is loaded at.
+    uint8_t* module_end{};   ///< The highest address the module is loaded at.
+    uint8_t* definition{};   ///< The module's own definition of the symbol, if it has one.
+    const char* version{};   ///< The version the module needs of the symbol, if it's versioned.
+    const char* module_name{};
+};
+
+struct FindImports {
+    std::string_view symbol{};
+    uint8_t* module{};
+    std::vector<ImportEntry> entries{};
+};
+
+// The parts of a module's dynamic section and program headers find_imports needs.
+struct ImportModule {
+    ElfW(Addr) base{};
+    const ElfW(Sym) * symtab{};
+    const char* strtab{};
+    const ElfW(Half) * versym{};
+    const ElfW(Verneed) * verneed{};
+    uint8_t* start{};
+    uint8_t* end{};
+    uint8_t* relro_start{};
+    uint8_t* relro_end{};
+    const char* name{};
+};
+
+// Finds the name of the version a module needs of a symbol in its version requirements.
+const char* find_version(const ImportModule& module, size_t symbol_index) {
+    if (module.versym == nullptr || module.verneed == nullptr) {
+        return nullptr;
+    }
+
+    // Indexes 0 and 1 are the local and global (unversioned) scopes.
+    const auto index = module.versym[symbol_index] & 0x7FFF;
+
+    if (index <= 1) {
+        return nullptr;
+    }
+
+    for (auto need = module.verneed;; need = reinterpret_cast<const ElfW(Verneed)*>(
+                                          reinterpret_cast<const uint8_t*>(need) + need->vn_next)) {
+        auto aux = reinterpret_cast<const ElfW(Vernaux)*>(reinterpret_cast<const uint8_t*>(need) + need->vn_aux);
+
+        for (size_t i = 0; i < need->vn_cnt; ++i) {
+            if (aux->vna_other == index) {
+                return module.strtab + aux->vna_name;
+            }
+
+            aux = reinterpret_cast<const ElfW(Vernaux)*>(reinterpret_cast<const uint8_t*>(aux) + aux->vna_next);
+        }
+
+        if (need->vn_next == 0) {
+            return nullptr;
+        }
+    }
+}
+
+// Finds the GOT entries relocated against the symbol in a relocation table.
+template <typename Rel>
+void find_imports(FindImports& find, const ImportModule& module, const Rel* relocs, size_t size) {
+    for (auto reloc = relocs; reloc < relocs + size / sizeof(Rel); ++reloc) {
+        const auto type = reloc_type(reloc->r_info);
+
+        if (type != RELOC_JUMP_SLOT && type != RELOC_GLOB_DAT) {
+            continue;
+        }
+
+        const auto symbol_index = reloc_symbol(reloc->r_info);
+        const auto& symbol = module.symtab[symbol_index];
+
+        if (find.symbol != module.strtab + symbol.st_name) {
+            continue;
+        }
+
+        auto* address = reinterpret_cast<uint8_t**>(module.base + reloc->r_offset);
+        const auto is_relro = reinterpret_cast<uint8_t*>(address) >= module.relro_start &&
+                              reinterpret_cast<uint8_t*>(address) < module.relro_end;
+
+        // Some linkers have DT_RELA cover the PLT relocations too.
+        if (std::any_of(find.entries.begin(), find.entries.end(),
+                [address](const ImportEntry& entry) { return entry.address == address; })) {
+            continue;
+        }
+
+        auto* definition =
+            symbol.st_shndx != SHN_UNDEF ? reinterpret_cast<uint8_t*>(module.base + symbol.st_value) : nullptr;
+
+        find.entries.emplace_back(address, is_relro, type == RELOC_JUMP_SLOT, module.start, module.end, definition,
+            find_version(module, symbol_index), module.name);
+    }
+}
+
+int find_module_imports(dl_phdr_info* info, size_t, void* data) {
+    auto& find = *static_cast<FindImports*>(data);
+    ImportModule module{.base = info->dlpi_addr, .name = info->dlpi_name};
+    const auto base = module.base;
+    const ElfW(Dyn)* dynamic{};
+    auto contains_module = find.module == nullptr;
+
+    for (auto phdr = info->dlpi_phdr; phdr < info->dlpi_phdr + info->dlpi_phnum; ++phdr) {
+        auto* start = reinterpret_cast<uint8_t*>(base + phdr->p_vaddr);
+
+        if (phdr->p_type == PT_LOAD) {
+            contains_module = contains_module || (find.module >= start && find.module < start + phdr->p_memsz);
+            module.start = module.start == nullptr ? start : std::min(module.start, start);
+            module.end = std::max(module.end, start + phdr->p_memsz);
+        } else if (phdr->p_type == PT_DYNAMIC) {
+            dynamic = reinterpret_cast<const ElfW(Dyn)*>(start);
+        } else if (phdr->p_type == PT_GNU_RELRO) {
+            module.relro_start = align_down(start, system_info().page_size);
+            module.relro_end = align_up(start + phdr->p_memsz, system_info().page_size);
+        }
+    }
+
+    if (!contains_module || dynamic == nullptr) {
+        return 0;
+    }
+
+    // The loader usually relocates the dynamic section in place, but not always (e.g. the vDSO's).
+    const auto address = [base](ElfW(Addr) ptr) { return ptr < base ? base + ptr : ptr; };
+    ElfW(Addr) jmprel{};
+    size_t pltrelsz{};
+    ElfW(Sxword) pltrel{};
+    ElfW(Addr) rela{};
+    size_t relasz{};
+    ElfW(Addr) rel{};
+    size_t relsz{};
+
+    for (auto dyn = dynamic; dyn->d_tag != DT_NULL; ++dyn) {
+        switch (dyn->d_tag) {
+        case DT_SYMTAB:
+            module.symtab = reinterpret_cast<const ElfW(Sym)*>(address(dyn->d_un.d_ptr));
+            break;
+        case DT_STRTAB:
+            module.strtab = reinterpret_cast<const char*>(address(dyn->d_un.d_ptr));
+            break;
+        case DT_VERSYM:
+            module.versym = reinterpret_cast<const ElfW(Half)*>(address(dyn->d_un.d_ptr));
+            break;
+        case DT_VERNEED:
+            module.verneed = reinterpret_cast<const ElfW(Verneed)*>(address(dyn->d_un.d_ptr));
+            break;
+        case DT_JMPREL:
+            jmprel = address(dyn->d_un.d_ptr);
+            break;
+        case DT_PLTRELSZ:
+            pltrelsz = dyn->d_un.d_val;
+            break;
+        case DT_PLTREL:
+            pltrel = static_cast<ElfW(Sxword)>(dyn->d_un.d_val);
+            break;
+        case DT_RELA:
+            rela = address(dyn->d_un.d_ptr);
+            break;
+        case DT_RELASZ:
+            relasz = dyn->d_un.d_val;
+            break;
+        case DT_REL:
+            rel = address(dyn->d_un.d_ptr);
+            break;
+        case DT_RELSZ:
+            relsz = dyn->d_un.d_val;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (module.symtab == nullptr || module.strtab == nullptr) {
+        return 0;
+    }
+
+    if (jmprel != 0 && pltrel == DT_RELA) {
+        find_imports(find, module, reinterpret_cast<const ElfW(Rela)*>(jmprel), pltrelsz);
+    } else if (jmprel != 0 && pltrel == DT_REL) {
+        find_imports(find, module, reinterpret_cast<const ElfW(Rel)*>(jmprel), pltrelsz);
+    }
+
+    if (rela != 0) {
+        find_imports(find, module, reinterpret_cast<const ElfW(Rela)*>(rela), relasz);
+    }
+
+    if (rel != 0) {
+        find_imports(find, module, reinterpret_cast<const ElfW(Rel)*>(rel), relsz);
+    }
+
+    return 0;
+}
+
+void* lookup_symbol(void* handle, const std::string& symbol, const char* version) {
+#if defined(__GLIBC__)
+    if (version != nullptr) {
+        return dlvsym(handle, symbol.c_str(), version);
+    }
+#else
+    (void)version;
+#endif
+
+    return dlsym(handle, symbol.c_str());
+}
+
+// Returns the function a GOT entry calls given its value before it was hooked.
+uint8_t* resolve_entry(const ImportEntry& entry, uint8_t* value, std::string_view symbol) {
+    // Entries of lazily bound imports still point at the module's own PLT until the first call binds them. Anything
+    // else is the function the loader bound the entry to, taking the module's symbol versions, RTLD_LOCAL and
+    // RTLD_DEEPBIND into account, so it's the original as is.
+    const auto is_lazy = entry.is_jump_slot && value >= entry.module_start && value < entry.module_end &&
+                         value != entry.definition;
+
+    if (!is_lazy) {
+        return value;
+    }
+
+    // The PLT would jump through the hooked entry, ask the loader for the version of the function the module needs
+    // instead. The global scope is searched first, then the module's own dependencies for RTLD_LOCAL modules.
+    const std::string name{symbol};
+
+    if (auto* function = lookup_symbol(RTLD_DEFAULT, name, entry.version); function != nullptr) {
+        return static_cast<uint8_t*>(function);
+    }
+
+    // The main program's name is empty, and its handle is the global scope searched above.
+    if (entry.module_name == nullptr || entry.module_name[0] == '\0') {
+        return nullptr;
+    }
+
+    auto* handle = dlopen(entry.module_name, RTLD_LAZY | RTLD_NOLOAD);
+
+    if (handle == nullptr) {
+        return nullptr;
+    }
+
+    auto* function = lookup_symbol(handle, name, entry.version);
+
+    dlclose(handle);
+
+    return static_cast<uint8_t*>(function);
+}
+} // namespace
+#endif
+
+// Swaps a GOT entry atomically, unprotecting it first if it's in the read-only after relocation segment.
+static bool store_entry(uint8_t** address, uint8_t* value, bool is_relro) {
+    if (!is_relro) {
+        std::atomic_ref{*address}.store(value);
+        return true;
+    }
+
+    auto unprotected = unprotect(reinterpret_cast<uint8_t*>(address), sizeof(uint8_t*));
+
+    if (!unprotected) {
+        return false;
+    }
+
+    std::atomic_ref{*address}.store(value);
+
+    return true;
+}
+
+std::expected<ImportHook, ImportHook::Error> ImportHook::create(
+    std::string_view symbol, void* destination, void* module) {
+#if SAFETYHOOK_OS_LINUX
+    ImportHook hook{};
+    FindImports find{symbol, static_cast<uint8_t*>(module)};
+
+    hook.m_destination = static_cast<uint8_t*>(destination);
+    dl_iterate_phdr(find_module_imports, &find);
+
+    if (find.entries.empty()) {
+        return std::unexpected{Error::import_not_found()};
+    }
+
+    for (const auto& entry : find.entries) {
+        const auto original = std::atomic_ref{*entry.address}.load();
+
+        if (!store_entry(entry.address, hook.m_destination, entry.is_relro)) {
+            return std::unexpected{Error::failed_to_unprotect(reinterpret_cast<uint8_t*>(entry.address))};
+        }
+
+        hook.m_entries.emplace_back(entry.address, original, entry.is_relro);
+
+        if (hook.m_original == nullptr) {
+            hook.m_original = resolve_entry(entry, original, symbol);
+        }
+    }
+
+    return hook;
+#else
+    (void)symbol;
+    (void)destination;
+    (void)module;
+    return std::unexpected{Error::unsupported()};
+#endif
+}
+
+ImportHook::ImportHook(ImportHook&& other) noexcept {
+    *this = std::move(other);
+}
+
+ImportHook& ImportHook::operator=(ImportHook&& other) noexcept {
+    if (this != &other) {
+        destroy();
+
+        m_entries = std::move(other.m_entries);
+        m_original = other.m_original;
+        m_destination = other.m_destination;
+
+        other.m_entries.clear();
+        other.m_original = nullptr;
+        other.m_destination = nullptr;
+    }
+
+    return *this;
+}
+
+ImportHook::~ImportHook() {
+    destroy();
+}
+
+void ImportHook::reset() {
+    *this = {};
+}
+
+void ImportHook::destroy() {
+    for (const auto& entry : m_entries) {
+        // Leave entries that were hooked again after us alone.
+        if (std::atomic_ref{*entry.address}.load() == m_destination) {
+            store_entry(entry.address, entry.original, entry.is_relro);
+        }
+    }
+
+    m_entries.clear();
+    m_original = nullptr;
+    m_destination = nullptr;
+}
+} // namespace safetyhook
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <atomic>
 #include <iterator>
 #include <optional>
 
@@ -11,6 +13,8 @@
 
 #include "safetyhook/allocator.hpp"
 #include "safetyhook/common.hpp"
+#include "safetyhook/internal/code_buffer.hpp"
+#include "safetyhook/internal/metrics.hpp"
 #include "safetyhook/os.hpp"
 #include "safetyhook/utility.hpp"
 
@@ -98,6 +102,98 @@ constexpr auto make_jmp_e9(uint8_t* src, uint8_t* dst) {
     return {};
 }
 
+// Hit counters are split into shards, each on its own cache line. A hit increments the shard picked by hashing the
+// address of the thread's block, so threads mostly increment different cache lines.
+constexpr size_t HIT_COUNTER_SHARD_BITS = 4;
+constexpr size_t HIT_COUNTER_SHARDS = size_t{1} << HIT_COUNTER_SHARD_BITS;
+constexpr size_t HIT_COUNTER_SHARD_SIZE = 64;
+constexpr uint32_t HIT_COUNTER_HASH = 0x7FEB352D;
+constexpr size_t HIT_COUNTER_STUB_SIZE = 48 + sizeof(uintptr_t) * 2;
+
+struct HitCounterEntry {
+    uint8_t* target;
+    uint8_t* shards;
+};
+
+static std::mutex g_hit_counters_mutex{};
+static std::vector<HitCounterEntry> g_hit_counters{};
+
+static uint64_t sum_hit_counter_shards(uint8_t* shards) {
+    uint64_t hits{};
+
+    for (size_t i = 0; i < HIT_COUNTER_SHARDS; ++i) {
+        auto& shard = *reinterpret_cast<uint64_t*>(shards + i * HIT_COUNTER_SHARD_SIZE);
+        hits += std::atomic_ref{shard}.load(std::memory_order_relaxed);
+    }
+
+    return hits;
+}
+
+static void clear_hit_counter_shards(uint8_t* shards) {
+    for (size_t i = 0; i < HIT_COUNTER_SHARDS; ++i) {
+        auto& shard = *reinterpret_cast<uint64_t*>(shards + i * HIT_COUNTER_SHARD_SIZE);
+        std::atomic_ref{shard}.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Emits the code a hooked target enters before the destination: it picks a shard, increments it and jumps to the
+// destination. It changes the arithmetic flags but no registers.
+static void emit_hit_counter_stub(uint8_t* stub, uint8_t* destination, uint8_t* shards) {
+    constexpr auto shard_shift = static_cast<uint8_t>(sizeof(uintptr_t) * 8 - HIT_COUNTER_SHARD_BITS - 6);
+    constexpr auto shard_mask = static_cast<uint32_t>((HIT_COUNTER_SHARDS - 1) * HIT_COUNTER_SHARD_SIZE);
+    CodeBuffer buf{};
+
+    buf.emit({0x50});                           // push xax
+    buf.emit({THREAD_SEGMENT_PREFIX});          // mov xax, seg:[self]
+#if SAFETYHOOK_ARCH_X86_64
+    buf.emit({0x48, 0x8B, 0x04, 0x25});
+#elif SAFETYHOOK_ARCH_X86_32
+    buf.emit({0xA1});
+#endif
+    buf.emit_value(static_cast<uint32_t>(THREAD_SELF_OFFSET));
+#if SAFETYHOOK_ARCH_X86_64
+    buf.emit({0x48});
+#endif
+    buf.emit({0x69, 0xC0}); // imul xax, xax, hash
+    buf.emit_value(HIT_COUNTER_HASH);
+#if SAFETYHOOK_ARCH_X86_64
+    buf.emit({0x48});
+#endif
+    buf.emit({0xC1, 0xE8, shard_shift}); // shr xax, shard_shift
+    buf.emit({0x25});                    // and eax, shard_mask
+    buf.emit_value(shard_mask);
+
+#if SAFETYHOOK_ARCH_X86_64
+    // The shards and destination addresses are stored after the code.
+    constexpr uint32_t data_offset = 48;
+
+    buf.emit({0x48, 0x03, 0x05}); // add rax, [rip + shards]
+    buf.emit_value(data_offset - static_cast<uint32_t>(buf.code.size() + 4));
+    buf.emit({0xF0, 0x48, 0xFF, 0x00}); // lock inc qword [rax]
+    buf.emit({0x58});                   // pop rax
+    buf.emit({0xFF, 0x25});             // jmp [rip + destination]
+    buf.emit_value(data_offset + 8 - static_cast<uint32_t>(buf.code.size() + 4));
+
+    buf.code.resize(data_offset, 0xCC);
+    buf.code.resize(data_offset + sizeof(uintptr_t) * 2);
+    store(buf.code.data() + data_offset, shards);
+    store(buf.code.data() + data_offset + sizeof(uintptr_t), destination);
+#elif SAFETYHOOK_ARCH_X86_32
+    // The counters are 64 bits, the carry out of the low half is added to the high half.
+    buf.emit({0xF0, 0x83, 0x80}); // lock add dword [eax + shards], 1
+    buf.emit_value(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(shards)));
+    buf.emit({0x01});
+    buf.emit({0x73, 0x07});       // jnc done
+    buf.emit({0xF0, 0xFF, 0x80}); // lock inc dword [eax + shards + 4]
+    buf.emit_value(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(shards + 4)));
+    buf.emit({0x58}); // done: pop eax
+    buf.emit({0xE9}); // jmp destination
+    buf.emit_value(static_cast<uint32_t>(destination - (stub + buf.code.size() + 4)));
+#endif
+
+    std::copy(buf.code.begin(), buf.code.end(), stub);
+}
+
 static bool decode(ZydisDecodedInstruction* ix, uint8_t* ip) {
     ZydisDecoder decoder{};
     ZyanStatus status;
@@ -112,7 +208,13 @@ static bool decode(ZydisDecodedInstruction* ix, uint8_t* ip) {
         return false;
     }
 
-    return ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(&decoder, nullptr, ip, 15, ix));
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(&decoder, nullptr, ip, 15, ix))) {
+        return false;
+    }
+
+    add_metric(Metric::INSTRUCTIONS_DECODED);
+
+    return true;
 }
 
 #if SAFETYHOOK_ARCH_X86_32
@@ -158,13 +260,35 @@ std::expected<InlineHook, InlineHook::Error> InlineHook::create(void* target, vo
 std::expected<InlineHook, InlineHook::Error> InlineHook::create(
     const std::shared_ptr<Allocator>& allocator, void* target, void* destination, Flags flags) {
     InlineHook hook{};
+    const auto hit_counter_stub_size = (flags & CountHits) != 0 ? HIT_COUNTER_STUB_SIZE : 0;
+    const auto latency_stub_size = (flags & MeasureLatency) != 0 ? LatencyProbe::STUB_SIZE : 0;
 
-    if (const auto setup_result =
-            hook.setup(allocator, reinterpret_cast<uint8_t*>(target), reinterpret_cast<uint8_t*>(destination));
+    if (const auto setup_result = hook.setup(allocator, reinterpret_cast<uint8_t*>(target),
+            reinterpret_cast<uint8_t*>(destination), hit_counter_stub_size + latency_stub_size);
         !setup_result) {
         return std::unexpected{setup_result.error()};
     }
 
+    // setup pointed the hook at the stub. With both flags the hit counting stub goes first and continues to the
+    // timing stub, which continues to the real destination.
+    auto* next = reinterpret_cast<uint8_t*>(destination);
+
+    if (latency_stub_size != 0) {
+        if (const auto result = hook.setup_latency_probe(hook.stub() + hit_counter_stub_size, next); !result) {
+            return std::unexpected{result.error()};
+        }
+
+        next = hook.stub() + hit_counter_stub_size;
+    }
+
+    if (hit_counter_stub_size != 0) {
+        if (const auto result = hook.setup_hit_counters(allocator, next); !result) {
+            return std::unexpected{result.error()};
+        }
+    }
+
+    hook.m_destination = reinterpret_cast<uint8_t*>(destination);
+
     if (!(flags & StartDisabled)) {
         if (auto enable_result = hook.enable(); !enable_result) {
             return std::unexpected{enable_result.error()};
@@ -187,6 +311,8 @@ InlineHook& InlineHook::operator=(InlineHook&& other) noexcept {
         m_target = other.m_target;
         m_destination = other.m_destination;
         m_trampoline = std::move(other.m_trampoline);
+        m_hit_counters = std::move(other.m_hit_counters);
+        m_latency_probe = std::move(other.m_latency_probe);
         m_trampoline_size = other.m_trampoline_size;
         m_original_bytes = std::move(other.m_original_bytes);
         m_enabled = other.m_enabled;
@@ -210,14 +336,16 @@ void InlineHook::reset() {
     *this = {};
 }
 
-std::expected<void, InlineHook::Error> InlineHook::setup(
-    const std::shared_ptr<Allocator>& allocator, uint8_t* target, uint8_t* destination) {
+std::expected<void, InlineHook::Error> InlineHook::setup(const std::shared_ptr<Allocator>& allocator,
+    uint8_t* target, uint8_t* destination, size_t stub_size, size_t stub_entry) {
     m_target = target;
     m_destination = destination;
 
-    if (auto e9_result = e9_hook(allocator); !e9_result) {
+    if (auto e9_result = e9_hook(allocator, stub_size, stub_entry); !e9_result) {
 #if SAFETYHOOK_ARCH_X86_64
-        if (auto ff_result = ff_hook(allocator); !ff_result) {
+        add_metric(Metric::E9_TO_FF_FALLBACKS);
+
+        if (auto ff_result = ff_hook(allocator, stub_size, stub_entry); !ff_result) {
             return ff_result;
         }
 #elif SAFETYHOOK_ARCH_X86_32
@@ -228,7 +356,90 @@ std::expected<void, InlineHook::Error> InlineHook::setup(
     return {};
 }
 
-std::expected<void, InlineHook::Error> InlineHook::e9_hook(const std::shared_ptr<Allocator>& allocator) {
+size_t InlineHook::stub_offset() const {
+    return align_up(m_trampoline_size, 16);
+}
+
+std::expected<void, InlineHook::Error> InlineHook::setup_hit_counters(
+    const std::shared_ptr<Allocator>& allocator, uint8_t* destination) {
+    // Data allocations are only aligned for fundamental types, the extra space lets the shards start on a cache line.
+    auto hit_counters = allocator->allocate_data(HIT_COUNTER_SHARDS * HIT_COUNTER_SHARD_SIZE + HIT_COUNTER_SHARD_SIZE);
+
+    if (!hit_counters) {
+        return std::unexpected{Error::bad_allocation(hit_counters.error())};
+    }
+
+    m_hit_counters = std::move(*hit_counters);
+
+    const auto shards = hit_counter_shards();
+
+    clear_hit_counter_shards(shards);
+    emit_hit_counter_stub(stub(), destination, shards);
+
+    std::scoped_lock lock{g_hit_counters_mutex};
+    g_hit_counters.push_back({m_target, shards});
+
+    return {};
+}
+
+std::expected<void, InlineHook::Error> InlineHook::setup_latency_probe(uint8_t* stub, uint8_t* destination) {
+    auto probe = LatencyProbe::create();
+
+    if (!probe) {
+        return std::unexpected{Error::bad_latency_probe(probe.error())};
+    }
+
+    m_latency_probe = std::move(*probe);
+    m_latency_probe.emit_stub(stub, destination);
+
+    return {};
+}
+
+uint8_t* InlineHook::hit_counter_shards() const {
+    return align_up(m_hit_counters.data(), HIT_COUNTER_SHARD_SIZE);
+}
+
+uint64_t InlineHook::hits() const {
+    return m_hit_counters ? sum_hit_counter_shards(hit_counter_shards()) : 0;
+}
+
+void InlineHook::reset_hits() {
+    if (m_hit_counters) {
+        clear_hit_counter_shards(hit_counter_shards());
+    }
+}
+
+std::vector<InlineHook::HitCount> InlineHook::hit_counts() {
+    std::scoped_lock lock{g_hit_counters_mutex};
+    std::vector<HitCount> hit_counts{};
+
+    hit_counts.reserve(g_hit_counters.size());
+
+    for (const auto& [target, shards] : g_hit_counters) {
+        hit_counts.push_back({target, sum_hit_counter_shards(shards)});
+    }
+
+    return hit_counts;
+}
+
+void InlineHook::reset_hit_counts() {
+    std::scoped_lock lock{g_hit_counters_mutex};
+
+    for (const auto& entry : g_hit_counters) {
+        clear_hit_counter_shards(entry.shards);
+    }
+}
+
+LatencyHistogram InlineHook::latencies() const {
+    return m_latency_probe.histogram();
+}
+
+void InlineHook::reset_latencies() {
+    m_latency_probe.reset();
+}
+
+std::expected<void, InlineHook::Error> InlineHook::e9_hook(
+    const std::shared_ptr<Allocator>& allocator, size_t stub_size, size_t stub_entry) {
     m_original_bytes.clear();
     m_trampoline_size = sizeof(TrampolineEpilogueE9);
 
@@ -266,7 +477,8 @@ std::expected<void, InlineHook::Error> InlineHook::e9_hook(const std::shared_ptr
         }
     }
 
-    auto trampoline_allocation = allocator->allocate_near(desired_addresses, m_trampoline_size);
+    const auto allocation_size = stub_size != 0 ? stub_offset() + stub_size : m_trampoline_size;
+    auto trampoline_allocation = allocator->allocate_near(desired_addresses, allocation_size);
 
     if (!trampoline_allocation) {
         return std::unexpected{Error::bad_allocation(trampoline_allocation.error())};
@@ -274,6 +486,10 @@ std::expected<void, InlineHook::Error> InlineHook::e9_hook(const std::shared_ptr
 
     m_trampoline = std::move(*trampoline_allocation);
 
+    if (stub_size != 0) {
+        m_destination = stub() + stub_entry;
+    }
+
     for (auto ip = m_target, tramp_ip = m_trampoline.data(); ip < m_target + m_original_bytes.size(); ip += ix.length) {
         if (!decode(&ix, ip)) {
             m_trampoline.free();
@@ -366,7 +582,8 @@ std::expected<void, InlineHook::Error> InlineHook::e9_hook(const std::shared_ptr
 }
 
 #if SAFETYHOOK_ARCH_X86_64
-std::expected<void, InlineHook::Error> InlineHook::ff_hook(const std::shared_ptr<Allocator>& allocator) {
+std::expected<void, InlineHook::Error> InlineHook::ff_hook(
+    const std::shared_ptr<Allocator>& allocator, size_t stub_size, size_t stub_entry) {
     m_original_bytes.clear();
     m_trampoline_size = sizeof(TrampolineEpilogueFF);
     ZydisDecodedInstruction ix{};
@@ -387,7 +604,8 @@ std::expected<void, InlineHook::Error> InlineHook::ff_hook(const std::shared_ptr
         m_trampoline_size += ix.length;
     }
 
-    auto trampoline_allocation = allocator->allocate(m_trampoline_size);
+    const auto allocation_size = stub_size != 0 ? stub_offset() + stub_size : m_trampoline_size;
+    auto trampoline_allocation = allocator->allocate(allocation_size);
 
     if (!trampoline_allocation) {
         return std::unexpected{Error::bad_allocation(trampoline_allocation.error())};
@@ -395,6 +613,10 @@ std::expected<void, InlineHook::Error> InlineHook::ff_hook(const std::shared_ptr
 
     m_trampoline = std::move(*trampoline_allocation);
 
+    if (stub_size != 0) {
+        m_destination = stub() + stub_entry;
+    }
+
     std::copy(m_original_bytes.begin(), m_original_bytes.end(), m_trampoline.data());
 
     const auto trampoline_epilogue =
@@ -439,7 +661,9 @@ std::expected<void, InlineHook::Error> InlineHook::enable() {
 
 #if SAFETYHOOK_ARCH_X86_64
         if (m_type == Type::FF) {
-            if (auto result = emit_jmp_ff(m_target, m_destination, m_target + sizeof(JmpFF), m_original_bytes.size());
+            const auto entry = m_hit_counters || m_latency_probe ? stub() : m_destination;
+
+            if (auto result = emit_jmp_ff(m_target, entry, m_target + sizeof(JmpFF), m_original_bytes.size());
                 !result) {
                 error = result.error();
             }
@@ -480,6 +704,13 @@ void InlineHook::destroy() {
         return;
     }
 
+    if (m_hit_counters) {
+        std::scoped_lock hit_counters_lock{g_hit_counters_mutex};
+        std::erase_if(g_hit_counters, [this](const auto& entry) { return entry.shards == hit_counter_shards(); });
+    }
+
     m_trampoline.free();
+    m_hit_counters.free();
+    m_latency_probe = {};
 }
 } // namespace safetyhook
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "safetyhook/allocator.hpp"
+#include "safetyhook/common.hpp"
+#include "safetyhook/internal/shadow_stack.hpp"
+
+#if SAFETYHOOK_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "safetyhook/latency.hpp"
+
+namespace safetyhook {
+size_t LatencyHistogram::bucket_index(uint64_t ticks) {
+    if (ticks < SUB_BUCKETS) {
+        return static_cast<size_t>(ticks);
+    }
+
+    // The top SUB_BUCKET_BITS + 1 bits of the duration pick the bucket within its power of two.
+    const auto exponent = static_cast<size_t>(std::bit_width(ticks)) - 1;
+    const auto shift = exponent - SUB_BUCKET_BITS;
+
+    return (shift + 1) * SUB_BUCKETS + static_cast<size_t>((ticks >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::bucket_lower_bound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    const auto shift = index / SUB_BUCKETS - 1;
+
+    return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    const auto shift = index / SUB_BUCKETS - 1;
+
+    return bucket_lower_bound(index) + ((uint64_t{1} << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t ticks, uint64_t count) {
+    m_buckets[bucket_index(ticks)] += count;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        m_buckets[i] += other.m_buckets[i];
+    }
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t count{};
+
+    for (const auto bucket : m_buckets) {
+        count += bucket;
+    }
+
+    return count;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const {
+    const auto total = count();
+
+    if (total == 0) {
+        return 0;
+    }
+
+    const auto rank = std::clamp(percentile, 0.0, 100.0) / 100.0 * static_cast<double>(total);
+    const auto target = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(rank)), 1);
+    uint64_t seen{};
+
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        seen += m_buckets[i];
+
+        if (seen >= target) {
+            return bucket_upper_bound(i);
+        }
+    }
+
+    return bucket_upper_bound(NUM_BUCKETS - 1);
+}
+
+// A probe's key (see next_shadow_stack_key) has its index in g_latency_keys in the low bits.
+constexpr uint32_t LATENCY_INDEX_BITS = 12;
+constexpr uint32_t LATENCY_INDEX_MASK = (1u << LATENCY_INDEX_BITS) - 1;
+
+static_assert(LatencyProbe::MAX_PROBES == size_t{1} << LATENCY_INDEX_BITS);
+
+struct LatencyFrame {
+    uintptr_t return_address;
+    uint64_t start;
+    uint32_t key;
+};
+
+// The histograms of one thread, by probe key. The mutex is only contended while the histograms are being read.
+struct ThreadLatencies {
+    std::mutex mutex{};
+    std::unordered_map<uint32_t, LatencyHistogram> histograms{};
+
+    ThreadLatencies();
+    ThreadLatencies(const ThreadLatencies&) = delete;
+    ThreadLatencies& operator=(const ThreadLatencies&) = delete;
+    ~ThreadLatencies();
+};
+
+struct LatencyRegistry {
+    std::mutex mutex{};
+    std::vector<ThreadLatencies*> threads{};
+    std::unordered_map<uint32_t, LatencyHistogram> exited{}; // Histograms of the threads that exited, by probe key.
+    uint32_t generation{};
+    Allocation exit_stub{};
+};
+
+static LatencyRegistry& latency_registry() {
+    return never_destroyed<LatencyRegistry>();
+}
+
+// The key of the live probe at each index, 0 for free indices.
+static std::array<std::atomic_uint32_t, LatencyProbe::MAX_PROBES> g_latency_keys{};
+static std::atomic<uint8_t*> g_latency_exit_stub{};
+
+// Set while safetyhook records or reads durations on the thread, so timed calls made meanwhile (a timed allocator,
+// for example) aren't timed instead of recursing.
+static thread_local bool t_latency_busy{};
+static thread_local size_t t_latency_depth{};
+static thread_local LatencyFrame t_latency_frames[LatencyProbe::MAX_DEPTH]{};
+static thread_local std::unique_ptr<ThreadLatencies> t_latencies{};
+
+struct LatencyBusyScope {
+    bool was_busy{std::exchange(t_latency_busy, true)};
+
+    LatencyBusyScope() = default;
+    LatencyBusyScope(const LatencyBusyScope&) = delete;
+    LatencyBusyScope& operator=(const LatencyBusyScope&) = delete;
+    ~LatencyBusyScope() { t_latency_busy = was_busy; }
+};
+
+static bool is_live_latency_key(uint32_t key) {
+    return g_latency_keys[key & LATENCY_INDEX_MASK].load(std::memory_order_relaxed) == key;
+}
+
+ThreadLatencies::ThreadLatencies() {
+    auto& registry = latency_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    registry.threads.push_back(this);
+}
+
+ThreadLatencies::~ThreadLatencies() {
+    LatencyBusyScope busy{};
+    auto& registry = latency_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    std::erase(registry.threads, this);
+
+    for (const auto& [key, histogram] : histograms) {
+        if (is_live_latency_key(key)) {
+            registry.exited[key].merge(histogram);
+        }
+    }
+}
+
+// Called by a probe's stub with the address of the return address of the call. Returns without timing the call if
+// the shadow stack is full, otherwise the return address is swapped for the exit stub.
+static void SAFETYHOOK_CCALL latency_enter(uint32_t key, uintptr_t* return_address) {
+    if (t_latency_busy || t_latency_depth == LatencyProbe::MAX_DEPTH) {
+        return;
+    }
+
+    auto& frame = t_latency_frames[t_latency_depth++];
+
+    frame.return_address = *return_address;
+    frame.key = key;
+    *return_address = reinterpret_cast<uintptr_t>(g_latency_exit_stub.load(std::memory_order_relaxed));
+    frame.start = __rdtsc();
+}
+
+// Called by the exit stub when a timed call returns. Returns the original return address.
+static uintptr_t SAFETYHOOK_CCALL latency_exit() {
+    const auto end = __rdtsc();
+    const auto frame = t_latency_frames[--t_latency_depth];
+
+    if (!t_latency_busy && is_live_latency_key(frame.key)) {
+        LatencyBusyScope busy{};
+
+        if (!t_latencies) {
+            t_latencies = std::make_unique<ThreadLatencies>();
+        }
+
+        std::scoped_lock lock{t_latencies->mutex};
+        t_latencies->histograms[frame.key].record(end - frame.start);
+    }
+
+    return frame.return_address;
+}
+
+std::expected<LatencyProbe, LatencyProbe::Error> LatencyProbe::create() {
+    LatencyBusyScope busy{};
+    auto& registry = latency_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    if (!registry.exit_stub) {
+        auto exit_stub = allocate_shadow_stack_exit_stub(&latency_exit);
+
+        if (!exit_stub) {
+            return std::unexpected{Error::BAD_ALLOCATION};
+        }
+
+        registry.exit_stub = std::move(*exit_stub);
+        g_latency_exit_stub.store(registry.exit_stub.data(), std::memory_order_relaxed);
+    }
+
+    const auto free_key = std::find_if(g_latency_keys.begin(), g_latency_keys.end(),
+        [](const auto& key) { return key.load(std::memory_order_relaxed) == 0; });
+
+    if (free_key == g_latency_keys.end()) {
+        return std::unexpected{Error::TOO_MANY_PROBES};
+    }
+
+    LatencyProbe probe{};
+
+    probe.m_key = next_shadow_stack_key(
+        registry.generation, LATENCY_INDEX_BITS, static_cast<size_t>(std::distance(g_latency_keys.begin(), free_key)));
+    free_key->store(probe.m_key, std::memory_order_relaxed);
+
+    return probe;
+}
+
+LatencyProbe::LatencyProbe(LatencyProbe&& other) noexcept {
+    *this = std::move(other);
+}
+
+LatencyProbe& LatencyProbe::operator=(LatencyProbe&& other) noexcept {
+    if (this != &other) {
+        destroy();
+        m_key = std::exchange(other.m_key, 0);
+    }
+
+    return *this;
+}
+
+LatencyProbe::~LatencyProbe() {
+    destroy();
+}
+
+void LatencyProbe::destroy() {
+    if (m_key == 0) {
+        return;
+    }
+
+    LatencyBusyScope busy{};
+    auto& registry = latency_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    g_latency_keys[m_key & LATENCY_INDEX_MASK].store(0, std::memory_order_relaxed);
+    registry.exited.erase(m_key);
+
+    for (auto* thread : registry.threads) {
+        std::scoped_lock thread_lock{thread->mutex};
+        thread->histograms.erase(m_key);
+    }
+
+    m_key = 0;
+}
+
+void LatencyProbe::emit_stub(uint8_t* stub, uint8_t* destination) const {
+    emit_shadow_stack_entry_stub(stub, STUB_SIZE, reinterpret_cast<void*>(&latency_enter), {m_key}, destination);
+}
+
+LatencyHistogram LatencyProbe::histogram() const {
+    LatencyHistogram histogram{};
+
+    if (m_key == 0) {
+        return histogram;
+    }
+
+    LatencyBusyScope busy{};
+    auto& registry = latency_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    if (const auto exited = registry.exited.find(m_key); exited != registry.exited.end()) {
+        histogram.merge(exited->second);
+    }
+
+    for (auto* thread : registry.threads) {
+        std::scoped_lock thread_lock{thread->mutex};
+
+        if (const auto it = thread->histograms.find(m_key); it != thread->histograms.end()) {
+            histogram.merge(it->second);
+        }
+    }
+
+    return histogram;
+}
+
+void LatencyProbe::reset() {
+    if (m_key == 0) {
+        return;
+    }
+
+    LatencyBusyScope busy{};
+    auto& registry = latency_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    registry.exited.erase(m_key);
+
+    for (auto* thread : registry.threads) {
+        std::scoped_lock thread_lock{thread->mutex};
+
+        if (const auto it = thread->histograms.find(m_key); it != thread->histograms.end()) {
+            it->second.clear();
+        }
+    }
+}
+} // namespace safetyhook
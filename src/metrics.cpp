@@ -0,0 +1,50 @@
+#include <array>
+#include <atomic>
+#include <cstring>
+
+#include "safetyhook/internal/metrics.hpp"
+
+#include "safetyhook/metrics.hpp"
+
+namespace safetyhook {
+static_assert(sizeof(Metrics) == static_cast<size_t>(Metric::COUNT) * sizeof(uint64_t));
+
+#if SAFETYHOOK_METRICS
+// Each metric is on its own cache line so threads updating different metrics don't contend.
+struct alignas(64) MetricCell {
+    std::atomic_uint64_t value{};
+};
+
+static std::array<MetricCell, static_cast<size_t>(Metric::COUNT)> g_metric_cells{};
+
+void add_metric(Metric metric, uint64_t value) noexcept {
+    g_metric_cells[static_cast<size_t>(metric)].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+Metrics metrics() {
+    std::array<uint64_t, static_cast<size_t>(Metric::COUNT)> values{};
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = g_metric_cells[i].value.load(std::memory_order_relaxed);
+    }
+
+    Metrics result{};
+    std::memcpy(&result, values.data(), sizeof(result));
+
+    return result;
+}
+
+void reset_metrics() {
+    for (auto& cell : g_metric_cells) {
+        cell.value.store(0, std::memory_order_relaxed);
+    }
+}
+#else
+Metrics metrics() {
+    return {};
+}
+
+void reset_metrics() {
+}
+#endif
+} // namespace safetyhook
@@ -1,8 +1,15 @@
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
 
 #include "safetyhook/allocator.hpp"
 #include "safetyhook/inline_hook.hpp"
+#include "safetyhook/internal/code_buffer.hpp"
+#include "safetyhook/os.hpp"
 #include "safetyhook/utility.hpp"
 
 #include "safetyhook/mid_hook.hpp"
@@ -11,7 +18,7 @@ namespace safetyhook {
 
 #if SAFETYHOOK_ARCH_X86_64
 #if SAFETYHOOK_OS_WINDOWS
-constexpr std::array<uint8_t, 391> asm_data = {0xFF, 0x35, 0x79, 0x01, 0x00, 0x00, 0x54, 0x54, 0x55, 0x50, 0x53, 0x51,
+constexpr std::array<uint8_t, 461> asm_data = {0xFF, 0x35, 0xBF, 0x01, 0x00, 0x00, 0x54, 0x54, 0x55, 0x50, 0x53, 0x51,
     0x52, 0x56, 0x57, 0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,
     0x9C, 0x48, 0x81, 0xEC, 0x00, 0x01, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x7F, 0xBC, 0x24, 0xF0, 0x00, 0x00, 0x00, 0xF3,
     0x44, 0x0F, 0x7F, 0xB4, 0x24, 0xE0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x7F, 0xAC, 0x24, 0xD0, 0x00, 0x00, 0x00,
@@ -22,18 +29,22 @@ constexpr std::array<uint8_t, 391> asm_data = {0xFF, 0x35, 0x79, 0x01, 0x00, 0x0
     0x7F, 0x5C, 0x24, 0x30, 0xF3, 0x0F, 0x7F, 0x54, 0x24, 0x20, 0xF3, 0x0F, 0x7F, 0x4C, 0x24, 0x10, 0xF3, 0x0F, 0x7F,
     0x04, 0x24, 0x48, 0x8B, 0x8C, 0x24, 0x80, 0x01, 0x00, 0x00, 0x48, 0x83, 0xC1, 0x10, 0x48, 0x89, 0x8C, 0x24, 0x80,
     0x01, 0x00, 0x00, 0x48, 0x8D, 0x0C, 0x24, 0x48, 0x89, 0xE3, 0x48, 0x83, 0xEC, 0x30, 0x48, 0x83, 0xE4, 0xF0, 0xFF,
-    0x15, 0xA8, 0x00, 0x00, 0x00, 0x48, 0x89, 0xDC, 0xF3, 0x0F, 0x6F, 0x04, 0x24, 0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x10,
+    0x15, 0xEE, 0x00, 0x00, 0x00, 0x48, 0x89, 0xDC, 0xF3, 0x0F, 0x6F, 0x04, 0x24, 0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x10,
     0xF3, 0x0F, 0x6F, 0x54, 0x24, 0x20, 0xF3, 0x0F, 0x6F, 0x5C, 0x24, 0x30, 0xF3, 0x0F, 0x6F, 0x64, 0x24, 0x40, 0xF3,
     0x0F, 0x6F, 0x6C, 0x24, 0x50, 0xF3, 0x0F, 0x6F, 0x74, 0x24, 0x60, 0xF3, 0x0F, 0x6F, 0x7C, 0x24, 0x70, 0xF3, 0x44,
     0x0F, 0x6F, 0x84, 0x24, 0x80, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0x8C, 0x24, 0x90, 0x00, 0x00, 0x00, 0xF3,
     0x44, 0x0F, 0x6F, 0x94, 0x24, 0xA0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0x9C, 0x24, 0xB0, 0x00, 0x00, 0x00,
     0xF3, 0x44, 0x0F, 0x6F, 0xA4, 0x24, 0xC0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0xAC, 0x24, 0xD0, 0x00, 0x00,
     0x00, 0xF3, 0x44, 0x0F, 0x6F, 0xB4, 0x24, 0xE0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0xBC, 0x24, 0xF0, 0x00,
-    0x00, 0x00, 0x48, 0x81, 0xC4, 0x00, 0x01, 0x00, 0x00, 0x9D, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x41,
-    0x5B, 0x41, 0x5A, 0x41, 0x59, 0x41, 0x58, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x48, 0x8D, 0x64, 0x24, 0x08,
-    0x5C, 0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    0x00, 0x00, 0x48, 0x81, 0xC4, 0x00, 0x01, 0x00, 0x00, 0x48, 0x8D, 0x84, 0x24, 0x90, 0x00, 0x00, 0x00, 0x48, 0x3B,
+    0x84, 0x24, 0x88, 0x00, 0x00, 0x00, 0x75, 0x34, 0x48, 0x8B, 0x84, 0x24, 0x90, 0x00, 0x00, 0x00, 0x48, 0x3B, 0x05,
+    0x4C, 0x00, 0x00, 0x00, 0x75, 0x23, 0x9D, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x41, 0x5B, 0x41, 0x5A,
+    0x41, 0x59, 0x41, 0x58, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x48, 0x8D, 0x64, 0x24, 0x18, 0xFF, 0x25, 0x27,
+    0x00, 0x00, 0x00, 0x9D, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x41, 0x5B, 0x41, 0x5A, 0x41, 0x59, 0x41,
+    0x58, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x48, 0x8D, 0x64, 0x24, 0x08, 0x5C, 0xC3, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 #elif SAFETYHOOK_OS_LINUX
-constexpr std::array<uint8_t, 391> asm_data = {0xFF, 0x35, 0x79, 0x01, 0x00, 0x00, 0x54, 0x54, 0x55, 0x50, 0x53, 0x51,
+constexpr std::array<uint8_t, 461> asm_data = {0xFF, 0x35, 0xBF, 0x01, 0x00, 0x00, 0x54, 0x54, 0x55, 0x50, 0x53, 0x51,
     0x52, 0x56, 0x57, 0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,
     0x9C, 0x48, 0x81, 0xEC, 0x00, 0x01, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x7F, 0xBC, 0x24, 0xF0, 0x00, 0x00, 0x00, 0xF3,
     0x44, 0x0F, 0x7F, 0xB4, 0x24, 0xE0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x7F, 0xAC, 0x24, 0xD0, 0x00, 0x00, 0x00,
@@ -44,39 +55,574 @@ constexpr std::array<uint8_t, 391> asm_data = {0xFF, 0x35, 0x79, 0x01, 0x00, 0x0
     0x7F, 0x5C, 0x24, 0x30, 0xF3, 0x0F, 0x7F, 0x54, 0x24, 0x20, 0xF3, 0x0F, 0x7F, 0x4C, 0x24, 0x10, 0xF3, 0x0F, 0x7F,
     0x04, 0x24, 0x48, 0x8B, 0xBC, 0x24, 0x80, 0x01, 0x00, 0x00, 0x48, 0x83, 0xC7, 0x10, 0x48, 0x89, 0xBC, 0x24, 0x80,
     0x01, 0x00, 0x00, 0x48, 0x8D, 0x3C, 0x24, 0x48, 0x89, 0xE3, 0x48, 0x83, 0xEC, 0x30, 0x48, 0x83, 0xE4, 0xF0, 0xFF,
-    0x15, 0xA8, 0x00, 0x00, 0x00, 0x48, 0x89, 0xDC, 0xF3, 0x0F, 0x6F, 0x04, 0x24, 0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x10,
+    0x15, 0xEE, 0x00, 0x00, 0x00, 0x48, 0x89, 0xDC, 0xF3, 0x0F, 0x6F, 0x04, 0x24, 0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x10,
     0xF3, 0x0F, 0x6F, 0x54, 0x24, 0x20, 0xF3, 0x0F, 0x6F, 0x5C, 0x24, 0x30, 0xF3, 0x0F, 0x6F, 0x64, 0x24, 0x40, 0xF3,
     0x0F, 0x6F, 0x6C, 0x24, 0x50, 0xF3, 0x0F, 0x6F, 0x74, 0x24, 0x60, 0xF3, 0x0F, 0x6F, 0x7C, 0x24, 0x70, 0xF3, 0x44,
     0x0F, 0x6F, 0x84, 0x24, 0x80, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0x8C, 0x24, 0x90, 0x00, 0x00, 0x00, 0xF3,
     0x44, 0x0F, 0x6F, 0x94, 0x24, 0xA0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0x9C, 0x24, 0xB0, 0x00, 0x00, 0x00,
     0xF3, 0x44, 0x0F, 0x6F, 0xA4, 0x24, 0xC0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0xAC, 0x24, 0xD0, 0x00, 0x00,
     0x00, 0xF3, 0x44, 0x0F, 0x6F, 0xB4, 0x24, 0xE0, 0x00, 0x00, 0x00, 0xF3, 0x44, 0x0F, 0x6F, 0xBC, 0x24, 0xF0, 0x00,
-    0x00, 0x00, 0x48, 0x81, 0xC4, 0x00, 0x01, 0x00, 0x00, 0x9D, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x41,
-    0x5B, 0x41, 0x5A, 0x41, 0x59, 0x41, 0x58, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x48, 0x8D, 0x64, 0x24, 0x08,
-    0x5C, 0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    0x00, 0x00, 0x48, 0x81, 0xC4, 0x00, 0x01, 0x00, 0x00, 0x48, 0x8D, 0x84, 0x24, 0x90, 0x00, 0x00, 0x00, 0x48, 0x3B,
+    0x84, 0x24, 0x88, 0x00, 0x00, 0x00, 0x75, 0x34, 0x48, 0x8B, 0x84, 0x24, 0x90, 0x00, 0x00, 0x00, 0x48, 0x3B, 0x05,
+    0x4C, 0x00, 0x00, 0x00, 0x75, 0x23, 0x9D, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x41, 0x5B, 0x41, 0x5A,
+    0x41, 0x59, 0x41, 0x58, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x48, 0x8D, 0x64, 0x24, 0x18, 0xFF, 0x25, 0x27,
+    0x00, 0x00, 0x00, 0x9D, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x41, 0x5B, 0x41, 0x5A, 0x41, 0x59, 0x41,
+    0x58, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x48, 0x8D, 0x64, 0x24, 0x08, 0x5C, 0xC3, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 #endif
 #elif SAFETYHOOK_ARCH_X86_32
-constexpr std::array<uint8_t, 171> asm_data = {0xFF, 0x35, 0xA7, 0x00, 0x00, 0x00, 0x54, 0x54, 0x55, 0x50, 0x53, 0x51,
+constexpr std::array<uint8_t, 211> asm_data = {0xFF, 0x35, 0xCF, 0x00, 0x00, 0x00, 0x54, 0x54, 0x55, 0x50, 0x53, 0x51,
     0x52, 0x56, 0x57, 0x9C, 0x81, 0xEC, 0x80, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x7F, 0x7C, 0x24, 0x70, 0xF3, 0x0F, 0x7F,
     0x74, 0x24, 0x60, 0xF3, 0x0F, 0x7F, 0x6C, 0x24, 0x50, 0xF3, 0x0F, 0x7F, 0x64, 0x24, 0x40, 0xF3, 0x0F, 0x7F, 0x5C,
     0x24, 0x30, 0xF3, 0x0F, 0x7F, 0x54, 0x24, 0x20, 0xF3, 0x0F, 0x7F, 0x4C, 0x24, 0x10, 0xF3, 0x0F, 0x7F, 0x04, 0x24,
     0x8B, 0x8C, 0x24, 0xA0, 0x00, 0x00, 0x00, 0x83, 0xC1, 0x08, 0x89, 0x8C, 0x24, 0xA0, 0x00, 0x00, 0x00, 0x54, 0xFF,
-    0x15, 0xA3, 0x00, 0x00, 0x00, 0x83, 0xC4, 0x04, 0xF3, 0x0F, 0x6F, 0x04, 0x24, 0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x10,
+    0x15, 0xCB, 0x00, 0x00, 0x00, 0x83, 0xC4, 0x04, 0xF3, 0x0F, 0x6F, 0x04, 0x24, 0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x10,
     0xF3, 0x0F, 0x6F, 0x54, 0x24, 0x20, 0xF3, 0x0F, 0x6F, 0x5C, 0x24, 0x30, 0xF3, 0x0F, 0x6F, 0x64, 0x24, 0x40, 0xF3,
     0x0F, 0x6F, 0x6C, 0x24, 0x50, 0xF3, 0x0F, 0x6F, 0x74, 0x24, 0x60, 0xF3, 0x0F, 0x6F, 0x7C, 0x24, 0x70, 0x81, 0xC4,
-    0x80, 0x00, 0x00, 0x00, 0x9D, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x8D, 0x64, 0x24, 0x04, 0x5C, 0xC3, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    0x80, 0x00, 0x00, 0x00, 0x8D, 0x44, 0x24, 0x28, 0x3B, 0x44, 0x24, 0x24, 0x75, 0x1E, 0x8B, 0x44, 0x24, 0x28, 0x3B,
+    0x05, 0xCF, 0x00, 0x00, 0x00, 0x75, 0x12, 0x9D, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x8D, 0x64, 0x24, 0x0C,
+    0xFF, 0x25, 0xCF, 0x00, 0x00, 0x00, 0x9D, 0x5F, 0x5E, 0x5A, 0x59, 0x5B, 0x58, 0x5D, 0x8D, 0x64, 0x24, 0x04, 0x5C,
+    0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 #endif
 
+// Code emitted in front of the stub to check a MidHook's filters, followed by the code that writes a record for
+// record-only hooks. Each check falls through to the next one (and finally into the stub) when its filter passes and
+// jumps to the trampoline when it fails. The thunk that saves the extended state goes first when it's needed. Operands
+// that can only be resolved once the stub has been allocated are recorded as fixups.
+struct StubCode : CodeBuffer {
+    enum class FixupType {
+        TRAMPOLINE, // Address of the trampoline, which shares the stub's allocation.
+        DATA,       // Address of one of the filter data slots stored after the stub.
+    };
+
+    struct Fixup {
+        size_t offset;
+        FixupType type;
+        size_t data_slot;
+    };
+
+    std::vector<Fixup> fixups{};
+
+    void emit_fixup(FixupType type, size_t data_slot = 0) {
+        fixups.push_back({code.size(), type, data_slot});
+        emit_value<uint32_t>(0);
+    }
+
+    // Emits a short jump with a placeholder displacement and returns the offset of the displacement.
+    size_t emit_jump8(uint8_t opcode) {
+        emit({opcode, 0x00});
+        return code.size() - 1;
+    }
+
+    // Points a short jump emitted by emit_jump8 at the current end of the code.
+    void bind_jump8(size_t displacement_offset) {
+        code[displacement_offset] = static_cast<uint8_t>(code.size() - (displacement_offset + 1));
+    }
+
+    void emit_jump_trampoline() {
+        emit({0xE9}); // jmp trampoline
+        emit_fixup(FixupType::TRAMPOLINE);
+    }
+};
+
+// The register number of xsp and the number of bytes a filter check pushes before reading registers or memory.
+constexpr uint8_t FILTER_SP = 4;
+constexpr uint8_t FILTER_PUSHED_SIZE = sizeof(uintptr_t) * 2;
+
+// Every filter owns two pointer sized data slots after the stub. REGISTER and MEMORY filters keep their mask and value
+// there (x86_64 only), SAMPLE filters keep their hit counter (unless it is per thread) and random number state.
+constexpr size_t FILTER_DATA_SLOTS = 2;
+
+static bool is_valid_filter(const MidHook::Filter& filter) {
+    const auto reg = static_cast<uint8_t>(filter.reg);
+
+    if (reg >= sizeof(uintptr_t) * 2 || filter.mask == 0) {
+        return false;
+    }
+
+    if (filter.type == MidHook::Filter::REGISTER) {
+        return true;
+    }
+
+    if (filter.type == MidHook::Filter::SAMPLE) {
+        // Random intervals are drawn from [1, 2 * value - 1] which has to fit in 32 bits.
+        return filter.value != 0 && filter.value <= (filter.random ? 0x80000000u : 0xFFFFFFFFu);
+    }
+
+    if (filter.type != MidHook::Filter::MEMORY) {
+        return false;
+    }
+
+    if (filter.size != 1 && filter.size != 2 && filter.size != 4 && filter.size != sizeof(uintptr_t)) {
+        return false;
+    }
+
+    return reg != FILTER_SP || filter.offset <= INT32_MAX - FILTER_PUSHED_SIZE;
+}
+
+// Emits a countdown of hits held in ecx. The filter passes when the counter reaches zero, at which point it's reloaded
+// with the number of hits to skip until the next pass. The common path doesn't touch the flags.
+static void emit_sample_filter(
+    StubCode& fc, const MidHook::Filter& filter, size_t filter_index, int32_t thread_slot) {
+    using FixupType = StubCode::FixupType;
+    const auto counter_slot = filter_index * FILTER_DATA_SLOTS;
+    const auto rng_slot = counter_slot + 1;
+
+    const auto emit_counter_access = [&](uint8_t opcode) {
+        if (filter.per_thread) {
+#if SAFETYHOOK_ARCH_X86_64
+            fc.emit({THREAD_SEGMENT_PREFIX, opcode, 0x0C, 0x25}); // [seg:disp32]
+#elif SAFETYHOOK_ARCH_X86_32
+            fc.emit({THREAD_SEGMENT_PREFIX, opcode, 0x0D}); // [seg:disp32]
+#endif
+            fc.emit_value(thread_slot);
+        } else {
+            fc.emit({opcode, 0x0D}); // [rip + counter] on x86_64, [counter] on x86_32
+            fc.emit_fixup(FixupType::DATA, counter_slot);
+        }
+    };
+
+    fc.emit({0x51});                            // push xcx
+    emit_counter_access(0x8B);                  // mov ecx, counter
+    const auto to_reload = fc.emit_jump8(0xE3); // jrcxz/jecxz reload
+    fc.emit({0x8D, 0x49, 0xFF});                // lea ecx, [xcx - 1]
+    emit_counter_access(0x89);                  // mov counter, ecx
+    fc.emit({0x59});                            // pop xcx
+
+    size_t to_pass{};
+
+    if (filter.negate) {
+        to_pass = fc.emit_jump8(0xEB); // jmp pass
+    } else {
+        fc.emit_jump_trampoline();
+    }
+
+    fc.bind_jump8(to_reload);
+
+    if (!filter.random) {
+        fc.emit({0xB9}); // mov ecx, interval - 1
+        fc.emit_value(static_cast<uint32_t>(filter.value - 1));
+    } else {
+        fc.emit({0x9C, 0x50, 0x52}); // pushf; push xax; push xdx
+
+        // Advance the xorshift state and scale it to [0, 2 * interval - 1) with a widening multiply.
+#if SAFETYHOOK_ARCH_X86_64
+        fc.emit({0x48, 0x8B, 0x05}); // mov rax, [rip + rng]
+        fc.emit_fixup(FixupType::DATA, rng_slot);
+        fc.emit({0x48, 0x89, 0xC2, 0x48, 0xC1, 0xE2, 0x0D, 0x48, 0x31, 0xD0}); // rax ^= rax << 13
+        fc.emit({0x48, 0x89, 0xC2, 0x48, 0xC1, 0xEA, 0x07, 0x48, 0x31, 0xD0}); // rax ^= rax >> 7
+        fc.emit({0x48, 0x89, 0xC2, 0x48, 0xC1, 0xE2, 0x11, 0x48, 0x31, 0xD0}); // rax ^= rax << 17
+        fc.emit({0x48, 0x89, 0x05});                                           // mov [rip + rng], rax
+        fc.emit_fixup(FixupType::DATA, rng_slot);
+        fc.emit({0xB9}); // mov ecx, 2 * interval - 1
+        fc.emit_value(static_cast<uint32_t>(filter.value * 2 - 1));
+        fc.emit({0x48, 0xF7, 0xE1}); // mul rcx
+#elif SAFETYHOOK_ARCH_X86_32
+        fc.emit({0xA1}); // mov eax, [rng]
+        fc.emit_fixup(FixupType::DATA, rng_slot);
+        fc.emit({0x89, 0xC2, 0xC1, 0xE2, 0x0D, 0x31, 0xD0}); // eax ^= eax << 13
+        fc.emit({0x89, 0xC2, 0xC1, 0xEA, 0x11, 0x31, 0xD0}); // eax ^= eax >> 17
+        fc.emit({0x89, 0xC2, 0xC1, 0xE2, 0x05, 0x31, 0xD0}); // eax ^= eax << 5
+        fc.emit({0xA3});                                     // mov [rng], eax
+        fc.emit_fixup(FixupType::DATA, rng_slot);
+        fc.emit({0xB9}); // mov ecx, 2 * interval - 1
+        fc.emit_value(static_cast<uint32_t>(filter.value * 2 - 1));
+        fc.emit({0xF7, 0xE1}); // mul ecx
+#endif
+
+        fc.emit({0x89, 0xD1, 0x5A, 0x58, 0x9D}); // mov ecx, edx; pop xdx; pop xax; popf
+    }
+
+    emit_counter_access(0x89); // mov counter, ecx
+    fc.emit({0x59});           // pop xcx
+
+    if (filter.negate) {
+        fc.emit_jump_trampoline();
+        fc.bind_jump8(to_pass);
+    }
+}
+
+static void emit_filter(StubCode& fc, const MidHook::Filter& filter, size_t filter_index, int32_t thread_slot) {
+    const auto reg = static_cast<uint8_t>(filter.reg);
+
+    if (filter.type == MidHook::Filter::SAMPLE) {
+        emit_sample_filter(fc, filter, filter_index, thread_slot);
+        return;
+    }
+
+    fc.emit({0x9C, 0x50}); // pushf; push xax
+
+    // Load the value to test into xax.
+    if (filter.type == MidHook::Filter::REGISTER) {
+        if (reg == FILTER_SP) {
+#if SAFETYHOOK_ARCH_X86_64
+            fc.emit({0x48}); // REX.W
+#endif
+            fc.emit({0x8D, 0x44, 0x24, FILTER_PUSHED_SIZE}); // lea xax, [xsp + FILTER_PUSHED_SIZE]
+        } else if (reg != 0) {
+#if SAFETYHOOK_ARCH_X86_64
+            fc.emit({static_cast<uint8_t>(0x48 | (reg >> 3) << 2)}); // REX.W (+ REX.R)
+#endif
+            fc.emit({0x89, static_cast<uint8_t>(0xC0 | (reg & 7) << 3)}); // mov xax, reg
+        }
+    } else {
+        const auto offset = filter.offset + (reg == FILTER_SP ? FILTER_PUSHED_SIZE : 0);
+
+#if SAFETYHOOK_ARCH_X86_64
+        if (const auto rex = (filter.size == 8 ? 0x08 : 0x00) | (reg >> 3); rex != 0) {
+            fc.emit({static_cast<uint8_t>(0x40 | rex)}); // REX.W/REX.B
+        }
+#endif
+
+        switch (filter.size) {
+        case 1:
+            fc.emit({0x0F, 0xB6}); // movzx eax, byte [reg + offset]
+            break;
+        case 2:
+            fc.emit({0x0F, 0xB7}); // movzx eax, word [reg + offset]
+            break;
+        default:
+            fc.emit({0x8B}); // mov eax/rax, [reg + offset]
+            break;
+        }
+
+        fc.emit({static_cast<uint8_t>(0x80 | (reg & 7))});
+
+        if ((reg & 7) == FILTER_SP) {
+            fc.emit({0x24}); // SIB for a base of xsp/r12.
+        }
+
+        fc.emit_value(static_cast<int32_t>(offset));
+    }
+
+#if SAFETYHOOK_ARCH_X86_64
+    if (filter.mask != ~uintptr_t{}) {
+        fc.emit({0x48, 0x23, 0x05}); // and rax, [rip + mask]
+        fc.emit_fixup(StubCode::FixupType::DATA, filter_index * FILTER_DATA_SLOTS);
+    }
+
+    fc.emit({0x48, 0x3B, 0x05}); // cmp rax, [rip + value]
+    fc.emit_fixup(StubCode::FixupType::DATA, filter_index * FILTER_DATA_SLOTS + 1);
+#elif SAFETYHOOK_ARCH_X86_32
+    if (filter.mask != ~uintptr_t{}) {
+        fc.emit({0x25}); // and eax, mask
+        fc.emit_value(static_cast<uint32_t>(filter.mask));
+    }
+
+    fc.emit({0x3D}); // cmp eax, value
+    fc.emit_value(static_cast<uint32_t>(filter.value));
+#endif
+
+    // pop xax; je/jne pass; popf; jmp trampoline; pass: popf
+    fc.emit({0x58});
+    const auto to_pass = fc.emit_jump8(filter.negate ? 0x75 : 0x74);
+    fc.emit({0x9D});
+    fc.emit_jump_trampoline();
+    fc.bind_jump8(to_pass);
+    fc.emit({0x9D});
+}
+
+// The parts of a Recorder's memory layout that record-only stubs need (see Recorder::Cell).
+struct RecorderLayout {
+    uintptr_t lanes;
+    uint32_t lane_mask;
+    uint32_t lane_size;
+    uint32_t capacity_mask;
+    uint32_t cell_size;
+    uint8_t lane_header_size;
+    uint8_t record_offset;
+};
+
+// Emits the code that replaces the stub for record-only hooks. It reserves the next cell of the current CPU's lane,
+// writes the record and publishes it by storing the cell's sequence last.
+static void emit_record(StubCode& fc, const RecorderLayout& layout, uint32_t hook_id, uint16_t registers) {
+    using Record = Recorder::Record;
+
+    const auto timestamp_offset = static_cast<uint8_t>(layout.record_offset + offsetof(Record, timestamp));
+    const auto hook_id_offset = static_cast<uint8_t>(layout.record_offset + offsetof(Record, hook_id));
+    const auto cpu_offset = static_cast<uint8_t>(layout.record_offset + offsetof(Record, cpu));
+    const auto registers_offset = static_cast<uint8_t>(layout.record_offset + offsetof(Record, registers));
+    const auto values_offset = static_cast<int32_t>(layout.record_offset + offsetof(Record, values));
+
+    // The stack offsets of the registers pushed below, indexed by register number.
+    constexpr uint8_t W = sizeof(uintptr_t);
+    constexpr uint8_t NOT_SAVED = 0xFF;
+    constexpr uint8_t saved_offsets[8] = {5 * W, 4 * W, 3 * W, 2 * W, NOT_SAVED, NOT_SAVED, 1 * W, 0 * W};
+    constexpr uint8_t saved_size = 7 * W;
+
+    // Widens the next instruction to 64 bits on x86_64.
+    const auto emit_rex_w = [&] {
+#if SAFETYHOOK_ARCH_X86_64
+        fc.emit({0x48});
+#endif
+    };
+
+    fc.emit({0x9C, 0x50, 0x51, 0x52, 0x53, 0x56, 0x57}); // pushf; push xax, xcx, xdx, xbx, xsi, xdi
+    fc.emit({0x0F, 0x01, 0xF9});                         // rdtscp
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48, 0xC1, 0xE2, 0x20, 0x48, 0x09, 0xD0}); // shl rdx, 32; or rax, rdx
+#endif
+    fc.emit({0x89, 0xCE}); // mov esi, ecx
+    fc.emit({0x81, 0xE6}); // and esi, 0xFFF
+    fc.emit_value<uint32_t>(0xFFF);
+    fc.emit({0x81, 0xE1}); // and ecx, lane_mask
+    fc.emit_value(layout.lane_mask);
+    emit_rex_w();
+    fc.emit({0x69, 0xC9}); // imul xcx, xcx, lane_size
+    fc.emit_value(layout.lane_size);
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48, 0xBA}); // mov rdx, lanes
+    fc.emit_value(layout.lanes);
+    fc.emit({0x48, 0x01, 0xD1}); // add rcx, rdx
+#elif SAFETYHOOK_ARCH_X86_32
+    fc.emit({0x81, 0xC1}); // add ecx, lanes
+    fc.emit_value(layout.lanes);
+#endif
+    fc.emit({0xBB, 0x01, 0x00, 0x00, 0x00}); // mov ebx, 1
+    fc.emit({0xF0});                         // lock
+    emit_rex_w();
+    fc.emit({0x0F, 0xC1, 0x19}); // xadd [xcx], xbx
+    emit_rex_w();
+    fc.emit({0x89, 0xDF}); // mov xdi, xbx
+    emit_rex_w();
+    fc.emit({0x81, 0xE7}); // and xdi, capacity - 1
+    fc.emit_value(layout.capacity_mask);
+    emit_rex_w();
+    fc.emit({0x69, 0xFF}); // imul xdi, xdi, sizeof(Cell)
+    fc.emit_value(layout.cell_size);
+    emit_rex_w();
+    fc.emit({0x8D, 0x7C, 0x39, layout.lane_header_size}); // lea xdi, [xcx + xdi + lane_header_size]
+
+    // Mark the cell as being written before touching the record.
+    emit_rex_w();
+    fc.emit({0xC7, 0x07, 0x00, 0x00, 0x00, 0x00}); // mov [xdi], 0
+
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48, 0x89, 0x47, timestamp_offset}); // mov [rdi + timestamp], rax
+#elif SAFETYHOOK_ARCH_X86_32
+    fc.emit({0x89, 0x47, timestamp_offset});                            // mov [edi + timestamp], eax
+    fc.emit({0x89, 0x57, static_cast<uint8_t>(timestamp_offset + 4)}); // mov [edi + timestamp + 4], edx
+#endif
+    fc.emit({0xC7, 0x47, hook_id_offset}); // mov dword [xdi + hook_id], hook_id
+    fc.emit_value(hook_id);
+    fc.emit({0x66, 0x89, 0x77, cpu_offset}); // mov [xdi + cpu], si
+    fc.emit({0x66, 0xC7, 0x47, registers_offset}); // mov word [xdi + registers], registers
+    fc.emit_value(registers);
+
+    for (uint8_t reg = 0; reg < sizeof(uintptr_t) * 2; ++reg) {
+        if ((registers & (1u << reg)) == 0) {
+            continue;
+        }
+
+        // Load the register's value at the hooked instruction into xax.
+        if (reg == FILTER_SP) {
+            emit_rex_w();
+            fc.emit({0x8D, 0x44, 0x24, saved_size}); // lea xax, [xsp + saved_size]
+        } else if (reg < 8 && saved_offsets[reg] != NOT_SAVED) {
+            emit_rex_w();
+            fc.emit({0x8B, 0x44, 0x24, saved_offsets[reg]}); // mov xax, [xsp + saved_offset]
+        } else {
+#if SAFETYHOOK_ARCH_X86_64
+            fc.emit({static_cast<uint8_t>(0x48 | (reg >> 3) << 2)}); // REX.W (+ REX.R)
+#endif
+            fc.emit({0x89, static_cast<uint8_t>(0xC0 | (reg & 7) << 3)}); // mov xax, reg
+        }
+
+        emit_rex_w();
+        fc.emit({0x89, 0x87}); // mov [xdi + values + reg * sizeof(uintptr_t)], xax
+        fc.emit_value(static_cast<int32_t>(values_offset + reg * sizeof(uintptr_t)));
+    }
+
+    // Publish the record.
+    emit_rex_w();
+    fc.emit({0xFF, 0xC3}); // inc xbx
+    emit_rex_w();
+    fc.emit({0x89, 0x1F}); // mov [xdi], xbx
+
+    fc.emit({0x5F, 0x5E, 0x5B, 0x5A, 0x59, 0x58, 0x9D}); // pop xdi, xsi, xbx, xdx, xcx, xax; popf
+    fc.emit_jump_trampoline();
+}
+
+// Emits a thunk that the stub calls instead of the destination when the extended state has to be saved. It saves the
+// AVX and AVX-512 state to a 64 byte aligned area on the stack, publishes the area through a thread slot for the
+// Context accessors (keeping the previous value for nested hooks), calls the destination and restores the state. The
+// area records the address of the Context it belongs to, so the Contexts of hooks nested in the destination don't
+// pick it up.
+// XSAVEC is preferred since it only stores the components in use. XSAVEOPT isn't used because its modified
+// optimization assumes the area was last written by the same XSAVEOPT, which doesn't hold for a reused stack area.
+static void emit_extended_state_thunk(StubCode& fc, const ExtendedStateLayout& layout, size_t destination_slot) {
+    const auto features_low = static_cast<uint32_t>(layout.features);
+    const auto features_high = static_cast<uint32_t>(layout.features >> 32);
+
+    // Accesses the thread slot with a segment prefixed instruction.
+    const auto emit_thread_slot_access = [&](uint8_t opcode, uint8_t reg) {
+#if SAFETYHOOK_ARCH_X86_64
+        fc.emit({THREAD_SEGMENT_PREFIX, 0x48, opcode, static_cast<uint8_t>(reg << 3 | 0x04), 0x25}); // [seg:disp32]
+#elif SAFETYHOOK_ARCH_X86_32
+        fc.emit({THREAD_SEGMENT_PREFIX, opcode, static_cast<uint8_t>(reg << 3 | 0x05)}); // [seg:disp32]
+#endif
+        fc.emit_value(layout.thread_slot);
+    };
+
+    const auto emit_load_features = [&] {
+        fc.emit({0xB8}); // mov eax, features_low
+        fc.emit_value(features_low);
+        fc.emit({0xBA}); // mov edx, features_high
+        fc.emit_value(features_high);
+    };
+
+    fc.emit({0x53, 0x55}); // push xbx; push xbp
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48, 0x89, 0xE5}); // mov rbp, rsp
+#if SAFETYHOOK_OS_WINDOWS
+    fc.emit({0x48, 0x89, 0xCB}); // mov rbx, rcx
+#else
+    fc.emit({0x48, 0x89, 0xFB}); // mov rbx, rdi
+#endif
+#elif SAFETYHOOK_ARCH_X86_32
+    fc.emit({0x89, 0xE5});       // mov ebp, esp
+    fc.emit({0x8B, 0x5D, 0x0C}); // mov ebx, [ebp + 12]
+#endif
+    emit_thread_slot_access(0x8B, 0); // mov xax, [slot]
+    fc.emit({0x50});                  // push xax
+
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48});
+#endif
+    fc.emit({0x81, 0xEC}); // sub xsp, size
+    fc.emit_value(layout.size);
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48});
+#endif
+    fc.emit({0x83, 0xE4, 0xC0}); // and xsp, -64
+
+    // XRSTOR faults unless the reserved bytes of the header are zero and XSAVE(C) doesn't write all of them.
+    fc.emit({0x31, 0xC0}); // xor eax, eax
+
+    for (uint32_t offset = 512; offset < 576; offset += sizeof(uintptr_t)) {
+#if SAFETYHOOK_ARCH_X86_64
+        fc.emit({0x48});
+#endif
+        fc.emit({0x89, 0x84, 0x24}); // mov [xsp + offset], xax
+        fc.emit_value(offset);
+    }
+
+    // Bytes 464 to 511 of the legacy region are left to software, XSAVE(C) doesn't write them and XRSTOR ignores them.
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48});
+#endif
+    fc.emit({0x89, 0x9C, 0x24}); // mov [xsp + 464], xbx
+    fc.emit_value(uint32_t{464});
+
+    emit_load_features();
+
+    if (layout.compacted) {
+        fc.emit({0x0F, 0xC7, 0x24, 0x24}); // xsavec [xsp]
+    } else {
+        fc.emit({0x0F, 0xAE, 0x24, 0x24}); // xsave [xsp]
+    }
+
+    emit_thread_slot_access(0x89, 4); // mov [slot], xsp
+
+#if SAFETYHOOK_ARCH_X86_64
+#if SAFETYHOOK_OS_WINDOWS
+    fc.emit({0x48, 0x89, 0xD9}); // mov rcx, rbx
+#else
+    fc.emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+#endif
+    fc.emit({0x48, 0x83, 0xEC, 0x20}); // sub rsp, 32
+    fc.emit({0xFF, 0x15});             // call [rip + destination]
+    fc.emit_fixup(StubCode::FixupType::DATA, destination_slot);
+    fc.emit({0x48, 0x83, 0xC4, 0x20}); // add rsp, 32
+#elif SAFETYHOOK_ARCH_X86_32
+    fc.emit({0x83, 0xEC, 0x0C}); // sub esp, 12
+    fc.emit({0x53});             // push ebx
+    fc.emit({0xFF, 0x15});       // call [destination]
+    fc.emit_fixup(StubCode::FixupType::DATA, destination_slot);
+    fc.emit({0x83, 0xC4, 0x10}); // add esp, 16
+#endif
+
+    emit_load_features();
+    fc.emit({0x0F, 0xAE, 0x2C, 0x24}); // xrstor [xsp]
+
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48});
+#endif
+    fc.emit({0x8B, 0x45, static_cast<uint8_t>(-static_cast<int8_t>(sizeof(uintptr_t)))}); // mov xax, [xbp - n]
+    emit_thread_slot_access(0x89, 0);                                                        // mov [slot], xax
+
+#if SAFETYHOOK_ARCH_X86_64
+    fc.emit({0x48});
+#endif
+    fc.emit({0x89, 0xEC});             // mov xsp, xbp
+    fc.emit({0x5D, 0x5B, 0xC3});       // pop xbp; pop xbx; ret
+}
+
+// Seeds a SAMPLE filter's random number state. It only needs to differ between hooks and runs, not be unpredictable.
+static uintptr_t sample_seed(const void* salt) {
+    auto x = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+             reinterpret_cast<uintptr_t>(salt);
+
+    // splitmix64 finalizer.
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+
+    // xorshift never leaves the all zero state.
+    return static_cast<uintptr_t>(x) | 1;
+}
+
 std::expected<MidHook, MidHook::Error> MidHook::create(void* target, MidHookFn destination, Flags flags) {
     return create(Allocator::global(), target, destination, flags);
 }
 
+std::expected<MidHook, MidHook::Error> MidHook::create(
+    void* target, MidHookFn destination, const std::vector<Filter>& filters, Flags flags) {
+    return create(Allocator::global(), target, destination, filters, flags);
+}
+
 std::expected<MidHook, MidHook::Error> MidHook::create(
     const std::shared_ptr<Allocator>& allocator, void* target, MidHookFn destination, Flags flags) {
+    return create(allocator, target, destination, {}, flags);
+}
+
+std::expected<MidHook, MidHook::Error> MidHook::create(const std::shared_ptr<Allocator>& allocator, void* target,
+    MidHookFn destination, const std::vector<Filter>& filters, Flags flags) {
     MidHook hook{};
 
-    if (const auto setup_result = hook.setup(allocator, reinterpret_cast<uint8_t*>(target), destination);
+    if (const auto setup_result =
+            hook.setup(allocator, reinterpret_cast<uint8_t*>(target), destination, filters, flags);
+        !setup_result) {
+        return std::unexpected{setup_result.error()};
+    }
+
+    if (!(flags & StartDisabled)) {
+        if (auto enable_result = hook.enable(); !enable_result) {
+            return std::unexpected{enable_result.error()};
+        }
+    }
+
+    return hook;
+}
+
+std::expected<MidHook, MidHook::Error> MidHook::create_record_only(void* target,
+    const std::shared_ptr<Recorder>& recorder, uint32_t hook_id, uint16_t registers, const std::vector<Filter>& filters,
+    Flags flags) {
+    return create_record_only(Allocator::global(), target, recorder, hook_id, registers, filters, flags);
+}
+
+std::expected<MidHook, MidHook::Error> MidHook::create_record_only(const std::shared_ptr<Allocator>& allocator,
+    void* target, const std::shared_ptr<Recorder>& recorder, uint32_t hook_id, uint16_t registers,
+    const std::vector<Filter>& filters, Flags flags) {
+    if (recorder == nullptr || (registers & ~Recorder::ALL_REGISTERS) != 0) {
+        return std::unexpected{Error::bad_recorder()};
+    }
+
+    MidHook hook{};
+    hook.m_recorder = recorder;
+
+    if (const auto setup_result =
+            hook.setup(allocator, reinterpret_cast<uint8_t*>(target), nullptr, filters, flags, hook_id, registers);
         !setup_result) {
         return std::unexpected{setup_result.error()};
     }
@@ -98,59 +644,183 @@ MidHook& MidHook::operator=(MidHook&& other) noexcept {
     if (this != &other) {
         m_hook = std::move(other.m_hook);
         m_target = other.m_target;
-        m_stub = std::move(other.m_stub);
         m_destination = other.m_destination;
 
+        // Our old hook is gone at this point so nothing is using its thread slots anymore.
+        free_thread_slots();
+        m_thread_slots = std::move(other.m_thread_slots);
+        m_recorder = std::move(other.m_recorder);
+
         other.m_target = 0;
         other.m_destination = nullptr;
+        other.m_thread_slots.clear();
     }
 
     return *this;
 }
 
+MidHook::~MidHook() {
+    // Unhook before giving the thread slots back so the stub can't touch a slot that has been handed out again.
+    m_hook.reset();
+    free_thread_slots();
+}
+
 void MidHook::reset() {
     *this = {};
 }
 
-std::expected<void, MidHook::Error> MidHook::setup(
-    const std::shared_ptr<Allocator>& allocator, uint8_t* target, MidHookFn destination_fn) {
+void MidHook::free_thread_slots() {
+    for (const auto slot : m_thread_slots) {
+        thread_slot_free(slot);
+    }
+
+    m_thread_slots.clear();
+}
+
+std::expected<void, MidHook::Error> MidHook::setup(const std::shared_ptr<Allocator>& allocator, uint8_t* target,
+    MidHookFn destination_fn, const std::vector<Filter>& filters, Flags flags, uint32_t record_id,
+    uint16_t record_registers) {
     m_target = target;
     m_destination = destination_fn;
 
-    auto stub_allocation = allocator->allocate(asm_data.size());
+    StubCode filter_code{};
+    std::vector<uintptr_t> filter_data(filters.size() * FILTER_DATA_SLOTS);
 
-    if (!stub_allocation) {
-        return std::unexpected{Error::bad_allocation(stub_allocation.error())};
+    // The stub calls the thunk instead of the destination, which is kept in the data slot after the filters'.
+    const auto& extended_state = extended_state_layout();
+    const auto save_extended_state =
+        (flags & SaveExtendedState) != 0 && m_recorder == nullptr && extended_state.features != 0;
+
+    if (save_extended_state) {
+        emit_extended_state_thunk(filter_code, extended_state, filter_data.size());
     }
 
-    m_stub = std::move(*stub_allocation);
+    const auto entry_offset = filter_code.code.size();
 
-    std::copy(asm_data.begin(), asm_data.end(), m_stub.data());
+    for (size_t i = 0; i < filters.size(); ++i) {
+        const auto& filter = filters[i];
 
-#if SAFETYHOOK_ARCH_X86_64
-    store(m_stub.data() + sizeof(asm_data) - 16, m_destination);
-#elif SAFETYHOOK_ARCH_X86_32
-    store(m_stub.data() + sizeof(asm_data) - 8, m_destination);
+        if (!is_valid_filter(filter)) {
+            return std::unexpected{Error::bad_filter()};
+        }
 
-    // 32-bit has some relocations we need to fix up as well.
-    store(m_stub.data() + 0x02, m_stub.data() + m_stub.size() - 4);
-    store(m_stub.data() + 0x59, m_stub.data() + m_stub.size() - 8);
-#endif
+        int32_t thread_slot{};
+
+        if (filter.type == Filter::SAMPLE) {
+            const auto seed = sample_seed(&filter_data[i * FILTER_DATA_SLOTS]);
+
+            if (filter.per_thread) {
+                auto slot = thread_slot_allocate();
 
-    auto hook_result = InlineHook::create(allocator, m_target, m_stub.data(), InlineHook::StartDisabled);
+                if (!slot) {
+                    return std::unexpected{Error::bad_thread_slot(slot.error())};
+                }
+
+                thread_slot = *slot;
+                m_thread_slots.push_back(thread_slot);
+            }
+
+            // Start part way into the first interval so hooks created together don't pass on the same hits.
+            filter_data[i * FILTER_DATA_SLOTS] =
+                filter.random ? seed % (filter.value * 2 - 1) : static_cast<uintptr_t>(filter.value - 1);
+            filter_data[i * FILTER_DATA_SLOTS + 1] = seed;
+        } else {
+            filter_data[i * FILTER_DATA_SLOTS] = filter.mask;
+            filter_data[i * FILTER_DATA_SLOTS + 1] = filter.value;
+        }
 
-    if (!hook_result) {
-        m_stub.free();
+        emit_filter(filter_code, filter, i, thread_slot);
+    }
+
+    if (save_extended_state) {
+        filter_data.push_back(reinterpret_cast<uintptr_t>(m_destination));
+    }
+
+    // Record-only hooks replace the stub with their own code.
+    const auto is_record_only = m_recorder != nullptr;
+    const auto stub_size = is_record_only ? 0 : asm_data.size();
+
+    if (is_record_only) {
+        // The lane header and the record's header fields are addressed with 8-bit displacements.
+        static_assert(Recorder::LANE_HEADER_SIZE < 0x80);
+        static_assert(offsetof(Recorder::Cell, record) + offsetof(Recorder::Record, values) < 0x80);
+
+        RecorderLayout layout{};
+        layout.lanes = reinterpret_cast<uintptr_t>(m_recorder->m_memory);
+        layout.lane_mask = static_cast<uint32_t>(m_recorder->m_lane_count - 1);
+        layout.lane_size = static_cast<uint32_t>(m_recorder->m_lane_size);
+        layout.capacity_mask = static_cast<uint32_t>(m_recorder->m_capacity - 1);
+        layout.cell_size = static_cast<uint32_t>(sizeof(Recorder::Cell));
+        layout.lane_header_size = Recorder::LANE_HEADER_SIZE;
+        layout.record_offset = offsetof(Recorder::Cell, record);
+
+        emit_record(filter_code, layout, record_id, record_registers);
+    }
+
+    // The stub is laid out as [thunk][filter code][stub][filter data] and shares one allocation with the trampoline,
+    // which comes first, so jumps to the trampoline are rel32 and a hit touches as few cache lines as possible.
+    const auto stub_offset = filter_code.code.size();
+    const auto filter_data_offset = stub_offset + stub_size;
+    const auto stub_allocation_size = filter_data_offset + filter_data.size() * sizeof(uintptr_t);
+
+    InlineHook hook{};
+
+    if (auto hook_result = hook.setup(allocator, m_target, nullptr, stub_allocation_size, entry_offset);
+        !hook_result) {
         return std::unexpected{Error::bad_inline_hook(hook_result.error())};
     }
 
-    m_hook = std::move(*hook_result);
+    auto* base = hook.stub();
+    auto* stub = base + stub_offset;
+    auto* data = base + filter_data_offset;
+    auto* trampoline = hook.trampoline().data();
+
+    std::copy(filter_code.code.begin(), filter_code.code.end(), base);
+    std::copy_n(asm_data.begin(), stub_size, stub);
+
+    for (size_t i = 0; i < filter_data.size(); ++i) {
+        store(data + i * sizeof(uintptr_t), filter_data[i]);
+    }
 
+    for (const auto& fixup : filter_code.fixups) {
+        auto* address = base + fixup.offset;
+
+        switch (fixup.type) {
+        case StubCode::FixupType::TRAMPOLINE:
+            store(address, static_cast<int32_t>(trampoline - (address + sizeof(int32_t))));
+            break;
+        case StubCode::FixupType::DATA: {
+            auto* operand = data + fixup.data_slot * sizeof(uintptr_t);
 #if SAFETYHOOK_ARCH_X86_64
-    store(m_stub.data() + sizeof(asm_data) - 8, m_hook.trampoline().data());
+            store(address, static_cast<int32_t>(operand - (address + sizeof(int32_t))));
 #elif SAFETYHOOK_ARCH_X86_32
-    store(m_stub.data() + sizeof(asm_data) - 4, m_hook.trampoline().data());
+            store(address, operand);
 #endif
+            break;
+        }
+        }
+    }
+
+    if (!is_record_only) {
+        const auto destination = save_extended_state ? reinterpret_cast<uintptr_t>(base)
+                                                     : reinterpret_cast<uintptr_t>(m_destination);
+
+        store(stub + sizeof(asm_data) - sizeof(uintptr_t), trampoline);
+
+#if SAFETYHOOK_ARCH_X86_64
+        store(stub + sizeof(asm_data) - 16, destination);
+#elif SAFETYHOOK_ARCH_X86_32
+        store(stub + sizeof(asm_data) - 8, destination);
+
+        // 32-bit has some relocations we need to fix up as well.
+        store(stub + 0x02, stub + sizeof(asm_data) - 4);
+        store(stub + 0x59, stub + sizeof(asm_data) - 8);
+        store(stub + 0xA5, stub + sizeof(asm_data) - 4);
+        store(stub + 0xB9, stub + sizeof(asm_data) - 4);
+#endif
+    }
+
+    m_hook = std::move(hook);
 
     return {};
 }
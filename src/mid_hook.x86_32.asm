@@ -42,6 +42,27 @@ movdqu xmm5, [esp+80]
 movdqu xmm6, [esp+96]
 movdqu xmm7, [esp+112]
 add esp, 128
+
+; jump to the trampoline unless the destination changed the trampoline esp or eip. returning to it with a ret
+; that has no matching call would throw off the return stack buffer for the rest of the hooked function.
+lea eax, [esp+40]
+cmp eax, [esp+36]
+jne slow_exit
+mov eax, [esp+40]
+cmp eax, [trampoline]
+jne slow_exit
+popfd
+pop edi
+pop esi
+pop edx
+pop ecx
+pop ebx
+pop eax
+pop ebp
+lea esp, [esp+12] ; skip original esp, trampoline esp and eip
+jmp [trampoline]
+
+slow_exit:
 popfd
 pop edi
 pop esi
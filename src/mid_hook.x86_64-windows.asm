@@ -75,6 +75,35 @@ movdqu xmm13, [rsp+208]
 movdqu xmm14, [rsp+224]
 movdqu xmm15, [rsp+240]
 add rsp, 256
+
+; jump to the trampoline unless the destination changed the trampoline rsp or rip. returning to it with a ret
+; that has no matching call would throw off the return stack buffer for the rest of the hooked function.
+lea rax, [rsp+144]
+cmp rax, [rsp+136]
+jne slow_exit
+mov rax, [rsp+144]
+cmp rax, [rel trampoline]
+jne slow_exit
+popfq
+pop r15
+pop r14
+pop r13
+pop r12
+pop r11
+pop r10
+pop r9
+pop r8
+pop rdi
+pop rsi
+pop rdx
+pop rcx
+pop rbx
+pop rax
+pop rbp
+lea rsp, [rsp+24] ; skip original rsp, trampoline rsp and rip
+jmp [rel trampoline]
+
+slow_exit:
 popfq
 pop r15
 pop r14
@@ -2,12 +2,20 @@
 
 #if SAFETYHOOK_OS_LINUX
 
+#include <bitset>
 #include <cstdio>
 #include <limits>
+#include <mutex>
 
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include "safetyhook/internal/metrics.hpp"
 #include "safetyhook/utility.hpp"
 
 #include "safetyhook/os.hpp"
@@ -61,6 +69,9 @@ std::expected<uint32_t, OsError> vm_protect(uint8_t* address, size_t size, VmAcc
 }
 
 std::expected<uint32_t, OsError> vm_protect(uint8_t* address, size_t size, uint32_t protect) {
+    MetricTimer timer{Metric::VM_PROTECT_TIME};
+    add_metric(Metric::VM_PROTECT_CALLS);
+
     auto mbi = vm_query(address);
 
     if (!mbi.has_value()) {
@@ -85,6 +96,8 @@ std::expected<uint32_t, OsError> vm_protect(uint8_t* address, size_t size, uint3
 
     size = size + static_cast<size_t>(address - addr);
 
+    add_metric(Metric::PROTECT_SYSCALLS);
+
     if (mprotect(addr, size, static_cast<int>(protect)) == -1) {
         return std::unexpected{OsError::FAILED_TO_PROTECT};
     }
@@ -93,6 +106,10 @@ std::expected<uint32_t, OsError> vm_protect(uint8_t* address, size_t size, uint3
 }
 
 std::expected<VmBasicInfo, OsError> vm_query(uint8_t* address) {
+    MetricTimer timer{Metric::VM_QUERY_TIME};
+    add_metric(Metric::VM_QUERY_CALLS);
+    add_metric(Metric::MAPS_PARSES);
+
     auto* maps = fopen("/proc/self/maps", "r");
 
     if (maps == nullptr) {
@@ -170,6 +187,27 @@ bool vm_is_executable(uint8_t* address) {
     return vm_query(address).value_or(VmBasicInfo{}).access.execute;
 }
 
+std::expected<SymbolInfo, OsError> symbol_query(uint8_t* address) {
+    Dl_info info{};
+    void* entry{};
+
+    if (dladdr1(address, &info, &entry, RTLD_DL_SYMENT) == 0 || entry == nullptr || info.dli_saddr == nullptr ||
+        info.dli_sname == nullptr) {
+        return std::unexpected{OsError::FAILED_TO_QUERY};
+    }
+
+    const auto* symbol = static_cast<const ElfW(Sym)*>(entry);
+
+    // dladdr1 returns the closest symbol below the address, which doesn't have to contain it.
+    auto* start = static_cast<uint8_t*>(info.dli_saddr);
+
+    if (address < start || address >= start + symbol->st_size) {
+        return std::unexpected{OsError::FAILED_TO_QUERY};
+    }
+
+    return SymbolInfo{start, symbol->st_size, info.dli_sname};
+}
+
 SystemInfo system_info() {
     auto page_size = static_cast<uint32_t>(sysconf(_SC_PAGESIZE));
 
@@ -186,8 +224,132 @@ SystemInfo system_info() {
     return info;
 }
 
+std::expected<FileMapping, OsError> file_map(const std::filesystem::path& path, size_t size, VmAccess access) {
+    const auto writable = access == VM_ACCESS_RW;
+
+    if ((!writable && access != VM_ACCESS_R) || (writable && size == 0)) {
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    const auto fd = writable ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+                             : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    // Allocating the blocks now means writing to the mapping can't fail later with SIGBUS for lack of space.
+    if (writable && posix_fallocate(fd, 0, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    if (!writable) {
+        struct stat st{};
+
+        if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+            close(fd);
+            return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+        }
+
+        size = static_cast<size_t>(st.st_size);
+    }
+
+    // MAP_POPULATE faults the pages in now instead of on the first write to each of them.
+    auto* address = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        writable ? MAP_SHARED | MAP_POPULATE : MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (address == MAP_FAILED) {
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    return FileMapping{static_cast<uint8_t*>(address), size};
+}
+
+void file_unmap(const FileMapping& mapping) {
+    munmap(mapping.address, mapping.size);
+}
+
+void file_flush(const FileMapping& mapping) {
+    msync(mapping.address, mapping.size, MS_ASYNC);
+}
+
+uint32_t current_thread_id() {
+    return static_cast<uint32_t>(syscall(SYS_gettid));
+}
+
+// Thread slots live in static TLS (initial-exec) so they sit at the same offset from the thread pointer in every
+// thread, including ones created before the slot was allocated.
+constexpr size_t MAX_THREAD_SLOTS = 64;
+static thread_local uintptr_t g_thread_slots[MAX_THREAD_SLOTS] __attribute__((tls_model("initial-exec")));
+static std::bitset<MAX_THREAD_SLOTS> g_thread_slots_used;
+static std::mutex g_thread_slots_mutex;
+
+static intptr_t thread_slots_offset() {
+    uintptr_t thread_pointer{};
+
+    // The first word of the thread control block points to itself.
+#if SAFETYHOOK_ARCH_X86_64
+    asm("mov %%fs:0, %0" : "=r"(thread_pointer));
+#elif SAFETYHOOK_ARCH_X86_32
+    asm("mov %%gs:0, %0" : "=r"(thread_pointer));
+#endif
+
+    return static_cast<intptr_t>(reinterpret_cast<uintptr_t>(&g_thread_slots[0]) - thread_pointer);
+}
+
+std::expected<int32_t, OsError> thread_slot_allocate() {
+    std::scoped_lock lock{g_thread_slots_mutex};
+
+    for (size_t i = 0; i < MAX_THREAD_SLOTS; ++i) {
+        if (g_thread_slots_used[i]) {
+            continue;
+        }
+
+        const auto offset = thread_slots_offset() + static_cast<intptr_t>(i * sizeof(uintptr_t));
+
+        if (offset < std::numeric_limits<int32_t>::min() || offset > std::numeric_limits<int32_t>::max()) {
+            break;
+        }
+
+        g_thread_slots_used[i] = true;
+
+        // Slots are reused so clear the value left behind by the previous owner in the calling thread at least.
+        g_thread_slots[i] = 0;
+
+        return static_cast<int32_t>(offset);
+    }
+
+    return std::unexpected{OsError::FAILED_TO_ALLOCATE_THREAD_SLOT};
+}
+
+void thread_slot_free(int32_t offset) {
+    std::scoped_lock lock{g_thread_slots_mutex};
+
+    const auto i = static_cast<size_t>((offset - thread_slots_offset()) / static_cast<intptr_t>(sizeof(uintptr_t)));
+
+    if (i < MAX_THREAD_SLOTS) {
+        g_thread_slots_used[i] = false;
+    }
+}
+
+uintptr_t thread_slot_get(int32_t offset) {
+    const auto i = static_cast<size_t>((offset - thread_slots_offset()) / static_cast<intptr_t>(sizeof(uintptr_t)));
+
+    if (i >= MAX_THREAD_SLOTS) {
+        return 0;
+    }
+
+    return g_thread_slots[i];
+}
+
 void trap_threads([[maybe_unused]] uint8_t* from, [[maybe_unused]] uint8_t* to, [[maybe_unused]] size_t len,
     const std::function<void()>& run_fn) {
+    MetricTimer timer{Metric::TRAP_THREADS_TIME};
+    add_metric(Metric::TRAP_THREADS_CALLS);
+
     auto from_protect = vm_protect(from, len, VM_ACCESS_RWX).value_or(0);
     auto to_protect = vm_protect(to, len, VM_ACCESS_RWX).value_or(0);
     run_fn();
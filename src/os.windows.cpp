@@ -3,6 +3,7 @@
 #include <mutex>
 
 #include "safetyhook/common.hpp"
+#include "safetyhook/internal/metrics.hpp"
 #include "safetyhook/utility.hpp"
 
 #if SAFETYHOOK_OS_WINDOWS
@@ -69,6 +70,10 @@ std::expected<uint32_t, OsError> vm_protect(uint8_t* address, size_t size, VmAcc
 }
 
 std::expected<uint32_t, OsError> vm_protect(uint8_t* address, size_t size, uint32_t protect) {
+    MetricTimer timer{Metric::VM_PROTECT_TIME};
+    add_metric(Metric::VM_PROTECT_CALLS);
+    add_metric(Metric::PROTECT_SYSCALLS);
+
     DWORD old_protect = 0;
 
     if (VirtualProtect(address, size, protect, &old_protect) == FALSE) {
@@ -79,6 +84,9 @@ std::expected<uint32_t, OsError> vm_protect(uint8_t* address, size_t size, uint3
 }
 
 std::expected<VmBasicInfo, OsError> vm_query(uint8_t* address) {
+    MetricTimer timer{Metric::VM_QUERY_TIME};
+    add_metric(Metric::VM_QUERY_CALLS);
+
     MEMORY_BASIC_INFORMATION mbi{};
     auto result = VirtualQuery(address, &mbi, sizeof(mbi));
 
@@ -143,6 +151,11 @@ bool vm_is_executable(uint8_t* address) {
     return vm_query(address).value_or(VmBasicInfo{}).access.execute;
 }
 
+std::expected<SymbolInfo, OsError> symbol_query([[maybe_unused]] uint8_t* address) {
+    // Symbol sizes aren't available without debug information.
+    return std::unexpected{OsError::FAILED_TO_QUERY};
+}
+
 SystemInfo system_info() {
     SystemInfo info{};
 
@@ -157,6 +170,99 @@ SystemInfo system_info() {
     return info;
 }
 
+std::expected<FileMapping, OsError> file_map(const std::filesystem::path& path, size_t size, VmAccess access) {
+    const auto writable = access == VM_ACCESS_RW;
+
+    if ((!writable && access != VM_ACCESS_R) || (writable && size == 0)) {
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    // Other processes can read the file while it's written.
+    auto* file = CreateFileW(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    if (!writable) {
+        LARGE_INTEGER file_size{};
+
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0) {
+            CloseHandle(file);
+            return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+        }
+
+        size = static_cast<size_t>(file_size.QuadPart);
+    }
+
+    // Creating a writable mapping larger than the file extends the file to its size.
+    const auto size64 = static_cast<uint64_t>(size);
+    auto* mapping = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+        static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), nullptr);
+
+    CloseHandle(file);
+
+    if (mapping == nullptr) {
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    // The view keeps the mapping and the file open.
+    auto* address = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+
+    CloseHandle(mapping);
+
+    if (address == nullptr) {
+        return std::unexpected{OsError::FAILED_TO_MAP_FILE};
+    }
+
+    return FileMapping{static_cast<uint8_t*>(address), size};
+}
+
+void file_unmap(const FileMapping& mapping) {
+    UnmapViewOfFile(mapping.address);
+}
+
+void file_flush(const FileMapping& mapping) {
+    FlushViewOfFile(mapping.address, mapping.size);
+}
+
+uint32_t current_thread_id() {
+    return GetCurrentThreadId();
+}
+
+// Offset of TEB::TlsSlots. Only the first TLS_MINIMUM_AVAILABLE indices are stored inline in the TEB.
+#if SAFETYHOOK_ARCH_X86_64
+constexpr int32_t TEB_TLS_SLOTS_OFFSET = 0x1480;
+#elif SAFETYHOOK_ARCH_X86_32
+constexpr int32_t TEB_TLS_SLOTS_OFFSET = 0xE10;
+#endif
+
+std::expected<int32_t, OsError> thread_slot_allocate() {
+    const auto index = TlsAlloc();
+
+    if (index == TLS_OUT_OF_INDEXES) {
+        return std::unexpected{OsError::FAILED_TO_ALLOCATE_THREAD_SLOT};
+    }
+
+    if (index >= TLS_MINIMUM_AVAILABLE) {
+        TlsFree(index);
+        return std::unexpected{OsError::FAILED_TO_ALLOCATE_THREAD_SLOT};
+    }
+
+    return TEB_TLS_SLOTS_OFFSET + static_cast<int32_t>(index * sizeof(void*));
+}
+
+void thread_slot_free(int32_t offset) {
+    TlsFree(static_cast<DWORD>((offset - TEB_TLS_SLOTS_OFFSET) / static_cast<int32_t>(sizeof(void*))));
+}
+
+uintptr_t thread_slot_get(int32_t offset) {
+    return reinterpret_cast<uintptr_t>(
+        TlsGetValue(static_cast<DWORD>((offset - TEB_TLS_SLOTS_OFFSET) / static_cast<int32_t>(sizeof(void*)))));
+}
+
 struct TrapInfo {
     uint8_t* from_page_start;
     uint8_t* from_page_end;
@@ -269,6 +375,9 @@ void find_me() {
 static std::mutex virtual_protect_mutex;
 
 void trap_threads(uint8_t* from, uint8_t* to, size_t len, const std::function<void()>& run_fn) {
+    MetricTimer timer{Metric::TRAP_THREADS_TIME};
+    add_metric(Metric::TRAP_THREADS_CALLS);
+
     MEMORY_BASIC_INFORMATION find_me_mbi{};
     MEMORY_BASIC_INFORMATION from_mbi{};
     MEMORY_BASIC_INFORMATION to_mbi{};
@@ -313,6 +422,7 @@ void trap_threads(uint8_t* from, uint8_t* to, size_t len, const std::function<vo
     DWORD from_protect;
     DWORD to_protect;
 
+    add_metric(Metric::PROTECT_SYSCALLS, 4);
     VirtualProtect(from, len, new_protect, &from_protect);
     VirtualProtect(to, len, new_protect, &to_protect);
 
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <atomic>
+#include <optional>
+
+#include "safetyhook/os.hpp"
+#include "safetyhook/utility.hpp"
+
+#include "safetyhook/pointer_hook.hpp"
+
+namespace safetyhook {
+static uint8_t* load_slot(uint8_t** slot) {
+    if (reinterpret_cast<uintptr_t>(slot) % alignof(uint8_t*) != 0) {
+        uint8_t* current{};
+        std::copy_n(reinterpret_cast<const uint8_t*>(slot), sizeof(current), reinterpret_cast<uint8_t*>(&current));
+        return current;
+    }
+
+    return std::atomic_ref{*slot}.load();
+}
+
+// Swaps the pointer in a slot for value if it holds expected (or unconditionally when expected is nullopt), returning
+// what the slot held. Slots are normally naturally aligned, anything else can't be swapped atomically.
+static uint8_t* exchange_slot(uint8_t** slot, uint8_t* value, std::optional<uint8_t*> expected = std::nullopt) {
+    if (reinterpret_cast<uintptr_t>(slot) % alignof(uint8_t*) != 0) {
+        const auto current = load_slot(slot);
+
+        if (!expected || current == *expected) {
+            store(reinterpret_cast<uint8_t*>(slot), value);
+        }
+
+        return current;
+    }
+
+    std::atomic_ref slot_ref{*slot};
+
+    if (!expected) {
+        return slot_ref.exchange(value);
+    }
+
+    auto current = *expected;
+    slot_ref.compare_exchange_strong(current, value);
+
+    return current;
+}
+
+// Runs swap_fn on each of the sorted slots. Slots in the same memory region are handled together: nothing is done to
+// the region when it is writable, otherwise the range holding the slots is unprotected once for all of them. Returns
+// the first slot that couldn't be unprotected, or nullptr.
+template <typename SwapFn> static uint8_t** swap_slots(const std::vector<uint8_t**>& slots, SwapFn swap_fn) {
+    for (size_t first = 0; first < slots.size();) {
+        auto* start = reinterpret_cast<uint8_t*>(slots[first]);
+        const auto region = vm_query(start);
+        auto* region_end = region ? region->address + region->size : start;
+        auto last = first + 1;
+
+        while (last < slots.size() && reinterpret_cast<uint8_t*>(slots[last] + 1) <= region_end) {
+            ++last;
+        }
+
+        auto* end = reinterpret_cast<uint8_t*>(slots[last - 1] + 1);
+        std::optional<UnprotectMemory> unprotected{};
+
+        if (!region || !region->access.write || end > region_end) {
+            unprotected = unprotect(start, static_cast<size_t>(end - start));
+
+            if (!unprotected) {
+                return slots[first];
+            }
+        }
+
+        for (auto i = first; i < last; ++i) {
+            swap_fn(i);
+        }
+
+        first = last;
+    }
+
+    return nullptr;
+}
+
+std::expected<PointerHook, PointerHook::Error> PointerHook::create(void* slot, void* destination) {
+    return create(std::vector{slot}, destination);
+}
+
+std::expected<PointerHook, PointerHook::Error> PointerHook::create(
+    const std::vector<void*>& slots, void* destination) {
+    if (slots.empty()) {
+        return std::unexpected{Error::no_slots()};
+    }
+
+    PointerHook hook{};
+    hook.m_destination = static_cast<uint8_t*>(destination);
+
+    std::vector<uint8_t**> sorted_slots{};
+    sorted_slots.reserve(slots.size());
+
+    for (auto* slot : slots) {
+        sorted_slots.push_back(static_cast<uint8_t**>(slot));
+    }
+
+    std::sort(sorted_slots.begin(), sorted_slots.end());
+    sorted_slots.erase(std::unique(sorted_slots.begin(), sorted_slots.end()), sorted_slots.end());
+
+    // The slots are kept in the order they were given, without duplicates.
+    std::vector<size_t> slot_indices(sorted_slots.size(), SIZE_MAX);
+
+    for (auto* slot : slots) {
+        const auto i = static_cast<size_t>(
+            std::lower_bound(sorted_slots.begin(), sorted_slots.end(), static_cast<uint8_t**>(slot)) -
+            sorted_slots.begin());
+
+        if (slot_indices[i] == SIZE_MAX) {
+            slot_indices[i] = hook.m_slots.size();
+            hook.m_slots.emplace_back(sorted_slots[i]);
+        }
+    }
+
+    std::vector<bool> is_swapped(hook.m_slots.size());
+    auto* failed_slot = swap_slots(sorted_slots, [&](size_t i) {
+        auto& slot = hook.m_slots[slot_indices[i]];
+        slot.original = exchange_slot(slot.address, hook.m_destination);
+        is_swapped[slot_indices[i]] = true;
+    });
+
+    if (failed_slot != nullptr) {
+        // Only the slots swapped so far are restored as the hook is destroyed.
+        std::vector<Slot> swapped_slots{};
+
+        for (size_t i = 0; i < hook.m_slots.size(); ++i) {
+            if (is_swapped[i]) {
+                swapped_slots.push_back(hook.m_slots[i]);
+            }
+        }
+
+        hook.m_slots = std::move(swapped_slots);
+        return std::unexpected{Error::failed_to_unprotect(reinterpret_cast<uint8_t*>(failed_slot))};
+    }
+
+    return hook;
+}
+
+PointerHook::PointerHook(PointerHook&& other) noexcept {
+    *this = std::move(other);
+}
+
+PointerHook& PointerHook::operator=(PointerHook&& other) noexcept {
+    if (this != &other) {
+        destroy();
+
+        m_slots = std::move(other.m_slots);
+        m_destination = other.m_destination;
+
+        other.m_slots.clear();
+        other.m_destination = nullptr;
+    }
+
+    return *this;
+}
+
+PointerHook::~PointerHook() {
+    destroy();
+}
+
+void PointerHook::reset() {
+    *this = {};
+}
+
+void PointerHook::destroy() {
+    auto slots = m_slots;
+    std::sort(slots.begin(), slots.end(), [](const Slot& a, const Slot& b) { return a.address < b.address; });
+
+    // Slots that were changed again after us are left alone, like VmtHook::remove.
+    std::erase_if(slots, [this](const Slot& slot) { return load_slot(slot.address) != m_destination; });
+
+    std::vector<uint8_t**> addresses{};
+    addresses.reserve(slots.size());
+
+    for (const auto& slot : slots) {
+        addresses.push_back(slot.address);
+    }
+
+    (void)swap_slots(addresses, [&](size_t i) { exchange_slot(slots[i].address, slots[i].original, m_destination); });
+
+    m_slots.clear();
+    m_destination = nullptr;
+}
+} // namespace safetyhook
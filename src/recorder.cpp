@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <thread>
+
+#include "safetyhook/os.hpp"
+
+#include "safetyhook/recorder.hpp"
+
+namespace safetyhook {
+// Lanes are selected with the low 12 bits of IA32_TSC_AUX so there is no point in having more than that.
+constexpr size_t MAX_LANES = 0x1000;
+
+std::expected<std::shared_ptr<Recorder>, Recorder::Error> Recorder::create(size_t capacity, size_t lanes) {
+    if (lanes == 0) {
+        lanes = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    if (capacity == 0 || capacity > 0x4000'0000 || lanes > MAX_LANES) {
+        return std::unexpected{Error::BAD_CAPACITY};
+    }
+
+    capacity = std::bit_ceil(capacity);
+    lanes = std::bit_ceil(lanes);
+
+    // The stub addresses lanes and cells with 32-bit immediates.
+    const auto lane_size = LANE_HEADER_SIZE + capacity * sizeof(Cell);
+
+    if (lane_size > 0x7FFF'FFFF || lane_size > SIZE_MAX / lanes) {
+        return std::unexpected{Error::BAD_CAPACITY};
+    }
+
+    auto memory = vm_allocate(nullptr, lane_size * lanes, VM_ACCESS_RW);
+
+    if (!memory) {
+        return std::unexpected{Error::BAD_ALLOCATION};
+    }
+
+    std::shared_ptr<Recorder> recorder{new Recorder{}};
+    recorder->m_memory = *memory;
+    recorder->m_capacity = capacity;
+    recorder->m_lane_count = lanes;
+    recorder->m_lane_size = lane_size;
+    recorder->m_read_positions.resize(lanes);
+
+    return recorder;
+}
+
+Recorder::~Recorder() {
+    if (m_memory != nullptr) {
+        vm_free(m_memory);
+    }
+}
+
+size_t Recorder::drain(const std::function<void(const Record&)>& fn) {
+    std::scoped_lock lock{m_mutex};
+    size_t drained{};
+
+    for (size_t i = 0; i < m_lane_count; ++i) {
+        auto* lane = this->lane(i);
+        auto* cells = reinterpret_cast<Cell*>(lane + LANE_HEADER_SIZE);
+        auto& read = m_read_positions[i];
+        const auto write = std::atomic_ref{*reinterpret_cast<uintptr_t*>(lane)}.load(std::memory_order_acquire);
+
+        // Writers lapped us, skip the records that have been overwritten.
+        if (write - read > m_capacity) {
+            m_dropped += write - read - m_capacity;
+            read = write - m_capacity;
+        }
+
+        for (; read != write; ++read) {
+            auto& cell = cells[read & (m_capacity - 1)];
+            std::atomic_ref sequence{cell.sequence};
+            const auto expected = read + 1;
+            const auto before = sequence.load(std::memory_order_acquire);
+
+            if (before != expected) {
+                // Newer than expected means the cell was reused by a writer that lapped us. Anything else is a
+                // record that is still being written.
+                if (before != 0 && static_cast<intptr_t>(before - expected) > 0) {
+                    ++m_dropped;
+                    continue;
+                }
+
+                break;
+            }
+
+            Record record{};
+            std::memcpy(&record, &cell.record, sizeof(record));
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // The cell was reused while we were copying it.
+            if (sequence.load(std::memory_order_relaxed) != before) {
+                ++m_dropped;
+                continue;
+            }
+
+            for (size_t reg = 0; reg < std::size(record.values); ++reg) {
+                if ((record.registers & (1u << reg)) == 0) {
+                    record.values[reg] = 0;
+                }
+            }
+
+            fn(record);
+            ++drained;
+        }
+    }
+
+    return drained;
+}
+
+uint64_t Recorder::dropped() const {
+    std::scoped_lock lock{m_mutex};
+    return m_dropped;
+}
+} // namespace safetyhook
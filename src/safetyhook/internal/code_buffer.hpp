@@ -0,0 +1,24 @@
+/// @file safetyhook/internal/code_buffer.hpp
+/// @brief Buffer for machine code emitted at runtime.
+
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "safetyhook/utility.hpp"
+
+namespace safetyhook {
+// Machine code being emitted, copied to its allocation once it's complete.
+struct CodeBuffer {
+    std::vector<uint8_t> code{};
+
+    void emit(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+
+    template <typename T> void emit_value(T value) {
+        code.resize(code.size() + sizeof(T));
+        store(code.data() + code.size() - sizeof(T), value);
+    }
+};
+} // namespace safetyhook
@@ -0,0 +1,60 @@
+/// @file safetyhook/internal/metrics.hpp
+/// @brief Updating the metrics reported by safetyhook::metrics.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "safetyhook/metrics.hpp"
+
+namespace safetyhook {
+// The metrics safetyhook updates, in the same order as the fields of Metrics.
+enum class Metric : uint8_t {
+    VM_QUERY_CALLS,
+    VM_QUERY_TIME,
+    MAPS_PARSES,
+    VM_PROTECT_CALLS,
+    VM_PROTECT_TIME,
+    PROTECT_SYSCALLS,
+    TRAP_THREADS_CALLS,
+    TRAP_THREADS_TIME,
+    INSTRUCTIONS_DECODED,
+    NEAR_ALLOCATION_PROBES,
+    NEAR_ALLOCATION_TIME,
+    E9_TO_FF_FALLBACKS,
+    COUNT,
+};
+
+#if SAFETYHOOK_METRICS
+// Adds value to a metric.
+void add_metric(Metric metric, uint64_t value = 1) noexcept;
+
+// Adds the time from its construction to its destruction to a metric.
+class MetricTimer final {
+public:
+    explicit MetricTimer(Metric metric) noexcept : m_metric{metric}, m_start{std::chrono::steady_clock::now()} {}
+    MetricTimer(const MetricTimer&) = delete;
+    MetricTimer& operator=(const MetricTimer&) = delete;
+
+    ~MetricTimer() {
+        const auto elapsed = std::chrono::steady_clock::now() - m_start;
+        add_metric(m_metric, static_cast<uint64_t>(std::chrono::nanoseconds{elapsed}.count()));
+    }
+
+private:
+    Metric m_metric;
+    std::chrono::steady_clock::time_point m_start;
+};
+#else
+inline void add_metric(Metric, uint64_t = 1) noexcept {
+}
+
+class MetricTimer final {
+public:
+    explicit MetricTimer(Metric) noexcept {}
+    MetricTimer(const MetricTimer&) = delete;
+    MetricTimer& operator=(const MetricTimer&) = delete;
+};
+#endif
+} // namespace safetyhook
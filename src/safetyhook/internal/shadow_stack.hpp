@@ -0,0 +1,43 @@
+/// @file safetyhook/internal/shadow_stack.hpp
+/// @brief Stubs and keys shared by the probes that observe calls returning (LatencyProbe and Tracer).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <initializer_list>
+
+#include "safetyhook/allocator.hpp"
+#include "safetyhook/common.hpp"
+
+namespace safetyhook {
+// A probe's entry stub saves the registers that can hold arguments and calls its enter function with some constants
+// and the address of the call's return address. The enter function pushes the return address on a thread local shadow
+// stack and swaps it for the exit stub, which calls the exit function when the call returns. The exit function pops
+// the shadow stack and returns the original return address, which the exit stub jumps to.
+constexpr size_t SHADOW_STACK_EXIT_STUB_SIZE = 64;
+
+using ShadowStackExitFn = uintptr_t(SAFETYHOOK_CCALL*)();
+
+// Returns an instance of T that's never destroyed. Threads can exit after static destruction, so the state they use as
+// they exit is kept in one.
+template <typename T> T& never_destroyed() {
+    static auto* instance = new T{};
+    return *instance;
+}
+
+// Makes the key of a probe from its index in the low index_bits bits and the next generation above them, so the events
+// of a call that returns after its probe was destroyed aren't mistaken for events of a new probe at the same index.
+// Keys are never 0.
+uint32_t next_shadow_stack_key(uint32_t& generation, uint32_t index_bits, size_t index);
+
+// Emits an entry stub of size bytes. It calls enter with args (up to 2) followed by the address of the return address,
+// then jumps to destination.
+void emit_shadow_stack_entry_stub(
+    uint8_t* stub, size_t size, void* enter, std::initializer_list<uint32_t> args, uint8_t* destination);
+
+// Allocates and emits an exit stub that calls exit. Calls can still be returning through it when their probe is
+// destroyed, so callers keep it in never_destroyed state instead of freeing it.
+std::expected<Allocation, Allocator::Error> allocate_shadow_stack_exit_stub(ShadowStackExitFn exit);
+} // namespace safetyhook
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <array>
+#include <climits>
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/internal/code_buffer.hpp"
+#include "safetyhook/utility.hpp"
+
+#include "safetyhook/internal/shadow_stack.hpp"
+
+namespace safetyhook {
+uint32_t next_shadow_stack_key(uint32_t& generation, uint32_t index_bits, size_t index) {
+    if (++generation > (UINT32_MAX >> index_bits)) {
+        generation = 1;
+    }
+
+    return (generation << index_bits) | static_cast<uint32_t>(index);
+}
+
+void emit_shadow_stack_entry_stub(
+    uint8_t* stub, size_t size, void* enter, std::initializer_list<uint32_t> args, uint8_t* destination) {
+    CodeBuffer buf{};
+
+    // movups [xsp + disp32], xmm (store) or movups xmm, [xsp + disp32] (load).
+    const auto emit_movups = [&](uint8_t opcode, uint8_t xmm, uint32_t displacement) {
+        buf.emit({0x0F, opcode, static_cast<uint8_t>(0x84 | (xmm << 3)), 0x24});
+        buf.emit_value(displacement);
+    };
+
+#if SAFETYHOOK_ARCH_X86_64
+    // Save the registers that can hold arguments, plus rax, r10 and r11 which some conventions also use.
+    constexpr uint32_t frame_size = 0xA0; // 32 bytes of shadow space and xmm0 to xmm7.
+    constexpr uint32_t saved_size = 9 * 8;
+    const auto data_offset = static_cast<uint32_t>(size - sizeof(uintptr_t) * 2);
+
+#if SAFETYHOOK_OS_WINDOWS
+    constexpr std::array<uint8_t, 3> arg_registers{1, 2, 8}; // rcx, rdx, r8
+#else
+    constexpr std::array<uint8_t, 3> arg_registers{7, 6, 2}; // rdi, rsi, rdx
+#endif
+
+    buf.emit({0x50, 0x51, 0x52, 0x56, 0x57}); // push rax; push rcx; push rdx; push rsi; push rdi
+    buf.emit({0x41, 0x50, 0x41, 0x51});       // push r8; push r9
+    buf.emit({0x41, 0x52, 0x41, 0x53});       // push r10; push r11
+    buf.emit({0x48, 0x81, 0xEC});             // sub rsp, frame_size
+    buf.emit_value(frame_size);
+
+    for (uint8_t i = 0; i < 8; ++i) {
+        emit_movups(0x11, i, 0x20 + i * 16);
+    }
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        buf.emit({static_cast<uint8_t>(0xB8 + arg_registers[i])}); // mov arg32, imm32
+        buf.emit_value(std::data(args)[i]);
+    }
+
+    const auto return_register = arg_registers[args.size()];
+
+    // lea arg, [rsp + return address]
+    buf.emit({static_cast<uint8_t>(0x48 | ((return_register >> 3) << 2)), 0x8D,
+        static_cast<uint8_t>(0x84 | ((return_register & 7) << 3)), 0x24});
+    buf.emit_value(frame_size + saved_size);
+    buf.emit({0xFF, 0x15}); // call [rip + enter]
+    buf.emit_value(data_offset - static_cast<uint32_t>(buf.code.size() + 4));
+
+    for (uint8_t i = 0; i < 8; ++i) {
+        emit_movups(0x10, i, 0x20 + i * 16);
+    }
+
+    buf.emit({0x48, 0x81, 0xC4}); // add rsp, frame_size
+    buf.emit_value(frame_size);
+    buf.emit({0x41, 0x5B, 0x41, 0x5A});       // pop r11; pop r10
+    buf.emit({0x41, 0x59, 0x41, 0x58});       // pop r9; pop r8
+    buf.emit({0x5F, 0x5E, 0x5A, 0x59, 0x58}); // pop rdi; pop rsi; pop rdx; pop rcx; pop rax
+    buf.emit({0xFF, 0x25});                   // jmp [rip + destination]
+    buf.emit_value(data_offset + 8 - static_cast<uint32_t>(buf.code.size() + 4));
+
+    buf.code.resize(data_offset, 0xCC);
+    buf.code.resize(size);
+    store(buf.code.data() + data_offset, enter);
+    store(buf.code.data() + data_offset + sizeof(uintptr_t), destination);
+#elif SAFETYHOOK_ARCH_X86_32
+    // Save the registers fastcall, thiscall and regparm pass arguments in, and xmm0 to xmm7 for vectorcall. The
+    // arguments of enter go at the bottom of the frame.
+    constexpr uint32_t frame_size = 0x90;
+    constexpr uint32_t saved_size = 3 * 4;
+
+    buf.emit({0x50, 0x51, 0x52}); // push eax; push ecx; push edx
+    buf.emit({0x81, 0xEC});       // sub esp, frame_size
+    buf.emit_value(frame_size);
+
+    for (uint8_t i = 0; i < 8; ++i) {
+        emit_movups(0x11, i, 0x10 + i * 16);
+    }
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (i == 0) {
+            buf.emit({0xC7, 0x04, 0x24}); // mov dword [esp], imm32
+        } else {
+            buf.emit({0xC7, 0x44, 0x24, static_cast<uint8_t>(i * 4)}); // mov dword [esp + i * 4], imm32
+        }
+
+        buf.emit_value(std::data(args)[i]);
+    }
+
+    buf.emit({0x8D, 0x84, 0x24}); // lea eax, [esp + return address]
+    buf.emit_value(frame_size + saved_size);
+    buf.emit({0x89, 0x44, 0x24, static_cast<uint8_t>(args.size() * 4)}); // mov [esp + args * 4], eax
+    buf.emit({0xE8});                                                      // call enter
+    buf.emit_value(static_cast<uint32_t>(static_cast<uint8_t*>(enter) - (stub + buf.code.size() + 4)));
+
+    for (uint8_t i = 0; i < 8; ++i) {
+        emit_movups(0x10, i, 0x10 + i * 16);
+    }
+
+    buf.emit({0x81, 0xC4}); // add esp, frame_size
+    buf.emit_value(frame_size);
+    buf.emit({0x5A, 0x59, 0x58}); // pop edx; pop ecx; pop eax
+    buf.emit({0xE9});             // jmp destination
+    buf.emit_value(static_cast<uint32_t>(destination - (stub + buf.code.size() + 4)));
+
+    buf.code.resize(size, 0xCC);
+#endif
+
+    std::copy(buf.code.begin(), buf.code.end(), stub);
+}
+
+// The exit stub preserves the registers that can hold return values, calls exit and jumps to the address it returns.
+// A jmp through a scratch register is predicted by the branch target buffer, where a ret would be mispredicted since
+// the return stack buffer doesn't know about the swapped return address.
+static void emit_shadow_stack_exit_stub(uint8_t* stub, ShadowStackExitFn exit) {
+    CodeBuffer buf{};
+
+    buf.emit({0x50, 0x52}); // push xax; push xdx
+
+#if SAFETYHOOK_ARCH_X86_64
+    // The data is stored after the code.
+    constexpr uint32_t data_offset = SHADOW_STACK_EXIT_STUB_SIZE - sizeof(uintptr_t);
+
+    buf.emit({0x48, 0x83, 0xEC, 0x40});       // sub rsp, 0x40
+    buf.emit({0x0F, 0x11, 0x44, 0x24, 0x20}); // movups [rsp + 0x20], xmm0
+    buf.emit({0x0F, 0x11, 0x4C, 0x24, 0x30}); // movups [rsp + 0x30], xmm1
+    buf.emit({0xFF, 0x15});                   // call [rip + exit]
+    buf.emit_value(data_offset - static_cast<uint32_t>(buf.code.size() + 4));
+    buf.emit({0x49, 0x89, 0xC3});             // mov r11, rax
+    buf.emit({0x0F, 0x10, 0x44, 0x24, 0x20}); // movups xmm0, [rsp + 0x20]
+    buf.emit({0x0F, 0x10, 0x4C, 0x24, 0x30}); // movups xmm1, [rsp + 0x30]
+    buf.emit({0x48, 0x83, 0xC4, 0x40});       // add rsp, 0x40
+    buf.emit({0x5A, 0x58});                   // pop rdx; pop rax
+    buf.emit({0x41, 0xFF, 0xE3});             // jmp r11
+
+    buf.code.resize(data_offset, 0xCC);
+    buf.code.resize(SHADOW_STACK_EXIT_STUB_SIZE);
+    store(buf.code.data() + data_offset, exit);
+#elif SAFETYHOOK_ARCH_X86_32
+    buf.emit({0x83, 0xEC, 0x18});             // sub esp, 0x18
+    buf.emit({0x0F, 0x11, 0x44, 0x24, 0x08}); // movups [esp + 8], xmm0
+    buf.emit({0xE8});                         // call exit
+    buf.emit_value(static_cast<uint32_t>(reinterpret_cast<uint8_t*>(exit) - (stub + buf.code.size() + 4)));
+    buf.emit({0x89, 0xC1});                   // mov ecx, eax
+    buf.emit({0x0F, 0x10, 0x44, 0x24, 0x08}); // movups xmm0, [esp + 8]
+    buf.emit({0x83, 0xC4, 0x18});             // add esp, 0x18
+    buf.emit({0x5A, 0x58});                   // pop edx; pop eax
+    buf.emit({0xFF, 0xE1});                   // jmp ecx
+#endif
+
+    std::copy(buf.code.begin(), buf.code.end(), stub);
+}
+
+std::expected<Allocation, Allocator::Error> allocate_shadow_stack_exit_stub(ShadowStackExitFn exit) {
+    auto exit_stub = Allocator::global()->allocate(SHADOW_STACK_EXIT_STUB_SIZE);
+
+    if (!exit_stub) {
+        return std::unexpected{exit_stub.error()};
+    }
+
+    emit_shadow_stack_exit_stub(exit_stub->data(), exit);
+
+    return exit_stub;
+}
+} // namespace safetyhook
@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <utility>
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/os.hpp"
+#include "safetyhook/utility.hpp"
+
+#if SAFETYHOOK_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "safetyhook/trace_file.hpp"
+
+namespace safetyhook {
+static_assert(sizeof(TraceFile::Header) == 72);
+static_assert(sizeof(TraceFile::SegmentHeader) == 64);
+static_assert(sizeof(TraceFile::Record) == 16);
+
+constexpr uint32_t TRACE_FILE_NAMES_OFFSET = 0x100;
+constexpr size_t TRACE_FILE_PAGE_SIZE = 0x1000;
+
+// Readers map the file read only, where an atomic 64-bit load (a locked cmpxchg8b on x86-32) would fault, so they
+// use volatile loads ordered by a fence instead.
+template <typename T> static T trace_file_load(const T& value) {
+    const auto result = *static_cast<const volatile T*>(&value);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return result;
+}
+
+TraceFile::Writer::Writer(std::shared_ptr<TraceFile> file)
+    : m_file{std::move(file)}, m_thread_id{current_thread_id()} {
+}
+
+TraceFile::Writer::Writer(Writer&& other) noexcept {
+    *this = std::move(other);
+}
+
+TraceFile::Writer& TraceFile::Writer::operator=(Writer&& other) noexcept {
+    if (this != &other) {
+        release();
+        m_file = std::move(other.m_file);
+        m_segment = std::exchange(other.m_segment, nullptr);
+        m_used = std::exchange(other.m_used, 0);
+        m_thread_id = std::exchange(other.m_thread_id, 0);
+    }
+
+    return *this;
+}
+
+TraceFile::Writer::~Writer() {
+    release();
+}
+
+bool TraceFile::Writer::write(uint32_t hook_id, uint8_t type, std::span<const uint64_t> payload) {
+    return write_at(__rdtsc(), hook_id, type, payload);
+}
+
+bool TraceFile::Writer::write_at(
+    uint64_t timestamp, uint32_t hook_id, uint8_t type, std::span<const uint64_t> payload) {
+    if (m_file == nullptr) {
+        return false;
+    }
+
+    const auto size = static_cast<uint32_t>(sizeof(Record) + payload.size() * sizeof(uint64_t));
+    const auto capacity = m_file->header().segment_size - static_cast<uint32_t>(sizeof(SegmentHeader));
+
+    if (payload.size() > MAX_PAYLOAD || ((m_segment == nullptr || m_used + size > capacity) && !rotate())) {
+        std::atomic_ref{m_file->header().dropped}.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const Record record{timestamp, hook_id, type, static_cast<uint8_t>(payload.size()), 0};
+    auto* data = reinterpret_cast<uint8_t*>(m_segment + 1) + m_used;
+
+    std::memcpy(data, &record, sizeof(record));
+
+    if (!payload.empty()) {
+        std::memcpy(data + sizeof(record), payload.data(), payload.size_bytes());
+    }
+
+    // Publishing the new count makes the record visible to readers, and it's in the file from then on.
+    m_used += size;
+    std::atomic_ref{m_segment->used}.store(m_used, std::memory_order_release);
+
+    return true;
+}
+
+// Releases the current segment and claims another one. A segment still owned by another writer is skipped, so a
+// writer never waits, and gives up once it tried as many sequence numbers as there are segments.
+bool TraceFile::Writer::rotate() {
+    release();
+
+    auto& header = m_file->header();
+
+    for (uint32_t attempt = 0; attempt < header.segment_count; ++attempt) {
+        const auto sequence = std::atomic_ref{header.next_sequence}.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto& segment = m_file->segment(sequence % header.segment_count);
+        uint32_t writing = 0;
+
+        if (!std::atomic_ref{segment.writing}.compare_exchange_strong(writing, 1, std::memory_order_acquire)) {
+            continue;
+        }
+
+        // Readers that see the old sequence number after the records are overwritten know to throw their copy away.
+        std::atomic_ref{segment.sequence}.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::atomic_ref{segment.used}.store(0, std::memory_order_relaxed);
+        std::atomic_ref{segment.thread_id}.store(m_thread_id, std::memory_order_relaxed);
+        std::atomic_ref{segment.sequence}.store(sequence, std::memory_order_release);
+
+        m_segment = &segment;
+        m_used = 0;
+
+        return true;
+    }
+
+    return false;
+}
+
+void TraceFile::Writer::release() {
+    if (m_segment != nullptr) {
+        std::atomic_ref{m_segment->writing}.store(0, std::memory_order_release);
+        m_segment = nullptr;
+    }
+}
+
+std::expected<std::shared_ptr<TraceFile>, TraceFile::Error> TraceFile::create(
+    const std::filesystem::path& path, size_t segment_size, size_t segment_count) {
+    if (segment_size < TRACE_FILE_PAGE_SIZE || segment_size > 0x4000'0000 || segment_size % TRACE_FILE_PAGE_SIZE != 0 ||
+        segment_count < 2 || segment_count > 0x10000 ||
+        segment_count > (std::numeric_limits<size_t>::max() - HEADER_SIZE) / segment_size) {
+        return std::unexpected{Error::BAD_SIZE};
+    }
+
+    auto mapping = file_map(path, HEADER_SIZE + segment_size * segment_count, VM_ACCESS_RW);
+
+    if (!mapping) {
+        return std::unexpected{Error::FAILED_TO_MAP};
+    }
+
+    std::shared_ptr<TraceFile> file{new TraceFile{}};
+
+    file->m_mapping = *mapping;
+
+    // The file starts zeroed, so the segments are unused and the table of names is empty.
+    auto& header = file->header();
+
+    header.version = VERSION;
+    header.header_size = HEADER_SIZE;
+    header.segment_size = static_cast<uint32_t>(segment_size);
+    header.segment_count = static_cast<uint32_t>(segment_count);
+    header.names_offset = TRACE_FILE_NAMES_OFFSET;
+    header.names_size = HEADER_SIZE - TRACE_FILE_NAMES_OFFSET;
+
+    // Measure the time stamp counter frequency so a file left behind by a crash can still be converted to time.
+    file->m_start_time = std::chrono::steady_clock::now();
+    header.start_timestamp = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    file->measure_ticks_per_microsecond();
+
+    // The magic number goes last so a file with a magic number has a complete header.
+    std::atomic_thread_fence(std::memory_order_release);
+    std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+
+    return file;
+}
+
+TraceFile::~TraceFile() {
+    if (m_mapping.address == nullptr) {
+        return;
+    }
+
+    // Measured over the file's lifetime, this is more precise than the measurement made when it was created.
+    measure_ticks_per_microsecond();
+    file_flush(m_mapping);
+    file_unmap(m_mapping);
+}
+
+bool TraceFile::set_name(uint32_t hook_id, std::string_view name) {
+    std::scoped_lock lock{m_names_mutex};
+
+    auto& header = this->header();
+    const auto used = header.names_used;
+    const auto size = sizeof(NameEntry) + align_up(name.size(), sizeof(uint32_t));
+
+    if (size > header.names_size - used) {
+        return false;
+    }
+
+    auto* entry = m_mapping.address + header.names_offset + used;
+    const NameEntry name_entry{hook_id, static_cast<uint32_t>(name.size())};
+
+    std::memcpy(entry, &name_entry, sizeof(name_entry));
+    std::copy(name.begin(), name.end(), entry + sizeof(name_entry));
+    std::atomic_ref{header.names_used}.store(used + static_cast<uint32_t>(size), std::memory_order_release);
+
+    return true;
+}
+
+void TraceFile::flush() {
+    file_flush(m_mapping);
+}
+
+uint64_t TraceFile::dropped() const {
+    return std::atomic_ref{header().dropped}.load(std::memory_order_relaxed);
+}
+
+void TraceFile::measure_ticks_per_microsecond() {
+    auto& header = this->header();
+    const auto ticks = __rdtsc() - header.start_timestamp;
+    const auto elapsed = std::chrono::duration<double, std::micro>{std::chrono::steady_clock::now() - m_start_time};
+
+    header.ticks_per_microsecond = static_cast<double>(ticks) / elapsed.count();
+}
+
+TraceFile::SegmentHeader& TraceFile::segment(size_t index) const {
+    auto* segments = m_mapping.address + header().header_size;
+    return *reinterpret_cast<SegmentHeader*>(segments + index * header().segment_size);
+}
+
+std::expected<TraceFileReader, TraceFileReader::Error> TraceFileReader::open(const std::filesystem::path& path) {
+    auto mapping = file_map(path, 0, VM_ACCESS_R);
+
+    if (!mapping) {
+        return std::unexpected{Error::FAILED_TO_MAP};
+    }
+
+    TraceFileReader reader{*mapping};
+
+    if (mapping->size < sizeof(TraceFile::Header) ||
+        !std::equal(std::begin(TraceFile::MAGIC), std::end(TraceFile::MAGIC), reader.header().magic)) {
+        return std::unexpected{Error::BAD_FORMAT};
+    }
+
+    const auto& header = reader.header();
+
+    if (header.version != TraceFile::VERSION) {
+        return std::unexpected{Error::UNSUPPORTED_VERSION};
+    }
+
+    if (header.segment_size <= sizeof(TraceFile::SegmentHeader) || header.segment_size % sizeof(uint64_t) != 0 ||
+        header.names_offset > header.header_size || header.names_size > header.header_size - header.names_offset ||
+        header.header_size > mapping->size ||
+        header.segment_count > (mapping->size - header.header_size) / header.segment_size) {
+        return std::unexpected{Error::BAD_FORMAT};
+    }
+
+    reader.m_cursors.resize(header.segment_count);
+
+    return reader;
+}
+
+TraceFileReader::TraceFileReader(FileMapping mapping) : m_mapping{mapping} {
+}
+
+TraceFileReader::TraceFileReader(TraceFileReader&& other) noexcept {
+    *this = std::move(other);
+}
+
+TraceFileReader& TraceFileReader::operator=(TraceFileReader&& other) noexcept {
+    if (this != &other) {
+        if (m_mapping.address != nullptr) {
+            file_unmap(m_mapping);
+        }
+
+        m_mapping = std::exchange(other.m_mapping, {});
+        m_cursors = std::move(other.m_cursors);
+        m_records = std::move(other.m_records);
+    }
+
+    return *this;
+}
+
+TraceFileReader::~TraceFileReader() {
+    if (m_mapping.address != nullptr) {
+        file_unmap(m_mapping);
+    }
+}
+
+size_t TraceFileReader::read(const std::function<void(const Event&)>& fn) {
+    const auto& header = this->header();
+    const auto* segments = m_mapping.address + header.header_size;
+    const auto capacity = header.segment_size - static_cast<uint32_t>(sizeof(TraceFile::SegmentHeader));
+    std::vector<std::pair<uint64_t, uint32_t>> order{};
+
+    const auto segment = [&](uint32_t index) -> const TraceFile::SegmentHeader& {
+        return *reinterpret_cast<const TraceFile::SegmentHeader*>(segments + size_t{index} * header.segment_size);
+    };
+
+    for (uint32_t i = 0; i < header.segment_count; ++i) {
+        if (const auto sequence = trace_file_load(segment(i).sequence); sequence != 0) {
+            order.emplace_back(sequence, i);
+        }
+    }
+
+    std::ranges::sort(order);
+
+    size_t count = 0;
+
+    for (const auto& [sequence, index] : order) {
+        const auto& segment_header = segment(index);
+        auto& cursor = m_cursors[index];
+
+        if (cursor.sequence != sequence) {
+            cursor = {sequence, 0};
+        }
+
+        const auto used = std::min(trace_file_load(segment_header.used), capacity);
+        const auto thread_id = trace_file_load(segment_header.thread_id);
+
+        if (used <= cursor.offset) {
+            continue;
+        }
+
+        const auto* data = reinterpret_cast<const uint8_t*>(&segment_header + 1);
+        m_records.assign(data + cursor.offset, data + used);
+
+        // The copy is only good if no writer claimed the segment again while it was made.
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (trace_file_load(segment_header.sequence) != sequence) {
+            continue;
+        }
+
+        size_t offset = 0;
+
+        while (offset + sizeof(TraceFile::Record) <= m_records.size()) {
+            TraceFile::Record record{};
+            std::memcpy(&record, m_records.data() + offset, sizeof(record));
+
+            const auto size = sizeof(record) + record.payload_count * sizeof(uint64_t);
+
+            if (record.payload_count > TraceFile::MAX_PAYLOAD || offset + size > m_records.size()) {
+                break;
+            }
+
+            // Records are 8 byte aligned in the copy, like in the segment.
+            const std::span payload{
+                reinterpret_cast<const uint64_t*>(m_records.data() + offset + sizeof(record)), record.payload_count};
+
+            fn({sequence, record.timestamp, thread_id, record.hook_id, record.type, payload});
+            offset += size;
+            ++count;
+        }
+
+        cursor.offset += static_cast<uint32_t>(offset);
+    }
+
+    return count;
+}
+
+std::map<uint32_t, std::string> TraceFileReader::names() const {
+    const auto& header = this->header();
+    const auto* table = m_mapping.address + header.names_offset;
+    const auto used = std::min(trace_file_load(header.names_used), header.names_size);
+    std::map<uint32_t, std::string> names{};
+
+    for (size_t offset = 0; offset + sizeof(TraceFile::NameEntry) <= used;) {
+        TraceFile::NameEntry entry{};
+        std::memcpy(&entry, table + offset, sizeof(entry));
+        offset += sizeof(entry);
+
+        if (entry.length > used - offset) {
+            break;
+        }
+
+        names[entry.hook_id].assign(reinterpret_cast<const char*>(table + offset), entry.length);
+        offset += align_up(size_t{entry.length}, sizeof(uint32_t));
+    }
+
+    return names;
+}
+} // namespace safetyhook
@@ -0,0 +1,597 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "safetyhook/common.hpp"
+#include "safetyhook/internal/shadow_stack.hpp"
+#include "safetyhook/os.hpp"
+
+#if SAFETYHOOK_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "safetyhook/tracer.hpp"
+
+namespace safetyhook {
+// A tracer's key (see next_shadow_stack_key) has its index in the registry in the low bits, so a thread's buffer for a
+// destroyed tracer isn't mistaken for the buffer of a new tracer at the same index.
+constexpr uint32_t TRACER_INDEX_BITS = 4;
+constexpr uint32_t TRACER_INDEX_MASK = (1u << TRACER_INDEX_BITS) - 1;
+constexpr size_t TRACE_THUNK_SIZE = sizeof(uintptr_t) == 8 ? 224 : 192;
+
+static_assert(Tracer::MAX_TRACERS == size_t{1} << TRACER_INDEX_BITS);
+
+struct TraceRecord {
+    uint64_t timestamp;
+    uint32_t target;
+    uint32_t type;
+};
+
+// A single producer, single consumer ring of records. The owning thread advances head, drains advance tail. The
+// buffers of a tracer that writes to a file only hold the thread's writer.
+struct TraceBuffer {
+    uint32_t key{};
+    uint32_t thread_id{};
+    size_t mask{};
+    std::unique_ptr<TraceRecord[]> records{};
+    TraceFile::Writer writer{};
+    alignas(64) std::atomic_uint64_t head{};
+    std::atomic_uint64_t dropped{};
+    alignas(64) std::atomic_uint64_t tail{};
+};
+
+struct TraceFrame {
+    uintptr_t return_address;
+    uint32_t key;
+    uint32_t target;
+};
+
+// The shadow stack and buffers of a thread. Other threads only touch it with the registry's mutex held.
+struct TraceThread {
+    uint32_t thread_id{current_thread_id()};
+    size_t depth{};
+    std::array<TraceFrame, Tracer::MAX_DEPTH> frames{};
+    std::array<std::unique_ptr<TraceBuffer>, Tracer::MAX_TRACERS> buffers{};
+
+    TraceThread();
+    TraceThread(const TraceThread&) = delete;
+    TraceThread& operator=(const TraceThread&) = delete;
+    ~TraceThread();
+};
+
+struct TracerEntry {
+    Tracer* tracer;
+    uint32_t key;
+    size_t capacity;
+    std::shared_ptr<TraceFile> file;
+};
+
+struct TracerRegistry {
+    std::mutex mutex{};
+    std::array<TracerEntry, Tracer::MAX_TRACERS> tracers{};
+    std::vector<TraceThread*> threads{};
+    uint32_t generation{};
+    Allocation exit_stub{};
+};
+
+static TracerRegistry& tracer_registry() {
+    return never_destroyed<TracerRegistry>();
+}
+
+static std::atomic<uint8_t*> g_trace_exit_stub{};
+
+// Counts the tracers destroyed, so each thread can tell when it holds buffers it should drop.
+static std::atomic_uint32_t g_trace_retirements{};
+
+// The hot path only reads these trivially initialized variables. t_trace_thread_owner frees the thread's state when
+// it exits.
+static thread_local TraceThread* t_trace_thread{};
+static thread_local bool t_trace_busy{};
+static thread_local bool t_trace_thread_exited{};
+static thread_local uint32_t t_trace_retirements{};
+static thread_local std::unique_ptr<TraceThread> t_trace_thread_owner{};
+
+TraceThread::TraceThread() {
+    auto& registry = tracer_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    registry.threads.push_back(this);
+}
+
+TraceThread::~TraceThread() {
+    t_trace_busy = true;
+
+    auto& registry = tracer_registry();
+    std::scoped_lock lock{registry.mutex};
+
+    std::erase(registry.threads, this);
+
+    // Hand the buffers of live tracers over so their last events can still be drained. Writers are destroyed with the
+    // thread, which releases their segments.
+    for (auto& buffer : buffers) {
+        if (buffer == nullptr || buffer->writer) {
+            continue;
+        }
+
+        const auto& entry = registry.tracers[buffer->key & TRACER_INDEX_MASK];
+
+        if (entry.tracer != nullptr && entry.key == buffer->key) {
+            entry.tracer->m_exited_buffers.push_back(std::move(buffer));
+        }
+    }
+
+    t_trace_thread = nullptr;
+    t_trace_thread_exited = true;
+}
+
+static void append_trace_record(TraceBuffer& buffer, uint32_t target, uint32_t type, uint64_t timestamp) {
+    if (buffer.writer) {
+        buffer.writer.write_at(timestamp, target, static_cast<uint8_t>(type));
+        return;
+    }
+
+    const auto head = buffer.head.load(std::memory_order_relaxed);
+
+    if (head - buffer.tail.load(std::memory_order_acquire) > buffer.mask) {
+        buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer.records[head & buffer.mask] = {timestamp, target, type};
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+// Allocates the calling thread's state and its buffer for a tracer. Traced calls made meanwhile (a traced allocator,
+// for example) aren't traced.
+static TraceBuffer* allocate_trace_buffer(uint32_t key) {
+    if (t_trace_thread_exited) {
+        return nullptr;
+    }
+
+    t_trace_busy = true;
+
+    if (t_trace_thread == nullptr) {
+        t_trace_thread_owner = std::make_unique<TraceThread>();
+        t_trace_thread = t_trace_thread_owner.get();
+    }
+
+    auto& registry = tracer_registry();
+    std::unique_ptr<TraceBuffer> replaced{};
+    TraceBuffer* result{};
+
+    {
+        std::scoped_lock lock{registry.mutex};
+        const auto& entry = registry.tracers[key & TRACER_INDEX_MASK];
+
+        // The tracer can be gone if the call raced with its destruction.
+        if (entry.tracer != nullptr && entry.key == key) {
+            auto buffer = std::make_unique<TraceBuffer>();
+
+            buffer->key = key;
+            buffer->thread_id = t_trace_thread->thread_id;
+
+            if (entry.file != nullptr) {
+                buffer->writer = TraceFile::Writer{entry.file};
+            } else {
+                buffer->mask = entry.capacity - 1;
+                buffer->records = std::make_unique<TraceRecord[]>(entry.capacity);
+            }
+
+            // Replaces the buffer of a destroyed tracer that had the same index.
+            auto& slot = t_trace_thread->buffers[key & TRACER_INDEX_MASK];
+            replaced = std::exchange(slot, std::move(buffer));
+            result = slot.get();
+        }
+    }
+
+    replaced.reset();
+    t_trace_busy = false;
+
+    return result;
+}
+
+// Drops the calling thread's buffers of destroyed tracers. This releases the segments of their writers and lets the
+// files be unmapped. Only the owning thread can do it, since it writes to its buffers without locking.
+static void drop_stale_trace_buffers() {
+    auto* thread = t_trace_thread;
+
+    if (thread == nullptr) {
+        return;
+    }
+
+    const auto was_busy = std::exchange(t_trace_busy, true);
+    auto& registry = tracer_registry();
+    std::array<std::unique_ptr<TraceBuffer>, Tracer::MAX_TRACERS> stale{};
+
+    {
+        std::scoped_lock lock{registry.mutex};
+
+        for (size_t i = 0; i < thread->buffers.size(); ++i) {
+            const auto& entry = registry.tracers[i];
+
+            if (thread->buffers[i] != nullptr && (entry.tracer == nullptr || entry.key != thread->buffers[i]->key)) {
+                stale[i] = std::move(thread->buffers[i]);
+            }
+        }
+    }
+
+    // Destroyed outside the lock, like the buffers allocate_trace_buffer replaces.
+    for (auto& buffer : stale) {
+        buffer.reset();
+    }
+
+    t_trace_busy = was_busy;
+}
+
+// Called by a target's thunk with the address of the return address of the call. Records the enter event and swaps
+// the return address for the exit stub, unless the call can't be traced.
+static void SAFETYHOOK_CCALL trace_enter(uint32_t key, uint32_t target, uintptr_t* return_address) {
+    if (t_trace_busy) {
+        return;
+    }
+
+    if (const auto retirements = g_trace_retirements.load(std::memory_order_relaxed);
+        retirements != t_trace_retirements) {
+        t_trace_retirements = retirements;
+        drop_stale_trace_buffers();
+    }
+
+    auto* thread = t_trace_thread;
+    auto* buffer = thread != nullptr ? thread->buffers[key & TRACER_INDEX_MASK].get() : nullptr;
+
+    if (buffer == nullptr || buffer->key != key) {
+        if (buffer = allocate_trace_buffer(key); buffer == nullptr) {
+            return;
+        }
+
+        thread = t_trace_thread;
+    }
+
+    if (thread->depth == Tracer::MAX_DEPTH) {
+        return;
+    }
+
+    thread->frames[thread->depth++] = {*return_address, key, target};
+    *return_address = reinterpret_cast<uintptr_t>(g_trace_exit_stub.load(std::memory_order_relaxed));
+    append_trace_record(*buffer, target, Tracer::Event::ENTER, __rdtsc());
+}
+
+// Called by the exit stub when a traced call returns. Records the exit event and returns the original return address.
+static uintptr_t SAFETYHOOK_CCALL trace_exit() {
+    const auto timestamp = __rdtsc();
+    auto* thread = t_trace_thread;
+    const auto frame = thread->frames[--thread->depth];
+
+    if (auto* buffer = thread->buffers[frame.key & TRACER_INDEX_MASK].get();
+        buffer != nullptr && buffer->key == frame.key) {
+        append_trace_record(*buffer, frame.target, Tracer::Event::EXIT, timestamp);
+    }
+
+    return frame.return_address;
+}
+
+static std::string trace_target_name(const Tracer::Target& target) {
+    if (!target.name.empty()) {
+        return target.name;
+    }
+
+    if (const auto symbol = symbol_query(reinterpret_cast<uint8_t*>(target.address));
+        symbol && symbol->name != nullptr) {
+        return symbol->name;
+    }
+
+    constexpr auto digits = "0123456789abcdef";
+    auto address = reinterpret_cast<uintptr_t>(target.address);
+    std::string name(sizeof(uintptr_t) * 2, '0');
+
+    for (auto it = name.rbegin(); it != name.rend(); ++it, address >>= 4) {
+        *it = digits[address & 0xF];
+    }
+
+    return "0x" + name;
+}
+
+std::expected<std::shared_ptr<Tracer>, Tracer::Error> Tracer::create(
+    const std::vector<Target>& targets, size_t capacity) {
+    return create(Allocator::global(), targets, capacity);
+}
+
+std::expected<std::shared_ptr<Tracer>, Tracer::Error> Tracer::create(
+    const std::shared_ptr<Allocator>& allocator, const std::vector<Target>& targets, size_t capacity) {
+    return create(allocator, targets, capacity, nullptr);
+}
+
+std::expected<std::shared_ptr<Tracer>, Tracer::Error> Tracer::create(
+    const std::shared_ptr<TraceFile>& file, const std::vector<Target>& targets) {
+    return create(Allocator::global(), targets, 0, file);
+}
+
+std::expected<std::shared_ptr<Tracer>, Tracer::Error> Tracer::create(const std::shared_ptr<Allocator>& allocator,
+    const std::vector<Target>& targets, size_t capacity, const std::shared_ptr<TraceFile>& file) {
+    if (file == nullptr && (capacity == 0 || capacity > 0x1000'0000)) {
+        return std::unexpected{Error::bad_capacity()};
+    }
+
+    std::shared_ptr<Tracer> tracer{new Tracer{}};
+
+    tracer->m_capacity = file == nullptr ? std::bit_ceil(capacity) : 0;
+
+    {
+        auto& registry = tracer_registry();
+        std::scoped_lock lock{registry.mutex};
+
+        if (!registry.exit_stub) {
+            auto exit_stub = allocate_shadow_stack_exit_stub(&trace_exit);
+
+            if (!exit_stub) {
+                return std::unexpected{Error::bad_allocation(exit_stub.error())};
+            }
+
+            registry.exit_stub = std::move(*exit_stub);
+            g_trace_exit_stub.store(registry.exit_stub.data(), std::memory_order_relaxed);
+        }
+
+        const auto entry = std::ranges::find(registry.tracers, nullptr, &TracerEntry::tracer);
+
+        if (entry == registry.tracers.end()) {
+            return std::unexpected{Error::too_many_tracers()};
+        }
+
+        tracer->m_key = next_shadow_stack_key(registry.generation, TRACER_INDEX_BITS,
+            static_cast<size_t>(std::distance(registry.tracers.begin(), entry)));
+        *entry = {tracer.get(), tracer->m_key, tracer->m_capacity, file};
+    }
+
+    tracer->m_names.reserve(targets.size());
+
+    for (const auto& target : targets) {
+        tracer->m_names.push_back(trace_target_name(target));
+
+        if (file != nullptr) {
+            file->set_name(static_cast<uint32_t>(tracer->m_names.size() - 1), tracer->m_names.back());
+        }
+    }
+
+    if (targets.empty()) {
+        return tracer;
+    }
+
+    auto thunks = allocator->allocate(TRACE_THUNK_SIZE * targets.size());
+
+    if (!thunks) {
+        return std::unexpected{Error::bad_allocation(thunks.error())};
+    }
+
+    tracer->m_thunks = std::move(*thunks);
+    tracer->m_hooks.reserve(targets.size());
+
+    // The thunks continue to the trampolines, so they're written once the hooks exist and enabled after that.
+    for (size_t i = 0; i < targets.size(); ++i) {
+        auto* thunk = tracer->m_thunks.data() + i * TRACE_THUNK_SIZE;
+        auto hook = InlineHook::create(allocator, targets[i].address, thunk, InlineHook::StartDisabled);
+
+        if (!hook) {
+            return std::unexpected{Error::bad_inline_hook(hook.error(), static_cast<uint8_t*>(targets[i].address))};
+        }
+
+        // The thunk passes the tracer's key and the target's index to trace_enter, then continues to the trampoline.
+        emit_shadow_stack_entry_stub(thunk, TRACE_THUNK_SIZE, reinterpret_cast<void*>(&trace_enter),
+            {tracer->m_key, static_cast<uint32_t>(i)}, hook->trampoline().data());
+        tracer->m_hooks.push_back(std::move(*hook));
+    }
+
+    tracer->m_start_timestamp = __rdtsc();
+    tracer->m_start_time = std::chrono::steady_clock::now();
+
+    for (auto& hook : tracer->m_hooks) {
+        if (auto result = hook.enable(); !result) {
+            return std::unexpected{Error::bad_inline_hook(result.error(), hook.target())};
+        }
+    }
+
+    return tracer;
+}
+
+Tracer::~Tracer() {
+    m_hooks.clear();
+    stop_flushing();
+
+    {
+        auto& registry = tracer_registry();
+        std::scoped_lock lock{registry.mutex};
+
+        if (m_key != 0) {
+            registry.tracers[m_key & TRACER_INDEX_MASK] = {};
+            g_trace_retirements.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        m_exited_buffers.clear();
+    }
+
+    // The other threads drop their buffers the next time they enter a traced function, or when they exit.
+    drop_stale_trace_buffers();
+}
+
+size_t Tracer::drain(const std::function<void(const Event&)>& fn) {
+    std::scoped_lock drain_lock{m_drain_mutex};
+    std::vector<Event> events{};
+
+    {
+        auto& registry = tracer_registry();
+        std::scoped_lock lock{registry.mutex};
+
+        const auto drain_buffer = [&](TraceBuffer& buffer) {
+            const auto head = buffer.head.load(std::memory_order_acquire);
+            const auto tail = buffer.tail.load(std::memory_order_relaxed);
+
+            for (auto i = tail; i != head; ++i) {
+                const auto& record = buffer.records[i & buffer.mask];
+                events.push_back(
+                    {record.timestamp, buffer.thread_id, record.target, static_cast<Event::Type>(record.type)});
+            }
+
+            buffer.tail.store(head, std::memory_order_release);
+        };
+
+        for (auto* thread : registry.threads) {
+            if (auto& buffer = thread->buffers[m_key & TRACER_INDEX_MASK]; buffer && buffer->key == m_key) {
+                drain_buffer(*buffer);
+            }
+        }
+
+        // The threads of these buffers have exited, so they're empty once drained.
+        for (auto& buffer : m_exited_buffers) {
+            drain_buffer(*buffer);
+            m_exited_dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+
+        m_exited_buffers.clear();
+    }
+
+    for (const auto& event : events) {
+        fn(event);
+    }
+
+    return events.size();
+}
+
+void Tracer::start_flushing(std::function<void(const Event&)> fn, std::chrono::milliseconds interval) {
+    std::scoped_lock lock{m_flush_mutex};
+
+    if (m_flush_thread.joinable()) {
+        return;
+    }
+
+    m_flushing = true;
+    m_flush_thread = std::thread{[this, fn = std::move(fn), interval] {
+        std::unique_lock flush_lock{m_flush_mutex};
+
+        while (m_flushing) {
+            flush_lock.unlock();
+            drain(fn);
+            flush_lock.lock();
+            m_flush_cv.wait_for(flush_lock, interval, [this] { return !m_flushing; });
+        }
+
+        flush_lock.unlock();
+        drain(fn);
+    }};
+}
+
+void Tracer::stop_flushing() {
+    std::thread flush_thread{};
+
+    {
+        std::scoped_lock lock{m_flush_mutex};
+        m_flushing = false;
+        flush_thread = std::move(m_flush_thread);
+    }
+
+    m_flush_cv.notify_all();
+
+    if (flush_thread.joinable()) {
+        flush_thread.join();
+    }
+}
+
+uint64_t Tracer::dropped() const {
+    auto& registry = tracer_registry();
+    std::scoped_lock lock{registry.mutex};
+    auto dropped = m_exited_dropped;
+
+    for (auto* thread : registry.threads) {
+        if (auto& buffer = thread->buffers[m_key & TRACER_INDEX_MASK]; buffer && buffer->key == m_key) {
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+    }
+
+    for (const auto& buffer : m_exited_buffers) {
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+
+    return dropped;
+}
+
+double Tracer::ticks_per_microsecond() const {
+    constexpr auto min_elapsed = std::chrono::milliseconds{10};
+
+    if (const auto elapsed = std::chrono::steady_clock::now() - m_start_time; elapsed < min_elapsed) {
+        std::this_thread::sleep_for(min_elapsed - elapsed);
+    }
+
+    const auto ticks = __rdtsc() - m_start_timestamp;
+    const auto elapsed = std::chrono::duration<double, std::micro>{std::chrono::steady_clock::now() - m_start_time};
+
+    return static_cast<double>(ticks) / elapsed.count();
+}
+
+ChromeTraceWriter::ChromeTraceWriter(std::ostream& out, const Tracer& tracer)
+    : ChromeTraceWriter{out, tracer.names(), tracer.start_timestamp(), tracer.ticks_per_microsecond()} {
+}
+
+ChromeTraceWriter::ChromeTraceWriter(std::ostream& out, const std::vector<std::string>& names,
+    uint64_t start_timestamp, double ticks_per_microsecond)
+    : m_out{&out}, m_start_timestamp{start_timestamp}, m_ticks_per_microsecond{ticks_per_microsecond} {
+    // Names are written as JSON strings.
+    for (const auto& name : names) {
+        std::string escaped{};
+
+        for (const auto c : name) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                constexpr auto digits = "0123456789abcdef";
+                escaped += "\\u00";
+                escaped += digits[(c >> 4) & 0xF];
+                escaped += digits[c & 0xF];
+            } else {
+                escaped += c;
+            }
+        }
+
+        m_names.push_back(std::move(escaped));
+    }
+
+    *m_out << "[";
+}
+
+ChromeTraceWriter::~ChromeTraceWriter() {
+    finish();
+}
+
+void ChromeTraceWriter::write(const Tracer::Event& event) {
+    if (m_finished || event.target >= m_names.size()) {
+        return;
+    }
+
+    // Microseconds with three decimals, relative to the tracer's creation.
+    const auto ticks = static_cast<double>(static_cast<int64_t>(event.timestamp - m_start_timestamp));
+    const auto nanoseconds = static_cast<int64_t>(ticks * 1000.0 / m_ticks_per_microsecond);
+    const auto fraction = std::to_string(1000 + std::abs(nanoseconds % 1000)).substr(1);
+    const auto sign = nanoseconds < 0 && nanoseconds > -1000 ? "-" : "";
+
+    *m_out << (m_first ? "\n" : ",\n") << R"({"name":")" << m_names[event.target] << R"(","cat":"safetyhook","ph":")"
+           << (event.type == Tracer::Event::ENTER ? 'B' : 'E') << R"(","ts":)" << sign << nanoseconds / 1000 << '.'
+           << fraction << R"(,"pid":0,"tid":)" << event.thread_id << '}';
+    m_first = false;
+}
+
+void ChromeTraceWriter::finish() {
+    if (!m_finished) {
+        *m_out << "\n]\n";
+        m_out->flush();
+        m_finished = true;
+    }
+}
+} // namespace safetyhook
@@ -1,10 +1,206 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cstring>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "safetyhook/os.hpp"
+#include "safetyhook/utility.hpp"
 
 #include "safetyhook/vmt_hook.hpp"
 
 namespace safetyhook {
+// A cloned VMT, including its header. Shared clones are registered by the VMT they were cloned from and count the
+// hooks on each entry so VmHooks with the same function can share it. The allocation starts with a pointer back to the
+// clone so the destructor wrappers can find it from an object's vptr. An in place "clone" has no allocation, its
+// entries are the original VMT's and it is always shared.
+struct VmtClone {
+    Allocation allocation{};
+    uint8_t** entries{};
+    uint8_t** original_vmt{};
+    bool is_shared{};
+    bool is_in_place{};
+    std::mutex mutex{};
+    std::vector<size_t> hook_counts{};
+    std::vector<uint8_t*> original_vms{};
+
+    // The tables of the VmtHooks untracking objects on destruction, and the index of the destructor they wrap. Every
+    // destruction of a hooked object reads them, so they have their own lock that the destructors share.
+    std::shared_mutex untracking_mutex{};
+    std::vector<VmtObjectTable*> untracking_tables{};
+    size_t destructor_index{SIZE_MAX};
+
+    [[nodiscard]] uint8_t** vmt() const { return entries; }
+};
+
+// Tracks hooked objects and their original VMTs for a VmtHook. Objects are spread over shards by address, each an
+// open addressing table with its own lock, so threads applying and removing hooks rarely contend and tracking an
+// object doesn't allocate (beyond the occasional doubling of a shard).
+class VmtObjectTable {
+public:
+    struct Entry {
+        void* object{};
+        uint8_t** original_vmt{};
+    };
+
+    static constexpr size_t SHARD_COUNT = 64;
+
+    [[nodiscard]] static size_t hash(void* object) {
+        // Objects are at least pointer aligned, mix the address so neighbours land in different shards and slots.
+        auto value = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object)) * 0x9E37'79B9'7F4A'7C15ull;
+        return static_cast<size_t>(value ^ (value >> 32));
+    }
+
+    [[nodiscard]] static size_t shard_index(void* object) { return hash(object) % SHARD_COUNT; }
+
+    // Tracks an object unless it's already tracked, in which case its original VMT is kept.
+    void insert(void* object, uint8_t** original_vmt) {
+        auto& shard = m_shards[shard_index(object)];
+        std::scoped_lock lock{shard.mutex};
+        shard.insert(object, original_vmt);
+    }
+
+    // Stops tracking an object and returns its original VMT.
+    std::optional<uint8_t**> erase(void* object) {
+        auto& shard = m_shards[shard_index(object)];
+        std::scoped_lock lock{shard.mutex};
+        return shard.erase(object);
+    }
+
+    // Runs fn for each object in a shard with its lock held. Used for bulk operations.
+    template <typename Fn> void with_shard(size_t index, Fn&& fn) {
+        auto& shard = m_shards[index];
+        std::scoped_lock lock{shard.mutex};
+        fn(shard);
+    }
+
+    // Calls fn for every tracked object and stops tracking them all.
+    template <typename Fn> void drain(Fn&& fn) {
+        for (auto& shard : m_shards) {
+            std::scoped_lock lock{shard.mutex};
+
+            for (const auto& entry : shard.entries) {
+                if (entry.object != nullptr && entry.object != TOMBSTONE) {
+                    fn(entry);
+                }
+            }
+
+            shard.entries.clear();
+            shard.used = 0;
+            shard.count = 0;
+        }
+    }
+
+    struct Shard {
+        std::mutex mutex{};
+        std::vector<Entry> entries{};
+        size_t used{};  // Live entries and tombstones.
+        size_t count{}; // Live entries.
+
+        void insert(void* object, uint8_t** original_vmt) {
+            // Keep the load factor at or below one half, dropping the tombstones when growing.
+            if ((used + 1) * 2 > entries.size()) {
+                rehash(std::max<size_t>(16, (count + 1) * 4));
+            }
+
+            const auto mask = entries.size() - 1;
+            Entry* free_entry{};
+
+            for (auto i = hash(object) / SHARD_COUNT;; ++i) {
+                auto& entry = entries[i & mask];
+
+                if (entry.object == object) {
+                    return;
+                }
+
+                if (entry.object == TOMBSTONE && free_entry == nullptr) {
+                    free_entry = &entry;
+                } else if (entry.object == nullptr) {
+                    if (free_entry == nullptr) {
+                        free_entry = &entry;
+                        ++used;
+                    }
+
+                    break;
+                }
+            }
+
+            *free_entry = {object, original_vmt};
+            ++count;
+        }
+
+        std::optional<uint8_t**> erase(void* object) {
+            if (entries.empty()) {
+                return std::nullopt;
+            }
+
+            const auto mask = entries.size() - 1;
+
+            for (auto i = hash(object) / SHARD_COUNT;; ++i) {
+                auto& entry = entries[i & mask];
+
+                if (entry.object == nullptr) {
+                    return std::nullopt;
+                }
+
+                if (entry.object == object) {
+                    const auto original_vmt = entry.original_vmt;
+                    entry = {TOMBSTONE, nullptr};
+                    --count;
+                    return original_vmt;
+                }
+            }
+        }
+
+        void rehash(size_t capacity) {
+            auto old_entries = std::move(entries);
+            entries.assign(std::bit_ceil(capacity), Entry{});
+            used = 0;
+            count = 0;
+
+            for (const auto& entry : old_entries) {
+                if (entry.object != nullptr && entry.object != TOMBSTONE) {
+                    insert(entry.object, entry.original_vmt);
+                }
+            }
+        }
+    };
+
+private:
+    static inline void* const TOMBSTONE = reinterpret_cast<void*>(1);
+
+    std::array<Shard, SHARD_COUNT> m_shards{};
+};
+
+static std::mutex g_shared_clones_mutex;
+static std::unordered_map<uint8_t**, std::weak_ptr<VmtClone>> g_shared_clones;
+static std::unordered_map<uint8_t**, std::weak_ptr<VmtClone>> g_in_place_vmts;
+
+// Writes a VMT entry. Entries of an original VMT are unprotected first and written atomically since other threads
+// are calling through them.
+static bool store_vm(const VmtClone& clone, uint8_t** entry, uint8_t* vm) {
+    if (!clone.is_in_place) {
+        *entry = vm;
+        return true;
+    }
+
+    auto unprotected = unprotect(reinterpret_cast<uint8_t*>(entry), sizeof(uint8_t*));
+
+    if (!unprotected) {
+        return false;
+    }
+
+    std::atomic_ref{*entry}.store(vm);
+
+    return true;
+}
+
 VmHook::VmHook(VmHook&& other) noexcept {
     *this = std::move(other);
 }
@@ -14,7 +210,7 @@ VmHook& VmHook::operator=(VmHook&& other) noexcept {
     m_original_vm = other.m_original_vm;
     m_new_vm = other.m_new_vm;
     m_vmt_entry = other.m_vmt_entry;
-    m_new_vmt_allocation = std::move(other.m_new_vmt_allocation);
+    m_vmt = std::move(other.m_vmt);
     other.m_original_vm = nullptr;
     other.m_new_vm = nullptr;
     other.m_vmt_entry = nullptr;
@@ -31,44 +227,170 @@ void VmHook::reset() {
 
 void VmHook::destroy() {
     if (m_original_vm != nullptr) {
-        *m_vmt_entry = m_original_vm;
+        if (m_vmt != nullptr && m_vmt->is_shared) {
+            std::scoped_lock lock{m_vmt->mutex};
+
+            // Other hooks with the same function are still using the entry.
+            if (--m_vmt->hook_counts[static_cast<size_t>(m_vmt_entry - m_vmt->vmt())] == 0) {
+                store_vm(*m_vmt, m_vmt_entry, m_original_vm);
+            }
+        } else {
+            *m_vmt_entry = m_original_vm;
+        }
+
         m_original_vm = nullptr;
         m_new_vm = nullptr;
         m_vmt_entry = nullptr;
-        m_new_vmt_allocation.reset();
+        m_vmt.reset();
     }
 }
 
-std::expected<VmtHook, VmtHook::Error> VmtHook::create(void* object) {
-    VmtHook hook{};
+// The memory regions seen by a series of memory map queries. Every query answers for a whole region, so looking up
+// addresses in regions that were already seen doesn't query again (each query reparses /proc/self/maps on Linux).
+class RegionCache {
+public:
+    // Returns the region containing address, or nullptr if it can't be queried.
+    const VmBasicInfo* find(uint8_t* address) {
+        const auto region = std::find_if(m_regions.begin(), m_regions.end(), [address](const VmBasicInfo& info) {
+            return address >= info.address && address < info.address + info.size;
+        });
+
+        if (region != m_regions.end()) {
+            return &*region;
+        }
 
-    const auto original_vmt = *reinterpret_cast<uint8_t***>(object);
-    hook.m_objects.emplace(object, original_vmt);
+        const auto info = vm_query(address);
 
-    // Count the number of virtual method pointers. We start at VMT_HEADER to account for
-    // the vtable prefix entries (offset-to-top + RTTI ptr on Itanium, RTTICompleteObjectLocator* on MSVC).
-    auto num_vmt_entries = VMT_HEADER;
+        if (!info) {
+            return nullptr;
+        }
+
+        return &m_regions.emplace_back(*info);
+    }
+
+private:
+    std::vector<VmBasicInfo> m_regions{};
+};
+
+// Counts the virtual method pointers starting at vmt. A vtable pointing into one module costs a memory map query or
+// two rather than one per slot. When the module exports the vtable's _ZTV symbol its size bounds the scan, stopping it
+// early and keeping it from running into the next vtable.
+static size_t count_vmt_entries(uint8_t** vmt) {
+    auto max_entries = SIZE_MAX;
+
+    if (const auto symbol = symbol_query(reinterpret_cast<uint8_t*>(vmt));
+        symbol && std::string_view{symbol->name}.starts_with("_ZTV")) {
+        max_entries = static_cast<size_t>(symbol->address + symbol->size - reinterpret_cast<uint8_t*>(vmt)) /
+                      sizeof(uint8_t*);
+    }
 
-    for (auto vm = original_vmt; is_executable(*vm); ++vm) {
-        ++num_vmt_entries;
+    RegionCache regions{};
+    size_t num_entries{};
+
+    for (; num_entries < max_entries; ++num_entries) {
+        const auto* region = regions.find(vmt[num_entries]);
+
+        if (region == nullptr || !region->access.execute) {
+            break;
+        }
     }
 
+    return num_entries;
+}
+
+static std::expected<std::shared_ptr<VmtClone>, VmtHook::Error> clone_vmt(uint8_t** original_vmt) {
+    // Count the number of virtual method pointers. We start at VMT_HEADER to account for
+    // the vtable prefix entries (offset-to-top + RTTI ptr on Itanium, RTTICompleteObjectLocator* on MSVC).
+    const auto num_vmt_entries = VMT_HEADER + count_vmt_entries(original_vmt);
     auto size = num_vmt_entries * sizeof(uint8_t*);
 
-    // Allocate memory for the new VMT.
-    auto allocation = Allocator::global()->allocate(size);
+    // Allocate memory for the new VMT and the pointer back to the clone.
+    auto allocation = Allocator::global()->allocate_data(sizeof(VmtClone*) + size);
 
     if (!allocation) {
-        return std::unexpected{Error::bad_allocation(allocation.error())};
+        return std::unexpected{VmtHook::Error::bad_allocation(allocation.error())};
     }
 
-    hook.m_new_vmt_allocation = std::make_shared<Allocation>(std::move(*allocation));
-    hook.m_new_vmt = reinterpret_cast<uint8_t**>(hook.m_new_vmt_allocation->data());
+    auto clone = std::make_shared<VmtClone>();
+    clone->allocation = std::move(*allocation);
+    clone->original_vmt = original_vmt;
+    clone->entries = reinterpret_cast<uint8_t**>(clone->allocation.data()) + 1;
+    clone->hook_counts.resize(num_vmt_entries);
+    clone->original_vms.resize(num_vmt_entries);
+    *reinterpret_cast<VmtClone**>(clone->allocation.data()) = clone.get();
 
     // Copy RTTI header and virtual method pointers.
-    std::memcpy(hook.m_new_vmt, original_vmt - VMT_HEADER, size);
+    std::memcpy(clone->vmt(), original_vmt - VMT_HEADER, size);
 
-    *reinterpret_cast<uint8_t***>(object) = &hook.m_new_vmt[VMT_HEADER];
+    return clone;
+}
+
+static std::shared_ptr<VmtClone> in_place_vmt(uint8_t** original_vmt) {
+    const auto num_vmt_entries = VMT_HEADER + count_vmt_entries(original_vmt);
+    auto clone = std::make_shared<VmtClone>();
+    clone->entries = original_vmt - VMT_HEADER;
+    clone->original_vmt = original_vmt;
+    clone->is_shared = true;
+    clone->is_in_place = true;
+    clone->hook_counts.resize(num_vmt_entries);
+    clone->original_vms.resize(num_vmt_entries);
+
+    return clone;
+}
+
+std::expected<VmtHook, VmtHook::Error> VmtHook::create(void* object, Flags flags) {
+    VmtHook hook{};
+
+    const auto original_vmt = *reinterpret_cast<uint8_t***>(object);
+
+    if (flags & InPlace) {
+        std::scoped_lock lock{g_shared_clones_mutex};
+        auto& in_place = g_in_place_vmts[original_vmt];
+        hook.m_vmt = in_place.lock();
+
+        if (hook.m_vmt == nullptr) {
+            hook.m_vmt = in_place_vmt(original_vmt);
+            in_place = hook.m_vmt;
+        }
+
+        hook.m_new_vmt = hook.m_vmt->vmt();
+
+        return hook;
+    }
+
+    hook.m_objects = std::make_shared<VmtObjectTable>();
+    hook.m_objects->insert(object, original_vmt);
+
+    if (flags & ShareClone) {
+        std::scoped_lock lock{g_shared_clones_mutex};
+        auto& shared_clone = g_shared_clones[original_vmt];
+        hook.m_vmt = shared_clone.lock();
+
+        if (hook.m_vmt == nullptr) {
+            auto clone = clone_vmt(original_vmt);
+
+            if (!clone) {
+                g_shared_clones.erase(original_vmt);
+                return std::unexpected{clone.error()};
+            }
+
+            hook.m_vmt = std::move(*clone);
+            hook.m_vmt->is_shared = true;
+            shared_clone = hook.m_vmt;
+        }
+    } else {
+        auto clone = clone_vmt(original_vmt);
+
+        if (!clone) {
+            return std::unexpected{clone.error()};
+        }
+
+        hook.m_vmt = std::move(*clone);
+    }
+
+    hook.m_new_vmt = hook.m_vmt->vmt();
+
+    std::atomic_ref{*reinterpret_cast<uint8_t***>(object)}.store(&hook.m_new_vmt[VMT_HEADER]);
 
     return hook;
 }
@@ -80,8 +402,9 @@ VmtHook::VmtHook(VmtHook&& other) noexcept {
 VmtHook& VmtHook::operator=(VmtHook&& other) noexcept {
     destroy();
     m_objects = std::move(other.m_objects);
-    m_new_vmt_allocation = std::move(other.m_new_vmt_allocation);
+    m_vmt = std::move(other.m_vmt);
     m_new_vmt = other.m_new_vmt;
+    m_destructor_hooks = std::move(other.m_destructor_hooks);
     other.m_new_vmt = nullptr;
     return *this;
 }
@@ -90,54 +413,247 @@ VmtHook::~VmtHook() {
     destroy();
 }
 
-void VmtHook::apply(void* object) {
-    m_objects.emplace(object, *reinterpret_cast<uint8_t***>(object));
-    *reinterpret_cast<uint8_t***>(object) = &m_new_vmt[VMT_HEADER];
+// Swaps an object's vptr for the new VMT and returns the one it replaced, or nullptr if the hook was already applied.
+static uint8_t** swap_in_vmt(void* object, uint8_t** new_vmt) {
+    std::atomic_ref vptr{*reinterpret_cast<uint8_t***>(object)};
+    auto original_vmt = vptr.load(std::memory_order_relaxed);
+
+    do {
+        if (original_vmt == new_vmt) {
+            return nullptr;
+        }
+    } while (!vptr.compare_exchange_weak(original_vmt, new_vmt));
+
+    return original_vmt;
 }
 
-void VmtHook::remove(void* object) {
-    const auto search = m_objects.find(object);
+// Puts an object's original vptr back unless something else has replaced the new VMT in the meantime. Objects whose
+// memory is gone or no longer writable are skipped. The regions are shared by the objects of a bulk operation so it
+// doesn't query the memory map for each of them.
+static void swap_out_vmt(
+    [[maybe_unused]] RegionCache& regions, void* object, uint8_t** new_vmt, uint8_t** original_vmt) {
+    auto* vptr = reinterpret_cast<uint8_t*>(object);
+
+#if SAFETYHOOK_OS_WINDOWS
+    // IsBadWritePtr doesn't query the memory map and answers for exactly the vptr.
+    if (!vm_is_writable(vptr, sizeof(void*))) {
+        return;
+    }
+#else
+    const auto* region = regions.find(vptr);
 
-    if (search == m_objects.end()) {
+    if (region == nullptr || !region->access.write || vptr + sizeof(void*) > region->address + region->size) {
         return;
     }
+#endif
+
+    std::atomic_ref{*reinterpret_cast<uint8_t***>(object)}.compare_exchange_strong(new_vmt, original_vmt);
+}
+
+// Sorts objects by the shard that tracks them so bulk operations take each shard's lock once.
+static std::vector<std::pair<size_t, void*>> group_by_shard(std::span<void* const> objects) {
+    std::vector<std::pair<size_t, void*>> grouped{};
+    grouped.reserve(objects.size());
+
+    for (auto* object : objects) {
+        grouped.emplace_back(VmtObjectTable::shard_index(object), object);
+    }
+
+    std::sort(grouped.begin(), grouped.end());
 
-    const auto original_vmt = search->second;
+    return grouped;
+}
 
-    if (!vm_is_writable(reinterpret_cast<uint8_t*>(object), sizeof(void*))) {
-        m_objects.erase(search);
+void VmtHook::apply(void* object) {
+    if (m_objects == nullptr) {
         return;
     }
 
-    if (*reinterpret_cast<uint8_t***>(object) != &m_new_vmt[VMT_HEADER]) {
-        m_objects.erase(search);
+    if (const auto original_vmt = swap_in_vmt(object, &m_new_vmt[VMT_HEADER])) {
+        m_objects->insert(object, original_vmt);
+    }
+}
+
+void VmtHook::apply(std::span<void* const> objects) {
+    if (m_objects == nullptr) {
         return;
     }
 
-    *reinterpret_cast<uint8_t***>(object) = original_vmt;
+    const auto grouped = group_by_shard(objects);
 
-    m_objects.erase(search);
+    for (auto it = grouped.begin(); it != grouped.end();) {
+        m_objects->with_shard(it->first, [&](VmtObjectTable::Shard& shard) {
+            for (const auto shard_index = it->first; it != grouped.end() && it->first == shard_index; ++it) {
+                if (const auto original_vmt = swap_in_vmt(it->second, &m_new_vmt[VMT_HEADER])) {
+                    shard.insert(it->second, original_vmt);
+                }
+            }
+        });
+    }
 }
 
-void VmtHook::reset() {
-    *this = {};
+void VmtHook::remove(void* object) {
+    if (m_objects == nullptr) {
+        return;
+    }
+
+    if (const auto original_vmt = m_objects->erase(object)) {
+        RegionCache regions{};
+        swap_out_vmt(regions, object, &m_new_vmt[VMT_HEADER], *original_vmt);
+    }
 }
 
-void VmtHook::destroy() {
-    for (const auto [object, original_vmt] : m_objects) {
-        if (!vm_is_writable(reinterpret_cast<uint8_t*>(object), sizeof(void*))) {
-            continue;
+void VmtHook::remove(std::span<void* const> objects) {
+    if (m_objects == nullptr) {
+        return;
+    }
+
+    const auto grouped = group_by_shard(objects);
+    RegionCache regions{};
+
+    for (auto it = grouped.begin(); it != grouped.end();) {
+        m_objects->with_shard(it->first, [&](VmtObjectTable::Shard& shard) {
+            for (const auto shard_index = it->first; it != grouped.end() && it->first == shard_index; ++it) {
+                if (const auto original_vmt = shard.erase(it->second)) {
+                    swap_out_vmt(regions, it->second, &m_new_vmt[VMT_HEADER], *original_vmt);
+                }
+            }
+        });
+    }
+}
+
+std::expected<VmHook, VmtHook::Error> VmtHook::hook_vm(size_t index, uint8_t* new_vm) {
+    VmHook hook{};
+
+    index += VMT_HEADER; // Skip RTTI header.
+
+    if (m_vmt->is_shared) {
+        std::scoped_lock lock{m_vmt->mutex};
+        auto& hook_count = m_vmt->hook_counts[index];
+        auto& original_vm = m_vmt->original_vms[index];
+
+        if (hook_count != 0 && m_new_vmt[index] != new_vm) {
+            return std::unexpected{Error::method_already_hooked()};
+        }
+
+        if (hook_count == 0) {
+            original_vm = m_new_vmt[index];
+
+            if (!store_vm(*m_vmt, &m_new_vmt[index], new_vm)) {
+                return std::unexpected{Error::failed_to_unprotect()};
+            }
+        }
+
+        ++hook_count;
+        hook.m_original_vm = original_vm;
+    } else {
+        hook.m_original_vm = m_new_vmt[index];
+        m_new_vmt[index] = new_vm;
+    }
+
+    hook.m_new_vm = new_vm;
+    hook.m_vmt_entry = &m_new_vmt[index];
+    hook.m_vmt = m_vmt;
+
+    return hook;
+}
+
+// Untracks an object as it is destroyed, restoring its original VMT, and returns the original destructor entry.
+// slot is 0 for the complete and 1 for the deleting destructor on Itanium, MSVC only has the deleting destructor.
+static uint8_t* untrack_destroyed_object(void* object, size_t slot) {
+    auto* vmt = *reinterpret_cast<uint8_t***>(object) - VMT_HEADER;
+    auto* clone = reinterpret_cast<VmtClone**>(vmt)[-1];
+    std::shared_lock lock{clone->untracking_mutex};
+    auto original_vmt = clone->original_vmt;
+
+    for (auto* table : clone->untracking_tables) {
+        if (const auto tracked_vmt = table->erase(object)) {
+            original_vmt = *tracked_vmt;
+            *reinterpret_cast<uint8_t***>(object) = original_vmt;
+            break;
+        }
+    }
+
+    return original_vmt[clone->destructor_index + slot];
+}
+
+// The destructor entries of a cloned VMT are hooked with these, this being the object.
+struct DestructorWrapper {
+#if SAFETYHOOK_ABI_MSVC
+    void* scalar_deleting_destructor(unsigned int flags) {
+        auto destructor = untrack_destroyed_object(this, 0);
+        return reinterpret_cast<void*(SAFETYHOOK_THISCALL*)(void*, unsigned int)>(destructor)(this, flags);
+    }
+#else
+    void complete_destructor() { reinterpret_cast<void (*)(void*)>(untrack_destroyed_object(this, 0))(this); }
+    void deleting_destructor() { reinterpret_cast<void (*)(void*)>(untrack_destroyed_object(this, 1))(this); }
+#endif
+};
+
+std::expected<void, VmtHook::Error> VmtHook::untrack_on_destroy(size_t destructor_index) {
+    // In place hooks don't track objects.
+    if (m_objects == nullptr || !m_destructor_hooks.empty()) {
+        return {};
+    }
+
+    {
+        std::unique_lock lock{m_vmt->untracking_mutex};
+
+        // Every VmtHook sharing the clone has to agree on where the destructor is.
+        if (m_vmt->destructor_index != SIZE_MAX && m_vmt->destructor_index != destructor_index) {
+            return std::unexpected{Error::destructor_index_mismatch()};
         }
 
-        if (*reinterpret_cast<uint8_t***>(object) != &m_new_vmt[VMT_HEADER]) {
-            continue;
+        m_vmt->destructor_index = destructor_index;
+        m_vmt->untracking_tables.push_back(m_objects.get());
+    }
+
+#if SAFETYHOOK_ABI_MSVC
+    const auto wrappers = {&DestructorWrapper::scalar_deleting_destructor};
+#else
+    const auto wrappers = {&DestructorWrapper::complete_destructor, &DestructorWrapper::deleting_destructor};
+#endif
+    auto index = destructor_index;
+
+    for (const auto wrapper : wrappers) {
+        auto hook = hook_method(index++, wrapper);
+
+        if (!hook) {
+            m_destructor_hooks.clear();
+            stop_untracking();
+            return std::unexpected{hook.error()};
         }
 
-        *reinterpret_cast<uint8_t***>(object) = original_vmt;
+        m_destructor_hooks.emplace_back(std::move(*hook));
+    }
+
+    return {};
+}
+
+void VmtHook::stop_untracking() {
+    std::unique_lock lock{m_vmt->untracking_mutex};
+    auto& tables = m_vmt->untracking_tables;
+    tables.erase(std::remove(tables.begin(), tables.end(), m_objects.get()), tables.end());
+}
+
+void VmtHook::reset() {
+    *this = {};
+}
+
+void VmtHook::destroy() {
+    if (!m_destructor_hooks.empty()) {
+        stop_untracking();
+    }
+
+    if (m_objects != nullptr) {
+        RegionCache regions{};
+        m_objects->drain([this, &regions](const VmtObjectTable::Entry& entry) {
+            swap_out_vmt(regions, entry.object, &m_new_vmt[VMT_HEADER], entry.original_vmt);
+        });
     }
 
-    m_objects.clear();
-    m_new_vmt_allocation.reset();
+    m_destructor_hooks.clear();
+    m_vmt.reset();
     m_new_vmt = nullptr;
 }
 } // namespace safetyhook
@@ -1,3 +1,5 @@
+#include <cstddef>
+
 #include <gtest/gtest.h>
 #include <safetyhook.hpp>
 
@@ -25,3 +27,38 @@ TEST(Allocator, AllocatorReusesFreedMemory) {
     ASSERT_TRUE(fourth_allocation.has_value());
     EXPECT_EQ(fourth_allocation->address(), third_allocation->address() + 64);
 }
+
+TEST(Allocator, DataAllocationsAreNotExecutableOrSharedWithCode) {
+    const auto allocator = safetyhook::Allocator::create();
+    const auto code_allocation = allocator->allocate(128);
+
+    ASSERT_TRUE(code_allocation.has_value());
+
+    auto first_allocation = allocator->allocate_data(24);
+
+    ASSERT_TRUE(first_allocation.has_value());
+    EXPECT_TRUE(safetyhook::vm_is_writable(first_allocation->data(), first_allocation->size()));
+    EXPECT_FALSE(safetyhook::vm_is_executable(first_allocation->data()));
+    EXPECT_EQ(first_allocation->address() % alignof(std::max_align_t), 0);
+
+    const auto first_allocation_address = first_allocation->address();
+    const auto second_allocation = allocator->allocate_data(8);
+
+    ASSERT_TRUE(second_allocation.has_value());
+    EXPECT_EQ(
+        second_allocation->address(), first_allocation_address + safetyhook::align_up(24, alignof(std::max_align_t)));
+
+    first_allocation->free();
+
+    const auto third_allocation = allocator->allocate_data(16);
+
+    ASSERT_TRUE(third_allocation.has_value());
+    EXPECT_EQ(third_allocation->address(), first_allocation_address);
+
+    // Code keeps coming from its own memory.
+    const auto second_code_allocation = allocator->allocate(64);
+
+    ASSERT_TRUE(second_code_allocation.has_value());
+    EXPECT_EQ(second_code_allocation->address(), code_allocation->address() + 128);
+    EXPECT_TRUE(safetyhook::vm_is_executable(second_code_allocation->data()));
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+#if SAFETYHOOK_OS_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static SafetyHookCallSite g_hook{};
+
+SAFETYHOOK_NOINLINE static int add_42(int a) {
+    volatile int b = a;
+    return b + 42;
+}
+
+static int hooked_add_42(int a) {
+    return g_hook.call<int>(a) + 1337;
+}
+
+// Writes a jmp rel32 to target and returns its address.
+static uint8_t* emit_jmp(uint8_t* ip, void* target) {
+    ip[0] = 0xE9;
+    safetyhook::store(ip + 1, static_cast<int32_t>(static_cast<uint8_t*>(target) - (ip + 5)));
+    return ip;
+}
+
+TEST(CallSiteHook, CallSiteHookOnlyRetargetsTheHookedSite) {
+    auto code = safetyhook::Allocator::global()->allocate_near({reinterpret_cast<uint8_t*>(&add_42)}, 16);
+
+    ASSERT_TRUE(code.has_value());
+
+    const auto first = reinterpret_cast<int (*)(int)>(emit_jmp(code->data(), reinterpret_cast<void*>(&add_42)));
+    const auto second = reinterpret_cast<int (*)(int)>(emit_jmp(code->data() + 8, reinterpret_cast<void*>(&add_42)));
+
+    EXPECT_EQ(first(1), 43);
+    EXPECT_EQ(second(1), 43);
+
+    auto hook = SafetyHookCallSite::create(first, hooked_add_42);
+
+    ASSERT_TRUE(hook.has_value());
+
+    g_hook = std::move(*hook);
+
+    EXPECT_EQ(g_hook.original<void*>(), reinterpret_cast<void*>(&add_42));
+    EXPECT_EQ(first(1), 1380);
+    EXPECT_EQ(second(1), 43);
+    EXPECT_EQ(add_42(1), 43);
+
+    g_hook.reset();
+
+    EXPECT_EQ(first(1), 43);
+}
+
+#if SAFETYHOOK_ARCH_X86_64
+TEST(CallSiteHook, CallSiteHookWithARelayThunk) {
+    // Allocated anywhere, so likely far from the destination. The site jumps to an absolute jmp to add_42.
+    auto code = safetyhook::Allocator::global()->allocate(32);
+
+    ASSERT_TRUE(code.has_value());
+
+    const auto site = reinterpret_cast<int (*)(int)>(emit_jmp(code->data(), code->data() + 16));
+    safetyhook::store(code->data() + 16, std::array<uint8_t, 6>{0xFF, 0x25, 0x00, 0x00, 0x00, 0x00});
+    safetyhook::store(code->data() + 22, reinterpret_cast<uintptr_t>(&add_42));
+
+    EXPECT_EQ(site(1), 43);
+
+    g_hook = safetyhook::create_call_site(site, hooked_add_42);
+
+    ASSERT_TRUE(g_hook);
+    EXPECT_EQ(g_hook.original<uint8_t*>(), code->data() + 16);
+    EXPECT_EQ(site(2), 1381);
+
+    g_hook = {};
+
+    EXPECT_EQ(site(2), 44);
+}
+#endif
+
+TEST(CallSiteHook, CallSiteHookFailsForOtherInstructions) {
+    auto code = safetyhook::Allocator::global()->allocate(16);
+
+    ASSERT_TRUE(code.has_value());
+
+    code->data()[0] = 0xC3; // ret
+
+    const auto hook = SafetyHookCallSite::create(code->data(), hooked_add_42);
+
+    ASSERT_FALSE(hook.has_value());
+    EXPECT_EQ(hook.error().type, SafetyHookCallSite::Error::NOT_A_CALL_SITE);
+}
+
+static SafetyHookCallSite g_sites_hook{};
+
+SAFETYHOOK_NOINLINE static int sub_1337(int a) {
+    volatile int b = a;
+    return b - 1337;
+}
+
+static int hooked_sub_1337(int a) {
+    return g_sites_hook.call<int>(a) * 2;
+}
+
+SAFETYHOOK_NOINLINE static int first_caller(int a) {
+    volatile int b = sub_1337(a);
+    return b;
+}
+
+SAFETYHOOK_NOINLINE static int second_caller(int a) {
+    volatile int b = sub_1337(a + 1);
+    return b;
+}
+
+TEST(CallSiteHook, HookEveryCallSiteOfAFunction) {
+    EXPECT_EQ(first_caller(2000), 663);
+    EXPECT_EQ(second_caller(2000), 664);
+
+    const auto sites = safetyhook::find_call_sites(&sub_1337);
+
+    ASSERT_GE(sites.size(), 2);
+    EXPECT_TRUE(std::is_sorted(sites.begin(), sites.end()));
+
+    for (auto* site : sites) {
+        EXPECT_TRUE(site[0] == 0xE8 || site[0] == 0xE9);
+    }
+
+    auto hook = SafetyHookCallSite::create(sites, hooked_sub_1337);
+
+    ASSERT_TRUE(hook.has_value());
+
+    g_sites_hook = std::move(*hook);
+
+    EXPECT_EQ(g_sites_hook.sites(), sites);
+    EXPECT_EQ(first_caller(2000), 1326);
+    EXPECT_EQ(second_caller(2000), 1328);
+
+    // The callee itself isn't touched, indirect calls aren't hooked.
+    int (*volatile indirect)(int) = &sub_1337;
+
+    EXPECT_EQ(indirect(2000), 663);
+
+    g_sites_hook.reset();
+
+    EXPECT_EQ(first_caller(2000), 663);
+    EXPECT_EQ(second_caller(2000), 664);
+}
+
+TEST(CallSiteHook, CallSiteHookFailsForDifferentCallees) {
+    auto code = safetyhook::Allocator::global()->allocate_near({reinterpret_cast<uint8_t*>(&add_42)}, 16);
+
+    ASSERT_TRUE(code.has_value());
+
+    auto* first = emit_jmp(code->data(), reinterpret_cast<void*>(&add_42));
+    auto* second = emit_jmp(code->data() + 8, reinterpret_cast<void*>(&sub_1337));
+
+    const auto hook = SafetyHookCallSite::create(std::vector{first, second}, hooked_add_42);
+
+    ASSERT_FALSE(hook.has_value());
+    EXPECT_EQ(hook.error().type, SafetyHookCallSite::Error::DIFFERENT_CALLEES);
+    EXPECT_EQ(hook.error().ip, second);
+    EXPECT_EQ(add_42(1), 43);
+}
+
+TEST(CallSiteHook, CallSiteHookOnADisplacementCrossingACacheLine) {
+    auto code = safetyhook::Allocator::global()->allocate_near({reinterpret_cast<uint8_t*>(&add_42)}, 192);
+
+    ASSERT_TRUE(code.has_value());
+
+    // The displacement's first byte is the last one of a cache line.
+    auto* line = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(code->data()) + 63) & ~uintptr_t{63});
+    const auto fn = reinterpret_cast<int (*)(int)>(emit_jmp(line + 62, reinterpret_cast<void*>(&add_42)));
+
+    EXPECT_EQ(fn(1), 43);
+
+    auto hook = SafetyHookCallSite::create(fn, hooked_add_42);
+
+#if SAFETYHOOK_OS_LINUX
+    // Other threads aren't stopped while patching, so the site is left alone.
+    ASSERT_FALSE(hook.has_value());
+    EXPECT_EQ(hook.error().type, SafetyHookCallSite::Error::CROSSES_CACHE_LINE);
+    EXPECT_EQ(hook.error().ip, reinterpret_cast<uint8_t*>(fn));
+    EXPECT_EQ(fn(1), 43);
+#else
+    ASSERT_TRUE(hook.has_value());
+
+    g_hook = std::move(*hook);
+
+    EXPECT_EQ(fn(1), 1380);
+
+    g_hook.reset();
+
+    EXPECT_EQ(fn(1), 43);
+#endif
+}
+
+#if SAFETYHOOK_OS_LINUX
+TEST(CallSiteHook, CallSiteHookRestoresTheSitesItPatchedWhenItFailsToUnprotect) {
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    // A call site on the first page, a gap so the pages are unprotected separately, and a call site on a read-only
+    // shared file mapping that can't be made writable.
+    auto* code = static_cast<uint8_t*>(
+        mmap(nullptr, page_size * 3, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+    ASSERT_NE(code, MAP_FAILED);
+
+    auto* target = code + 0x100;
+    auto* first = emit_jmp(code, target);
+    auto* second = code + page_size * 2;
+    const std::vector<uint8_t> first_bytes(first, first + 5);
+    std::vector<uint8_t> page(page_size);
+
+    *target = 0xC3; // ret
+    emit_jmp(page.data(), target);
+    safetyhook::store(page.data() + 1, static_cast<int32_t>(target - (second + 5)));
+
+    const auto path = std::filesystem::temp_directory_path() / "safetyhook-call-site.bin";
+    std::ofstream{path, std::ios::binary}.write(reinterpret_cast<const char*>(page.data()), page.size());
+
+    const auto fd = open(path.c_str(), O_RDONLY);
+
+    ASSERT_GE(fd, 0);
+    ASSERT_NE(mmap(second, page_size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0), MAP_FAILED);
+
+    close(fd);
+    std::filesystem::remove(path);
+
+    const auto hook = SafetyHookCallSite::create(std::vector{first, second}, hooked_add_42);
+
+    ASSERT_FALSE(hook.has_value());
+    EXPECT_EQ(hook.error().type, SafetyHookCallSite::Error::FAILED_TO_UNPROTECT);
+    EXPECT_EQ(hook.error().ip, second);
+    EXPECT_EQ(std::vector<uint8_t>(first, first + 5), first_bytes);
+
+    munmap(code, page_size * 3);
+}
+#endif
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+#if SAFETYHOOK_OS_LINUX
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+static SafetyHookImport g_hook{};
+
+static pid_t hooked_getpid() {
+    return g_hook.call<pid_t>() + 1337;
+}
+
+TEST(ImportHook, ImportHookAFunctionInEveryModule) {
+    const auto pid = getpid();
+    auto hook = SafetyHookImport::create("getpid", hooked_getpid);
+
+    ASSERT_TRUE(hook.has_value());
+
+    g_hook = std::move(*hook);
+
+    EXPECT_GE(g_hook.entry_count(), 1);
+    EXPECT_EQ(getpid(), pid + 1337);
+
+    g_hook.reset();
+
+    EXPECT_EQ(getpid(), pid);
+}
+
+TEST(ImportHook, ImportHookAFunctionInOneModule) {
+    const auto pid = getpid();
+
+    // Hook only the module containing this test.
+    g_hook = safetyhook::create_import("getpid", hooked_getpid, reinterpret_cast<void*>(&hooked_getpid));
+
+    ASSERT_TRUE(g_hook);
+    EXPECT_EQ(g_hook.entry_count(), 1);
+    EXPECT_EQ(getpid(), pid + 1337);
+
+    g_hook = {};
+
+    EXPECT_EQ(getpid(), pid);
+}
+
+static SafetyHookImport g_ppid_hook{};
+
+static pid_t hooked_getppid() {
+    return g_ppid_hook.call<pid_t>() + 1337;
+}
+
+TEST(ImportHook, ImportHookOriginalIsTheFunctionBeforeAndAfterBinding) {
+    auto* const getppid_fn = dlsym(RTLD_DEFAULT, "getppid");
+
+    // getppid wasn't called yet, so the entry can still be lazily bound.
+    g_ppid_hook = safetyhook::create_import("getppid", hooked_getppid, reinterpret_cast<void*>(&hooked_getppid));
+
+    ASSERT_TRUE(g_ppid_hook);
+    EXPECT_EQ(g_ppid_hook.original<void*>(), getppid_fn);
+
+    g_ppid_hook = {};
+
+    // Now it's bound.
+    const auto ppid = getppid();
+
+    g_ppid_hook = safetyhook::create_import("getppid", hooked_getppid, reinterpret_cast<void*>(&hooked_getppid));
+
+    ASSERT_TRUE(g_ppid_hook);
+    EXPECT_EQ(g_ppid_hook.original<void*>(), getppid_fn);
+    EXPECT_EQ(getppid(), ppid + 1337);
+
+    g_ppid_hook = {};
+
+    EXPECT_EQ(getppid(), ppid);
+}
+
+TEST(ImportHook, ImportHookFailsForFunctionsThatArentImported) {
+    const auto hook = SafetyHookImport::create("safetyhook_not_imported_anywhere", hooked_getpid);
+
+    ASSERT_FALSE(hook.has_value());
+    EXPECT_EQ(hook.error().type, SafetyHookImport::Error::IMPORT_NOT_FOUND);
+}
+
+#endif
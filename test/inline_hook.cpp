@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include <safetyhook.hpp>
@@ -768,3 +770,69 @@ TEST(InlineHook, FunctionHookCanBeEnableAndDisabled) {
     EXPECT_EQ(fn(2), 4);
     EXPECT_EQ(fn(3), 6);
 }
+
+TEST(InlineHook, FunctionHookCountsHits) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int fn(int a) {
+            volatile int b = a;
+            return b * 3;
+        }
+    };
+
+    struct Hook {
+        static int fn(int a) { return a; }
+    };
+
+    using Fn = int (*)(int);
+    Fn volatile fn = Target::fn;
+
+    auto hook = safetyhook::create_inline(Target::fn, Hook::fn, SafetyHookInline::CountHits);
+
+    ASSERT_TRUE(hook);
+    EXPECT_EQ(hook.destination(), reinterpret_cast<uint8_t*>(&Hook::fn));
+    EXPECT_EQ(hook.hits(), 0);
+
+    constexpr auto num_threads = 4;
+    constexpr auto calls_per_thread = 10'000;
+    std::vector<std::thread> threads{};
+
+    for (auto i = 0; i < num_threads; ++i) {
+        threads.emplace_back([fn] {
+            for (auto j = 0; j < calls_per_thread; ++j) {
+                ASSERT_EQ(fn(j), j);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(hook.hits(), num_threads * calls_per_thread);
+
+    const auto hit_counts = SafetyHookInline::hit_counts();
+    const auto hit_count = std::ranges::find(
+        hit_counts, reinterpret_cast<uint8_t*>(&Target::fn), &SafetyHookInline::HitCount::target);
+
+    ASSERT_NE(hit_count, hit_counts.end());
+    EXPECT_EQ(hit_count->hits, num_threads * calls_per_thread);
+
+    // Calls while the hook is disabled and calls to the original through the trampoline aren't hits.
+    ASSERT_TRUE(hook.disable().has_value());
+    EXPECT_EQ(fn(2), 6);
+    ASSERT_TRUE(hook.enable().has_value());
+    EXPECT_EQ(hook.call<int>(2), 6);
+    EXPECT_EQ(hook.hits(), num_threads * calls_per_thread);
+
+    SafetyHookInline::reset_hit_counts();
+
+    EXPECT_EQ(hook.hits(), 0);
+    EXPECT_EQ(fn(2), 2);
+    EXPECT_EQ(hook.hits(), 1);
+
+    hook.reset();
+
+    EXPECT_EQ(fn(2), 6);
+    EXPECT_TRUE(std::ranges::none_of(SafetyHookInline::hit_counts(),
+        [&](const auto& count) { return count.target == reinterpret_cast<uint8_t*>(&Target::fn); }));
+}
@@ -0,0 +1,138 @@
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+TEST(LatencyHistogram, BucketsCoverEveryDuration) {
+    using safetyhook::LatencyHistogram;
+
+    for (uint64_t ticks = 0; ticks < 4096; ++ticks) {
+        const auto index = LatencyHistogram::bucket_index(ticks);
+
+        ASSERT_LE(LatencyHistogram::bucket_lower_bound(index), ticks);
+        ASSERT_GE(LatencyHistogram::bucket_upper_bound(index), ticks);
+    }
+
+    for (size_t i = 1; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+        ASSERT_EQ(LatencyHistogram::bucket_lower_bound(i), LatencyHistogram::bucket_upper_bound(i - 1) + 1);
+    }
+
+    EXPECT_EQ(LatencyHistogram::bucket_index(UINT64_MAX), LatencyHistogram::NUM_BUCKETS - 1);
+    EXPECT_EQ(LatencyHistogram::bucket_upper_bound(LatencyHistogram::NUM_BUCKETS - 1), UINT64_MAX);
+}
+
+TEST(LatencyHistogram, PercentilesAreBucketUpperBounds) {
+    safetyhook::LatencyHistogram histogram{};
+
+    EXPECT_EQ(histogram.percentile(50), 0);
+
+    histogram.record(3, 90);
+    histogram.record(1000, 10);
+
+    EXPECT_EQ(histogram.count(), 100);
+    EXPECT_EQ(histogram.percentile(50), 3);
+    EXPECT_EQ(histogram.percentile(90), 3);
+
+    const auto p99 = histogram.percentile(99);
+
+    EXPECT_GE(p99, 1000);
+    EXPECT_LE(p99, 1000 + 1000 / safetyhook::LatencyHistogram::SUB_BUCKETS);
+
+    safetyhook::LatencyHistogram other{};
+
+    other.record(3);
+    histogram.merge(other);
+
+    EXPECT_EQ(histogram.count(), 101);
+
+    histogram.clear();
+
+    EXPECT_EQ(histogram.count(), 0);
+}
+
+SAFETYHOOK_NOINLINE static double latency_target(double a, int b) {
+    volatile double c = a;
+    return c * b;
+}
+
+static SafetyHookInline g_latency_hook{};
+
+static double latency_destination(double a, int b) {
+    return g_latency_hook.call<double>(a + 1.0, b);
+}
+
+TEST(InlineHook, FunctionHookMeasuresLatency) {
+    using Fn = double (*)(double, int);
+    Fn volatile fn = latency_target;
+
+    g_latency_hook = safetyhook::create_inline(latency_target, latency_destination, SafetyHookInline::MeasureLatency);
+
+    ASSERT_TRUE(g_latency_hook);
+    EXPECT_EQ(g_latency_hook.latencies().count(), 0);
+
+    constexpr auto num_threads = 4;
+    constexpr auto calls_per_thread = 1'000;
+    std::vector<std::thread> threads{};
+
+    for (auto i = 0; i < num_threads; ++i) {
+        threads.emplace_back([fn] {
+            for (auto j = 0; j < calls_per_thread; ++j) {
+                ASSERT_EQ(fn(1.5, j), 2.5 * j);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // The threads have exited, their durations were kept.
+    const auto latencies = g_latency_hook.latencies();
+
+    EXPECT_EQ(latencies.count(), num_threads * calls_per_thread);
+    EXPECT_GT(latencies.percentile(50), 0);
+
+    EXPECT_EQ(fn(1.5, 2), 5.0);
+    EXPECT_EQ(g_latency_hook.latencies().count(), num_threads * calls_per_thread + 1);
+
+    g_latency_hook.reset_latencies();
+
+    EXPECT_EQ(g_latency_hook.latencies().count(), 0);
+    EXPECT_EQ(fn(1.5, 2), 5.0);
+    EXPECT_EQ(g_latency_hook.latencies().count(), 1);
+
+    g_latency_hook.reset();
+
+    EXPECT_EQ(fn(1.5, 2), 3.0);
+    EXPECT_EQ(g_latency_hook.latencies().count(), 0);
+}
+
+TEST(InlineHook, FunctionHookMeasuresLatencyAndCountsHits) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int fn(int a) {
+            volatile int b = a;
+            return b * 3;
+        }
+    };
+
+    struct Hook {
+        static int fn(int a) { return a; }
+    };
+
+    using Fn = int (*)(int);
+    Fn volatile fn = Target::fn;
+
+    auto hook = safetyhook::create_inline(
+        Target::fn, Hook::fn, SafetyHookInline::Flags(SafetyHookInline::CountHits | SafetyHookInline::MeasureLatency));
+
+    ASSERT_TRUE(hook);
+    EXPECT_EQ(hook.destination(), reinterpret_cast<uint8_t*>(&Hook::fn));
+
+    for (auto i = 0; i < 100; ++i) {
+        ASSERT_EQ(fn(i), i);
+    }
+
+    EXPECT_EQ(hook.hits(), 100);
+    EXPECT_EQ(hook.latencies().count(), 100);
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+SAFETYHOOK_NOINLINE static int metrics_target(int a) {
+    volatile int b = a;
+    return b * 3;
+}
+
+static int metrics_destination(int a) {
+    return a;
+}
+
+TEST(Metrics, CreatingAHookUpdatesTheMetrics) {
+    safetyhook::reset_metrics();
+
+    auto hook = safetyhook::create_inline(metrics_target, metrics_destination);
+
+    ASSERT_TRUE(hook);
+
+    const auto metrics = safetyhook::metrics();
+
+#if SAFETYHOOK_METRICS
+    EXPECT_GE(metrics.instructions_decoded, 1);
+    EXPECT_GE(metrics.trap_threads_calls, 1);
+    EXPECT_GE(metrics.protect_syscalls, 1);
+    EXPECT_GT(metrics.trap_threads_time, 0);
+#else
+    EXPECT_EQ(metrics.instructions_decoded, 0);
+    EXPECT_EQ(metrics.trap_threads_calls, 0);
+    EXPECT_EQ(metrics.protect_syscalls, 0);
+#endif
+}
+
+TEST(Metrics, ResetSetsTheMetricsToZero) {
+    {
+        auto hook = safetyhook::create_inline(metrics_target, metrics_destination);
+        ASSERT_TRUE(hook);
+    }
+
+    safetyhook::reset_metrics();
+
+    const auto metrics = safetyhook::metrics();
+
+    EXPECT_EQ(metrics.vm_query_calls, 0);
+    EXPECT_EQ(metrics.trap_threads_calls, 0);
+    EXPECT_EQ(metrics.instructions_decoded, 0);
+    EXPECT_EQ(metrics.e9_to_ff_fallbacks, 0);
+}
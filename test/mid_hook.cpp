@@ -1,5 +1,12 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 #include <safetyhook.hpp>
+#include <xbyak/xbyak.h>
+
+using namespace Xbyak::util;
 
 TEST(MidHook, MidHookToChangeARegister) {
     struct Target {
@@ -77,6 +84,186 @@ TEST(MidHook, MidHookToChangeAnXMMRegister) {
 }
 #endif
 
+#if SAFETYHOOK_ARCH_X86_64
+TEST(MidHook, MidHookToChangeAYMMRegister) {
+    if (safetyhook::extended_state_layout().features == 0) {
+        GTEST_SKIP() << "AVX is not available";
+    }
+
+    Xbyak::CodeGenerator cg{};
+
+#if SAFETYHOOK_OS_WINDOWS
+    constexpr auto param = rcx;
+#elif SAFETYHOOK_OS_LINUX
+    constexpr auto param = rdi;
+#endif
+
+    cg.vmovdqu(ymm1, yword[param]);
+    auto* hook_address = const_cast<uint8_t*>(cg.getCurr());
+    cg.nop(10, false);
+    cg.vmovdqu(yword[param], ymm1);
+    cg.vzeroupper();
+    cg.ret();
+
+    const auto fn = cg.getCode<void (*)(uint8_t*)>();
+
+    struct Hook {
+        static void fn(SafetyHookContext& ctx) {
+            auto ymm1 = ctx.ymm(1);
+
+            for (auto& byte : ymm1.u8) {
+                ++byte;
+            }
+
+            ctx.set_ymm(1, ymm1);
+        }
+    };
+
+    auto hook_result = SafetyHookMid::create(hook_address, Hook::fn, SafetyHookMid::SaveExtendedState);
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+    uint8_t values[32]{};
+
+    for (size_t i = 0; i < std::size(values); ++i) {
+        values[i] = static_cast<uint8_t>(i);
+    }
+
+    fn(values);
+
+    for (size_t i = 0; i < std::size(values); ++i) {
+        EXPECT_EQ(values[i], i + 1);
+    }
+}
+
+TEST(MidHook, MidHookWithoutExtendedStateNestedInOneWithItDoesntSeeItsRegisters) {
+    if (safetyhook::extended_state_layout().features == 0) {
+        GTEST_SKIP() << "AVX is not available";
+    }
+
+    Xbyak::CodeGenerator cg{};
+
+#if SAFETYHOOK_OS_WINDOWS
+    constexpr auto param = rcx;
+#elif SAFETYHOOK_OS_LINUX
+    constexpr auto param = rdi;
+#endif
+
+    cg.vmovdqu(ymm1, yword[param]);
+    auto* hook_address = const_cast<uint8_t*>(cg.getCurr());
+    cg.nop(10, false);
+    cg.vmovdqu(yword[param], ymm1);
+    cg.vzeroupper();
+    cg.ret();
+
+    const auto fn = cg.getCode<void (*)(uint8_t*)>();
+
+    Xbyak::CodeGenerator inner_cg{};
+    auto* inner_hook_address = const_cast<uint8_t*>(inner_cg.getCurr());
+    inner_cg.nop(10, false);
+    inner_cg.ret();
+
+    static auto inner_fn = inner_cg.getCode<void (*)()>();
+    static safetyhook::Ymm inner_ymm1{};
+
+    struct Hook {
+        static void fn(SafetyHookContext& ctx) {
+            auto ymm1 = ctx.ymm(1);
+
+            for (auto& byte : ymm1.u8) {
+                ++byte;
+            }
+
+            ctx.set_ymm(1, ymm1);
+            inner_fn();
+        }
+
+        static void inner(SafetyHookContext& ctx) {
+            inner_ymm1 = ctx.ymm(1);
+
+            safetyhook::Ymm garbage{};
+
+            for (auto& byte : garbage.u8) {
+                byte = 0xCC;
+            }
+
+            ctx.set_ymm(1, garbage);
+        }
+    };
+
+    auto hook_result = SafetyHookMid::create(hook_address, Hook::fn, SafetyHookMid::SaveExtendedState);
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+    auto inner_hook_result = SafetyHookMid::create(inner_hook_address, Hook::inner);
+
+    ASSERT_TRUE(inner_hook_result.has_value());
+
+    auto inner_hook = std::move(*inner_hook_result);
+
+    uint8_t values[32]{};
+
+    for (size_t i = 0; i < std::size(values); ++i) {
+        values[i] = static_cast<uint8_t>(i);
+    }
+
+    fn(values);
+
+    // The inner hook reads its upper half as zero and can't write the outer hook's.
+    for (size_t i = 16; i < std::size(inner_ymm1.u8); ++i) {
+        EXPECT_EQ(inner_ymm1.u8[i], 0);
+    }
+
+    for (size_t i = 0; i < std::size(values); ++i) {
+        EXPECT_EQ(values[i], i + 1);
+    }
+}
+#endif
+
+TEST(MidHook, MidHookToChangeTheResumeAddress) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
+            volatile int b = a;
+            return b + 42;
+        }
+
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_1337(int a) {
+            volatile int b = a;
+            return b + 1337;
+        }
+    };
+
+    using AddFn = int(SAFETYHOOK_FASTCALL*)(int);
+    // Force a real indirect call so MinGW Release cannot optimize around runtime patching.
+    AddFn volatile add_42 = Target::add_42;
+
+    struct Hook {
+        static void add_42(SafetyHookContext& ctx) {
+#if SAFETYHOOK_ARCH_X86_64
+            ctx.rip = reinterpret_cast<uintptr_t>(Target::add_1337);
+#elif SAFETYHOOK_ARCH_X86_32
+            ctx.eip = reinterpret_cast<uintptr_t>(Target::add_1337);
+#endif
+        }
+    };
+
+    auto hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42);
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+    EXPECT_EQ(add_42(1), 1338);
+    EXPECT_EQ(add_42(2), 1339);
+
+    hook.reset();
+
+    EXPECT_EQ(add_42(3), 45);
+}
+
 TEST(MidHook, MidHookEnableAndDisable) {
     struct Target {
         SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
@@ -141,3 +328,291 @@ TEST(MidHook, MidHookEnableAndDisable) {
     EXPECT_EQ(add_42(1), 43);
     EXPECT_EQ(add_42(2), 44);
 }
+
+TEST(MidHook, MidHookFilterOnARegisterSkipsNonMatchingHits) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
+            volatile int b = a;
+            return b + 42;
+        }
+    };
+
+    using Add42Fn = int(SAFETYHOOK_FASTCALL*)(int);
+    // Force a real indirect call so MinGW Release cannot optimize around runtime patching.
+    Add42Fn volatile add_42 = Target::add_42;
+
+    EXPECT_EQ(add_42(0), 42);
+
+    static int hits{};
+
+    struct Hook {
+        static void add_42(SafetyHookContext& ctx) {
+            ++hits;
+#if SAFETYHOOK_OS_WINDOWS
+#if SAFETYHOOK_ARCH_X86_64
+            ctx.rcx = 1337 - 42;
+#elif SAFETYHOOK_ARCH_X86_32
+            ctx.ecx = 1337 - 42;
+#endif
+#elif SAFETYHOOK_OS_LINUX
+#if SAFETYHOOK_ARCH_X86_64
+            ctx.rdi = 1337 - 42;
+#elif SAFETYHOOK_ARCH_X86_32
+            *reinterpret_cast<int*>(ctx.esp + 4) = 1337 - 42;
+#endif
+#endif
+        }
+    };
+
+#if SAFETYHOOK_OS_WINDOWS
+#if SAFETYHOOK_ARCH_X86_64
+    const auto filter = SafetyHookMid::Filter::register_equals(safetyhook::Register::RCX, 7, 0xFFFFFFFF);
+#elif SAFETYHOOK_ARCH_X86_32
+    const auto filter = SafetyHookMid::Filter::register_equals(safetyhook::Register::ECX, 7);
+#endif
+#elif SAFETYHOOK_OS_LINUX
+#if SAFETYHOOK_ARCH_X86_64
+    const auto filter = SafetyHookMid::Filter::register_equals(safetyhook::Register::RDI, 7, 0xFFFFFFFF);
+#elif SAFETYHOOK_ARCH_X86_32
+    const auto filter = SafetyHookMid::Filter::memory_equals(safetyhook::Register::ESP, 4, 7);
+#endif
+#endif
+
+    auto hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42, {filter});
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+    EXPECT_EQ(add_42(1), 43);
+    EXPECT_EQ(add_42(7), 1337);
+    EXPECT_EQ(add_42(8), 50);
+    EXPECT_EQ(hits, 1);
+
+    hook.reset();
+
+    EXPECT_EQ(add_42(7), 49);
+    EXPECT_EQ(hits, 1);
+}
+
+TEST(MidHook, MidHookFiltersOnMemoryMustAllPass) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL read(const int* p) {
+            volatile int b = *p;
+            return b;
+        }
+    };
+
+    using ReadFn = int(SAFETYHOOK_FASTCALL*)(const int*);
+    // Force a real indirect call so MinGW Release cannot optimize around runtime patching.
+    ReadFn volatile read = Target::read;
+
+    static int hits{};
+
+    struct Hook {
+        static void read(SafetyHookContext&) { ++hits; }
+    };
+
+#if SAFETYHOOK_OS_WINDOWS
+#if SAFETYHOOK_ARCH_X86_64
+    const auto arg = safetyhook::Register::RCX;
+#elif SAFETYHOOK_ARCH_X86_32
+    const auto arg = safetyhook::Register::ECX;
+#endif
+#elif SAFETYHOOK_OS_LINUX
+#if SAFETYHOOK_ARCH_X86_64
+    const auto arg = safetyhook::Register::RDI;
+#elif SAFETYHOOK_ARCH_X86_32
+    const auto arg = safetyhook::Register::EAX;
+#endif
+#endif
+
+    // Only count calls where *p has bit 4 set and isn't 0x30.
+    auto hook_result = SafetyHookMid::create(Target::read, Hook::read,
+        {SafetyHookMid::Filter::memory_bit_set(arg, 0, 4),
+            SafetyHookMid::Filter::memory_equals(arg, 0, 0x30, sizeof(int)).negated()});
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+#if SAFETYHOOK_OS_LINUX && SAFETYHOOK_ARCH_X86_32
+    struct LoadArgHook {
+        static void read(SafetyHookContext& ctx) { ctx.eax = *reinterpret_cast<uintptr_t*>(ctx.esp + 4); }
+    };
+
+    // 32-bit Linux passes the argument on the stack, so load it into eax with a hook that runs before the filters.
+    auto load_arg_result = SafetyHookMid::create(Target::read, LoadArgHook::read);
+
+    ASSERT_TRUE(load_arg_result.has_value());
+
+    auto load_arg_hook = std::move(*load_arg_result);
+#endif
+
+    const int values[] = {0x01, 0x10, 0x30, 0x31, 0x20};
+
+    for (const auto& value : values) {
+        EXPECT_EQ(read(&value), value);
+    }
+
+    EXPECT_EQ(hits, 2);
+}
+
+TEST(MidHook, MidHookRejectsInvalidFilters) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
+            volatile int b = a;
+            return b + 42;
+        }
+    };
+
+    struct Hook {
+        static void add_42(SafetyHookContext&) {}
+    };
+
+    auto filter = SafetyHookMid::Filter::memory_equals(static_cast<safetyhook::Register>(0), 0, 0);
+    filter.size = 3;
+
+    auto hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42, {filter});
+
+    ASSERT_FALSE(hook_result.has_value());
+    EXPECT_EQ(hook_result.error().type, SafetyHookMid::Error::BAD_FILTER);
+}
+
+TEST(MidHook, MidHookSampleFilterPassesEveryNthHit) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
+            volatile int b = a;
+            return b + 42;
+        }
+    };
+
+    using Add42Fn = int(SAFETYHOOK_FASTCALL*)(int);
+    // Force a real indirect call so MinGW Release cannot optimize around runtime patching.
+    Add42Fn volatile add_42 = Target::add_42;
+
+    static int hits{};
+
+    struct Hook {
+        static void add_42(SafetyHookContext&) { ++hits; }
+    };
+
+    auto hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42, {SafetyHookMid::Filter::sample(4)});
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+    for (auto i = 0; i < 20; ++i) {
+        EXPECT_EQ(add_42(i), i + 42);
+    }
+
+    EXPECT_EQ(hits, 5);
+
+    hook.reset();
+    hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42, {SafetyHookMid::Filter::sample(4).negated()});
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    hook = std::move(*hook_result);
+    hits = 0;
+
+    for (auto i = 0; i < 20; ++i) {
+        EXPECT_EQ(add_42(i), i + 42);
+    }
+
+    EXPECT_EQ(hits, 15);
+
+    hook.reset();
+    hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42, {SafetyHookMid::Filter::sample_random(8)});
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    hook = std::move(*hook_result);
+    hits = 0;
+
+    for (auto i = 0; i < 8000; ++i) {
+        add_42(i);
+    }
+
+    // The intervals average 8 hits, so 1000 passes are expected.
+    EXPECT_GT(hits, 800);
+    EXPECT_LT(hits, 1200);
+}
+
+TEST(MidHook, MidHookSampleFilterCountsPerThread) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
+            volatile int b = a;
+            return b + 42;
+        }
+    };
+
+    using Add42Fn = int(SAFETYHOOK_FASTCALL*)(int);
+    // Force a real indirect call so MinGW Release cannot optimize around runtime patching.
+    Add42Fn volatile add_42 = Target::add_42;
+
+    static std::atomic_int hits{};
+
+    struct Hook {
+        static void add_42(SafetyHookContext&) { ++hits; }
+    };
+
+    auto hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42, {SafetyHookMid::Filter::sample(3, true)});
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+    // Each thread passes on its 1st and 4th hit.
+    std::vector<std::thread> threads{};
+
+    for (auto i = 0; i < 4; ++i) {
+        threads.emplace_back([&add_42] {
+            for (auto j = 0; j < 6; ++j) {
+                add_42(j);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(hits, 8);
+}
+
+TEST(MidHook, MidHookReportsRunningOutOfThreadSlots) {
+    struct Target {
+        SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
+            volatile int b = a;
+            return b + 42;
+        }
+    };
+
+    struct Hook {
+        static void add_42(SafetyHookContext&) {}
+    };
+
+    std::vector<int32_t> slots{};
+
+    for (auto i = 0; i < 0x1000; ++i) {
+        auto slot = safetyhook::thread_slot_allocate();
+
+        if (!slot) {
+            break;
+        }
+
+        slots.push_back(*slot);
+    }
+
+    auto hook_result = SafetyHookMid::create(Target::add_42, Hook::add_42, {SafetyHookMid::Filter::sample(3, true)});
+
+    for (const auto slot : slots) {
+        safetyhook::thread_slot_free(slot);
+    }
+
+    ASSERT_FALSE(hook_result.has_value());
+    EXPECT_EQ(hook_result.error().type, SafetyHookMid::Error::BAD_THREAD_SLOT);
+    EXPECT_EQ(hook_result.error().os_error, safetyhook::OsError::FAILED_TO_ALLOCATE_THREAD_SLOT);
+}
@@ -0,0 +1,97 @@
+#include <array>
+
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+static SafetyHookPointer g_hook{};
+
+SAFETYHOOK_NOINLINE static int add_1(int a) {
+    volatile int b = a;
+    return b + 1;
+}
+
+SAFETYHOOK_NOINLINE static int add_2(int a) {
+    volatile int b = a;
+    return b + 2;
+}
+
+static int hooked_add(int a) {
+    return g_hook.call<int>(a) * 10;
+}
+
+static int replaced_add(int a) {
+    return a;
+}
+
+TEST(PointerHook, PointerHookASlotInADispatchTable) {
+    static std::array<int (*)(int), 2> table{add_1, add_2};
+
+    auto hook = SafetyHookPointer::create(&table[0], hooked_add);
+
+    ASSERT_TRUE(hook.has_value());
+
+    g_hook = std::move(*hook);
+
+    EXPECT_EQ(g_hook.slot_count(), 1);
+    EXPECT_EQ(g_hook.original<int (*)(int)>(), &add_1);
+    EXPECT_EQ(table[0](1), 20);
+    EXPECT_EQ(table[1](1), 3);
+
+    g_hook.reset();
+
+    EXPECT_EQ(table[0], &add_1);
+    EXPECT_EQ(table[0](1), 2);
+}
+
+TEST(PointerHook, PointerHookManySlotsInReadOnlyMemory) {
+    const auto page_size = safetyhook::system_info().page_size;
+    auto table_page = safetyhook::vm_allocate(nullptr, page_size, safetyhook::VM_ACCESS_RW);
+
+    ASSERT_TRUE(table_page.has_value());
+
+    auto* table = reinterpret_cast<int (**)(int)>(*table_page);
+    table[0] = add_1;
+    table[1] = add_2;
+    table[2] = add_1;
+
+    ASSERT_TRUE(safetyhook::vm_protect(*table_page, page_size, safetyhook::VM_ACCESS_R).has_value());
+
+    auto hook = safetyhook::PointerHook::create(std::vector<void*>{&table[2], &table[0], &table[2]}, replaced_add);
+
+    ASSERT_TRUE(hook.has_value());
+    EXPECT_EQ(hook->slot_count(), 2);
+    EXPECT_EQ(hook->slot(0), reinterpret_cast<uint8_t**>(&table[2]));
+    EXPECT_EQ(hook->original<int (*)(int)>(1), &add_1);
+    EXPECT_EQ(table[0](1), 1);
+    EXPECT_EQ(table[1](1), 3);
+    EXPECT_EQ(table[2](1), 1);
+    EXPECT_FALSE(safetyhook::vm_is_writable(*table_page, page_size));
+
+    hook->reset();
+
+    EXPECT_EQ(table[0], &add_1);
+    EXPECT_EQ(table[2], &add_1);
+    EXPECT_FALSE(safetyhook::vm_is_writable(*table_page, page_size));
+
+    safetyhook::vm_free(*table_page);
+}
+
+TEST(PointerHook, PointerHookLeavesSlotsChangedAfterItAlone) {
+    static std::array<int (*)(int), 2> table{add_1, add_1};
+
+    auto hook = safetyhook::create_pointer(&table[0], replaced_add);
+
+    ASSERT_TRUE(hook);
+
+    table[0] = add_2;
+    hook.reset();
+
+    EXPECT_EQ(table[0], &add_2);
+}
+
+TEST(PointerHook, PointerHookFailsWithoutSlots) {
+    const auto hook = SafetyHookPointer::create(std::vector<void*>{}, replaced_add);
+
+    ASSERT_FALSE(hook.has_value());
+    EXPECT_EQ(hook.error().type, SafetyHookPointer::Error::NO_SLOTS);
+}
@@ -0,0 +1,128 @@
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+namespace {
+struct Target {
+    SAFETYHOOK_NOINLINE static int SAFETYHOOK_FASTCALL add_42(int a) {
+        volatile int b = a;
+        return b + 42;
+    }
+};
+
+using Add42Fn = int(SAFETYHOOK_FASTCALL*)(int);
+
+// The register holding add_42's argument, or the stack pointer on 32-bit Linux which passes it on the stack.
+#if SAFETYHOOK_OS_WINDOWS
+#if SAFETYHOOK_ARCH_X86_64
+constexpr auto ARG_REGISTER = safetyhook::Register::RCX;
+#elif SAFETYHOOK_ARCH_X86_32
+constexpr auto ARG_REGISTER = safetyhook::Register::ECX;
+#endif
+#elif SAFETYHOOK_OS_LINUX
+#if SAFETYHOOK_ARCH_X86_64
+constexpr auto ARG_REGISTER = safetyhook::Register::RDI;
+#elif SAFETYHOOK_ARCH_X86_32
+constexpr auto ARG_REGISTER = safetyhook::Register::ESP;
+#endif
+#endif
+
+constexpr auto ARG_IS_IN_REGISTER = !(SAFETYHOOK_OS_LINUX && SAFETYHOOK_ARCH_X86_32);
+} // namespace
+
+TEST(Recorder, RecordOnlyMidHookWritesRecords) {
+    // Force a real indirect call so MinGW Release cannot optimize around runtime patching.
+    Add42Fn volatile add_42 = Target::add_42;
+
+    auto recorder = SafetyHookRecorder::create(64, 1);
+
+    ASSERT_TRUE(recorder.has_value());
+
+    const auto registers = SafetyHookRecorder::register_mask({ARG_REGISTER});
+    auto hook_result = SafetyHookMid::create_record_only(Target::add_42, *recorder, 7, registers);
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+    EXPECT_EQ(add_42(1), 43);
+    EXPECT_EQ(add_42(2), 44);
+    EXPECT_EQ(add_42(3), 45);
+
+    std::vector<SafetyHookRecorder::Record> records{};
+
+    EXPECT_EQ((*recorder)->drain([&](const auto& record) { records.push_back(record); }), 3u);
+    ASSERT_EQ(records.size(), 3u);
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto& record = records[i];
+        const auto arg = record.values[static_cast<uint8_t>(ARG_REGISTER)];
+
+        EXPECT_EQ(record.hook_id, 7u);
+        EXPECT_EQ(record.registers, registers);
+
+        if (ARG_IS_IN_REGISTER) {
+            EXPECT_EQ(arg & 0xFFFFFFFF, i + 1);
+        } else {
+            EXPECT_NE(arg, 0u);
+        }
+
+        if (i > 0) {
+            EXPECT_GE(record.timestamp, records[i - 1].timestamp);
+        }
+
+        for (size_t reg = 0; reg < std::size(record.values); ++reg) {
+            if (reg != static_cast<uint8_t>(ARG_REGISTER)) {
+                EXPECT_EQ(record.values[reg], 0u);
+            }
+        }
+    }
+
+    EXPECT_EQ((*recorder)->drain([](const auto&) {}), 0u);
+    EXPECT_EQ((*recorder)->dropped(), 0u);
+}
+
+TEST(Recorder, RecorderDropsOverwrittenRecords) {
+    // Force a real indirect call so MinGW Release cannot optimize around runtime patching.
+    Add42Fn volatile add_42 = Target::add_42;
+
+    auto recorder = SafetyHookRecorder::create(4, 1);
+
+    ASSERT_TRUE(recorder.has_value());
+    EXPECT_EQ((*recorder)->capacity(), 4u);
+
+    auto hook_result = SafetyHookMid::create_record_only(Target::add_42, *recorder, 1);
+
+    ASSERT_TRUE(hook_result.has_value());
+
+    auto hook = std::move(*hook_result);
+
+    for (auto i = 0; i < 10; ++i) {
+        EXPECT_EQ(add_42(i), i + 42);
+    }
+
+    std::vector<uintptr_t> args{};
+
+    EXPECT_EQ((*recorder)->drain([&](const auto& record) {
+        args.push_back(record.values[static_cast<uint8_t>(ARG_REGISTER)] & 0xFFFFFFFF);
+    }),
+        4u);
+    EXPECT_EQ((*recorder)->dropped(), 6u);
+
+    if (ARG_IS_IN_REGISTER) {
+        EXPECT_EQ(args, (std::vector<uintptr_t>{6, 7, 8, 9}));
+    }
+}
+
+TEST(Recorder, RecorderRejectsInvalidCapacities) {
+    auto recorder = SafetyHookRecorder::create(0);
+
+    ASSERT_FALSE(recorder.has_value());
+    EXPECT_EQ(recorder.error(), SafetyHookRecorder::Error::BAD_CAPACITY);
+
+    auto hook_result = SafetyHookMid::create_record_only(Target::add_42, nullptr, 1);
+
+    ASSERT_FALSE(hook_result.has_value());
+    EXPECT_EQ(hook_result.error().type, SafetyHookMid::Error::BAD_RECORDER);
+}
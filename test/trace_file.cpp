@@ -0,0 +1,272 @@
+#include <array>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+// A trace file in the temporary directory, removed when the test ends.
+struct TempTraceFile {
+    std::filesystem::path path;
+
+    explicit TempTraceFile(const std::string& name)
+        : path{std::filesystem::temp_directory_path() / ("safetyhook-" + name + ".shtrace")} {}
+    ~TempTraceFile() {
+        std::error_code ec{};
+        std::filesystem::remove(path, ec);
+    }
+};
+
+TEST(TraceFile, WritesAndReadsRecords) {
+    TempTraceFile temp{"records"};
+    auto file = safetyhook::TraceFile::create(temp.path, 0x1000, 4);
+
+    ASSERT_TRUE(file.has_value());
+    EXPECT_TRUE((*file)->set_name(7, "seven"));
+    EXPECT_TRUE((*file)->set_name(8, "eight!"));
+
+    safetyhook::TraceFile::Writer writer{*file};
+    const std::array<uint64_t, 3> payload{1, 0xFFFF'FFFF'FFFF'FFFF, 3};
+
+    EXPECT_TRUE(writer.write_at(100, 7, 0, payload));
+    EXPECT_TRUE(writer.write_at(200, 8, 1));
+
+    auto reader = safetyhook::TraceFileReader::open(temp.path);
+
+    ASSERT_TRUE(reader.has_value());
+    EXPECT_EQ(reader->header().version, safetyhook::TraceFile::VERSION);
+    EXPECT_GT(reader->header().ticks_per_microsecond, 0.0);
+
+    const auto names = reader->names();
+
+    ASSERT_EQ(names.size(), 2);
+    EXPECT_EQ(names.at(7), "seven");
+    EXPECT_EQ(names.at(8), "eight!");
+
+    std::vector<safetyhook::TraceFileReader::Event> events{};
+    std::vector<uint64_t> payloads{};
+
+    EXPECT_EQ(reader->read([&](const auto& event) {
+        events.push_back(event);
+        payloads.insert(payloads.end(), event.payload.begin(), event.payload.end());
+    }),
+        2);
+
+    ASSERT_EQ(events.size(), 2);
+    EXPECT_EQ(events[0].timestamp, 100);
+    EXPECT_EQ(events[0].hook_id, 7);
+    EXPECT_EQ(events[0].type, 0);
+    EXPECT_EQ(events[0].payload.size(), 3);
+    EXPECT_EQ(events[0].thread_id, safetyhook::current_thread_id());
+    EXPECT_EQ(events[1].timestamp, 200);
+    EXPECT_EQ(events[1].hook_id, 8);
+    EXPECT_EQ(events[1].type, 1);
+    EXPECT_TRUE(events[1].payload.empty());
+    EXPECT_EQ(payloads, std::vector<uint64_t>(payload.begin(), payload.end()));
+
+    // Only the records written since the last read are read again.
+    EXPECT_EQ(reader->read([](const auto&) {}), 0);
+    EXPECT_TRUE(writer.write_at(300, 7, 0));
+
+    events.clear();
+    EXPECT_EQ(reader->read([&](const auto& event) { events.push_back(event); }), 1);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_EQ(events[0].timestamp, 300);
+
+    // Records written without a timestamp get the time stamp counter.
+    EXPECT_TRUE(writer.write(9, 2));
+
+    events.clear();
+    EXPECT_EQ(reader->read([&](const auto& event) { events.push_back(event); }), 1);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_EQ(events[0].hook_id, 9);
+    EXPECT_EQ(events[0].type, 2);
+    EXPECT_GE(events[0].timestamp, reader->header().start_timestamp);
+
+    const std::vector<uint64_t> too_much(safetyhook::TraceFile::MAX_PAYLOAD + 1);
+
+    EXPECT_FALSE(writer.write_at(400, 7, 0, too_much));
+    EXPECT_EQ((*file)->dropped(), 1);
+}
+
+TEST(TraceFile, RotatesSegmentsAndKeepsTheLatestRecords) {
+    TempTraceFile temp{"rotation"};
+    auto file = safetyhook::TraceFile::create(temp.path, 0x1000, 2);
+
+    ASSERT_TRUE(file.has_value());
+
+    auto reader = safetyhook::TraceFileReader::open(temp.path);
+
+    ASSERT_TRUE(reader.has_value());
+
+    constexpr uint32_t num_records = 1000;
+    constexpr size_t records_per_segment = (0x1000 - sizeof(safetyhook::TraceFile::SegmentHeader)) /
+                                           sizeof(safetyhook::TraceFile::Record);
+
+    {
+        safetyhook::TraceFile::Writer writer{*file};
+
+        for (uint32_t i = 0; i < num_records; ++i) {
+            ASSERT_TRUE(writer.write_at(i, i, 0));
+        }
+    }
+
+    std::vector<uint32_t> ids{};
+    reader->read([&](const auto& event) { ids.push_back(event.hook_id); });
+
+    ASSERT_FALSE(ids.empty());
+    EXPECT_LE(ids.size(), records_per_segment * 2);
+    EXPECT_EQ(ids.back(), num_records - 1);
+
+    for (size_t i = 1; i < ids.size(); ++i) {
+        ASSERT_EQ(ids[i], ids[i - 1] + 1);
+    }
+
+    EXPECT_EQ((*file)->dropped(), 0);
+}
+
+TEST(TraceFile, DropsRecordsWhenEverySegmentIsOwned) {
+    TempTraceFile temp{"dropped"};
+    auto file = safetyhook::TraceFile::create(temp.path, 0x1000, 2);
+
+    ASSERT_TRUE(file.has_value());
+
+    safetyhook::TraceFile::Writer first{*file};
+    safetyhook::TraceFile::Writer second{*file};
+    safetyhook::TraceFile::Writer third{*file};
+
+    EXPECT_TRUE(first.write_at(1, 0, 0));
+    EXPECT_TRUE(second.write_at(2, 0, 0));
+    EXPECT_FALSE(third.write_at(3, 0, 0));
+    EXPECT_EQ((*file)->dropped(), 1);
+
+    // Destroying a writer releases its segment.
+    first = {};
+
+    EXPECT_TRUE(third.write_at(4, 0, 0));
+}
+
+TEST(TraceFileReader, RejectsFilesThatArentTraces) {
+    TempTraceFile temp{"not-a-trace"};
+
+    EXPECT_EQ(safetyhook::TraceFileReader::open(temp.path).error(), safetyhook::TraceFileReader::Error::FAILED_TO_MAP);
+
+    {
+        std::ofstream out{temp.path, std::ios::binary};
+        out << std::string(0x100, 'x');
+    }
+
+    EXPECT_EQ(safetyhook::TraceFileReader::open(temp.path).error(), safetyhook::TraceFileReader::Error::BAD_FORMAT);
+}
+
+SAFETYHOOK_NOINLINE static int trace_file_target(int a) {
+    volatile int b = a;
+    return b * 5;
+}
+
+TEST(Tracer, WritesEventsToTraceFile) {
+    TempTraceFile temp{"tracer"};
+    auto file = safetyhook::TraceFile::create(temp.path, 0x10000, 4);
+
+    ASSERT_TRUE(file.has_value());
+
+    int (*volatile fn)(int) = trace_file_target;
+    auto tracer = SafetyHookTracer::create(*file, {{reinterpret_cast<void*>(trace_file_target), "target"}});
+
+    ASSERT_TRUE(tracer.has_value());
+    EXPECT_EQ((*tracer)->capacity(), 0);
+
+    for (auto i = 0; i < 10; ++i) {
+        EXPECT_EQ(fn(i), i * 5);
+    }
+
+    // The events went to the file.
+    EXPECT_EQ((*tracer)->drain([](const auto&) {}), 0);
+
+    tracer->reset();
+
+    // Destroying the tracer released this thread's writer, so nothing else keeps the file open.
+    EXPECT_EQ(file->use_count(), 1);
+
+    auto reader = safetyhook::TraceFileReader::open(temp.path);
+
+    ASSERT_TRUE(reader.has_value());
+    EXPECT_EQ(reader->names().at(0), "target");
+
+    std::vector<safetyhook::TraceFileReader::Event> events{};
+    reader->read([&](const auto& event) { events.push_back(event); });
+
+    ASSERT_EQ(events.size(), 20);
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        EXPECT_EQ(events[i].hook_id, 0);
+        EXPECT_EQ(events[i].type, i % 2 == 0 ? SafetyHookTracer::Event::ENTER : SafetyHookTracer::Event::EXIT);
+        EXPECT_EQ(events[i].thread_id, safetyhook::current_thread_id());
+    }
+}
+
+SAFETYHOOK_NOINLINE static int trace_file_other_target(int a) {
+    volatile int b = a;
+    return b * 7;
+}
+
+TEST(Tracer, OtherThreadsReleaseTheirWritersOnTheirNextEntry) {
+    TempTraceFile temp{"tracer-threads"};
+    auto file = safetyhook::TraceFile::create(temp.path, 0x10000, 4);
+
+    ASSERT_TRUE(file.has_value());
+
+    int (*volatile fn)(int) = trace_file_target;
+    int (*volatile other_fn)(int) = trace_file_other_target;
+    auto tracer = SafetyHookTracer::create(*file, {{reinterpret_cast<void*>(trace_file_target), "target"}});
+    auto other_tracer = SafetyHookTracer::create({{reinterpret_cast<void*>(trace_file_other_target), "other"}});
+
+    ASSERT_TRUE(tracer.has_value());
+    ASSERT_TRUE(other_tracer.has_value());
+
+    std::mutex mutex{};
+    std::condition_variable cv{};
+    auto step = 0;
+
+    std::thread thread{[&] {
+        EXPECT_EQ(fn(1), 5);
+
+        std::unique_lock lock{mutex};
+        step = 1;
+        cv.notify_all();
+        cv.wait(lock, [&] { return step == 2; });
+        lock.unlock();
+
+        // Entering any traced function drops the buffer of the destroyed tracer.
+        EXPECT_EQ(other_fn(1), 7);
+
+        lock.lock();
+        step = 3;
+        cv.notify_all();
+        cv.wait(lock, [&] { return step == 4; });
+    }};
+
+    std::unique_lock lock{mutex};
+    cv.wait(lock, [&] { return step == 1; });
+
+    // The thread's writer keeps the file open after the tracer is gone...
+    tracer->reset();
+    EXPECT_EQ(file->use_count(), 2);
+
+    step = 2;
+    cv.notify_all();
+    cv.wait(lock, [&] { return step == 3; });
+
+    // ...until the thread enters a traced function again.
+    EXPECT_EQ(file->use_count(), 1);
+
+    step = 4;
+    cv.notify_all();
+    lock.unlock();
+    thread.join();
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <safetyhook.hpp>
+
+SAFETYHOOK_NOINLINE static int tracer_leaf(int a) {
+    volatile int b = a;
+    return b * 3;
+}
+
+SAFETYHOOK_NOINLINE static int tracer_parent(int a) {
+    volatile int b = a;
+    return tracer_leaf(b) + 1;
+}
+
+TEST(Tracer, RecordsNestedEnterAndExitEvents) {
+    int (*volatile fn)(int) = tracer_parent;
+    auto tracer = SafetyHookTracer::create({{reinterpret_cast<void*>(tracer_parent), "parent"},
+        {reinterpret_cast<void*>(tracer_leaf), "leaf \"quoted\""}});
+
+    ASSERT_TRUE(tracer.has_value());
+
+    EXPECT_EQ(fn(2), 7);
+
+    std::vector<SafetyHookTracer::Event> events{};
+    EXPECT_EQ((*tracer)->drain([&](const auto& event) { events.push_back(event); }), 4);
+
+    using Event = SafetyHookTracer::Event;
+    ASSERT_EQ(events.size(), 4);
+    EXPECT_EQ(events[0].type, Event::ENTER);
+    EXPECT_EQ(events[0].target, 0);
+    EXPECT_EQ(events[1].type, Event::ENTER);
+    EXPECT_EQ(events[1].target, 1);
+    EXPECT_EQ(events[2].type, Event::EXIT);
+    EXPECT_EQ(events[2].target, 1);
+    EXPECT_EQ(events[3].type, Event::EXIT);
+    EXPECT_EQ(events[3].target, 0);
+    EXPECT_TRUE(std::ranges::is_sorted(events, {}, &Event::timestamp));
+    EXPECT_TRUE(std::ranges::all_of(
+        events, [](const auto& event) { return event.thread_id == safetyhook::current_thread_id(); }));
+
+    std::ostringstream json{};
+
+    {
+        safetyhook::ChromeTraceWriter writer{json, **tracer};
+
+        for (const auto& event : events) {
+            writer.write(event);
+        }
+    }
+
+    const auto trace = json.str();
+
+    EXPECT_EQ(trace.front(), '[');
+    EXPECT_NE(trace.find(R"({"name":"parent","cat":"safetyhook","ph":"B","ts":)"), std::string::npos);
+    EXPECT_NE(trace.find(R"("name":"leaf \"quoted\"","cat":"safetyhook","ph":"E")"), std::string::npos);
+    EXPECT_EQ(trace.substr(trace.size() - 3), "\n]\n");
+
+    EXPECT_EQ((*tracer)->drain([](const auto&) {}), 0);
+
+    tracer->reset();
+
+    EXPECT_EQ(fn(2), 7);
+}
+
+TEST(Tracer, FlushThreadDrainsEventsOfExitedThreads) {
+    int (*volatile fn)(int) = tracer_leaf;
+    auto tracer = SafetyHookTracer::create({{reinterpret_cast<void*>(tracer_leaf), ""}}, 64);
+
+    ASSERT_TRUE(tracer.has_value());
+    EXPECT_FALSE((*tracer)->names()[0].empty());
+
+    std::atomic_size_t flushed{};
+    (*tracer)->start_flushing([&](const auto&) { ++flushed; }, std::chrono::milliseconds{1});
+
+    constexpr auto num_threads = 4;
+    constexpr auto calls_per_thread = 10;
+    std::vector<std::thread> threads{};
+
+    for (auto i = 0; i < num_threads; ++i) {
+        threads.emplace_back([fn] {
+            for (auto j = 0; j < calls_per_thread; ++j) {
+                ASSERT_EQ(fn(j), j * 3);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    (*tracer)->stop_flushing();
+
+    EXPECT_EQ(flushed, num_threads * calls_per_thread * 2);
+    EXPECT_EQ((*tracer)->dropped(), 0);
+}
+
+TEST(Tracer, FullBuffersDropEvents) {
+    int (*volatile fn)(int) = tracer_leaf;
+    auto tracer = SafetyHookTracer::create({{reinterpret_cast<void*>(tracer_leaf), "leaf"}}, 8);
+
+    ASSERT_TRUE(tracer.has_value());
+    EXPECT_EQ((*tracer)->capacity(), 8);
+
+    for (auto i = 0; i < 10; ++i) {
+        EXPECT_EQ(fn(i), i * 3);
+    }
+
+    EXPECT_EQ((*tracer)->dropped(), 12);
+    EXPECT_EQ((*tracer)->drain([](const auto&) {}), 8);
+}
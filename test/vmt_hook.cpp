@@ -1,3 +1,7 @@
+#include <new>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 #include <safetyhook.hpp>
 
@@ -163,6 +167,50 @@ TEST(VmtHook, CanSafelyDestroyVmtHookAfterObjectIsDeleted) {
     add_42_hook_storage.reset();
 }
 
+TEST(VmtHook, CanSafelyDestroyVmtHookAfterObjectIsMadeReadOnly) {
+    auto target = make_single_target();
+    auto page = safetyhook::vm_allocate(nullptr, 0x1000, safetyhook::VM_ACCESS_RW);
+
+    ASSERT_TRUE(page.has_value());
+
+    auto* read_only_target = new (*page) SingleTarget{};
+
+    SafetyHookVmt target_hook{};
+    static SafetyHookVm* add_42_hook{};
+    SafetyHookVm add_42_hook_storage{};
+    add_42_hook = &add_42_hook_storage;
+
+    struct Hook : SingleTarget {
+        int hooked_add_42(int a) { return add_42_hook->thiscall<int>(this, a) + 1337; }
+    };
+
+    auto vmt_result = SafetyHookVmt::create(target.get());
+
+    ASSERT_TRUE(vmt_result.has_value());
+
+    target_hook = std::move(*vmt_result);
+    target_hook.apply(read_only_target);
+
+    auto vm_result = target_hook.hook_method(1 + VMT_OFFSET, &Hook::hooked_add_42);
+
+    ASSERT_TRUE(vm_result.has_value());
+
+    add_42_hook_storage = std::move(*vm_result);
+
+    EXPECT_EQ(target->add_42(1), 1380);
+    EXPECT_EQ(read_only_target->add_42(1), 1380);
+
+    // The object that can't be written anymore is skipped, the others still get their VMT back.
+    ASSERT_TRUE(safetyhook::vm_protect(*page, 0x1000, safetyhook::VM_ACCESS_R).has_value());
+
+    target_hook.reset();
+    add_42_hook_storage.reset();
+
+    EXPECT_EQ(target->add_42(2), 44);
+
+    safetyhook::vm_free(*page);
+}
+
 TEST(VmtHook, CanApplyAnExistingVMTHookToMoreThanOneObject) {
     auto target = make_single_target();
     auto target0 = make_single_target();
@@ -281,6 +329,234 @@ TEST(VmtHook, CanRemoveAnObjectThatWasPreviouslyVMTHooked) {
     target_hook.reset();
 }
 
+TEST(VmtHook, CanApplyAndRemoveManyObjectsFromManyThreads) {
+    auto target = make_single_target();
+
+    SafetyHookVmt target_hook{};
+    static SafetyHookVm* add_42_hook{};
+    SafetyHookVm add_42_hook_storage{};
+    add_42_hook = &add_42_hook_storage;
+
+    struct Hook : SingleTarget {
+        int hooked_add_42(int a) { return add_42_hook->thiscall<int>(this, a) + 1337; }
+    };
+
+    auto vmt_result = SafetyHookVmt::create(target.get());
+
+    ASSERT_TRUE(vmt_result.has_value());
+
+    target_hook = std::move(*vmt_result);
+
+    auto vm_result = target_hook.hook_method(1 + VMT_OFFSET, &Hook::hooked_add_42);
+
+    ASSERT_TRUE(vm_result.has_value());
+
+    add_42_hook_storage = std::move(*vm_result);
+
+    constexpr size_t THREAD_COUNT = 4;
+    constexpr size_t OBJECTS_PER_THREAD = 1000;
+    std::vector<decltype(make_single_target())> targets{};
+    std::vector<void*> objects{};
+
+    for (size_t i = 0; i < THREAD_COUNT * OBJECTS_PER_THREAD; ++i) {
+        objects.push_back(targets.emplace_back(make_single_target()).get());
+    }
+
+    std::vector<std::thread> threads{};
+
+    for (size_t i = 0; i < THREAD_COUNT; ++i) {
+        threads.emplace_back([&, i] {
+            auto* first = objects.data() + i * OBJECTS_PER_THREAD;
+
+            // Half go through the bulk API, the other half one at a time.
+            target_hook.apply(std::span{first, OBJECTS_PER_THREAD / 2});
+
+            for (auto* object : std::span{first + OBJECTS_PER_THREAD / 2, OBJECTS_PER_THREAD / 2}) {
+                target_hook.apply(object);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    threads.clear();
+
+    for (auto& t : targets) {
+        EXPECT_EQ(t->add_42(1), 1380);
+    }
+
+    for (size_t i = 0; i < THREAD_COUNT; ++i) {
+        threads.emplace_back([&, i] {
+            auto* first = objects.data() + i * OBJECTS_PER_THREAD;
+
+            // Remove every other object so the rest stay hooked until the VmtHook is reset.
+            for (size_t j = 0; j < OBJECTS_PER_THREAD; j += 2) {
+                target_hook.remove(first[j]);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i) {
+        EXPECT_EQ(targets[i]->add_42(1), i % 2 == 0 ? 43 : 1380);
+    }
+
+    target_hook.remove(std::span{objects});
+
+    for (auto& t : targets) {
+        EXPECT_EQ(t->add_42(1), 43);
+    }
+
+    target_hook.apply(std::span{objects});
+    target_hook.reset();
+
+    for (auto& t : targets) {
+        EXPECT_EQ(t->add_42(1), 43);
+    }
+
+    EXPECT_EQ(target->add_42(1), 43);
+}
+
+TEST(VmtHook, DestroyedObjectsAreUntrackedWhenUntrackingOnDestroy) {
+    static int destructions{};
+
+    struct Target : SingleTarget {
+        ~Target() override { ++destructions; }
+    };
+
+    auto target = std::make_unique<Target>();
+    auto target0 = std::make_unique<Target>();
+    alignas(Target) uint8_t storage[sizeof(Target)];
+    auto* target1 = new (storage) Target{};
+
+    SafetyHookVmt target_hook{};
+    static SafetyHookVm* add_42_hook{};
+    SafetyHookVm add_42_hook_storage{};
+    add_42_hook = &add_42_hook_storage;
+
+    struct Hook : SingleTarget {
+        int hooked_add_42(int a) { return add_42_hook->thiscall<int>(this, a) + 1337; }
+    };
+
+    auto vmt_result = SafetyHookVmt::create(target.get());
+
+    ASSERT_TRUE(vmt_result.has_value());
+
+    target_hook = std::move(*vmt_result);
+
+    ASSERT_TRUE(target_hook.untrack_on_destroy().has_value());
+
+    auto vm_result = target_hook.hook_method(1 + VMT_OFFSET, &Hook::hooked_add_42);
+
+    ASSERT_TRUE(vm_result.has_value());
+
+    add_42_hook_storage = std::move(*vm_result);
+
+    target_hook.apply(target0.get());
+    target_hook.apply(target1);
+
+    EXPECT_EQ(target->add_42(1), 1380);
+    EXPECT_EQ(target0->add_42(1), 1380);
+    EXPECT_EQ(target1->add_42(1), 1380);
+
+    // Deleting and complete destructors.
+    target0.reset();
+    std::destroy_at(static_cast<SingleInterface*>(target1));
+
+    EXPECT_EQ(destructions, 2);
+
+    // The storage is reused by an unhooked object, resetting the hook has to leave it alone.
+    target1 = new (storage) Target{};
+    auto* vmt = *reinterpret_cast<void**>(target1);
+    target_hook.reset();
+
+    EXPECT_EQ(*reinterpret_cast<void**>(target1), vmt);
+    EXPECT_EQ(target->add_42(1), 43);
+    EXPECT_EQ(target1->add_42(1), 43);
+
+    std::destroy_at(target1);
+    target.reset();
+
+    EXPECT_EQ(destructions, 4);
+}
+
+TEST(VmtHook, SharedCloneHooksMustUntrackWithTheSameDestructor) {
+    struct Target : SingleTarget {
+        ~Target() override {}
+    };
+
+    auto target = std::make_unique<Target>();
+    auto target0 = std::make_unique<Target>();
+
+    auto first = SafetyHookVmt::create(target.get(), SafetyHookVmt::ShareClone);
+    auto second = SafetyHookVmt::create(target0.get(), SafetyHookVmt::ShareClone);
+
+    ASSERT_TRUE(first.has_value());
+    ASSERT_TRUE(second.has_value());
+    ASSERT_TRUE(first->untrack_on_destroy().has_value());
+
+    const auto result = second->untrack_on_destroy(1);
+
+    ASSERT_FALSE(result.has_value());
+    EXPECT_EQ(result.error().type, SafetyHookVmt::Error::DESTRUCTOR_INDEX_MISMATCH);
+    EXPECT_TRUE(second->untrack_on_destroy().has_value());
+}
+
+TEST(VmtHook, InPlaceVMTHooksHookEveryObjectOfTheClass) {
+    auto target = make_dual_target();
+    auto target0 = make_dual_target();
+
+    EXPECT_EQ(target->add_43(0), 43);
+
+    static SafetyHookVm* add_43_hook{};
+    SafetyHookVm add_43_hook_storage{};
+    add_43_hook = &add_43_hook_storage;
+
+    struct Hook : DualTarget {
+        int hooked_add_43(int a) { return add_43_hook->thiscall<int>(this, a) + 1337; }
+    };
+
+    auto* vmt = *reinterpret_cast<void**>(target.get());
+    auto vmt_result = SafetyHookVmt::create(target.get(), SafetyHookVmt::InPlace);
+
+    ASSERT_TRUE(vmt_result.has_value());
+
+    auto target_hook = std::move(*vmt_result);
+
+    EXPECT_EQ(*reinterpret_cast<void**>(target.get()), vmt);
+
+    auto vm_result = target_hook.hook_method(2 + VMT_OFFSET, &Hook::hooked_add_43);
+
+    ASSERT_TRUE(vm_result.has_value());
+
+    add_43_hook_storage = std::move(*vm_result);
+
+    // Objects that already existed and new ones are hooked without applying the hook to them.
+    auto target1 = make_dual_target();
+
+    EXPECT_EQ(target->add_43(1), 1381);
+    EXPECT_EQ(target0->add_43(1), 1381);
+    EXPECT_EQ(target1->add_43(1), 1381);
+    EXPECT_EQ(target1->add_42(1), 43);
+
+    // Destroying the VmtHook leaves the method hooked until its VmHook is destroyed.
+    target_hook.reset();
+
+    EXPECT_EQ(target0->add_43(2), 1382);
+
+    add_43_hook_storage.reset();
+
+    EXPECT_EQ(target->add_43(2), 45);
+    EXPECT_EQ(target0->add_43(2), 45);
+    EXPECT_EQ(target1->add_43(2), 45);
+    EXPECT_EQ(*reinterpret_cast<void**>(target.get()), vmt);
+}
+
 TEST(VmtHook, VMTHookAnObjectInstanceWithEasyAPI) {
     auto target = make_single_target();
 
@@ -341,3 +617,58 @@ TEST(VmtHook, VMTHookPreservesDynamicCastWithCrossCast) {
     add_1337_hook_storage.reset();
     base2_hook.reset();
 }
+
+TEST(VmtHook, SharedVMTHooksShareTheClonedVMTAndItsMethodHooks) {
+    auto target1 = make_dual_target();
+    auto target2 = make_dual_target();
+
+    static SafetyHookVm* add_42_hook{};
+    SafetyHookVm add_42_hook1{};
+    SafetyHookVm add_42_hook2{};
+    add_42_hook = &add_42_hook1;
+
+    struct Hook : DualTarget {
+        int hooked_add_42(int a) { return add_42_hook->thiscall<int>(this, a) + 1337; }
+        int other_add_42(int a) { return add_42_hook->thiscall<int>(this, a) + 1; }
+    };
+
+    auto vmt1_result = SafetyHookVmt::create(target1.get(), SafetyHookVmt::ShareClone);
+    auto vmt2_result = SafetyHookVmt::create(target2.get(), SafetyHookVmt::ShareClone);
+
+    ASSERT_TRUE(vmt1_result.has_value());
+    ASSERT_TRUE(vmt2_result.has_value());
+
+    auto vmt1 = std::move(*vmt1_result);
+    auto vmt2 = std::move(*vmt2_result);
+
+    EXPECT_EQ(*reinterpret_cast<void**>(target1.get()), *reinterpret_cast<void**>(target2.get()));
+
+    auto vm1_result = vmt1.hook_method(1 + VMT_OFFSET, &Hook::hooked_add_42);
+    auto vm2_result = vmt2.hook_method(1 + VMT_OFFSET, &Hook::hooked_add_42);
+    auto conflict_result = vmt2.hook_method(1 + VMT_OFFSET, &Hook::other_add_42);
+
+    ASSERT_TRUE(vm1_result.has_value());
+    ASSERT_TRUE(vm2_result.has_value());
+    ASSERT_FALSE(conflict_result.has_value());
+    EXPECT_EQ(conflict_result.error().type, SafetyHookVmt::Error::METHOD_ALREADY_HOOKED);
+
+    add_42_hook1 = std::move(*vm1_result);
+    add_42_hook2 = std::move(*vm2_result);
+
+    EXPECT_EQ(target1->add_42(1), 1380);
+    EXPECT_EQ(target2->add_42(1), 1380);
+
+    // The method stays hooked until the last hook sharing it is gone.
+    add_42_hook1.reset();
+    add_42_hook = &add_42_hook2;
+
+    EXPECT_EQ(target1->add_42(2), 1381);
+
+    add_42_hook2.reset();
+
+    EXPECT_EQ(target1->add_42(2), 44);
+    EXPECT_EQ(target2->add_43(2), 45);
+
+    vmt1.reset();
+    vmt2.reset();
+}
@@ -0,0 +1,139 @@
+// Prints the records of a trace file written by safetyhook::TraceFile, as text or as a Chrome trace.
+//
+// Usage: safetyhook-trace-dump [--chrome] [--follow] <file>
+//
+//   --chrome  Writes the enter and exit events as a Chrome trace (see safetyhook::ChromeTraceWriter).
+//   --follow  Keeps reading the records as they're written, until interrupted.
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <safetyhook.hpp>
+
+using namespace std::literals;
+
+static void usage() {
+    std::fprintf(stderr, "usage: safetyhook-trace-dump [--chrome] [--follow] <file>\n");
+}
+
+static const char* error_message(safetyhook::TraceFileReader::Error error) {
+    switch (error) {
+    case safetyhook::TraceFileReader::Error::FAILED_TO_MAP:
+        return "failed to open the file";
+    case safetyhook::TraceFileReader::Error::BAD_FORMAT:
+        return "not a trace file";
+    case safetyhook::TraceFileReader::Error::UNSUPPORTED_VERSION:
+        return "unsupported format version";
+    }
+
+    return "unknown error";
+}
+
+int main(int argc, char* argv[]) {
+    auto chrome = false;
+    auto follow = false;
+    const char* path = nullptr;
+
+    for (auto i = 1; i < argc; ++i) {
+        if (argv[i] == "--chrome"sv) {
+            chrome = true;
+        } else if (argv[i] == "--follow"sv) {
+            follow = true;
+        } else if (path == nullptr && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    // A Chrome trace is only complete once it's closed, so it can't follow the file.
+    if (path == nullptr || (chrome && follow)) {
+        usage();
+        return 1;
+    }
+
+    auto reader = safetyhook::TraceFileReader::open(path);
+
+    if (!reader) {
+        std::fprintf(stderr, "%s: %s\n", path, error_message(reader.error()));
+        return 1;
+    }
+
+    const auto& header = reader->header();
+    const auto start_timestamp = header.start_timestamp;
+    const auto ticks_per_microsecond = header.ticks_per_microsecond;
+
+    if (chrome) {
+        // Hook ids index the names. Ids between the named ones get a placeholder name.
+        const auto names = reader->names();
+        std::vector<std::string> indexed_names{};
+
+        if (!names.empty()) {
+            indexed_names.resize(names.rbegin()->first + size_t{1});
+        }
+
+        for (size_t i = 0; i < indexed_names.size(); ++i) {
+            const auto it = names.find(static_cast<uint32_t>(i));
+            indexed_names[i] = it != names.end() ? it->second : "hook " + std::to_string(i);
+        }
+
+        safetyhook::ChromeTraceWriter writer{std::cout, indexed_names, start_timestamp, ticks_per_microsecond};
+
+        reader->read([&](const safetyhook::TraceFileReader::Event& event) {
+            if (event.type == safetyhook::Tracer::Event::ENTER || event.type == safetyhook::Tracer::Event::EXIT) {
+                writer.write({event.timestamp, event.thread_id, event.hook_id,
+                    static_cast<safetyhook::Tracer::Event::Type>(event.type)});
+            }
+        });
+
+        return 0;
+    }
+
+    std::printf("segments: %" PRIu32 " x %" PRIu32 " bytes, ticks per us: %.3f\n", header.segment_count,
+        header.segment_size, ticks_per_microsecond);
+    std::printf("%-10s %-10s %-16s %-6s %s\n", "segment", "thread", "time (us)", "type", "hook");
+
+    while (true) {
+        // The names are read again in case hooks were named since the last read.
+        const auto names = reader->names();
+
+        reader->read([&](const safetyhook::TraceFileReader::Event& event) {
+            const auto ticks = static_cast<double>(static_cast<int64_t>(event.timestamp - start_timestamp));
+            const auto microseconds = ticks_per_microsecond > 0.0 ? ticks / ticks_per_microsecond : ticks;
+            const auto name = names.find(event.hook_id);
+
+            std::printf("%-10" PRIu64 " %-10" PRIu32 " %-16.3f %-6u ", event.sequence, event.thread_id, microseconds,
+                unsigned{event.type});
+
+            if (name != names.end()) {
+                std::printf("%s", name->second.c_str());
+            } else {
+                std::printf("hook %" PRIu32, event.hook_id);
+            }
+
+            for (const auto word : event.payload) {
+                std::printf(" %016" PRIx64, word);
+            }
+
+            std::printf("\n");
+        });
+
+        if (!follow) {
+            break;
+        }
+
+        std::fflush(stdout);
+        std::this_thread::sleep_for(100ms);
+    }
+
+    std::printf("dropped: %" PRIu64 "\n", header.dropped);
+
+    return 0;
+}